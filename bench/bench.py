@@ -0,0 +1,373 @@
+"""
+Microbenchmarks for the bitarray kernels.
+
+Every benchmark is run for a sweep of sizes (from 64 bits up to the
+maximal size given by --max-bits, in steps of a factor of 8), and reports
+the per call latency, the calls per second and the throughput in GB/s
+(with respect to the number of bytes of the bitarray(s) processed).
+
+The results can be written as JSON (--output), and compared against a
+stored baseline (--baseline), in which case the exit status is 1 when
+any benchmark got slower by more than the tolerance.
+
+Author: Ilan Schnell
+"""
+from __future__ import division, print_function
+
+import os
+import re
+import sys
+import json
+import platform
+import tempfile
+from optparse import OptionParser
+from random import getrandbits, randint, seed
+from time import time
+
+from bitarray import bitarray, _sysinfo, __version__
+
+
+# ------------------------- data for benchmarks ---------------------------
+
+def randombits(n, endian='big'):
+    a = bitarray(endian=endian)
+    a.frombytes(os.urandom(n // 8))
+    a.extend(getrandbits(1) for _ in range(n % 8))
+    return a
+
+def zeros(n, endian='big'):
+    a = bitarray(n, endian)
+    a.setall(0)
+    return a
+
+
+# ------------------------------ benchmarks --------------------------------
+
+BENCHMARKS = []
+
+def benchmark(max_bits=None):
+    """
+    Register a benchmark.  The decorated function takes the number of bits
+    n, and returns (func, nbytes), where func is the function to be timed
+    (without arguments) and nbytes the number of bytes processed per call.
+    Sizes above max_bits are skipped, for benchmarks which are slow or
+    need memory proportional to the number of bits (rather than bytes).
+    """
+    def wrapper(setup):
+        BENCHMARKS.append((setup.__name__, setup, max_bits))
+        return setup
+    return wrapper
+
+@benchmark()
+def count(n):
+    a = randombits(n)
+    return a.count, n / 8
+
+@benchmark()
+def index(n):
+    a = zeros(n)
+    a[-1] = 1
+    return lambda: a.index(1), n / 8
+
+@benchmark()
+def search(n):
+    x = bitarray(16 * '1')
+    a = zeros(n)
+    a[-16:] = x
+    return lambda: a.search(x, 1), n / 8
+
+@benchmark()
+def bitwise_and(n):
+    a, b = randombits(n), randombits(n)
+    return lambda: a & b, 3 * n / 8
+
+@benchmark()
+def bitwise_or(n):
+    a, b = randombits(n), randombits(n)
+    return lambda: a | b, 3 * n / 8
+
+@benchmark()
+def bitwise_xor(n):
+    a, b = randombits(n), randombits(n)
+    return lambda: a ^ b, 3 * n / 8
+
+@benchmark()
+def bitwise_iand(n):
+    a, b = randombits(n), randombits(n)
+    def f():
+        a.__iand__(b)
+    return f, 2 * n / 8
+
+@benchmark()
+def invert(n):
+    a = randombits(n)
+    return a.invert, n / 8
+
+@benchmark()
+def slice_get(n):
+    a = randombits(n)
+    return lambda: a[3:], 2 * n / 8
+
+@benchmark(max_bits=1 << 30)
+def slice_step(n):
+    a = randombits(n)
+    return lambda: a[::3], 4 * n / 3 / 8
+
+@benchmark()
+def copy_aligned(n):
+    a, b = zeros(n), randombits(n - 16)
+    def f():
+        a[8:n - 8] = b
+    return f, 2 * n / 8
+
+@benchmark()
+def copy_unaligned(n):
+    a, b = zeros(n), randombits(n - 16)
+    def f():
+        a[5:n - 11] = b
+    return f, 2 * n / 8
+
+@benchmark()
+def copy_mixed_endian(n):
+    a, b = zeros(n, 'big'), randombits(n - 16, 'little')
+    def f():
+        a[8:n - 8] = b
+    return f, 2 * n / 8
+
+@benchmark(max_bits=1 << 24)
+def encode(n):
+    code = {'a': bitarray('0'), 'b': bitarray('10'), 'c': bitarray('11')}
+    # the encoded bitarray has (in average) n bits
+    symbols = [['a', 'b', 'c'][randint(0, 2)] for _ in range(3 * n // 5)]
+    def f():
+        bitarray().encode(code, symbols)
+    return f, n / 8
+
+@benchmark(max_bits=1 << 24)
+def decode(n):
+    code = {'a': bitarray('0'), 'b': bitarray('10'), 'c': bitarray('11')}
+    a = randombits(n)
+    a.extend('0')  # make sure the bitarray is completely decodable
+    return lambda: a.decode(code), n / 8
+
+@benchmark(max_bits=1 << 30)
+def pack(n):
+    s = bytes(bytearray(getrandbits(1) for _ in range(min(n, 1 << 16))))
+    s *= n // len(s)
+    def f():
+        bitarray().pack(s)
+    return f, n / 8
+
+@benchmark(max_bits=1 << 30)
+def unpack(n):
+    a = randombits(n)
+    return a.unpack, n / 8
+
+@benchmark(max_bits=1 << 30)
+def to01(n):
+    a = randombits(n)
+    return a.to01, n / 8
+
+@benchmark()
+def tobytes(n):
+    a = randombits(n)
+    return a.tobytes, n / 8
+
+@benchmark()
+def fromfile(n):
+    fo = tempfile.TemporaryFile()
+    randombits(n).tofile(fo)
+    def f():
+        fo.seek(0)
+        bitarray().fromfile(fo)
+    return f, n / 8
+
+
+# ------------------------------- timing ----------------------------------
+
+def measure(func, min_time, repeat=3):
+    """
+    Return the best time (in seconds) per call of func, where the calls are
+    timed in loops long enough to take at least min_time seconds.
+    """
+    number = 1
+    while True:
+        t0 = time()
+        for _ in range(number):
+            func()
+        dt = time() - t0
+        if dt >= min_time:
+            break
+        number *= 10 if dt < min_time / 10 else 2
+
+    best = dt
+    for _ in range(repeat - 1):
+        t0 = time()
+        for _ in range(number):
+            func()
+        best = min(best, time() - t0)
+    return best / number
+
+
+def sizes(max_bits):
+    n = 64
+    while n <= max_bits:
+        yield n
+        n *= 8
+
+
+def parse_bits(s):
+    m = re.match(r'(\d+)([kMG]?)$', s)
+    if m is None:
+        raise ValueError("invalid number of bits: %r" % s)
+    return int(m.group(1)) << {'': 0, 'k': 10, 'M': 20, 'G': 30}[m.group(2)]
+
+
+def write_json(path, results, **info):
+    """
+    Write results (together with the versions of bitarray and Python, the
+    platform and any additional info) as JSON to the file path.
+    """
+    data = dict(info)
+    data.update(version=__version__,
+                python=platform.python_version(),
+                platform=platform.platform(),
+                results=results)
+    with open(path, 'w') as fo:
+        json.dump(data, fo, indent=1, sort_keys=True)
+        fo.write('\n')
+
+
+def run(opts):
+    for name, setup, max_bits in BENCHMARKS:
+        if opts.pattern and not re.search(opts.pattern, name):
+            continue
+        for n in sizes(opts.max_bits):
+            if max_bits and n > max_bits:
+                break
+            func, nbytes = setup(n)
+            sec = measure(func, opts.min_time, opts.repeat)
+            res = {
+                'name': name,
+                'bits': n,
+                'seconds': sec,
+                'ops_per_sec': 1.0 / sec,
+                'gb_per_sec': nbytes / sec / 1e9,
+            }
+            yield res
+
+
+# ------------------------- baseline comparison ---------------------------
+
+def compare(results, baseline, tolerance):
+    """
+    Compare results against baseline results (matched by name and size).
+    Return list of (result, ratio) where the ratio is the new time divided
+    by the baseline time, for the results which got slower than
+    1 + tolerance.
+    """
+    base = dict(((r['name'], r['bits']), r['seconds'])
+                for r in baseline['results'])
+    regressions = []
+    for r in results:
+        key = r['name'], r['bits']
+        if key not in base:
+            continue
+        r['ratio'] = ratio = r['seconds'] / base[key]
+        if ratio > 1.0 + tolerance:
+            regressions.append((r, ratio))
+    return regressions
+
+
+def format_bits(n):
+    for shift, unit in (30, 'G'), (20, 'M'), (10, 'k'):
+        if n >= 1 << shift:
+            return '%d%s' % (n >> shift, unit)
+    return str(n)
+
+
+def main():
+    p = OptionParser("usage: %prog [options]")
+    p.add_option(
+        '-m', '--max-bits',
+        action="store",
+        default="128M",
+        help="maximal size of bitarrays (suffixes k, M, G allowed), "
+             "default: 128M (use 8G for the full sweep)")
+    p.add_option(
+        '-k', '--pattern',
+        action="store",
+        help="only run benchmarks whose name matches regular expression")
+    p.add_option(
+        '-t', '--min-time',
+        action="store",
+        type="float",
+        default=0.05,
+        help="minimal time (in seconds) of timing loops, default: 0.05")
+    p.add_option(
+        '-r', '--repeat',
+        action="store",
+        type="int",
+        default=5,
+        help="number of timing loops, of which the fastest is taken, "
+             "default: 5")
+    p.add_option(
+        '-o', '--output',
+        action="store",
+        help="write results as JSON to file")
+    p.add_option(
+        '-b', '--baseline',
+        action="store",
+        help="compare against results in JSON file")
+    p.add_option(
+        '--tolerance',
+        action="store",
+        type="float",
+        default=0.5,
+        help="relative slowdown (compared to baseline) which is "
+             "considered a regression, default: 0.5")
+    opts, args = p.parse_args()
+    if args:
+        p.error('no arguments expected')
+    try:
+        opts.max_bits = parse_bits(opts.max_bits)
+    except ValueError as e:
+        p.error(str(e))
+
+    baseline = None
+    if opts.baseline:
+        with open(opts.baseline) as fi:
+            baseline = json.load(fi)
+
+    seed(1234)
+    print('bitarray %s, Python %s, %d bit' % (
+        __version__, platform.python_version(), 8 * _sysinfo()[0]))
+    print('%-18s %6s %12s %14s %10s' % (
+        'benchmark', 'bits', 'latency [s]', 'ops/s', 'GB/s'))
+    results = []
+    for r in run(opts):
+        results.append(r)
+        print('%-18s %6s %12.3e %14.1f %10.3f' % (
+            r['name'], format_bits(r['bits']), r['seconds'],
+            r['ops_per_sec'], r['gb_per_sec']))
+        sys.stdout.flush()
+
+    if opts.output:
+        write_json(opts.output, results, pointer_size=_sysinfo()[0],
+                   min_time=opts.min_time, repeat=opts.repeat)
+
+    if baseline is None:
+        return
+    regressions = compare(results, baseline, opts.tolerance)
+    print('\ncompared against %s (bitarray %s, Python %s)' % (
+        opts.baseline, baseline['version'], baseline['python']))
+    for r, ratio in regressions:
+        print('REGRESSION: %-18s %6s %6.2fx slower' % (
+            r['name'], format_bits(r['bits']), ratio))
+    if regressions:
+        sys.exit(1)
+    print('no regressions (tolerance %.0f%%)' % (100 * opts.tolerance))
+
+
+if __name__ == '__main__':
+    main()
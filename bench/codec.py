@@ -0,0 +1,158 @@
+"""
+Throughput and compression of prefix codes (Huffman coding).
+
+A reproducible synthetic corpus (generated from a fixed seed) is used for
+each of the following symbol distributions:
+
+  text   letters and spaces with the frequencies of English text
+  skew   bytes with a geometric distribution
+  dna    nucleotides A, C, G, T with 40% GC content
+  64k    65536 integer symbols with a Zipf distribution
+
+For each corpus, the speed (in MB/s of symbols, where the symbols of the
+64k corpus are counted as 2 bytes) of counting the frequencies and
+generating the Huffman code, .encode(), .decode() and .iterdecode() is
+measured, as well as util.dna2ba() and util.ba2dna() for the dna corpus.
+The bits per symbol of the encoded corpus are reported together with the
+entropy of the symbol distribution, which is the lower bound.
+
+Author: Ilan Schnell
+"""
+from __future__ import division, print_function
+
+import sys
+import platform
+from bisect import bisect
+from collections import Counter
+from math import log
+from optparse import OptionParser
+from random import Random
+
+from bitarray import bitarray, __version__
+from bitarray.util import huffman_code, dna2ba, ba2dna
+
+from bench import measure, write_json
+
+
+ENGLISH = {
+    ' ': 18.3, 'e': 10.3, 't': 7.5, 'a': 6.5, 'o': 6.2, 'n': 5.7, 'i': 5.7,
+    's': 5.3, 'r': 5.0, 'h': 5.0, 'l': 3.3, 'd': 3.3, 'u': 2.3, 'c': 2.2,
+    'm': 2.0, 'f': 2.0, 'w': 1.7, 'g': 1.6, 'p': 1.5, 'y': 1.4, 'b': 1.3,
+    'v': 0.8, 'k': 0.6, 'x': 0.1, 'j': 0.1, 'q': 0.1, 'z': 0.1,
+}
+
+def sample(rng, weights, n):
+    """
+    Return list of n symbols, drawn from the dict weights (mapping symbols
+    to their weights) using the random number generator rng.
+    """
+    symbols = sorted(weights)
+    cum = []
+    total = 0.0
+    for sym in symbols:
+        total += weights[sym]
+        cum.append(total)
+    return [symbols[bisect(cum, rng.random() * total)] for _ in range(n)]
+
+def corpus(name, n, seed=42):
+    """
+    Return the corpus of n symbols with given name, as a string or list
+    (which can be passed to .encode()), and the number of bytes of each
+    symbol.
+    """
+    rng = Random(seed)
+    if name == 'text':
+        return ''.join(sample(rng, ENGLISH, n)), 1
+    if name == 'skew':
+        return sample(rng, dict((i, 0.8 ** i) for i in range(256)), n), 1
+    if name == 'dna':
+        return ''.join(sample(rng, {'A': 3, 'C': 2, 'G': 2, 'T': 3}, n)), 1
+    if name == '64k':
+        return sample(rng, dict((i, 1.0 / (i + 1) ** 1.1)
+                                for i in range(1 << 16)), n), 2
+    raise ValueError("unknown corpus: %r" % name)
+
+CORPORA = ['text', 'skew', 'dna', '64k']
+
+
+def entropy(freq):
+    total = sum(freq.values())
+    return -sum(f / total * log(f / total, 2) for f in freq.values())
+
+
+def run(name, n, min_time):
+    symbols, symsize = corpus(name, n)
+    mb = symsize * n / 1e6
+    freq = Counter(symbols)
+    code = huffman_code(freq)
+    a = bitarray()
+    a.encode(code, symbols)
+    assert a.decode(code) == list(symbols)
+
+    res = {
+        'corpus': name,
+        'symbols': n,
+        'distinct': len(freq),
+        'entropy': entropy(freq),
+        'bits_per_symbol': len(a) / n,
+        'mb_per_sec': {},
+    }
+    def bench(op, func):
+        res['mb_per_sec'][op] = mb / measure(func, min_time, repeat=2)
+
+    bench('huffman_code', lambda: huffman_code(Counter(symbols)))
+    bench('encode', lambda: bitarray().encode(code, symbols))
+    bench('decode', lambda: a.decode(code))
+    bench('iterdecode', lambda: sum(1 for _ in a.iterdecode(code)))
+    if name == 'dna':
+        b = dna2ba(symbols)
+        res['dna_bits_per_symbol'] = len(b) / n
+        bench('dna2ba', lambda: dna2ba(symbols))
+        bench('ba2dna', lambda: ba2dna(b))
+    return res
+
+
+def main():
+    p = OptionParser("usage: %prog [options] [CORPUS ...]")
+    p.add_option(
+        '-n', '--symbols',
+        action="store",
+        type="int",
+        default=1000000,
+        help="number of symbols in each corpus, default: 1000000")
+    p.add_option(
+        '-t', '--min-time',
+        action="store",
+        type="float",
+        default=0.2,
+        help="minimal time (in seconds) of timing loops, default: 0.2")
+    p.add_option(
+        '-o', '--output',
+        action="store",
+        help="write results as JSON to file")
+    opts, args = p.parse_args()
+    for name in args:
+        if name not in CORPORA:
+            p.error("unknown corpus %r, choose from: %s" %
+                    (name, ', '.join(CORPORA)))
+
+    print('bitarray %s, Python %s, %d symbols' % (
+        __version__, platform.python_version(), opts.symbols))
+    results = []
+    for name in args or CORPORA:
+        r = run(name, opts.symbols, opts.min_time)
+        results.append(r)
+        print('\n%s: %d distinct symbols, %.3f bits/symbol '
+              '(entropy %.3f, %.1f%% above)' % (
+                  name, r['distinct'], r['bits_per_symbol'], r['entropy'],
+                  100 * (r['bits_per_symbol'] / r['entropy'] - 1)))
+        for op in sorted(r['mb_per_sec']):
+            print('    %-14s %10.2f MB/s' % (op, r['mb_per_sec'][op]))
+        sys.stdout.flush()
+
+    if opts.output:
+        write_json(opts.output, results)
+
+
+if __name__ == '__main__':
+    main()
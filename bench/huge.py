@@ -0,0 +1,144 @@
+"""
+Scaling of time and memory for huge bitarrays (4 Gbits and more).
+
+For sizes from --min-bits up to --max-bits (doubling), the time of
+operations and the resident memory of the process are recorded.  The
+throughput is only reported for operations touching the whole array.
+The correctness near the 2^31, 2^32, 2^34 and 2^35 bit boundaries is
+tested by HugeTests in bitarray/test_bitarray.py (which is enabled by
+setting the environment variable BITARRAY_HUGE).
+
+Author: Ilan Schnell
+"""
+from __future__ import division, print_function
+
+import gc
+import sys
+import platform
+from optparse import OptionParser
+from time import time
+
+from bitarray import bitarray, __version__
+
+from bench import parse_bits, format_bits, write_json
+
+
+def rss_mb():
+    """
+    Return tuple (current, peak) resident memory of the process in MB,
+    where current is None when not available (on other systems than Linux).
+    """
+    current = None
+    try:
+        with open('/proc/self/statm') as fi:
+            current = int(fi.read().split()[1]) * 4096 / 2 ** 20
+    except (IOError, OSError, ValueError):
+        pass
+    try:
+        import resource
+    except ImportError:  # Windows
+        return current, None
+    peak = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    if sys.platform != 'darwin':  # Linux reports KB, macOS bytes
+        peak *= 1024
+    return current, peak / 2 ** 20
+
+
+def operations(n):
+    """
+    Yield (name, func, whole) for a bitarray of n bits, where the functions
+    are called in order on the same bitarray (the first one creates it),
+    and whole is True when the function touches the entire buffer (only
+    then a throughput is reported).
+    """
+    a = bitarray(0, 'little')
+    def create():
+        a.extend(bitarray(n, 'little'))
+        a.setall(0)
+    yield 'create', create, True
+    def setitem():
+        for i in range(0, n, n // 1024):
+            a[i] = 1
+        a[-1] = 1
+    yield 'setitem', setitem, False
+    yield 'count', a.count, True
+    yield 'index', lambda: a.index(0), False
+    yield 'invert', a.invert, True
+    yield 'iand', lambda: a.__iand__(a), True
+    # inserting and deleting near the start moves the whole buffer
+    yield 'insert', lambda: a.insert(3, 1), True
+    yield 'delete', lambda: a.__delitem__(3), True
+    yield 'append', lambda: a.append(1), False
+    yield 'pop', a.pop, False
+
+
+def run(sizes):
+    for n in sizes:
+        for name, func, whole in operations(n):
+            t0 = time()
+            func()
+            sec = time() - t0
+            current, peak = rss_mb()
+            yield {
+                'name': name,
+                'bits': n,
+                'seconds': sec,
+                'gb_per_sec': n / 8 / sec / 1e9 if whole and sec else None,
+                'rss_mb': current,
+                'peak_rss_mb': peak,
+            }
+        gc.collect()
+
+
+def main():
+    p = OptionParser("usage: %prog [options]")
+    p.add_option(
+        '--min-bits',
+        action="store",
+        default="4G",
+        help="smallest size of bitarray, default: 4G")
+    p.add_option(
+        '-m', '--max-bits',
+        action="store",
+        default="8G",
+        help="largest size of bitarray, default: 8G (the bitarray needs "
+             "max-bits / 8 bytes of memory, 64G for the full sweep)")
+    p.add_option(
+        '-o', '--output',
+        action="store",
+        help="write results as JSON to file")
+    opts, args = p.parse_args()
+    if args:
+        p.error('no arguments expected')
+    try:
+        min_bits = parse_bits(opts.min_bits)
+        max_bits = parse_bits(opts.max_bits)
+    except ValueError as e:
+        p.error(str(e))
+
+    sizes = []
+    n = min_bits
+    while n <= max_bits:
+        sizes.append(n)
+        n *= 2
+
+    print('bitarray %s, Python %s' % (__version__,
+                                      platform.python_version()))
+    print('%-10s %6s %10s %10s %10s %10s' % (
+        'operation', 'bits', 'time [s]', 'GB/s', 'RSS [MB]', 'peak [MB]'))
+    results = []
+    for r in run(sizes):
+        results.append(r)
+        print('%-10s %6s %10.4f %10s %10s %10s' % (
+            r['name'], format_bits(r['bits']), r['seconds'],
+            '%.3f' % r['gb_per_sec'] if r['gb_per_sec'] else '-',
+            '%.0f' % r['rss_mb'] if r['rss_mb'] is not None else '-',
+            '%.0f' % r['peak_rss_mb'] if r['peak_rss_mb'] else '-'))
+        sys.stdout.flush()
+
+    if opts.output:
+        write_json(opts.output, results)
+
+
+if __name__ == '__main__':
+    main()
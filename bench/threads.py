@@ -0,0 +1,258 @@
+"""
+Thread scaling of bitarray operations.
+
+Each operation is run from 1 up to N Python threads (each thread calls
+the operation the same number of times), either on data shared by all
+threads or on private copies for each thread.  For each number of threads
+we report the aggregate throughput (GB/s of bitarray data processed) and
+the speedup over one thread.  Operations which gain less than a threshold
+fraction of the ideal additional speedup (k - 1 for k threads) are flagged
+as serialized, i.e. they hold the GIL (or contend on shared state, when
+only the shared variant is flagged).
+
+The aggregate throughput is also compared with the memory bandwidth of
+copying a buffer (of the same size as the bitarrays) in a single thread.
+An operation which reaches this bandwidth is limited by memory, not by
+the GIL, and is therefore marked as saturated rather than serialized.
+
+As a control, hashlib.sha1() of a large buffer is included, which
+releases the GIL, and therefore shows how far the machine can scale.
+No bitarray operation currently releases the GIL, and there is no
+internal thread pool.
+
+Author: Ilan Schnell
+"""
+from __future__ import division, print_function
+
+import os
+import sys
+import hashlib
+import platform
+import threading
+from optparse import OptionParser
+from time import time
+
+from bitarray import bitarray, __version__
+
+from bench import write_json
+
+
+def randombits(n):
+    a = bitarray(endian='big')
+    a.frombytes(os.urandom(n // 8))
+    return a
+
+
+def operations(n):
+    """
+    Yield (name, make, nbytes), where make() returns a function (without
+    arguments) which runs the operation once on new data, and nbytes is
+    the number of bytes processed by each call.
+    """
+    def count():
+        a = randombits(n)
+        return a.count
+    yield 'count', count, n / 8
+
+    def bitwise_and():
+        a, b = randombits(n), randombits(n)
+        return lambda: a & b
+    yield 'and', bitwise_and, 3 * n / 8
+
+    def bitwise_ior():
+        a, b = randombits(n), randombits(n)
+        return lambda: a.__ior__(b)
+    yield 'ior', bitwise_ior, 2 * n / 8
+
+    m = n // 64  # search and decode are much slower
+    def search():
+        a = bitarray(m)
+        a.setall(0)
+        a[-8:] = 1
+        x = bitarray('00011111')
+        return lambda: a.search(x, 1)
+    yield 'search', search, m / 8
+
+    def decode():
+        code = {'a': bitarray('0'), 'b': bitarray('10'),
+                'c': bitarray('11')}
+        a = randombits(m)
+        a.append(0)
+        return lambda: a.decode(code)
+    yield 'decode', decode, m / 8
+
+    def sha1():  # control, releases the GIL
+        data = os.urandom(n // 8)
+        return lambda: hashlib.sha1(data).digest()
+    yield 'sha1 (control)', sha1, n / 8
+
+
+def copy_bandwidth(nbytes, calls, warmup):
+    """
+    Return the memory bandwidth (GB/s of bytes read and written) of
+    copying a buffer of nbytes in a single thread.
+    """
+    src = bytearray(os.urandom(nbytes))
+    dst = bytearray(nbytes)
+    for _ in range(warmup):
+        dst[:] = src
+    t0 = time()
+    for _ in range(calls):
+        dst[:] = src
+    return 2 * calls * nbytes / (time() - t0) / 1e9
+
+
+def run_threads(funcs, calls):
+    """
+    Run each function in funcs (one per thread) calls times, and return
+    the wall time.
+    """
+    barrier = threading.Event()
+
+    def worker(f):
+        barrier.wait()
+        for _ in range(calls):
+            f()
+
+    threads = [threading.Thread(target=worker, args=(f,)) for f in funcs]
+    for t in threads:
+        t.start()
+    t0 = time()
+    barrier.set()
+    for t in threads:
+        t.join()
+    return time() - t0
+
+
+def measure(make, nbytes, nthreads, shared, calls, warmup):
+    if shared:
+        f = make()
+        funcs = nthreads * [f]
+    else:
+        funcs = [make() for _ in range(nthreads)]
+    run_threads(funcs, warmup)
+    dt = run_threads(funcs, calls)
+    return nthreads * calls * nbytes / dt / 1e9
+
+
+def main():
+    try:
+        from multiprocessing import cpu_count
+        ncpu = cpu_count()
+    except (ImportError, NotImplementedError):
+        ncpu = 1
+
+    p = OptionParser("usage: %prog [options]")
+    p.add_option(
+        '-n', '--bits',
+        action="store",
+        type="int",
+        default=1 << 26,
+        help="size of bitarrays, default: 2^26 (8 MB)")
+    p.add_option(
+        '-j', '--threads',
+        action="store",
+        type="int",
+        default=ncpu,
+        help="maximal number of threads, default: number of CPUs (%d)" %
+             ncpu)
+    p.add_option(
+        '-c', '--calls',
+        action="store",
+        type="int",
+        default=10,
+        help="calls of each operation per thread, default: 10")
+    p.add_option(
+        '-w', '--warmup',
+        action="store",
+        type="int",
+        default=3,
+        help="warm up calls per thread before measuring, default: 3")
+    p.add_option(
+        '--threshold',
+        action="store",
+        type="float",
+        default=0.5,
+        help="flag operations which gain less than threshold times the "
+             "ideal additional speedup (k - 1 for k threads), "
+             "default: 0.5")
+    p.add_option(
+        '--saturation',
+        action="store",
+        type="float",
+        default=0.8,
+        help="consider the memory bandwidth saturated when the throughput "
+             "reaches this fraction of the single thread copy bandwidth, "
+             "default: 0.8")
+    p.add_option(
+        '-o', '--output',
+        action="store",
+        help="write results as JSON to file")
+    opts, args = p.parse_args()
+    if args:
+        p.error('no arguments expected')
+
+    nthreads = [1]
+    while 2 * nthreads[-1] <= opts.threads:
+        nthreads.append(2 * nthreads[-1])
+    if nthreads[-1] != opts.threads:
+        nthreads.append(opts.threads)
+
+    print('bitarray %s, Python %s, %d CPUs, %d bits' % (
+        __version__, platform.python_version(), ncpu, opts.bits))
+    copy_gbs = copy_bandwidth(opts.bits // 8, opts.calls, opts.warmup)
+    print('single thread copy bandwidth: %.3f GB/s' % copy_gbs)
+    print('%-16s %-8s %8s %10s %8s %8s' % ('operation', 'data', 'threads',
+                                            'GB/s', 'speedup', 'copy %'))
+    results = []
+    flagged = []
+    for name, make, nbytes in operations(opts.bits):
+        for shared in True, False:
+            base = None
+            for k in nthreads:
+                gbs = measure(make, nbytes, k, shared, opts.calls,
+                              opts.warmup)
+                if base is None:
+                    base = gbs
+                speedup = gbs / base
+                results.append({
+                    'name': name,
+                    'shared': shared,
+                    'threads': k,
+                    'gb_per_sec': gbs,
+                    'speedup': speedup,
+                    'copy_ratio': gbs / copy_gbs,
+                })
+                print('%-16s %-8s %8d %10.3f %8.2f %8.0f' % (
+                    name, 'shared' if shared else 'private', k, gbs,
+                    speedup, 100 * gbs / copy_gbs))
+                sys.stdout.flush()
+            if k > 1 and speedup - 1 < opts.threshold * (k - 1):
+                saturated = gbs >= opts.saturation * copy_gbs
+                flagged.append((name, shared, k, speedup, saturated))
+
+    if len(nthreads) > 1:
+        print()
+        for name, shared, k, speedup, saturated in flagged:
+            print('%s: %-16s (%s data) speedup %.2f with %d threads' % (
+                'SATURATED' if saturated else 'SERIALIZED', name,
+                'shared' if shared else 'private', speedup, k))
+        if any(name.endswith('(control)') and not saturated
+               for name, _, _, _, saturated in flagged):
+            print('the control does not scale either, so the machine has '
+                  'fewer cores\nthan threads (or they are busy), and the '
+                  'flags above are not meaningful')
+    else:
+        print('\nonly one thread, no speedups measured (use -j)')
+
+    if opts.output:
+        write_json(opts.output, results, cpus=ncpu, bits=opts.bits,
+                   copy_gb_per_sec=copy_gbs,
+                   serialized=[dict(name=name, shared=shared, threads=k,
+                                    speedup=speedup, saturated=saturated)
+                               for name, shared, k, speedup, saturated
+                               in flagged])
+
+
+if __name__ == '__main__':
+    main()
@@ -10,7 +10,7 @@ Author: Ilan Schnell
 """
 from bitarray._bitarray import (_bitarray, bitdiff, bits2bytes, _sysinfo,
                                 get_default_endian, _set_default_endian,
-                                __version__)
+                                _set_isa, enable_stats, stats, __version__)
 
 
 __all__ = ['bitarray', 'frozenbitarray', '__version__']
@@ -77,6 +77,17 @@ a dictionary key.
     __iand__ = __iadd__ = __imul__ = __ior__ = __ixor__ = __delitem__
 
 
+def get_include():
+    """get_include() -> str
+
+Return the directory containing the C headers `bitarray.h`, for compiling
+extension modules which use the bitarray C API, and `bitkernels.h`, which
+contains the bit kernels (independent of Python, usable from C and C++).
+"""
+    import os
+    return os.path.dirname(os.path.abspath(__file__))
+
+
 def test(verbosity=1, repeat=1):
     """test(verbosity=1, repeat=1) -> TextTestResult
 
@@ -37,71 +37,170 @@
 #endif /* !STDC_HEADERS */
 
 
-/* instead of Py_ssize_t, we use this type indices, as Py_ssize_t is
-   only 4 bytes on 32bit machines, but bitarray indices can exceed this */
-typedef long long int idx_t;
-
-/* Unlike the normal convention, ob_size is the byte count, not the number
-   of elements.  The reason for doing this is that we can use our own
-   special idx_t for the number of bits, which may exceed 2^32 on a 32 bit
-   machine.  */
-typedef struct {
-    PyObject_VAR_HEAD
-    char *ob_item;
-    Py_ssize_t allocated;       /* how many bytes allocated */
-    idx_t nbits;                /* length of bitarray, i.e. elements */
-    int endian;                 /* bit endianness of bitarray */
-    int ob_exports;             /* how many buffer exports */
-    PyObject *weakreflist;      /* list of weak references */
-} bitarrayobject;
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#define BITARRAY_INTERNAL
+#include "bitarray.h"
 
 static PyTypeObject Bitarraytype;
 
 /* --- bit endianness --- */
-#define ENDIAN_LITTLE  0
-#define ENDIAN_BIG     1
-#define ENDIAN_INT(i)  ((i) == ENDIAN_LITTLE ? "little" : "big")
 #define ENDIAN_OBJ(o)  ENDIAN_INT(((bitarrayobject *) o)->endian)
 static int default_endian = ENDIAN_BIG;
 
 #define bitarray_Check(obj)  PyObject_TypeCheck((obj), &Bitarraytype)
 
-#define BITS(bytes)  ((idx_t) (bytes) << 3)
-
-/* number of bytes necessary to store given bits */
-#define BYTES(bits)  (((bits) == 0) ? 0 : (((bits) - 1) / 8 + 1))
-
-#define BITMASK(endian, i)  \
-    (((char) 1) << ((endian) == ENDIAN_LITTLE ? ((i) % 8) : (7 - (i) % 8)))
-
 /* This (bytes) block size is used when reading/writing blocks of bytes
    from files. */
 #define BLOCKSIZE  65536
 
-/* ------------ low level access to bits in bitarrayobject ------------- */
+/* ------------------------- runtime statistics ------------------------ */
+
+/* Statistics are only collected while stats_enabled is set (see
+   enable_stats() and stats() below), otherwise they cost a single
+   predictable branch. */
+static int stats_enabled = 0;
+
+enum stats_op {
+    ST_count,
+    ST_index,
+    ST_search,
+    ST_bitwise,
+    ST_invert,
+    ST_setrange,
+    ST_copy_fast,       /* copy_n() copying whole bytes */
+    ST_copy_slow,       /* copy_n() copying bit by bit */
+    ST_encode,
+    ST_decode,
+    ST_pack,
+    ST_unpack,
+    ST_frombytes,
+    ST_tobytes,
+    ST_fromfile,
+    ST_tofile,
+    ST_NUM,
+};
+
+static const char *stats_names[ST_NUM] = {
+    "count", "index", "search", "bitwise", "invert", "setrange",
+    "copy_fast", "copy_slow", "encode", "decode", "pack", "unpack",
+    "frombytes", "tobytes", "fromfile", "tofile",
+};
 
-#ifndef NDEBUG
-static int GETBIT(bitarrayobject *self, idx_t i) {
-    assert(0 <= i && i < self->nbits);
-    return ((self)->ob_item[(i) / 8] & BITMASK((self)->endian, i) ? 1 : 0);
-}
+static struct {
+    idx_t calls[ST_NUM];
+    idx_t bytes[ST_NUM];        /* bytes of bitarray data processed */
+    double time[ST_NUM];        /* seconds spent */
+    idx_t resize;               /* calls to resize() */
+    idx_t realloc;              /* calls to PyMem_Realloc() in resize() */
+    idx_t realloc_bytes;        /* bytes requested by these calls */
+    idx_t export_refused;       /* resizes refused due to buffer exports */
+} stats;
+
+static double
+stats_clock(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER count, freq;
+
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return (double) count.QuadPart / (double) freq.QuadPart;
 #else
-#define GETBIT(self, i)  \
-    ((self)->ob_item[(i) / 8] & BITMASK((self)->endian, i) ? 1 : 0)
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + 1e-9 * (double) ts.tv_nsec;
 #endif
+}
 
-static void
-setbit(bitarrayobject *self, idx_t i, int bit)
+/* Every instrumented operation is wrapped as:
+
+       t0 = STATS_BEGIN(op);
+       ...
+       STATS_END(op, t0, nbytes);
+
+   where t0 is the start time, or 0.0 when statistics are disabled.
+   STATS_END() has to be reached on error paths as well, such that the
+   time and bytes of every call counted are recorded. */
+#define STATS_BEGIN(op)  \
+    (stats_enabled ? (stats.calls[op]++, stats_clock()) : 0.0)
+
+#define STATS_END(op, t0, nbytes)  do {                 \
+    if ((t0) != 0.0) {                                   \
+        stats.bytes[op] += (idx_t) (nbytes);             \
+        stats.time[op] += stats_clock() - (t0);          \
+    }                                                    \
+} while (0)
+
+#define STATS_INC(field)  do {                           \
+    if (stats_enabled)                                   \
+        stats.field++;                                   \
+} while (0)
+
+/* -------------------- CPU features and kernel dispatch ------------------- */
+
+/* The byte kernels and the CPU probe are defined in bitkernels.h.  On
+   import, the best kernels for the CPU are selected, which may be limited
+   to an ISA level using the environment variable BITARRAY_ISA or
+   _set_isa(). */
+
+static int cpu_features = 0;    /* features detected on import */
+static int isa_level = 3;       /* index of the selected level */
+
+/* the dispatch table, exported through the C API */
+static bitarray_kernels kernels = {
+    bk_count_bytes,
+    bk_bitwise_bytes,
+    bk_invert_bytes,
+    bk_skip_bytes,
+    bk_shift_bytes,
+};
+
+/* ISA level names of the selected kernels, see bk_select_kernels() */
+static const char *kernel_names[BK_NKERNELS];
+
+/* select the kernels for the ISA level with given name, and return 0,
+   or -1 when there is no such level (without setting an exception) */
+static int
+set_isa_level(const char *name)
 {
-    char *cp, mask;
+    const int k = bk_find_isa_level(name);
 
-    assert(0 <= i && i < BITS(Py_SIZE(self)));
-    mask = BITMASK(self->endian, i);
-    cp = self->ob_item + i / 8;
-    if (bit)
-        *cp |= mask;
-    else
-        *cp &= ~mask;
+    if (k < 0)
+        return -1;
+    isa_level = k;
+    bk_select_kernels(&kernels, cpu_features & bk_isa_levels[k].features,
+                      kernel_names);
+    return 0;
+}
+
+/* ------------------------ dirty block tracking ----------------------- */
+
+/* make the dirty bitmap of self large enough to cover nbytes of buffer,
+   return 0 on success or -1 (with exception set) on failure */
+static int
+dirty_reserve(bitarrayobject *self, Py_ssize_t nbytes)
+{
+    Py_ssize_t n = (DIRTY_BLOCKS(nbytes) + 7) / 8;
+    char *p;
+
+    if (n <= self->dirty_alloc)
+        return 0;
+    n += (n >> 4) + 8;
+    p = (char *) PyMem_Realloc(self->dirty, (size_t) n);
+    if (p == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    memset(p + self->dirty_alloc, 0x00, (size_t) (n - self->dirty_alloc));
+    self->dirty = p;
+    self->dirty_alloc = n;
+    return 0;
 }
 
 static int
@@ -109,7 +208,9 @@ check_overflow(idx_t nbits)
 {
     assert(nbits >= 0);
     if (sizeof(void *) == 4) {  /* 32bit system */
-        const idx_t max_bits = ((idx_t) 1) << 34;  /* 2^34 = 16 Gbits*/
+        /* the number of bytes has to fit into Py_ssize_t, 2^34 bits
+           (2^31 bytes) would already be too large */
+        const idx_t max_bits = BITS(PY_SSIZE_T_MAX);  /* ~16 Gbits */
         if (nbits > max_bits) {
             PyErr_Format(PyExc_OverflowError,
                          "cannot create bitarray of size %lld, "
@@ -136,6 +237,15 @@ resize(bitarrayobject *self, idx_t nbits)
     if (check_overflow(nbits) < 0)
         return -1;
     newsize = (Py_ssize_t) BYTES(nbits);
+    STATS_INC(resize);
+
+    if (self->dirty && nbits != self->nbits) {
+        /* the new bytes as well as the last byte (whose padding changes)
+           are modified */
+        if (dirty_reserve(self, newsize) < 0)
+            return -1;
+        MARK_DIRTY(self, Py_MIN(size, newsize) - 1, newsize);
+    }
 
     if (newsize == size) {
         /* the memory size hasn't changed - bypass everything */
@@ -144,6 +254,7 @@ resize(bitarrayobject *self, idx_t nbits)
     }
 
     if (self->ob_exports > 0) {
+        STATS_INC(export_refused);
         PyErr_SetString(PyExc_BufferError,
                         "cannot resize bitarray that is exporting buffers");
         return -1;
@@ -188,6 +299,10 @@ resize(bitarrayobject *self, idx_t nbits)
         new_allocated += (newsize >> 4) + (newsize < 8 ? 3 : 7);
 
     assert(new_allocated >= (size_t) newsize);
+    if (stats_enabled) {
+        stats.realloc++;
+        stats.realloc_bytes += new_allocated;
+    }
     self->ob_item = PyMem_Realloc(self->ob_item, new_allocated);
     if (self->ob_item == NULL) {
         PyErr_NoMemory();
@@ -213,24 +328,29 @@ newbitarrayobject(PyTypeObject *type, idx_t nbits, int endian)
     if (obj == NULL)
         return NULL;
 
+    obj->ob_item = NULL;
+    obj->ob_exports = 0;
+    obj->weakreflist = NULL;
+    obj->dirty = NULL;
+    obj->dirty_alloc = 0;
+    obj->clean_size = 0;
+
     nbytes = (Py_ssize_t) BYTES(nbits);
-    Py_SIZE(obj) = nbytes;
-    if (nbytes == 0) {
-        obj->ob_item = NULL;
-    }
-    else {
+    if (nbytes) {
         obj->ob_item = (char *) PyMem_Malloc((size_t) nbytes);
         if (obj->ob_item == NULL) {
-            PyObject_Del(obj);
-            PyErr_NoMemory();
-            return NULL;
+            /* the object was allocated by tp_alloc (which may add a GC
+               header for subclasses), so it has to be freed by
+               deallocating it (and not by PyObject_Del) */
+            Py_SIZE(obj) = 0;
+            Py_DECREF(obj);
+            return PyErr_NoMemory();
         }
     }
+    Py_SIZE(obj) = nbytes;
     obj->allocated = nbytes;
     obj->nbits = nbits;
     obj->endian = endian;
-    obj->ob_exports = 0;
-    obj->weakreflist = NULL;
     return (PyObject *) obj;
 }
 
@@ -243,6 +363,9 @@ bitarray_dealloc(bitarrayobject *self)
     if (self->ob_item != NULL)
         PyMem_Free((void *) self->ob_item);
 
+    if (self->dirty != NULL)
+        PyMem_Free((void *) self->dirty);
+
     Py_TYPE(self)->tp_free((PyObject *) self);
 }
 
@@ -251,47 +374,24 @@ static void
 copy_n(bitarrayobject *self, idx_t a,
        bitarrayobject *other, idx_t b, idx_t n)
 {
-    idx_t i;
+    bitspan dst = bitarray_span(self), src = bitarray_span(other);
+    enum stats_op op;
+    double t0;
 
     assert(0 <= n && n <= self->nbits && n <= other->nbits);
     assert(0 <= a && a <= self->nbits - n);
     assert(0 <= b && b <= other->nbits - n);
     if (n == 0)
         return;
+    MARK_DIRTY_BITS(self, a, a + n);
 
-    /* When the start positions are at byte positions, we can copy whole
-       bytes using memmove, and copy the remaining few bits individually.
-       Note that the order of these two operations matters when copying
-       self to self. */
-    if (self->endian == other->endian && a % 8 == 0 && b % 8 == 0 && n >= 8)
-    {
-        const size_t bytes = n / 8;
-        const idx_t bits = BITS(bytes);
-
-        assert(bits <= n && n < bits + 8);
-        if (a <= b)
-            memmove(self->ob_item + a / 8, other->ob_item + b / 8, bytes);
-
-        if (n != bits)
-            copy_n(self, bits + a, other, bits + b, n - bits);
-
-        if (a > b)
-            memmove(self->ob_item + a / 8, other->ob_item + b / 8, bytes);
-
-        return;
-    }
-
-    /* The two different types of looping are only relevant when copying
-       self to self, i.e. when copying a piece of an bitarrayobject onto
-       itself. */
-    if (a <= b) {
-        for (i = 0; i < n; i++)             /* loop forward (delete) */
-            setbit(self, i + a, GETBIT(other, i + b));
-    }
-    else {
-        for (i = n - 1; i >= 0; i--)      /* loop backwards (insert) */
-            setbit(self, i + a, GETBIT(other, i + b));
-    }
+    /* whether whole bytes are copied is only known afterwards */
+    t0 = stats_enabled ? stats_clock() : 0.0;
+    op = bk_copy(&kernels, &dst, a, &src, b, n) ? ST_copy_fast :
+                                                   ST_copy_slow;
+    if (t0 != 0.0)
+        stats.calls[op]++;
+    STATS_END(op, t0, n / 8);
 }
 
 /* starting at start, delete n bits from self */
@@ -322,30 +422,15 @@ insert_n(bitarrayobject *self, idx_t start, idx_t n)
     return 0;
 }
 
-/* sets unused padding bits (within last byte of buffer) to 0,
-   and return the number of padding bits -- self->nbits is unchanged */
-static int
-setunused(bitarrayobject *self)
-{
-    idx_t n, i;
-
-    if (self->nbits % 8 == 0)
-        return 0;
-
-    n = BITS(Py_SIZE(self));    /* number of bits in buffer */
-    for (i = self->nbits; i < n; i++)
-        setbit(self, i, 0);
-    assert(0 < n - self->nbits && n - self->nbits < 8);
-    return (int) (n - self->nbits);
-}
-
 static void
 invert(bitarrayobject *self)
 {
-    Py_ssize_t nbytes = Py_SIZE(self), i;
+    Py_ssize_t nbytes = Py_SIZE(self);
+    double t0 = STATS_BEGIN(ST_invert);
 
-    for (i = 0; i < nbytes; i++)
-        self->ob_item[i] = ~self->ob_item[i];
+    MARK_DIRTY(self, 0, nbytes);
+    kernels.invert(self->ob_item, nbytes);
+    STATS_END(ST_invert, t0, nbytes);
 }
 
 /* repeat self n times (negative n is treated as 0) */
@@ -365,18 +450,13 @@ repeat(bitarrayobject *self, idx_t n)
 }
 
 
-enum op_type {
-    OP_and,
-    OP_or,
-    OP_xor,
-};
-
 /* perform bitwise in-place operation */
 static int
 bitwise(bitarrayobject *self, PyObject *arg, enum op_type oper)
 {
     bitarrayobject *other;
-    Py_ssize_t n = Py_SIZE(self), i;
+    Py_ssize_t n = Py_SIZE(self);
+    double t0;
 
     if (!bitarray_Check(arg)) {
         PyErr_SetString(PyExc_TypeError,
@@ -391,22 +471,10 @@ bitwise(bitarrayobject *self, PyObject *arg, enum op_type oper)
     }
     setunused(self);
     setunused(other);
-    switch (oper) {
-    case OP_and:
-        for (i = 0; i < n; i++)
-            self->ob_item[i] &= other->ob_item[i];
-        break;
-    case OP_or:
-        for (i = 0; i < n; i++)
-            self->ob_item[i] |= other->ob_item[i];
-        break;
-    case OP_xor:
-        for (i = 0; i < n; i++)
-            self->ob_item[i] ^= other->ob_item[i];
-        break;
-    default:  /* cannot happen */
-        return -1;
-    }
+    MARK_DIRTY(self, 0, n);
+    t0 = STATS_BEGIN(ST_bitwise);
+    kernels.bitwise(self->ob_item, other->ob_item, n, oper);
+    STATS_END(ST_bitwise, t0, n);
     return 0;
 }
 
@@ -414,71 +482,36 @@ bitwise(bitarrayobject *self, PyObject *arg, enum op_type oper)
 static void
 setrange(bitarrayobject *self, idx_t start, idx_t stop, int val)
 {
-    idx_t i;
+    bitspan s = bitarray_span(self);
+    double t0;
 
     assert(0 <= start && start <= self->nbits);
     assert(0 <= stop && stop <= self->nbits);
 
     if (self->nbits == 0 || start >= stop)
         return;
-
-    if (stop >= start + 8) {
-        const Py_ssize_t byte_start = BYTES(start);
-        const Py_ssize_t byte_stop = (Py_ssize_t) stop / 8;
-        for (i = start; i < BITS(byte_start); i++)
-            setbit(self, i, val);
-        memset(self->ob_item + byte_start, val ? 0xff : 0x00,
-               (size_t) (byte_stop - byte_start));
-        for (i = BITS(byte_stop); i < stop; i++)
-            setbit(self, i, val);
-    }
-    else {
-        for (i = start; i < stop; i++)
-            setbit(self, i, val);
-    }
+    MARK_DIRTY_BITS(self, start, stop);
+    t0 = STATS_BEGIN(ST_setrange);
+    bk_setrange(&s, start, stop, val);
+    STATS_END(ST_setrange, t0, (stop - start) / 8);
 }
 
-static unsigned char bitcount_lookup[256] = {
-    0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,
-    1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,
-    1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,
-    2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,
-    1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,
-    2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,
-    2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,
-    3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,4,5,5,6,5,6,6,7,5,6,6,7,6,7,7,8,
-};
-
 /* Return number of 1 bits.  This function never fails. */
 static idx_t
 count(bitarrayobject *self, int vi, idx_t start, idx_t stop)
 {
-    idx_t i, res = 0;
+    bitspan s = bitarray_span(self);
+    idx_t res;
+    double t0;
 
-    assert(0 <= start && start <= self->nbits);
-    assert(0 <= stop && stop <= self->nbits);
     assert(0 <= vi && vi <= 1);
     assert(BYTES(stop) <= Py_SIZE(self));
 
     if (self->nbits == 0 || start >= stop)
         return 0;
-
-    if (stop >= start + 8) {
-        const Py_ssize_t byte_start = BYTES(start);
-        const Py_ssize_t byte_stop = (Py_ssize_t) (stop / 8);
-        Py_ssize_t j;
-
-        for (i = start; i < BITS(byte_start); i++)
-            res += GETBIT(self, i);
-        for (j = byte_start; j < byte_stop; j++)
-            res += bitcount_lookup[(unsigned char) self->ob_item[j]];
-        for (i = BITS(byte_stop); i < stop; i++)
-            res += GETBIT(self, i);
-    }
-    else {
-        for (i = start; i < stop; i++)
-            res += GETBIT(self, i);
-    }
+    t0 = STATS_BEGIN(ST_count);
+    res = bk_count(&kernels, &s, start, stop);
+    STATS_END(ST_count, t0, (stop - start) / 8);
     return vi ? res : stop - start - res;
 }
 
@@ -487,37 +520,18 @@ count(bitarrayobject *self, int vi, idx_t start, idx_t stop)
 static idx_t
 findfirst(bitarrayobject *self, int vi, idx_t start, idx_t stop)
 {
-    Py_ssize_t j;
-    idx_t i;
+    bitspan s = bitarray_span(self);
+    idx_t res;
+    double t0;
 
-    assert(0 <= start && start <= self->nbits);
-    assert(0 <= stop && stop <= self->nbits);
-    assert(0 <= vi && vi <= 1);
     assert(BYTES(stop) <= Py_SIZE(self));
 
     if (self->nbits == 0 || start >= stop)
         return -1;
-
-    if (stop >= start + 8) {
-        /* seraching for 1 means: break when byte is not 0x00
-           searching for 0 means: break when byte is not 0xff */
-        const char c = vi ? 0x00 : 0xff;
-
-        /* skip ahead by checking whole bytes */
-        for (j = (Py_ssize_t) (start / 8); j < BYTES(stop); j++)
-            if (c ^ self->ob_item[j])
-                break;
-
-        if (start < BITS(j))
-            start = BITS(j);
-    }
-
-    /* fine grained search */
-    for (i = start; i < stop; i++)
-        if (GETBIT(self, i) == vi)
-            return i;
-
-    return -1;
+    t0 = STATS_BEGIN(ST_index);
+    res = bk_findfirst(&kernels, &s, vi, start, stop);
+    STATS_END(ST_index, t0, ((res < 0 ? stop : res) - start) / 8);
+    return res;
 }
 
 /* search for the first occurrence of bitarray xa (in self), starting at p,
@@ -526,19 +540,116 @@ findfirst(bitarrayobject *self, int vi, idx_t start, idx_t stop)
 static idx_t
 search(bitarrayobject *self, bitarrayobject *xa, idx_t p)
 {
-    idx_t i;
+    bitspan s = bitarray_span(self), x = bitarray_span(xa);
+    idx_t res, end;
+    double t0 = STATS_BEGIN(ST_search);
 
-    assert(p >= 0);
-    while (p < self->nbits - xa->nbits + 1) {
-        for (i = 0; i < xa->nbits; i++)
-            if (GETBIT(self, p + i) != GETBIT(xa, i))
-                goto next;
+    res = bk_search(&s, &x, p);
+    end = res < 0 ? self->nbits - xa->nbits + 1 : res;
+    STATS_END(ST_search, t0, end > p ? (end - p) / 8 : 0);
+    return res;
+}
 
-        return p;
-    next:
-        p++;
+/* like search(), but only compare the bits of xa where the bitarray mask
+   (which has the same length as xa) is 1 */
+static idx_t
+search_masked(bitarrayobject *self, bitarrayobject *xa,
+              bitarrayobject *mask, idx_t p)
+{
+    bitspan s = bitarray_span(self), x = bitarray_span(xa);
+    bitspan m = bitarray_span(mask);
+    idx_t res, end;
+    double t0 = STATS_BEGIN(ST_search);
+
+    res = bk_search_masked(&s, &x, &m, p);
+    end = res < 0 ? self->nbits - xa->nbits + 1 : res;
+    STATS_END(ST_search, t0, end > p ? (end - p) / 8 : 0);
+    return res;
+}
+
+/* Check the (optional) search mask argument for pattern xa, and set *mask
+   to the mask bitarray, or NULL for None.  Return -1 on error. */
+static int
+search_mask_arg(bitarrayobject *xa, PyObject *maskobj,
+                bitarrayobject **mask)
+{
+    *mask = NULL;
+    if (maskobj == NULL || maskobj == Py_None)
+        return 0;
+    if (!bitarray_Check(maskobj)) {
+        PyErr_SetString(PyExc_TypeError, "bitarray expected for mask");
+        return -1;
     }
-    return -1;
+    if (((bitarrayobject *) maskobj)->nbits != xa->nbits) {
+        PyErr_SetString(PyExc_ValueError,
+                        "mask and pattern must have same length");
+        return -1;
+    }
+    *mask = (bitarrayobject *) maskobj;
+    return 0;
+}
+
+/* ------------------------ word level access ------------------------- */
+
+/* Allocate and return the words of the pattern xa, in the bit order used
+   by window() for bitarrays of given endianness, or set MemoryError and
+   return NULL.  The padding bits of xa end up in the last word. */
+static word_t *
+pattern_words(bitarrayobject *xa, int endian)
+{
+    const Py_ssize_t nwords = (Py_ssize_t) WORDS(xa->nbits);
+    word_t *w;
+    unsigned char c;
+    Py_ssize_t i;
+
+    w = (word_t *) PyMem_Malloc(nwords * sizeof(word_t) + 1);
+    if (w == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    memset(w, 0x00, nwords * sizeof(word_t));
+    for (i = 0; i < Py_SIZE(xa); i++) {
+        c = (unsigned char) xa->ob_item[i];
+        if (xa->endian != endian)
+            c = reverse_trans[c];
+        w[i / 8] |= ((word_t) c) << (endian == ENDIAN_LITTLE ?
+                                     8 * (i % 8) : 56 - 8 * (i % 8));
+    }
+    return w;
+}
+
+/* Return the 64 bits self[p:p+64], read in place from the buffer.  For
+   little-endian bitarrays, bit p + k is bit k of the result, and for
+   big-endian bitarrays bit 63 - k, such that no bits need to be reversed.
+   Bits beyond the end of the buffer are 0. */
+static word_t
+window(bitarrayobject *self, idx_t p)
+{
+    const unsigned char *buff = (unsigned char *) self->ob_item + p / 8;
+    const Py_ssize_t avail = Py_SIZE(self) - (Py_ssize_t) (p / 8);
+    const int r = (int) (p % 8);
+    unsigned char tmp[9];
+    word_t x = 0;
+    int k;
+
+    if (avail < 9) {
+        memset(tmp, 0x00, 9);
+        memcpy(tmp, buff, (size_t) avail);
+        buff = tmp;
+    }
+    if (self->endian == ENDIAN_LITTLE) {
+        for (k = 0; k < 8; k++)
+            x |= ((word_t) buff[k]) << (8 * k);
+        if (r)
+            x = (x >> r) | (((word_t) buff[8]) << (WBITS - r));
+    }
+    else {
+        for (k = 0; k < 8; k++)
+            x |= ((word_t) buff[k]) << (56 - 8 * k);
+        if (r)
+            x = (x << r) | (buff[8] >> (8 - r));
+    }
+    return x;
 }
 
 static int
@@ -550,6 +661,7 @@ set_item(bitarrayobject *self, idx_t i, PyObject *v)
     vi = PyObject_IsTrue(v);
     if (vi < 0)
         return -1;
+    MARK_DIRTY_BITS(self, i, i + 1);
     setbit(self, i, vi);
     return 0;
 }
@@ -736,22 +848,29 @@ extend_dispatch(bitarrayobject *self, PyObject *obj)
 static PyObject *
 unpack(bitarrayobject *self, char zero, char one, const char *fmt)
 {
+    const char *buf = self->ob_item;
     PyObject *result;
-    Py_ssize_t i;
+    Py_ssize_t i, nbits;
     char *str;
+    double t0;
 
     if (self->nbits > PY_SSIZE_T_MAX) {
         PyErr_SetString(PyExc_OverflowError, "bitarray too large to unpack");
         return NULL;
     }
 
-    str = (char *) PyMem_Malloc((size_t) self->nbits);
+    nbits = (Py_ssize_t) self->nbits;
+    str = (char *) PyMem_Malloc((size_t) nbits);
     if (str == NULL) {
         PyErr_NoMemory();
         return NULL;
     }
-    for (i = 0; i < self->nbits; i++)
-        str[i] = GETBIT(self, i) ? one : zero;
+    t0 = STATS_BEGIN(ST_unpack);
+    ENDIAN_SPECIALIZE(E, self->endian,
+        for (i = 0; i < nbits; i++)
+            str[i] = GETBIT_E(buf, E, i) ? one : zero;
+    )
+    STATS_END(ST_unpack, t0, Py_SIZE(self));
 
     result = Py_BuildValue(fmt, str, (Py_ssize_t) self->nbits);
     PyMem_Free((void *) str);
@@ -801,19 +920,6 @@ IntBool_AsInt(PyObject *v)
     return (int) x;
 }
 
-/* Normalize index (which may be negative), such that 0 <= i <= n */
-static void
-normalize_index(idx_t n, idx_t *i)
-{
-    if (*i < 0) {
-        *i += n;
-        if (*i < 0)
-            *i = 0;
-    }
-    if (*i > n)
-        *i = n;
-}
-
 /* Extract a slice index from a PyInt or PyLong or an object with the
    nb_index slot defined, and store in *i.
    However, this function returns -1 on error and 0 on success.
@@ -824,6 +930,7 @@ static int
 getIndex(PyObject *v, idx_t *i)
 {
     idx_t x;
+    int overflow = 0;
 
 #ifndef IS_PY3K
     if (PyInt_Check(v)) {
@@ -832,18 +939,27 @@ getIndex(PyObject *v, idx_t *i)
     else
 #endif
     if (PyLong_Check(v)) {
-        x = PyLong_AsLongLong(v);
+        x = PyLong_AsLongLongAndOverflow(v, &overflow);
     }
     else if (PyIndex_Check(v)) {
-        x = PyNumber_AsSsize_t(v, NULL);
-        if (x == -1 && PyErr_Occurred())
+        /* not PyNumber_AsSsize_t(), as Py_ssize_t may be too small */
+        PyObject *n;
+
+        if ((n = PyNumber_Index(v)) == NULL)
             return -1;
+        x = PyLong_AsLongLongAndOverflow(n, &overflow);
+        Py_DECREF(n);
     }
     else {
         PyErr_SetString(PyExc_TypeError, "slice indices must be integers or "
                                          "None or have an __index__ method");
         return -1;
     }
+    if (x == -1 && PyErr_Occurred())
+        return -1;
+    /* like _PyEval_SliceIndex(), clip integers which are too large */
+    if (overflow)
+        x = overflow > 0 ? PY_LLONG_MAX : -PY_LLONG_MAX;
     *i = x;
     return 0;
 }
@@ -1056,15 +1172,17 @@ The value may be a boolean (or integer between 0 and 1), or a bitarray.");
 
 
 static PyObject *
-bitarray_search(bitarrayobject *self, PyObject *args)
+bitarray_search(bitarrayobject *self, PyObject *args, PyObject *kwds)
 {
+    static char *kwlist[] = {"", "", "mask", NULL};
     PyObject *list = NULL;   /* list of matching positions to be returned */
-    PyObject *x, *item = NULL;
+    PyObject *x, *item = NULL, *maskobj = NULL;
     Py_ssize_t limit = -1;
-    bitarrayobject *xa;
+    bitarrayobject *xa, *mask;
     idx_t p;
 
-    if (!PyArg_ParseTuple(args, "O|n:_search", &x, &limit))
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|nO:search", kwlist,
+                                     &x, &limit, &maskobj))
         return NULL;
 
     if (!bitarray_Check(x)) {
@@ -1076,6 +1194,8 @@ bitarray_search(bitarrayobject *self, PyObject *args)
         PyErr_SetString(PyExc_ValueError, "can't search for empty bitarray");
         return NULL;
     }
+    if (search_mask_arg(xa, maskobj, &mask) < 0)
+        return NULL;
     list = PyList_New(0);
     if (list == NULL)
         return NULL;
@@ -1084,7 +1204,7 @@ bitarray_search(bitarrayobject *self, PyObject *args)
 
     p = 0;
     while (1) {
-        p = search(self, xa, p);
+        p = mask ? search_masked(self, xa, mask, p) : search(self, xa, p);
         if (p < 0)
             break;
         item = PyLong_FromLongLong(p);
@@ -1102,11 +1222,103 @@ bitarray_search(bitarrayobject *self, PyObject *args)
 }
 
 PyDoc_STRVAR(search_doc,
-"search(bitarray, limit=<none>, /) -> list\n\
+"search(bitarray, limit=<none>, /, mask=None) -> list\n\
 \n\
 Searches for the given bitarray in self, and return the list of start\n\
 positions.\n\
 The optional argument limits the number of search results to the integer\n\
+specified.  By default, all search results are returned.\n\
+When the bitarray `mask` (of the same length as the searched bitarray) is\n\
+given, only the bits where `mask` is 1 are compared, i.e. bits where\n\
+`mask` is 0 are \"don't care\" bits.");
+
+
+static PyObject *
+bitarray_search_approx(bitarrayobject *self, PyObject *args)
+{
+    PyObject *list, *x, *item;
+    Py_ssize_t limit = -1, nblocks, b;
+    bitarrayobject *xa;
+    word_t *pw = NULL, last_mask;
+    idx_t max_errors, p, m;
+    int dist;
+
+    if (!PyArg_ParseTuple(args, "OL|n:search_approx",
+                          &x, &max_errors, &limit))
+        return NULL;
+
+    if (!bitarray_Check(x)) {
+        PyErr_SetString(PyExc_TypeError, "bitarray expected for search");
+        return NULL;
+    }
+    xa = (bitarrayobject *) x;
+    if (xa->nbits == 0) {
+        PyErr_SetString(PyExc_ValueError, "can't search for empty bitarray");
+        return NULL;
+    }
+    if (max_errors < 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "non-negative max_errors expected");
+        return NULL;
+    }
+    list = PyList_New(0);
+    if (list == NULL)
+        return NULL;
+    m = xa->nbits;
+    if (m > self->nbits || limit == 0)
+        return list;
+
+    if ((pw = pattern_words(xa, self->endian)) == NULL)
+        goto error;
+
+    /* the pattern is compared in blocks of 64 bits, each against the
+       window of 64 bits of self at the same offset (read in place), and
+       the distance is the sum of the number of 1 bits in the XOR of each
+       pair - the bits of the last block beyond the pattern are masked */
+    nblocks = (Py_ssize_t) WORDS(m);
+    last_mask = ~((word_t) 0);
+    if (m % WBITS)
+        last_mask = self->endian == ENDIAN_LITTLE ?
+            last_mask >> (WBITS - m % WBITS) :
+            last_mask << (WBITS - m % WBITS);
+    for (p = 0; p <= self->nbits - m; p++) {
+        dist = 0;
+        for (b = 0; b < nblocks && dist <= max_errors; b++) {
+            word_t d = window(self, p + WBITS * (idx_t) b) ^ pw[b];
+
+            if (b == nblocks - 1)
+                d &= last_mask;
+            dist += popcount64(d);
+        }
+        if (dist > max_errors)
+            continue;
+
+        item = Py_BuildValue("Li", p, dist);
+        if (item == NULL || PyList_Append(list, item) < 0) {
+            Py_XDECREF(item);
+            goto error;
+        }
+        Py_DECREF(item);
+        if (limit > 0 && PyList_Size(list) >= limit)
+            break;
+    }
+    PyMem_Free((void *) pw);
+    return list;
+
+ error:
+    if (pw)
+        PyMem_Free((void *) pw);
+    Py_DECREF(list);
+    return NULL;
+}
+
+PyDoc_STRVAR(search_approx_doc,
+"search_approx(bitarray, max_errors, limit=<none>, /) -> list\n\
+\n\
+Searches for the given bitarray in self, allowing up to `max_errors`\n\
+mismatching bits (Hamming distance), and return the list of tuples\n\
+`(position, distance)` of all matches.\n\
+The optional argument limits the number of search results to the integer\n\
 specified.  By default, all search results are returned.");
 
 
@@ -1226,6 +1438,7 @@ static PyObject *
 bitarray_reverse(bitarrayobject *self)
 {
     const idx_t m = self->nbits - 1;   /* index of max item of self */
+    char *buf = self->ob_item;
     PyObject *t;       /* temp bitarray to store lower half of self */
     idx_t i;
 
@@ -1239,14 +1452,17 @@ bitarray_reverse(bitarrayobject *self)
 #define tt  ((bitarrayobject *) t)
     /* copy lower half of array into temporary array */
     memcpy(tt->ob_item, self->ob_item, (size_t) Py_SIZE(tt));
+    MARK_DIRTY(self, 0, Py_SIZE(self));
 
-    /* reverse upper half onto the lower half. */
-    for (i = 0; i < tt->nbits; i++)
-        setbit(self, i, GETBIT(self, m - i));
+    ENDIAN_SPECIALIZE(E, self->endian,
+        /* reverse upper half onto the lower half. */
+        for (i = 0; i < tt->nbits; i++)
+            setbit_e(buf, E, i, GETBIT_E(buf, E, m - i));
 
-    /* reverse the stored away lower half onto the upper half of self. */
-    for (i = 0; i < tt->nbits; i++)
-        setbit(self, m - i, GETBIT(tt, i));
+        /* reverse the stored away lower half onto the upper half of self. */
+        for (i = 0; i < tt->nbits; i++)
+            setbit_e(buf, E, m - i, GETBIT_E(tt->ob_item, E, i));
+    )
 #undef tt
     Py_DECREF(t);
     Py_RETURN_NONE;
@@ -1292,27 +1508,12 @@ i.e. convert each 1-bit into a 0-bit and vice versa.");
 static PyObject *
 bitarray_bytereverse(bitarrayobject *self)
 {
-    static char trans[256];
-    static int setup = 0;
     Py_ssize_t i;
 
-    if (!setup) {
-        /* setup translation table, which maps each byte to it's reversed:
-           trans = {0, 128, 64, 192, 32, 160, ..., 255} */
-        int j, k;
-
-        for (k = 0; k < 256; k++) {
-            trans[k] = 0x00;
-            for (j = 0; j < 8; j++)
-                if (1 << (7 - j) & k)
-                    trans[k] |= 1 << j;
-        }
-        setup = 1;
-    }
-
     setunused(self);
+    MARK_DIRTY(self, 0, Py_SIZE(self));
     for (i = 0; i < Py_SIZE(self); i++)
-        self->ob_item[i] = trans[(unsigned char) self->ob_item[i]];
+        self->ob_item[i] = reverse_trans[(unsigned char) self->ob_item[i]];
 
     Py_RETURN_NONE;
 }
@@ -1334,6 +1535,7 @@ bitarray_setall(bitarrayobject *self, PyObject *v)
     if (vi < 0)
         return NULL;
 
+    MARK_DIRTY(self, 0, Py_SIZE(self));
     memset(self->ob_item, vi ? 0xff : 0x00, (size_t) Py_SIZE(self));
     Py_RETURN_NONE;
 }
@@ -1381,14 +1583,20 @@ bitarray_tolist(bitarrayobject *self)
     PyObject *list;
     idx_t i;
 
+    if (self->nbits > PY_SSIZE_T_MAX) {
+        PyErr_SetString(PyExc_OverflowError, "bitarray too large for list");
+        return NULL;
+    }
     list = PyList_New((Py_ssize_t) self->nbits);
     if (list == NULL)
         return NULL;
 
     for (i = 0; i < self->nbits; i++) {
         if (PyList_SetItem(list, (Py_ssize_t) i,
-                           PyBool_FromLong(GETBIT(self, i))) < 0)
+                           PyBool_FromLong(GETBIT(self, i))) < 0) {
+            Py_DECREF(list);
             return NULL;
+        }
     }
     return list;
 }
@@ -1402,19 +1610,17 @@ memory (depending on the machine architecture) than the bitarray object,\n\
 which may cause a memory error if the bitarray is very large.");
 
 
-static PyObject *
-bitarray_frombytes(bitarrayobject *self, PyObject *bytes)
+/* extend self with the raw bytes of the bytes object */
+static int
+extend_bytes(bitarrayobject *self, PyObject *bytes)
 {
     Py_ssize_t nbytes;
     idx_t t, p;
 
-    if (!PyBytes_Check(bytes)) {
-        PyErr_SetString(PyExc_TypeError, "bytes expected");
-        return NULL;
-    }
+    assert(PyBytes_Check(bytes));
     nbytes = PyBytes_GET_SIZE(bytes);
     if (nbytes == 0)
-        Py_RETURN_NONE;
+        return 0;
 
     /* Before we extend the raw bytes with the new data, we need to store
        the current size and pad the last byte, as our bitarray size might
@@ -1427,12 +1633,28 @@ bitarray_frombytes(bitarrayobject *self, PyObject *bytes)
     assert(self->nbits % 8 == 0);
 
     if (resize(self, self->nbits + BITS(nbytes)) < 0)
-        return NULL;
+        return -1;
 
     memcpy(self->ob_item + (Py_SIZE(self) - nbytes),
            PyBytes_AsString(bytes), (size_t) nbytes);
 
-    if (delete_n(self, t, p) < 0)
+    return delete_n(self, t, p);
+}
+
+static PyObject *
+bitarray_frombytes(bitarrayobject *self, PyObject *bytes)
+{
+    double t0;
+    int res;
+
+    if (!PyBytes_Check(bytes)) {
+        PyErr_SetString(PyExc_TypeError, "bytes expected");
+        return NULL;
+    }
+    t0 = STATS_BEGIN(ST_frombytes);
+    res = extend_bytes(self, bytes);
+    STATS_END(ST_frombytes, t0, PyBytes_GET_SIZE(bytes));
+    if (res < 0)
         return NULL;
     Py_RETURN_NONE;
 }
@@ -1447,8 +1669,13 @@ bits to the bitarray.");
 static PyObject *
 bitarray_tobytes(bitarrayobject *self)
 {
+    PyObject *res;
+    double t0 = STATS_BEGIN(ST_tobytes);
+
     setunused(self);
-    return PyBytes_FromStringAndSize(self->ob_item, Py_SIZE(self));
+    res = PyBytes_FromStringAndSize(self->ob_item, Py_SIZE(self));
+    STATS_END(ST_tobytes, t0, Py_SIZE(self));
+    return res;
 }
 
 PyDoc_STRVAR(tobytes_doc,
@@ -1462,9 +1689,10 @@ bits (1..7) are considered to be 0.");
 static PyObject *
 bitarray_fromfile(bitarrayobject *self, PyObject *args)
 {
-    PyObject *bytes, *f, *res;
+    PyObject *bytes, *f, *ret = NULL;
     Py_ssize_t nblock, nread = 0, nbytes = -1;
-    int not_enough_bytes;
+    int not_enough_bytes, res;
+    double t0;
 
     if (!PyArg_ParseTuple(args, "O|n:fromfile", &f, &nbytes))
         return NULL;
@@ -1472,34 +1700,39 @@ bitarray_fromfile(bitarrayobject *self, PyObject *args)
     if (nbytes < 0)  /* read till EOF */
         nbytes = PY_SSIZE_T_MAX;
 
+    t0 = STATS_BEGIN(ST_fromfile);
+
     while (nread < nbytes) {
         nblock = Py_MIN(nbytes - nread, BLOCKSIZE);
         bytes = PyObject_CallMethod(f, "read", "n", nblock);
         if (bytes == NULL)
-            return NULL;
+            goto done;
         if (!PyBytes_Check(bytes)) {
             Py_DECREF(bytes);
             PyErr_SetString(PyExc_TypeError, "read() didn't return bytes");
-            return NULL;
+            goto done;
         }
         not_enough_bytes = (PyBytes_GET_SIZE(bytes) < nblock);
         nread += PyBytes_GET_SIZE(bytes);
         assert(nread >= 0 && nread <= nbytes);
 
-        res = bitarray_frombytes(self, bytes);
+        res = extend_bytes(self, bytes);
         Py_DECREF(bytes);
-        if (res == NULL)
-            return NULL;
-        Py_DECREF(res);  /* drop frombytes result */
+        if (res < 0)
+            goto done;
 
         if (not_enough_bytes) {
             if (nbytes == PY_SSIZE_T_MAX)  /* read till EOF */
                 break;
             PyErr_SetString(PyExc_EOFError, "not enough bytes to read");
-            return NULL;
+            goto done;
         }
     }
-    Py_RETURN_NONE;
+    Py_INCREF(Py_None);
+    ret = Py_None;
+ done:
+    STATS_END(ST_fromfile, t0, nread);
+    return ret;
 }
 
 PyDoc_STRVAR(fromfile_doc,
@@ -1517,6 +1750,7 @@ bitarray_tofile(bitarrayobject *self, PyObject *f)
     Py_ssize_t size, nbytes = Py_SIZE(self);
     Py_ssize_t offset;
     PyObject *res;
+    double t0 = STATS_BEGIN(ST_tofile);
 
     setunused(self);
     for (offset = 0; offset < nbytes; offset += BLOCKSIZE) {
@@ -1527,9 +1761,12 @@ bitarray_tofile(bitarrayobject *self, PyObject *f)
                                   PY_MAJOR_VERSION == 2 ? "s#" : "y#",
                                   self->ob_item + offset, size);
         if (res == NULL)
-            return NULL;
+            break;
         Py_DECREF(res);  /* drop write result */
     }
+    STATS_END(ST_tofile, t0, Py_MIN(offset, nbytes));
+    if (offset < nbytes)  /* write failed */
+        return NULL;
     Py_RETURN_NONE;
 }
 
@@ -1541,6 +1778,150 @@ When the length of the bitarray is not a multiple of 8,\n\
 the remaining bits (1..7) are set to 0.");
 
 
+static PyObject *
+bitarray_track_dirty(bitarrayobject *self, PyObject *args)
+{
+    int flag = 1;
+
+    if (!PyArg_ParseTuple(args, "|i:track_dirty", &flag))
+        return NULL;
+
+    if (flag && self->dirty == NULL) {
+        if (dirty_reserve(self, Py_SIZE(self) + 1) < 0)
+            return NULL;
+        self->clean_size = Py_SIZE(self);
+    }
+    if (!flag && self->dirty) {
+        PyMem_Free((void *) self->dirty);
+        self->dirty = NULL;
+        self->dirty_alloc = 0;
+    }
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(track_dirty_doc,
+"track_dirty(flag=True, /)\n\
+\n\
+Turn dirty block tracking on (or off).  While on, all operations which\n\
+modify the buffer of the bitarray mark the modified blocks (of 4096\n\
+bytes) as dirty, such that `tofile_incremental()` only needs to write\n\
+those.  Turning tracking on starts out with all blocks clean.  Note that\n\
+releasing an exported buffer (e.g. a memoryview) marks all blocks dirty,\n\
+as writes through the buffer cannot be tracked.  Turning tracking off\n\
+(the default) removes all tracking overhead.");
+
+
+static int
+dirty_check(bitarrayobject *self)
+{
+    if (self->dirty == NULL) {
+        PyErr_SetString(PyExc_ValueError,
+                        "dirty block tracking is off, see track_dirty()");
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject *
+bitarray_dirty_blocks(bitarrayobject *self)
+{
+    PyObject *list, *item;
+    Py_ssize_t nblocks = DIRTY_BLOCKS(Py_SIZE(self)), i;
+
+    if (dirty_check(self) < 0)
+        return NULL;
+    if ((list = PyList_New(0)) == NULL)
+        return NULL;
+    for (i = 0; i < nblocks; i++) {
+        if (!DIRTY_GET(self, i))
+            continue;
+        item = PyLong_FromSsize_t(i);
+        if (item == NULL || PyList_Append(list, item) < 0) {
+            Py_XDECREF(item);
+            Py_DECREF(list);
+            return NULL;
+        }
+        Py_DECREF(item);
+    }
+    return list;
+}
+
+PyDoc_STRVAR(dirty_blocks_doc,
+"dirty_blocks() -> list\n\
+\n\
+Return the sorted list of indices of dirty blocks, i.e. blocks (of 4096\n\
+bytes of the buffer) modified since dirty block tracking was turned on\n\
+or last cleared.  Block i covers the bytes starting at offset `4096 * i`.");
+
+
+static PyObject *
+bitarray_clear_dirty(bitarrayobject *self)
+{
+    if (dirty_check(self) < 0)
+        return NULL;
+    memset(self->dirty, 0x00, (size_t) self->dirty_alloc);
+    self->clean_size = Py_SIZE(self);
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(clear_dirty_doc,
+"clear_dirty()\n\
+\n\
+Mark all blocks clean.");
+
+
+static PyObject *
+bitarray_tofile_incremental(bitarrayobject *self, PyObject *f)
+{
+    Py_ssize_t nbytes = Py_SIZE(self), nblocks = DIRTY_BLOCKS(nbytes);
+    Py_ssize_t offset, stop, i, j;
+    PyObject *res;
+
+    if (dirty_check(self) < 0)
+        return NULL;
+    setunused(self);
+    for (i = 0; i < nblocks; i = j + 1) {
+        if (!DIRTY_GET(self, i)) {
+            j = i;
+            continue;
+        }
+        /* write the run of dirty blocks i to j (excluding) at once */
+        for (j = i + 1; j < nblocks && DIRTY_GET(self, j); j++) ;
+        res = PyObject_CallMethod(f, "seek", "n", i * DIRTY_BLOCK);
+        if (res == NULL)
+            return NULL;
+        Py_DECREF(res);
+
+        stop = Py_MIN(j * DIRTY_BLOCK, nbytes);
+        for (offset = i * DIRTY_BLOCK; offset < stop; offset += BLOCKSIZE) {
+            res = PyObject_CallMethod(f, "write",
+                                      PY_MAJOR_VERSION == 2 ? "s#" : "y#",
+                                      self->ob_item + offset,
+                                      Py_MIN(stop - offset, BLOCKSIZE));
+            if (res == NULL)
+                return NULL;
+            Py_DECREF(res);
+        }
+    }
+    if (nbytes < self->clean_size) {
+        res = PyObject_CallMethod(f, "truncate", "n", nbytes);
+        if (res == NULL)
+            return NULL;
+        Py_DECREF(res);
+    }
+    return bitarray_clear_dirty(self);
+}
+
+PyDoc_STRVAR(tofile_incremental_doc,
+"tofile_incremental(f, /)\n\
+\n\
+Update the file object f, which has to contain the byte representation\n\
+of the bitarray as of when dirty block tracking was turned on or last\n\
+cleared (e.g. written by `tofile()`), by writing only the dirty blocks\n\
+at their offsets (using `f.seek()`).  When the bitarray has shrunk, the\n\
+file is truncated.  Afterwards, all blocks are marked clean.");
+
+
 static PyObject *
 bitarray_to01(bitarrayobject *self)
 {
@@ -1578,7 +1959,9 @@ static PyObject *
 bitarray_pack(bitarrayobject *self, PyObject *bytes)
 {
     Py_ssize_t nbytes, i;
-    char *data;
+    char *data, *buf;
+    idx_t offset;
+    double t0;
 
     if (!PyBytes_Check(bytes)) {
         PyErr_SetString(PyExc_TypeError, "bytes expected");
@@ -1592,8 +1975,14 @@ bitarray_pack(bitarrayobject *self, PyObject *bytes)
         return NULL;
 
     data = PyBytes_AsString(bytes);
-    for (i = 0; i < nbytes; i++)
-        setbit(self, self->nbits - nbytes + i, data[i] ? 1 : 0);
+    buf = self->ob_item;
+    offset = self->nbits - nbytes;
+    t0 = STATS_BEGIN(ST_pack);
+    ENDIAN_SPECIALIZE(E, self->endian,
+        for (i = 0; i < nbytes; i++)
+            setbit_e(buf, E, offset + i, data[i] ? 1 : 0);
+    )
+    STATS_END(ST_pack, t0, nbytes / 8);
 
     Py_RETURN_NONE;
 }
@@ -1620,12 +2009,14 @@ bitarray_repr(bitarrayobject *self)
     if (self->nbits == 0)
         return Py_BuildValue("s", "bitarray()");
 
-    strsize = self->nbits + 12;  /* 12 is the length of "bitarray('')" */
-    if (strsize > PY_SSIZE_T_MAX) {
+    /* 12 is the length of "bitarray('')" -- check before computing
+       strsize, which would overflow on 32bit systems */
+    if (self->nbits > PY_SSIZE_T_MAX - 12) {
         PyErr_SetString(PyExc_OverflowError,
                         "bitarray too large to represent");
         return NULL;
     }
+    strsize = (size_t) self->nbits + 12;
 
     str = (char *) PyMem_Malloc(strsize);
     if (str == NULL) {
@@ -1751,7 +2142,9 @@ Remove all items from the bitarray.");
 static PyObject *
 bitarray_getitem(bitarrayobject *self, PyObject *a)
 {
+    const char *src = self->ob_item;
     PyObject *res;
+    char *dst;
     idx_t start, stop, step, slicelength, j, i = 0;
 
     if (IS_INDEX(a)) {
@@ -1774,8 +2167,11 @@ bitarray_getitem(bitarrayobject *self, PyObject *a)
         if (res == NULL)
             return NULL;
 
-        for (i = 0, j = start; i < slicelength; i++, j += step)
-            setbit((bitarrayobject *) res, i, GETBIT(self, j));
+        dst = ((bitarrayobject *) res)->ob_item;
+        ENDIAN_SPECIALIZE(E, self->endian,
+            for (i = 0, j = start; i < slicelength; i++, j += step)
+                setbit_e(dst, E, i, GETBIT_E(src, E, j));
+        )
 
         return res;
     }
@@ -1785,20 +2181,43 @@ bitarray_getitem(bitarrayobject *self, PyObject *a)
 
 /* Sets the elements, specified by slice, in self to the value(s) given by v
    which is either a bitarray or a boolean. */
+/* mark the bytes covering the slice (given by start, step and
+   slicelength) of self dirty, i.e. the range from its lowest to its
+   highest index */
+static void
+mark_dirty_slice(bitarrayobject *self, idx_t start, idx_t step,
+                 idx_t slicelength)
+{
+    idx_t last;
+
+    if (self->dirty == NULL || slicelength == 0)
+        return;
+    last = start + (slicelength - 1) * step;
+    if (last < start)
+        MARK_DIRTY_BITS(self, last, start + 1);
+    else
+        MARK_DIRTY_BITS(self, start, last + 1);
+}
+
 static int
 setslice(bitarrayobject *self, PySliceObject *slice, PyObject *v)
 {
+    char *dst = self->ob_item;
     idx_t start, stop, step, slicelength, j, i = 0;
 
     if (slice_GetIndicesEx(slice, self->nbits,
                            &start, &stop, &step, &slicelength) < 0)
         return -1;
-
     if (bitarray_Check(v)) {
 #define vv  ((bitarrayobject *) v)
         if (vv->nbits == slicelength) {
-            for (i = 0, j = start; i < slicelength; i++, j += step)
-                setbit(self, j, GETBIT(vv, i));
+            const char *src = vv->ob_item;
+
+            mark_dirty_slice(self, start, step, slicelength);
+            ENDIAN_SPECIALIZE2(Es, self->endian, Ev, vv->endian,
+                for (i = 0, j = start; i < slicelength; i++, j += step)
+                    setbit_e(dst, Es, j, GETBIT_E(src, Ev, i));
+            )
             return 0;
         }
         if (step != 1) {
@@ -1828,8 +2247,11 @@ setslice(bitarrayobject *self, PySliceObject *slice, PyObject *v)
         vi = IntBool_AsInt(v);
         if (vi < 0)
             return -1;
-        for (i = 0, j = start; i < slicelength; i++, j += step)
-            setbit(self, j, vi);
+        mark_dirty_slice(self, start, step, slicelength);
+        ENDIAN_SPECIALIZE(E, self->endian,
+            for (i = 0, j = start; i < slicelength; i++, j += step)
+                setbit_e(dst, E, j, vi);
+        )
         return 0;
     }
     PyErr_SetString(PyExc_IndexError,
@@ -1871,6 +2293,7 @@ bitarray_setitem(bitarrayobject *self, PyObject *args)
 static PyObject *
 bitarray_delitem(bitarrayobject *self, PyObject *a)
 {
+    char *buf = self->ob_item;
     idx_t start, stop, step, slicelength, j, i = 0;
 
     if (IS_INDEX(a)) {
@@ -1906,11 +2329,14 @@ bitarray_delitem(bitarrayobject *self, PyObject *a)
             Py_RETURN_NONE;
         }
         /* this is the only complicated part when step > 1 */
-        for (i = j = start; i < self->nbits; i++)
-            if ((i - start) % step != 0 || i >= stop) {
-                setbit(self, j, GETBIT(self, i));
-                j++;
-            }
+        MARK_DIRTY_BITS(self, start, self->nbits);
+        ENDIAN_SPECIALIZE(E, self->endian,
+            for (i = j = start; i < self->nbits; i++)
+                if ((i - start) % step != 0 || i >= stop) {
+                    setbit_e(buf, E, j, GETBIT_E(buf, E, i));
+                    j++;
+                }
+        )
         if (resize(self, self->nbits - slicelength) < 0)
             return NULL;
         Py_RETURN_NONE;
@@ -2059,6 +2485,8 @@ static PyObject *
 bitarray_encode(bitarrayobject *self, PyObject *args)
 {
     PyObject *codedict, *iterable, *iter, *symbol, *bits;
+    idx_t nbits = self->nbits;
+    double t0;
 
     if (!PyArg_ParseTuple(args, "OO:encode", &codedict, &iterable))
         return NULL;
@@ -2072,24 +2500,23 @@ bitarray_encode(bitarrayobject *self, PyObject *args)
         return NULL;
     }
     /* extend self with the bitarrays from codedict */
+    t0 = STATS_BEGIN(ST_encode);
     while ((symbol = PyIter_Next(iter)) != NULL) {
         bits = PyDict_GetItem(codedict, symbol);
         Py_DECREF(symbol);
         if (bits == NULL) {
             PyErr_SetString(PyExc_ValueError,
                             "symbol not defined in prefix code");
-            goto error;
+            break;
         }
         if (extend_bitarray(self, (bitarrayobject *) bits) < 0)
-            goto error;
+            break;
     }
+    STATS_END(ST_encode, t0, (self->nbits - nbits) / 8);
     Py_DECREF(iter);
     if (PyErr_Occurred())
         return NULL;
     Py_RETURN_NONE;
-error:
-    Py_DECREF(iter);
-    return NULL;
 }
 
 PyDoc_STRVAR(encode_doc,
@@ -2100,20 +2527,16 @@ iterate over the iterable object with symbols, and extend the bitarray\n\
 with the corresponding bitarray for each symbol.");
 
 
-/* Binary tree definition */
-typedef struct _bin_node
-{
-    struct _bin_node *child[2];
-    PyObject *symbol;
-} binode;
+/* The prefix tree is made of bitnodes (see bitkernels.h), where the
+   symbols of the leaf nodes are PyObjects. */
 
 
-static binode *
-new_binode(void)
+static bitnode *
+new_bitnode(void)
 {
-    binode *nd;
+    bitnode *nd;
 
-    nd = (binode *) PyMem_Malloc(sizeof(binode));
+    nd = (bitnode *) PyMem_Malloc(sizeof(bitnode));
     if (nd == NULL) {
         PyErr_NoMemory();
         return NULL;
@@ -2125,22 +2548,22 @@ new_binode(void)
 }
 
 static void
-delete_binode_tree(binode *tree)
+delete_bitnode_tree(bitnode *tree)
 {
     if (tree == NULL)
         return;
 
-    delete_binode_tree(tree->child[0]);
-    delete_binode_tree(tree->child[1]);
+    delete_bitnode_tree(tree->child[0]);
+    delete_bitnode_tree(tree->child[1]);
     PyMem_Free(tree);
 }
 
 /* insert symbol (mapping to ba) into the tree */
 static int
-insert_symbol(binode *tree, bitarrayobject *ba, PyObject *symbol)
+insert_symbol(bitnode *tree, bitarrayobject *ba, PyObject *symbol)
 {
-    binode *nd = tree, *prev;
-    Py_ssize_t i;
+    bitnode *nd = tree, *prev;
+    idx_t i;
     int k;
 
     for (i = 0; i < ba->nbits; i++) {
@@ -2153,7 +2576,7 @@ insert_symbol(binode *tree, bitarrayobject *ba, PyObject *symbol)
             goto ambiguity;
 
         if (!nd) {
-            nd = new_binode();
+            nd = new_bitnode();
             if (nd == NULL)
                 return -1;
             prev->child[k] = nd;
@@ -2173,20 +2596,20 @@ insert_symbol(binode *tree, bitarrayobject *ba, PyObject *symbol)
 
 /* return a binary tree from a codedict, which is created by inserting
    all symbols mapping to bitarrays */
-static binode *
+static bitnode *
 make_tree(PyObject *codedict)
 {
-    binode *tree;
+    bitnode *tree;
     PyObject *symbol, *array;
     Py_ssize_t pos = 0;
 
-    tree = new_binode();
+    tree = new_bitnode();
     if (tree == NULL)
         return NULL;
 
     while (PyDict_Next(codedict, &pos, &symbol, &array)) {
         if (insert_symbol(tree, (bitarrayobject *) array, symbol) < 0) {
-            delete_binode_tree(tree);
+            delete_bitnode_tree(tree);
             return NULL;
         }
     }
@@ -2199,36 +2622,32 @@ make_tree(PyObject *codedict)
    case the appropriate PyErr_SetString is set.
 */
 static PyObject *
-traverse_tree(binode *tree, bitarrayobject *ba, idx_t *indexp)
+traverse_tree(bitnode *tree, bitarrayobject *ba, idx_t *indexp)
 {
-    binode *nd = tree;
-    int k;
+    bitspan s = bitarray_span(ba);
+    const bitnode *leaf;
 
-    while (*indexp < ba->nbits) {
-        k = GETBIT(ba, *indexp);
-        (*indexp)++;
-        nd = nd->child[k];
-        if (nd == NULL) {
-            PyErr_SetString(PyExc_ValueError,
-                            "prefix code does not match data in bitarray");
-            return NULL;
-        }
-        if (nd->symbol)  /* leaf */
-            return nd->symbol;
-    }
-    if (nd != tree)
+    switch (bk_decode_next(tree, &s, indexp, &leaf)) {
+    case 1:
+        return (PyObject *) leaf->symbol;
+    case -1:
+        PyErr_SetString(PyExc_ValueError,
+                        "prefix code does not match data in bitarray");
+        break;
+    case -2:
         PyErr_SetString(PyExc_ValueError, "decoding not terminated");
-
+        break;
+    }
     return NULL;
 }
 
 static PyObject *
 bitarray_decode(bitarrayobject *self, PyObject *codedict)
 {
-    binode *tree, *nd;
-    PyObject *list = NULL;
-    Py_ssize_t i;
-    int k;
+    bitnode *tree;
+    PyObject *list = NULL, *symbol;
+    idx_t i = 0;
+    double t0;
 
     if (check_codedict(codedict) < 0)
         return NULL;
@@ -2237,35 +2656,24 @@ bitarray_decode(bitarrayobject *self, PyObject *codedict)
     if (tree == NULL || PyErr_Occurred())
         goto error;
 
-    nd = tree;
     list = PyList_New(0);
     if (list == NULL)
         goto error;
 
-    /* traverse tree (just like above) */
-    for (i = 0; i < self->nbits; i++) {
-        k = GETBIT(self, i);
-        nd = nd->child[k];
-        if (nd == NULL) {
-            PyErr_SetString(PyExc_ValueError,
-                            "prefix code does not match data in bitarray");
-            goto error;
-        }
-        if (nd->symbol) {  /* leaf */
-            if (PyList_Append(list, nd->symbol) < 0)
-                goto error;
-            nd = tree;
-        }
+    t0 = STATS_BEGIN(ST_decode);
+    while ((symbol = traverse_tree(tree, self, &i)) != NULL) {
+        if (PyList_Append(list, symbol) < 0)
+            break;
     }
-    if (nd != tree) {
-        PyErr_SetString(PyExc_ValueError, "decoding not terminated");
+    STATS_END(ST_decode, t0, BYTES(i));
+    if (PyErr_Occurred())
         goto error;
-    }
-    delete_binode_tree(tree);
+
+    delete_bitnode_tree(tree);
     return list;
 
 error:
-    delete_binode_tree(tree);
+    delete_bitnode_tree(tree);
     Py_XDECREF(list);
     return NULL;
 }
@@ -2281,7 +2689,7 @@ decode the content of the bitarray and return it as a list of symbols.");
 typedef struct {
     PyObject_HEAD
     bitarrayobject *bao;        /* bitarray we're searching in */
-    binode *tree;               /* prefix tree containing symbols */
+    bitnode *tree;               /* prefix tree containing symbols */
     idx_t index;                /* current index in bitarray */
 } decodeiterobject;
 
@@ -2295,7 +2703,7 @@ static PyObject *
 bitarray_iterdecode(bitarrayobject *self, PyObject *codedict)
 {
     decodeiterobject *it;       /* iterator to be returned */
-    binode *tree;
+    bitnode *tree;
 
     if (check_codedict(codedict) < 0)
         return NULL;
@@ -2340,7 +2748,7 @@ decodeiter_next(decodeiterobject *it)
 static void
 decodeiter_dealloc(decodeiterobject *it)
 {
-    delete_binode_tree(it->tree);
+    delete_bitnode_tree(it->tree);
     PyObject_GC_UnTrack(it);
     Py_XDECREF(it->bao);
     PyObject_GC_Del(it);
@@ -2396,6 +2804,7 @@ typedef struct {
     PyObject_HEAD
     bitarrayobject *bao;        /* bitarray we're searching in */
     bitarrayobject *xa;         /* bitarray being searched for */
+    bitarrayobject *mask;       /* search mask, or NULL */
     idx_t p;                    /* current search position */
 } searchiterobject;
 
@@ -2405,10 +2814,16 @@ static PyTypeObject SearchIter_Type;
 
 /* create a new initialized bitarray search iterator object */
 static PyObject *
-bitarray_itersearch(bitarrayobject *self, PyObject *x)
+bitarray_itersearch(bitarrayobject *self, PyObject *args, PyObject *kwds)
 {
+    static char *kwlist[] = {"", "mask", NULL};
     searchiterobject *it;  /* iterator to be returned */
-    bitarrayobject *xa;
+    PyObject *x, *maskobj = NULL;
+    bitarrayobject *xa, *mask;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O:itersearch", kwlist,
+                                     &x, &maskobj))
+        return NULL;
 
     if (!bitarray_Check(x)) {
         PyErr_SetString(PyExc_TypeError, "bitarray expected for itersearch");
@@ -2419,6 +2834,8 @@ bitarray_itersearch(bitarrayobject *self, PyObject *x)
         PyErr_SetString(PyExc_ValueError, "can't search for empty bitarray");
         return NULL;
     }
+    if (search_mask_arg(xa, maskobj, &mask) < 0)
+        return NULL;
 
     it = PyObject_GC_New(searchiterobject, &SearchIter_Type);
     if (it == NULL)
@@ -2428,16 +2845,19 @@ bitarray_itersearch(bitarrayobject *self, PyObject *x)
     it->bao = self;
     Py_INCREF(xa);
     it->xa = xa;
+    Py_XINCREF(mask);
+    it->mask = mask;
     it->p = 0;  /* start search at position 0 */
     PyObject_GC_Track(it);
     return (PyObject *) it;
 }
 
 PyDoc_STRVAR(itersearch_doc,
-"itersearch(bitarray, /) -> iterator\n\
+"itersearch(bitarray, /, mask=None) -> iterator\n\
 \n\
 Searches for the given a bitarray in self, and return an iterator over\n\
-the start positions where bitarray matches self.");
+the start positions where bitarray matches self.  See `search()` for the\n\
+meaning of `mask`.");
 
 static PyObject *
 searchiter_next(searchiterobject *it)
@@ -2445,7 +2865,18 @@ searchiter_next(searchiterobject *it)
     idx_t p;
 
     assert(SearchIter_Check(it));
-    p = search(it->bao, it->xa, it->p);
+    if (it->mask) {
+        /* the mask or pattern may have been changed in the meantime */
+        if (it->mask->nbits != it->xa->nbits) {
+            PyErr_SetString(PyExc_ValueError,
+                            "mask and pattern must have same length");
+            return NULL;
+        }
+        p = search_masked(it->bao, it->xa, it->mask, it->p);
+    }
+    else {
+        p = search(it->bao, it->xa, it->p);
+    }
     if (p < 0)  /* no more positions -- stop iteration */
         return NULL;
     it->p = p + 1;  /* next search position */
@@ -2458,6 +2889,7 @@ searchiter_dealloc(searchiterobject *it)
     PyObject_GC_UnTrack(it);
     Py_XDECREF(it->bao);
     Py_XDECREF(it->xa);
+    Py_XDECREF(it->mask);
     PyObject_GC_Del(it);
 }
 
@@ -2505,6 +2937,155 @@ static PyTypeObject SearchIter_Type = {
     0,                                        /* tp_methods */
 };
 
+/********************** Arrow C data interface **************************/
+
+/* The structures (see bitarray.h) are defined by the Arrow C data
+   interface, see https://arrow.apache.org/docs/format/CDataInterface.html
+   A boolean Arrow array stores its values as a bitmap with the bits in
+   little-endian order, i.e. exactly like a little-endian bitarray. */
+
+/* private data of an exported array - the release callbacks may be called
+   from any thread, which is why malloc() / free() are used here */
+typedef struct {
+    const void *buffers[2];     /* validity bitmap (NULL) and values */
+    bitarrayobject *obj;        /* exporting bitarray (when not copied) */
+    char *copy;                 /* copy of the values (big-endian) */
+} arrow_private;
+
+static void
+arrow_release_schema(struct ArrowSchema *schema)
+{
+    schema->release = NULL;
+}
+
+static void
+arrow_release_array(struct ArrowArray *array)
+{
+    arrow_private *priv = (arrow_private *) array->private_data;
+
+    if (priv->obj) {
+        PyGILState_STATE state = PyGILState_Ensure();
+
+        priv->obj->ob_exports--;
+        Py_DECREF(priv->obj);
+        PyGILState_Release(state);
+    }
+    free(priv->copy);
+    free(priv);
+    array->release = NULL;
+}
+
+static void
+arrow_schema_capsule_destructor(PyObject *capsule)
+{
+    struct ArrowSchema *schema = (struct ArrowSchema *)
+        PyCapsule_GetPointer(capsule, "arrow_schema");
+
+    if (schema->release)
+        schema->release(schema);
+    free(schema);
+}
+
+static void
+arrow_array_capsule_destructor(PyObject *capsule)
+{
+    struct ArrowArray *array = (struct ArrowArray *)
+        PyCapsule_GetPointer(capsule, "arrow_array");
+
+    if (array->release)
+        array->release(array);
+    free(array);
+}
+
+static PyObject *
+bitarray_arrow_c_array(bitarrayobject *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"requested_schema", NULL};
+    static const char empty[1] = {0};
+    PyObject *requested_schema = Py_None, *schema_capsule, *array_capsule;
+    struct ArrowSchema *schema;
+    struct ArrowArray *array;
+    arrow_private *priv;
+    Py_ssize_t i;
+
+    /* as there is only one representation of a bitarray in Arrow, the
+       requested schema is ignored (which the interface allows) */
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O:__arrow_c_array__",
+                                     kwlist, &requested_schema))
+        return NULL;
+
+    schema = (struct ArrowSchema *) malloc(sizeof(struct ArrowSchema));
+    array = (struct ArrowArray *) malloc(sizeof(struct ArrowArray));
+    priv = (arrow_private *) calloc(1, sizeof(arrow_private));
+    if (schema == NULL || array == NULL || priv == NULL) {
+        free(schema);
+        free(array);
+        free(priv);
+        return PyErr_NoMemory();
+    }
+    memset(schema, 0, sizeof(struct ArrowSchema));
+    schema->format = "b";
+    schema->name = "";
+    schema->flags = ARROW_FLAG_NULLABLE;
+    schema->release = arrow_release_schema;
+
+    memset(array, 0, sizeof(struct ArrowArray));
+    array->length = self->nbits;
+    array->n_buffers = 2;
+    array->buffers = priv->buffers;
+    array->release = arrow_release_array;
+    array->private_data = priv;
+
+    setunused(self);
+    if (self->endian == ENDIAN_LITTLE) {
+        /* zero copy - resizing self is prohibited until the array is
+           released, just like for buffer exports */
+        priv->buffers[1] = self->ob_item ? self->ob_item : empty;
+        self->ob_exports++;
+        Py_INCREF(self);
+        priv->obj = self;
+    }
+    else {
+        priv->copy = (char *) malloc((size_t) Py_SIZE(self) + 1);
+        if (priv->copy == NULL) {
+            free(schema);
+            free(array);
+            free(priv);
+            return PyErr_NoMemory();
+        }
+        for (i = 0; i < Py_SIZE(self); i++)
+            priv->copy[i] = reverse_trans[(unsigned char) self->ob_item[i]];
+        priv->buffers[1] = priv->copy;
+    }
+
+    schema_capsule = PyCapsule_New(schema, "arrow_schema",
+                                   arrow_schema_capsule_destructor);
+    if (schema_capsule == NULL) {
+        free(schema);
+        array->release(array);
+        free(array);
+        return NULL;
+    }
+    array_capsule = PyCapsule_New(array, "arrow_array",
+                                  arrow_array_capsule_destructor);
+    if (array_capsule == NULL) {
+        Py_DECREF(schema_capsule);
+        array->release(array);
+        free(array);
+        return NULL;
+    }
+    return Py_BuildValue("NN", schema_capsule, array_capsule);
+}
+
+PyDoc_STRVAR(arrow_c_array_doc,
+"__arrow_c_array__(requested_schema=None) -> tuple\n\
+\n\
+Export the bitarray as a boolean array through the Arrow C data\n\
+interface, i.e. return a tuple of the PyCapsules `arrow_schema` and\n\
+`arrow_array`.  The values of little-endian bitarrays are exported\n\
+without copying (and the bitarray cannot be resized until the Arrow\n\
+array is released), big-endian bitarrays are copied.");
+
 /*************************** Method definitions *************************/
 
 static PyMethodDef
@@ -2521,10 +3102,14 @@ bitarray_methods[] = {
      bytereverse_doc},
     {"clear",        (PyCFunction) bitarray_clear,       METH_NOARGS,
      clear_doc},
+    {"clear_dirty",  (PyCFunction) bitarray_clear_dirty, METH_NOARGS,
+     clear_dirty_doc},
     {"copy",         (PyCFunction) bitarray_copy,        METH_NOARGS,
      copy_doc},
     {"count",        (PyCFunction) bitarray_count,       METH_VARARGS,
      count_doc},
+    {"dirty_blocks", (PyCFunction) bitarray_dirty_blocks, METH_NOARGS,
+     dirty_blocks_doc},
     {"decode",       (PyCFunction) bitarray_decode,      METH_O,
      decode_doc},
     {"iterdecode",   (PyCFunction) bitarray_iterdecode,  METH_O,
@@ -2559,21 +3144,29 @@ bitarray_methods[] = {
      reverse_doc},
     {"setall",       (PyCFunction) bitarray_setall,      METH_O,
      setall_doc},
-    {"search",       (PyCFunction) bitarray_search,      METH_VARARGS,
+    {"search",       (PyCFunction) bitarray_search,      METH_VARARGS |
+                                                         METH_KEYWORDS,
      search_doc},
-    {"itersearch",   (PyCFunction) bitarray_itersearch,  METH_O,
+    {"search_approx", (PyCFunction) bitarray_search_approx, METH_VARARGS,
+     search_approx_doc},
+    {"itersearch",   (PyCFunction) bitarray_itersearch,  METH_VARARGS |
+                                                         METH_KEYWORDS,
      itersearch_doc},
     {"sort",         (PyCFunction) bitarray_sort,        METH_VARARGS |
                                                          METH_KEYWORDS,
      sort_doc},
     {"tofile",       (PyCFunction) bitarray_tofile,      METH_O,
      tofile_doc},
+    {"tofile_incremental", (PyCFunction) bitarray_tofile_incremental,
+     METH_O, tofile_incremental_doc},
     {"tolist",       (PyCFunction) bitarray_tolist,      METH_NOARGS,
      tolist_doc},
     {"tobytes",      (PyCFunction) bitarray_tobytes,     METH_NOARGS,
      tobytes_doc},
     {"to01",         (PyCFunction) bitarray_to01,        METH_NOARGS,
      to01_doc},
+    {"track_dirty",  (PyCFunction) bitarray_track_dirty, METH_VARARGS,
+     track_dirty_doc},
     {"unpack",       (PyCFunction) bitarray_unpack,      METH_VARARGS |
                                                          METH_KEYWORDS,
      unpack_doc},
@@ -2589,6 +3182,9 @@ bitarray_methods[] = {
      contains_doc},
     {"__reduce__",   (PyCFunction) bitarray_reduce,      METH_NOARGS,
      reduce_doc},
+    {"__arrow_c_array__", (PyCFunction) bitarray_arrow_c_array,
+                                          METH_VARARGS | METH_KEYWORDS,
+     arrow_c_array_doc},
 
     /* slice methods */
     {"__delitem__",  (PyCFunction) bitarray_delitem,     METH_O,       0},
@@ -2917,6 +3513,7 @@ bitarray_buffer_getwritebuf(bitarrayobject *self,
         PyErr_SetString(PyExc_SystemError, "accessing non-existent segment");
         return -1;
     }
+    MARK_DIRTY(self, 0, Py_SIZE(self));
     *ptr = (void *) self->ob_item;
     return Py_SIZE(self);
 }
@@ -2965,6 +3562,8 @@ bitarray_getbuffer(bitarrayobject *self, Py_buffer *view, int flags)
 static void
 bitarray_releasebuffer(bitarrayobject *self, Py_buffer *view)
 {
+    /* the exported buffer may have been written to */
+    MARK_DIRTY(self, 0, Py_SIZE(self));
     self->ob_exports--;
 }
 
@@ -3051,9 +3650,7 @@ static PyObject *
 bitdiff(PyObject *module, PyObject *args)
 {
     PyObject *a, *b;
-    Py_ssize_t i;
-    idx_t res = 0;
-    unsigned char c;
+    idx_t res;
 
     if (!PyArg_ParseTuple(args, "OO:bitdiff", &a, &b))
         return NULL;
@@ -3076,10 +3673,7 @@ bitdiff(PyObject *module, PyObject *args)
     }
     setunused(aa);
     setunused(bb);
-    for (i = 0; i < Py_SIZE(aa); i++) {
-        c = aa->ob_item[i] ^ bb->ob_item[i];
-        res += bitcount_lookup[c];
-    }
+    res = count_op(&kernels, aa->ob_item, bb->ob_item, Py_SIZE(aa), OP_xor);
 #undef aa
 #undef bb
     return PyLong_FromLongLong(res);
@@ -3156,15 +3750,47 @@ PyDoc_STRVAR(set_default_endian_doc,
 Set the default bit endianness for new bitarray objects being created.");
 
 
+/* return dict describing the CPU features and selected kernels */
+static PyObject *
+isa_info(void)
+{
+    PyObject *features, *item;
+    int k;
+
+    if ((features = PyList_New(0)) == NULL)
+        return NULL;
+    for (k = 0; bk_cpu_feature_names[k]; k++) {
+        if (!(cpu_features & (1 << k)))
+            continue;
+        item = Py_BuildValue("s", bk_cpu_feature_names[k]);
+        if (item == NULL || PyList_Append(features, item) < 0) {
+            Py_XDECREF(item);
+            Py_DECREF(features);
+            return NULL;
+        }
+        Py_DECREF(item);
+    }
+    return Py_BuildValue("{sNsss{ssssssssss}}",
+                         "features", features,
+                         "isa", bk_isa_levels[isa_level].name,
+                         "kernels",
+                         "count", kernel_names[0],
+                         "bitwise", kernel_names[1],
+                         "invert", kernel_names[2],
+                         "skip", kernel_names[3],
+                         "shift", kernel_names[4]);
+}
+
 static PyObject *
 sysinfo(void)
 {
-    return Py_BuildValue("iiiiL",
+    return Py_BuildValue("iiiiLN",
                          (int) sizeof(void *),
                          (int) sizeof(size_t),
                          (int) sizeof(Py_ssize_t),
                          (int) sizeof(idx_t),
-                         (idx_t) PY_SSIZE_T_MAX);
+                         (idx_t) PY_SSIZE_T_MAX,
+                         isa_info());
 }
 
 PyDoc_STRVAR(sysinfo_doc,
@@ -3174,7 +3800,103 @@ tuple(sizeof(void *),\n\
       sizeof(size_t),\n\
       sizeof(Py_ssize_t),\n\
       sizeof(idx_t),\n\
-      PY_SSIZE_T_MAX)");
+      PY_SSIZE_T_MAX,\n\
+      dict(features=list of detected CPU features,\n\
+           isa=name of selected ISA level,\n\
+           kernels=dict mapping kernels to the ISA level used))");
+
+
+static PyObject *
+set_isa(PyObject *module, PyObject *args)
+{
+    char *name;
+
+    if (!PyArg_ParseTuple(args, "s:_set_isa", &name))
+        return NULL;
+    if (set_isa_level(name) < 0) {
+        PyErr_Format(PyExc_ValueError, "unknown ISA level: '%s'", name);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(set_isa_doc,
+"_set_isa(level, /)\n\
+\n\
+Select the kernels of the ISA level `generic`, `popcnt`, `avx2` or\n\
+`avx512` (the default), using only features detected on the CPU.\n\
+Like the environment variable `BITARRAY_ISA`, this is meant for testing.");
+
+
+static PyObject *
+enable_stats(PyObject *module, PyObject *args)
+{
+    int flag = 1;
+
+    if (!PyArg_ParseTuple(args, "|i:enable_stats", &flag))
+        return NULL;
+    stats_enabled = flag;
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(enable_stats_doc,
+"enable_stats(flag=True, /)\n\
+\n\
+Turn collecting runtime statistics (see `stats()`) on or off.  Collecting\n\
+statistics is off by default, unless the environment variable\n\
+`BITARRAY_STATS` is set (to a value other than `0`) on import.");
+
+
+static PyObject *
+get_stats(PyObject *module, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"reset", NULL};
+    PyObject *result, *ops, *op;
+    int reset = 0, i;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|i:stats", kwlist,
+                                     &reset))
+        return NULL;
+
+    if ((ops = PyDict_New()) == NULL)
+        return NULL;
+    for (i = 0; i < ST_NUM; i++) {
+        op = Py_BuildValue("{sLsLsd}",
+                           "calls", stats.calls[i],
+                           "bytes", stats.bytes[i],
+                           "time", stats.time[i]);
+        if (op == NULL || PyDict_SetItemString(ops, stats_names[i], op) < 0)
+        {
+            Py_XDECREF(op);
+            Py_DECREF(ops);
+            return NULL;
+        }
+        Py_DECREF(op);
+    }
+    result = Py_BuildValue("{sOsLsLsLsLsN}",
+                           "enabled", stats_enabled ? Py_True : Py_False,
+                           "resize", stats.resize,
+                           "realloc", stats.realloc,
+                           "realloc_bytes", stats.realloc_bytes,
+                           "export_refused", stats.export_refused,
+                           "ops", ops);
+    if (reset)
+        memset(&stats, 0, sizeof(stats));
+    return result;
+}
+
+PyDoc_STRVAR(stats_doc,
+"stats(reset=False) -> dict\n\
+\n\
+Return the runtime statistics collected while `enable_stats()` is on.\n\
+The dict contains the number of calls to the internal resize function,\n\
+of reallocations (and the bytes requested by them), of resizes refused\n\
+as the bitarray is exporting buffers, as well as (under the key `ops`)\n\
+for each instrumented operation a dict with the number of calls, bytes\n\
+processed and time (in seconds) spent.  Copying bits is counted\n\
+separately for the fast path (`copy_fast`, whole bytes with equal bit\n\
+endianness) and the bit by bit path (`copy_slow`).\n\
+When `reset` is true, all counters are set to zero after being returned.");
 
 
 static PyMethodDef module_functions[] = {
@@ -3185,6 +3907,11 @@ static PyMethodDef module_functions[] = {
     {"_set_default_endian", (PyCFunction) set_default_endian, METH_VARARGS,
                                                    set_default_endian_doc},
     {"_sysinfo",   (PyCFunction) sysinfo,    METH_NOARGS,  sysinfo_doc   },
+    {"_set_isa",   (PyCFunction) set_isa,    METH_VARARGS, set_isa_doc   },
+    {"enable_stats", (PyCFunction) enable_stats, METH_VARARGS,
+                                                   enable_stats_doc},
+    {"stats",      (PyCFunction) get_stats,  METH_VARARGS | METH_KEYWORDS,
+                                                   stats_doc},
     {NULL,         NULL}  /* sentinel */
 };
 
@@ -3196,6 +3923,25 @@ static PyModuleDef moduledef = {
 };
 #endif
 
+/******************************* C API **********************************/
+
+/* exported through the capsule bitarray._bitarray._C_API, see bitarray.h */
+static bitarray_capi capi = {
+    BITARRAY_CAPI_VERSION,
+    &Bitarraytype,
+    newbitarrayobject,
+    resize,
+    copy_n,
+    delete_n,
+    insert_n,
+    setrange,
+    invert,
+    count,
+    findfirst,
+    search,
+    &kernels,
+};
+
 PyMODINIT_FUNC
 #ifdef IS_PY3K
 PyInit__bitarray(void)
@@ -3204,11 +3950,26 @@ init_bitarray(void)
 #endif
 {
     PyObject *m;
+    const char *env;
 
     Py_TYPE(&Bitarraytype) = &PyType_Type;
     Py_TYPE(&SearchIter_Type) = &PyType_Type;
     Py_TYPE(&DecodeIter_Type) = &PyType_Type;
     Py_TYPE(&BitarrayIter_Type) = &PyType_Type;
+    env = getenv("BITARRAY_STATS");
+    stats_enabled = env != NULL && *env != '\0' && strcmp(env, "0") != 0;
+    cpu_features = bk_detect_cpu_features();
+    bk_select_kernels(&kernels, cpu_features, kernel_names);
+    env = getenv("BITARRAY_ISA");
+    if (env != NULL && *env != '\0' && set_isa_level(env) < 0 &&
+        PyErr_WarnEx(PyExc_RuntimeWarning, "BITARRAY_ISA: unknown ISA "
+                     "level ignored (use generic, popcnt, avx2 or avx512)",
+                     1) < 0)
+#ifdef IS_PY3K
+        return NULL;
+#else
+        return;
+#endif
 #ifdef IS_PY3K
     m = PyModule_Create(&moduledef);
     if (m == NULL)
@@ -3223,6 +3984,9 @@ init_bitarray(void)
     PyModule_AddObject(m, "_bitarray", (PyObject *) &Bitarraytype);
     PyModule_AddObject(m, "__version__",
                        Py_BuildValue("s", BITARRAY_VERSION));
+    PyModule_AddObject(m, "_C_API",
+                       PyCapsule_New((void *) &capi, BITARRAY_CAPSULE_NAME,
+                                     NULL));
 #ifdef IS_PY3K
     return m;
 #endif
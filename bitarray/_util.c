@@ -23,90 +23,36 @@
 #endif /* !STDC_HEADERS */
 
 
-typedef long long int idx_t;
+#define BITARRAY_INTERNAL
+#include "bitarray.h"
 
-typedef struct {
-    PyObject_VAR_HEAD
-    char *ob_item;
-    Py_ssize_t allocated;       /* how many bytes allocated */
-    idx_t nbits;                /* length of bitarray, i.e. elements */
-    int endian;                 /* bit endianness of bitarray */
-    int ob_exports;             /* how many buffer exports */
-    PyObject *weakreflist;      /* list of weak references */
-} bitarrayobject;
-
-#define ENDIAN_LITTLE  0
-#define ENDIAN_BIG     1
-
-#define BITS(bytes)  ((idx_t) (bytes) << 3)
-
-#define BYTES(bits)  (((bits) == 0) ? 0 : (((bits) - 1) / 8 + 1))
-
-#define BITMASK(endian, i)  \
-    (((char) 1) << ((endian) == ENDIAN_LITTLE ? ((i) % 8) : (7 - (i) % 8)))
-
-/* ------------ low level access to bits in bitarrayobject ------------- */
-
-#ifndef NDEBUG
-static int GETBIT(bitarrayobject *self, idx_t i) {
-    assert(0 <= i && i < self->nbits);
-    return ((self)->ob_item[(i) / 8] & BITMASK((self)->endian, i) ? 1 : 0);
-}
-#else
-#define GETBIT(self, i)  \
-    ((self)->ob_item[(i) / 8] & BITMASK((self)->endian, i) ? 1 : 0)
-#endif
+/* C API of the _bitarray module, imported in module init */
+static bitarray_capi *bitarray_api = NULL;
 
-static void
-setbit(bitarrayobject *self, idx_t i, int bit)
-{
-    char *cp, mask;
+#define bitarray_Check(obj)  BitarrayCAPI_Check(bitarray_api, (obj))
 
-    assert(0 <= i && i < BITS(Py_SIZE(self)));
-    mask = BITMASK(self->endian, i);
-    cp = self->ob_item + i / 8;
-    if (bit)
-        *cp |= mask;
-    else
-        *cp &= ~mask;
-}
+/* the bitarray type (bitarray.bitarray) used for creating new objects,
+   set using the Python module function _set_bato() */
+static PyObject *bitarray_type_obj = NULL;
 
-static void
-setunused(bitarrayobject *a)
+/* Return an integer representing the endianness given by string, or -1
+   (meaning default endianness) when string is NULL.  If the string is
+   invalid, set a Python exception and return -2. */
+static int
+endian_from_string(const char* string)
 {
-    const idx_t n = BITS(Py_SIZE(a));
-    idx_t i;
-
-    for (i = a->nbits; i < n; i++)
-        setbit(a, i, 0);
-}
-
-static unsigned char bitcount_lookup[256] = {
-    0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,
-    1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,
-    1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,
-    2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,
-    1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,
-    2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,
-    2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,
-    3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,4,5,5,6,5,6,6,7,5,6,6,7,6,7,7,8,
-};
+    if (string == NULL)
+        return -1;
 
-/*********** end of code basically copied from _bitarray.c *************/
+    if (strcmp(string, "little") == 0)
+        return ENDIAN_LITTLE;
 
-/* set using the Python module function _set_babt() */
-static PyObject *bitarray_basetype = NULL;
+    if (strcmp(string, "big") == 0)
+        return ENDIAN_BIG;
 
-/* Return 1 if obj is a bitarray, 0 otherwise.
-   Note that this is implemented differently in _bitarray.c */
-static int
-bitarray_Check(PyObject *obj)
-{
-    if (bitarray_basetype == NULL) {
-        fprintf(stderr, "FATAL: bitarray_basetype missing\n");
-        exit(1);
-    }
-    return PyObject_IsInstance(obj, bitarray_basetype);
+    PyErr_SetString(PyExc_ValueError,
+                    "bit endianness must be either 'little' or 'big'");
+    return -2;
 }
 
 /************ start of actual functionality in this module *************/
@@ -117,7 +63,7 @@ static idx_t
 count_to_n(bitarrayobject *a, idx_t n)
 {
     idx_t i = 0, j = 0, m;  /* i is the index, j the total count up to i */
-    Py_ssize_t block_start, block_stop, k;
+    Py_ssize_t block_start, k;
     unsigned char c;
 
     if (n == 0)
@@ -126,15 +72,11 @@ count_to_n(bitarrayobject *a, idx_t n)
 #define BLOCK_BITS  8192
     /* by counting big blocks we save comparisons */
     while (i + BLOCK_BITS < a->nbits) {
-        m = 0;
         assert(i % 8 == 0);
         block_start = (Py_ssize_t) (i / 8);
-        block_stop = block_start + (BLOCK_BITS / 8);
-        for (k = block_start; k < block_stop; k++) {
-            assert(k < Py_SIZE(a));
-            c = a->ob_item[k];
-            m += bitcount_lookup[c];
-        }
+        assert(block_start + BLOCK_BITS / 8 <= Py_SIZE(a));
+        m = bitarray_api->kernels->count(a->ob_item + block_start,
+                                         BLOCK_BITS / 8);
         if (j + m >= n)
             break;
         j += m;
@@ -217,6 +159,74 @@ make_swap_hilo_bytes(void)
     return PyBytes_FromStringAndSize(bytes, 256);
 }
 
+/* Return a new bitarray object of given type (or the bitarray type set
+   by _set_bato() when type is NULL), length and endianness (or the default
+   endianness, when endian is negative) with all bits set to 0. */
+static PyObject *
+new_zeros(PyObject *type, idx_t nbits, int endian)
+{
+    PyObject *res;
+
+    if (type == NULL)
+        type = bitarray_type_obj;
+    if (endian < 0)
+        res = PyObject_CallFunction(type, "L", nbits);
+    else
+        res = PyObject_CallFunction(type, "Ls", nbits, ENDIAN_INT(endian));
+    if (res == NULL)
+        return NULL;
+    memset(((bitarrayobject *) res)->ob_item, 0x00, (size_t) Py_SIZE(res));
+    return res;
+}
+
+/* ------------------------ word level access ------------------------- */
+
+/* see bitkernels.h for word_t, WBITS, WORDS, WGET and WSET, as well as
+   bk_get_byte(), bk_load_words() and bk_store_words(), which are wrapped
+   here for bitarray objects */
+
+static unsigned char
+get_byte(bitarrayobject *a, idx_t p)
+{
+    const bitspan s = bitarray_span(a);
+
+    return bk_get_byte(&s, p);
+}
+
+static void
+load_words(bitarrayobject *a, idx_t start, idx_t n, word_t *w)
+{
+    const bitspan s = bitarray_span(a);
+
+    bk_load_words(&s, start, n, w);
+}
+
+static void
+store_words(bitarrayobject *a, idx_t start, idx_t n, const word_t *w)
+{
+    bitspan s = bitarray_span(a);
+
+    bk_store_words(&s, start, n, w);
+}
+
+/* allocate and load words for all bits of a (see load_words), and
+   add extra (zero) words at the end */
+static word_t *
+new_words(bitarrayobject *a, Py_ssize_t extra)
+{
+    word_t *w;
+    Py_ssize_t nwords = (Py_ssize_t) WORDS(a->nbits) + extra;
+
+    w = (word_t *) PyMem_Malloc(nwords * sizeof(word_t) + 1);
+    if (w == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    memset(w, 0x00, nwords * sizeof(word_t));
+    load_words(a, 0, a->nbits, w);
+    return w;
+}
+
 /*************************** Module functions **********************/
 
 static PyObject *
@@ -303,7 +313,6 @@ two_bitarray_func(PyObject *args, enum kernel_type kern, char *format)
     PyObject *a, *b;
     Py_ssize_t n, i;
     idx_t res = 0;
-    unsigned char c;
 
     if (!PyArg_ParseTuple(args, format, &a, &b))
         return NULL;
@@ -330,22 +339,16 @@ two_bitarray_func(PyObject *args, enum kernel_type kern, char *format)
 
     switch (kern) {
     case KERN_cand:
-        for (i = 0; i < n; i++) {
-            c = aa->ob_item[i] & bb->ob_item[i];
-            res += bitcount_lookup[c];
-        }
+        res = count_op(bitarray_api->kernels, aa->ob_item, bb->ob_item, n,
+                       OP_and);
         break;
     case KERN_cor:
-        for (i = 0; i < n; i++) {
-            c = aa->ob_item[i] | bb->ob_item[i];
-            res += bitcount_lookup[c];
-        }
+        res = count_op(bitarray_api->kernels, aa->ob_item, bb->ob_item, n,
+                       OP_or);
         break;
     case KERN_cxor:
-        for (i = 0; i < n; i++) {
-            c = aa->ob_item[i] ^ bb->ob_item[i];
-            res += bitcount_lookup[c];
-        }
+        res = count_op(bitarray_api->kernels, aa->ob_item, bb->ob_item, n,
+                       OP_xor);
         break;
     case KERN_subset:
         for (i = 0; i < n; i++)
@@ -391,53 +394,3149 @@ Return True if bitarray `a` is a subset of bitarray `b` (False otherwise).\n\
 efficient since we can stop as soon as one mismatch is found, and no\n\
 intermediate bitarray object gets created.");
 
+/********************* linear algebra over GF(2) ***********************/
+
+/* A matrix over GF(2) is stored as an array of rows, each of which is
+   an array of nwords words (see word level access above).  Rows are
+   accessed through pointers, such that swapping rows is cheap. */
+typedef struct {
+    Py_ssize_t nrows;
+    Py_ssize_t nwords;          /* words per row */
+    idx_t ncols;                /* number of columns (without extra ones) */
+    word_t **rows;
+    word_t *data;
+    PyObject *tmpl;             /* bitarray used as template for results
+                                   (new reference) */
+} gf2matrix;
+
+static void
+gf2_free(gf2matrix *m)
+{
+    PyMem_Free(m->rows);
+    PyMem_Free(m->data);
+    Py_CLEAR(m->tmpl);
+}
+
+/* Load matrix, which is either a sequence of bitarrays (the rows) of
+   equal length, or a bitarray holding nrows * ncols bits (row by row),
+   into m.  When extra is non-zero, room for one additional column is
+   made (which is initialized to 0).  Return -1 on error. */
+static int
+gf2_load(gf2matrix *m, PyObject *matrix, idx_t ncols, int extra)
+{
+    PyObject *seq = NULL, *row;
+    Py_ssize_t i;
+
+    m->rows = NULL;
+    m->data = NULL;
+    m->tmpl = NULL;
+    if (bitarray_Check(matrix)) {
+        if (ncols <= 0) {
+            PyErr_SetString(PyExc_ValueError,
+                            "positive ncols expected for matrix buffer");
+            return -1;
+        }
+        if (((bitarrayobject *) matrix)->nbits % ncols) {
+            PyErr_SetString(PyExc_ValueError,
+                            "bitarray length not multiple of ncols");
+            return -1;
+        }
+        m->nrows = (Py_ssize_t) (((bitarrayobject *) matrix)->nbits / ncols);
+        m->tmpl = matrix;
+        Py_INCREF(matrix);
+    }
+    else {
+        seq = PySequence_Fast(matrix, "bitarray or sequence expected");
+        if (seq == NULL)
+            return -1;
+        m->nrows = PySequence_Fast_GET_SIZE(seq);
+        if (m->nrows == 0) {
+            PyErr_SetString(PyExc_ValueError, "non-empty matrix expected");
+            goto error;
+        }
+        for (i = 0; i < m->nrows; i++) {
+            row = PySequence_Fast_GET_ITEM(seq, i);
+            if (!bitarray_Check(row)) {
+                PyErr_SetString(PyExc_TypeError,
+                                "bitarray expected for matrix row");
+                goto error;
+            }
+            if (i == 0)
+                ncols = ((bitarrayobject *) row)->nbits;
+            if (((bitarrayobject *) row)->nbits != ncols) {
+                PyErr_SetString(PyExc_ValueError,
+                                "matrix rows of equal length expected");
+                goto error;
+            }
+        }
+        /* the rows may only be referenced by seq, which is released */
+        m->tmpl = PySequence_Fast_GET_ITEM(seq, 0);
+        Py_INCREF(m->tmpl);
+    }
+    m->ncols = ncols;
+    m->nwords = (Py_ssize_t) WORDS(ncols + (extra ? 1 : 0));
+
+    m->rows = (word_t **) PyMem_Malloc(m->nrows * sizeof(word_t *) + 1);
+    m->data = (word_t *) PyMem_Malloc(m->nrows * m->nwords *
+                                      sizeof(word_t) + 1);
+    if (m->rows == NULL || m->data == NULL) {
+        PyErr_NoMemory();
+        goto error;
+    }
+    for (i = 0; i < m->nrows; i++) {
+        m->rows[i] = m->data + i * m->nwords;
+        memset(m->rows[i], 0x00, m->nwords * sizeof(word_t));
+        if (seq)
+            load_words((bitarrayobject *) PySequence_Fast_GET_ITEM(seq, i),
+                       0, ncols, m->rows[i]);
+        else
+            load_words((bitarrayobject *) matrix, i * ncols, ncols,
+                       m->rows[i]);
+    }
+    Py_XDECREF(seq);
+    return 0;
+
+ error:
+    Py_XDECREF(seq);
+    gf2_free(m);
+    return -1;
+}
+
+/* row[k] ^= other[k] for k in range(start, nwords) */
+static void
+xor_row(word_t *row, const word_t *other, Py_ssize_t start,
+        Py_ssize_t nwords)
+{
+    Py_ssize_t k;
+
+    for (k = start; k < nwords; k++)
+        row[k] ^= other[k];
+}
+
+/* Bring the first m->ncols columns of m into row echelon form, or into
+   reduced row echelon form when full is non-zero, and return the rank r.
+   The pivot columns are stored in pivots[0:r].  Return -1 on error.
+
+   Columns are processed in blocks of up to k pivots.  Once the pivot rows
+   of a block are found (and reduced with respect to each other), all 2^k
+   linear combinations of them are tabulated, such that every other row
+   is reduced by a single table lookup and row XOR, instead of up to k row
+   XORs.  This is the "Method of Four Russians" (M4RI) by Bard, which for
+   large matrices saves a factor of about k in row operations. */
+static Py_ssize_t
+gf2_eliminate(gf2matrix *m, int full, idx_t *pivots)
+{
+    const Py_ssize_t nrows = m->nrows, nwords = m->nwords;
+    word_t **rows = m->rows, *table = NULL, *tptr[256], *tmp;
+    Py_ssize_t r = 0, i, j, w0;
+    idx_t c, col = 0;
+    int k = 1, kk, idx, low;
+
+    /* a block size k of about log2(nrows) - 2 works well in practice */
+    while (k < 8 && ((Py_ssize_t) 4 << k) <= nrows)
+        k++;
+    if (k > 1) {
+        table = (word_t *) PyMem_Malloc((1 << k) * nwords * sizeof(word_t));
+        if (table == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+    }
+
+    while (col < m->ncols && r < nrows) {
+        w0 = (Py_ssize_t) (col / WBITS);
+        /* find up to k pivot rows r, r + 1, ..., r + kk - 1 */
+        for (kk = 0, c = col; c < m->ncols && kk < k && r + kk < nrows; c++) {
+            for (i = r + kk; i < nrows; i++) {
+                /* reduce row by the pivots already found in this block */
+                for (j = 0; j < kk; j++)
+                    if (WGET(rows[i], pivots[r + j]))
+                        xor_row(rows[i], rows[r + j], w0, nwords);
+                if (WGET(rows[i], c))
+                    break;
+            }
+            if (i == nrows)     /* no pivot in column c */
+                continue;
+
+            tmp = rows[i];
+            rows[i] = rows[r + kk];
+            rows[r + kk] = tmp;
+            /* clear column c in the other pivot rows of this block */
+            for (j = 0; j < kk; j++)
+                if (WGET(rows[r + j], c))
+                    xor_row(rows[r + j], rows[r + kk], w0, nwords);
+            pivots[r + kk] = c;
+            kk++;
+        }
+        col = c;
+        if (kk == 0)
+            continue;
+
+        /* tabulate all linear combinations of the pivot rows */
+        tptr[0] = NULL;
+        for (idx = 1; idx < (1 << kk); idx++) {
+            for (low = 0; (idx >> low & 1) == 0; low++)
+                ;
+            if (idx == 1 << low) {
+                tptr[idx] = rows[r + low];
+            }
+            else {
+                tptr[idx] = table + idx * nwords;
+                for (j = w0; j < nwords; j++)
+                    tptr[idx][j] = tptr[idx ^ 1 << low][j] ^
+                                   rows[r + low][j];
+            }
+        }
+        /* reduce all other rows (or only rows below, when not full) */
+        for (i = full ? 0 : r + kk; i < nrows; i++) {
+            if (r <= i && i < r + kk)
+                continue;
+            for (idx = 0, j = 0; j < kk; j++)
+                idx |= WGET(rows[i], pivots[r + j]) << j;
+            if (idx)
+                xor_row(rows[i], tptr[idx], w0, nwords);
+        }
+        r += kk;
+    }
+    PyMem_Free(table);
+    return r;
+}
+
+/* allocate space for pivot columns of matrix m */
+static idx_t *
+gf2_pivots(gf2matrix *m)
+{
+    idx_t *pivots;
+
+    pivots = (idx_t *) PyMem_Malloc(m->nrows * sizeof(idx_t) + 1);
+    if (pivots == NULL)
+        PyErr_NoMemory();
+    return pivots;
+}
 
-/* set bitarray_basetype (babt) */
 static PyObject *
-set_babt(PyObject *module, PyObject *obj)
+gf2_rank(PyObject *module, PyObject *args, PyObject *kwds)
 {
-    bitarray_basetype = obj;
-    Py_RETURN_NONE;
+    PyObject *matrix;
+    gf2matrix m;
+    idx_t ncols = 0, *pivots;
+    Py_ssize_t rank;
+    static char *kwlist[] = {"", "ncols", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|L:gf2_rank", kwlist,
+                                     &matrix, &ncols))
+        return NULL;
+
+    if (gf2_load(&m, matrix, ncols, 0) < 0)
+        return NULL;
+    if ((pivots = gf2_pivots(&m)) == NULL) {
+        gf2_free(&m);
+        return NULL;
+    }
+    rank = gf2_eliminate(&m, 0, pivots);
+    PyMem_Free(pivots);
+    gf2_free(&m);
+    if (rank < 0)
+        return NULL;
+    return PyLong_FromSsize_t(rank);
 }
 
-static PyMethodDef module_functions[] = {
-    {"count_n",   (PyCFunction) count_n,   METH_VARARGS, count_n_doc},
-    {"rindex",    (PyCFunction) r_index,   METH_VARARGS, rindex_doc},
-    {"count_and", (PyCFunction) count_and, METH_VARARGS, count_and_doc},
-    {"count_or",  (PyCFunction) count_or,  METH_VARARGS, count_or_doc},
-    {"count_xor", (PyCFunction) count_xor, METH_VARARGS, count_xor_doc},
-    {"subset",    (PyCFunction) subset,    METH_VARARGS, subset_doc},
-    {"_set_babt", (PyCFunction) set_babt,  METH_O,       ""},
-    {NULL,        NULL}  /* sentinel */
-};
+PyDoc_STRVAR(gf2_rank_doc,
+"gf2_rank(matrix, /, ncols=0) -> int\n\
+\n\
+Return the rank of the matrix over GF(2).  The matrix is either given\n\
+as a sequence of bitarrays of equal length (the rows), or as a single\n\
+bitarray holding the rows one after another, each of length `ncols`.");
 
-/*********************** Install Module **************************/
 
-#ifdef IS_PY3K
-static PyModuleDef moduledef = {
-    PyModuleDef_HEAD_INIT, "_util", 0, -1, module_functions,
-};
-#endif
+static PyObject *
+gf2_solve(PyObject *module, PyObject *args, PyObject *kwds)
+{
+    PyObject *matrix, *b, *res = NULL;
+    gf2matrix m;
+    idx_t ncols = 0, *pivots;
+    Py_ssize_t rank, i;
+    static char *kwlist[] = {"", "", "ncols", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|L:gf2_solve", kwlist,
+                                     &matrix, &b, &ncols))
+        return NULL;
 
-PyMODINIT_FUNC
-#ifdef IS_PY3K
-PyInit__util(void)
-#else
-init_util(void)
-#endif
+    if (!bitarray_Check(b)) {
+        PyErr_SetString(PyExc_TypeError, "bitarray expected for b");
+        return NULL;
+    }
+    if (gf2_load(&m, matrix, ncols, 1) < 0)
+        return NULL;
+    if (((bitarrayobject *) b)->nbits != m.nrows) {
+        PyErr_SetString(PyExc_ValueError,
+                        "length of b must equal number of matrix rows");
+        gf2_free(&m);
+        return NULL;
+    }
+    if ((pivots = gf2_pivots(&m)) == NULL) {
+        gf2_free(&m);
+        return NULL;
+    }
+    /* augment the matrix by b */
+    for (i = 0; i < m.nrows; i++)
+        if (GETBIT((bitarrayobject *) b, i))
+            WSET(m.rows[i], m.ncols);
+
+    rank = gf2_eliminate(&m, 1, pivots);
+    if (rank < 0)
+        goto done;
+
+    /* the system is inconsistent, when a zero row has a 1 in column b */
+    for (i = rank; i < m.nrows; i++)
+        if (WGET(m.rows[i], m.ncols)) {
+            Py_INCREF(Py_None);
+            res = Py_None;
+            goto done;
+        }
+
+    res = new_zeros((PyObject *) Py_TYPE(m.tmpl), m.ncols,
+                    ((bitarrayobject *) m.tmpl)->endian);
+    if (res == NULL)
+        goto done;
+    /* free variables are 0, so each pivot variable equals column b */
+    for (i = 0; i < rank; i++)
+        setbit((bitarrayobject *) res, pivots[i], WGET(m.rows[i], m.ncols));
+ done:
+    PyMem_Free(pivots);
+    gf2_free(&m);
+    return res;
+}
+
+PyDoc_STRVAR(gf2_solve_doc,
+"gf2_solve(matrix, b, /, ncols=0) -> bitarray or None\n\
+\n\
+Solve the linear system `matrix * x = b` over GF(2), and return a solution\n\
+`x` (in which all free variables are 0), or `None` when the system is\n\
+inconsistent.  The matrix is given as for `gf2_rank()`, and the bitarray\n\
+`b` contains one bit for each row.");
+
+
+static PyObject *
+gf2_nullspace(PyObject *module, PyObject *args, PyObject *kwds)
 {
-    PyObject *m;
+    PyObject *matrix, *list = NULL, *v;
+    gf2matrix m;
+    idx_t ncols = 0, *pivots, f;
+    Py_ssize_t rank, i, p;
+    static char *kwlist[] = {"", "ncols", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|L:gf2_nullspace",
+                                     kwlist, &matrix, &ncols))
+        return NULL;
 
-#ifdef IS_PY3K
-    m = PyModule_Create(&moduledef);
-    if (m == NULL)
+    if (gf2_load(&m, matrix, ncols, 0) < 0)
         return NULL;
-#else
-    m = Py_InitModule3("_util", module_functions, 0);
-    if (m == NULL)
+    if ((pivots = gf2_pivots(&m)) == NULL) {
+        gf2_free(&m);
+        return NULL;
+    }
+    rank = gf2_eliminate(&m, 1, pivots);
+    if (rank < 0)
+        goto done;
+
+    list = PyList_New(0);
+    if (list == NULL)
+        goto done;
+
+    /* one basis vector for each free (non-pivot) column f */
+    for (f = 0, p = 0; f < m.ncols; f++) {
+        if (p < rank && pivots[p] == f) {
+            p++;
+            continue;
+        }
+        v = new_zeros((PyObject *) Py_TYPE(m.tmpl), m.ncols,
+                      ((bitarrayobject *) m.tmpl)->endian);
+        if (v == NULL || PyList_Append(list, v) < 0) {
+            Py_XDECREF(v);
+            Py_CLEAR(list);
+            goto done;
+        }
+        Py_DECREF(v);
+        setbit((bitarrayobject *) v, f, 1);
+        for (i = 0; i < rank; i++)
+            setbit((bitarrayobject *) v, pivots[i], WGET(m.rows[i], f));
+    }
+ done:
+    PyMem_Free(pivots);
+    gf2_free(&m);
+    return list;
+}
+
+PyDoc_STRVAR(gf2_nullspace_doc,
+"gf2_nullspace(matrix, /, ncols=0) -> list\n\
+\n\
+Return a basis of the null space (kernel) of the matrix over GF(2), that\n\
+is a list of `ncols - rank` bitarrays `x` with `matrix * x = 0`.\n\
+The matrix is given as for `gf2_rank()`.");
+
+
+/**************** CRC and polynomial arithmetic over GF(2) *************/
+
+/* The CRC register is kept left aligned in a 64-bit word, i.e. a CRC of
+   width w occupies the w most significant bits, and the polynomial is
+   shifted the same way.  This allows the same (table driven) code to be
+   used for all widths from 1 to 64.
+
+   crc_tables[k][i] is the register value obtained by feeding 8 * (k + 1)
+   zero bits into a register which has the byte i in its top 8 bits
+   (and zeros otherwise).  Using the 8 tables, 8 bytes of input are
+   processed at once ("slice-by-8").  As computing the tables requires a
+   few thousand operations, they are kept for the polynomial used last. */
+static word_t crc_tables[8][256];
+static word_t crc_tables_poly = 0;     /* 0 means tables not set up */
+
+static void
+setup_crc_tables(word_t poly)
+{
+    word_t reg;
+    int i, j, k;
+
+    if (poly == crc_tables_poly)
+        return;
+
+    for (i = 0; i < 256; i++) {
+        reg = ((word_t) i) << 56;
+        for (j = 0; j < 8; j++)
+            reg = (reg << 1) ^ (reg >> 63 ? poly : 0);
+        crc_tables[0][i] = reg;
+    }
+    for (k = 1; k < 8; k++)
+        for (i = 0; i < 256; i++) {
+            reg = crc_tables[k - 1][i];
+            crc_tables[k][i] = (reg << 8) ^ crc_tables[0][reg >> 56];
+        }
+    crc_tables_poly = poly;
+}
+
+/* Feed the bits a[start:stop] into the (left aligned) register reg, and
+   return the new register.  When refin is non-zero, each group of 8 bits
+   (counting from start) is fed in reverse order, which is what a reflected
+   CRC does with each byte.  A trailing group of less than 8 bits is always
+   fed in order. */
+static word_t
+crc_update(bitarrayobject *a, idx_t start, idx_t stop, word_t reg,
+           word_t poly, int refin)
+{
+    idx_t p = start;
+    int k;
+
+    assert(0 <= start && start <= stop && stop <= a->nbits);
+    if (stop - start >= 64) {
+        setup_crc_tables(poly);
+
+        if (start % 8 == 0) {
+            const unsigned char *buff = (unsigned char *) a->ob_item;
+            /* the byte in memory needs to be reversed, unless its most
+               significant bit is fed first */
+            const int rev = (a->endian == ENDIAN_BIG) == refin;
+            word_t x;
+
+            for (; p + 64 <= stop; p += 64) {
+                x = 0;
+                for (k = 0; k < 8; k++)
+                    x = x << 8 | (rev ? reverse_trans[buff[p / 8 + k]] :
+                                  buff[p / 8 + k]);
+                x ^= reg;
+                reg = crc_tables[7][x >> 56] ^
+                      crc_tables[6][x >> 48 & 0xff] ^
+                      crc_tables[5][x >> 40 & 0xff] ^
+                      crc_tables[4][x >> 32 & 0xff] ^
+                      crc_tables[3][x >> 24 & 0xff] ^
+                      crc_tables[2][x >> 16 & 0xff] ^
+                      crc_tables[1][x >>  8 & 0xff] ^
+                      crc_tables[0][x       & 0xff];
+            }
+            for (; p + 8 <= stop; p += 8) {
+                x = rev ? reverse_trans[buff[p / 8]] : buff[p / 8];
+                reg = (reg << 8) ^ crc_tables[0][(reg >> 56) ^ x];
+            }
+        }
+        else {
+            unsigned char c;
+
+            for (; p + 8 <= stop; p += 8) {
+                /* get_byte() has a[p] as least significant bit */
+                c = get_byte(a, p);
+                c = refin ? c : reverse_trans[c];
+                reg = (reg << 8) ^ crc_tables[0][(reg >> 56) ^ c];
+            }
+        }
+    }
+    else if (refin) {
+        for (; p + 8 <= stop; p += 8)
+            for (k = 7; k >= 0; k--)
+                reg = (reg << 1) ^
+                    (((reg >> 63) ^ GETBIT(a, p + k)) ? poly : 0);
+    }
+    /* remaining bits, fed in order */
+    for (; p < stop; p++)
+        reg = (reg << 1) ^ (((reg >> 63) ^ GETBIT(a, p)) ? poly : 0);
+
+    return reg;
+}
+
+/* reverse the lowest n bits of x */
+static word_t
+reflect(word_t x, int n)
+{
+    word_t res = 0;
+    int i;
+
+    for (i = 0; i < n; i++, x >>= 1)
+        res = res << 1 | (x & 1);
+    return res;
+}
+
+static PyObject *
+crc(PyObject *module, PyObject *args, PyObject *kwds)
+{
+    PyObject *a;
+    unsigned PY_LONG_LONG poly, init = 0, xorout = 0;
+    word_t mask, reg;
+    idx_t start = 0, stop = PY_LLONG_MAX;
+    int width, refin = 0, refout = 0;
+    static char *kwlist[] = {"", "poly", "width", "init", "refin",
+                             "refout", "xorout", "start", "stop", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OKi|KiiKLL:crc", kwlist,
+                                     &a, &poly, &width, &init, &refin,
+                                     &refout, &xorout, &start, &stop))
+        return NULL;
+
+    if (!bitarray_Check(a)) {
+        PyErr_SetString(PyExc_TypeError, "bitarray expected");
+        return NULL;
+    }
+    if (width < 1 || width > 64) {
+        PyErr_SetString(PyExc_ValueError, "width must be in range(1, 65)");
+        return NULL;
+    }
+    mask = ((word_t) -1) >> (64 - width);
+    if ((poly & ~mask) || (init & ~mask) || (xorout & ~mask)) {
+        PyErr_Format(PyExc_ValueError,
+                     "poly, init and xorout must fit into %d bits", width);
+        return NULL;
+    }
+#define aa  ((bitarrayobject *) a)
+    normalize_index(aa->nbits, &start);
+    normalize_index(aa->nbits, &stop);
+    if (stop < start)
+        stop = start;
+
+    reg = crc_update(aa, start, stop, ((word_t) init) << (64 - width),
+                     ((word_t) poly) << (64 - width), refin != 0);
+#undef aa
+    reg >>= 64 - width;
+    if (refout)
+        reg = reflect(reg, width);
+    return PyLong_FromUnsignedLongLong(reg ^ xorout);
+}
+
+PyDoc_STRVAR(crc_doc,
+"crc(bitarray, poly, width, /, init=0, refin=False, refout=False, \
+xorout=0, start=0, stop=<end of array>) -> int\n\
+\n\
+Return the cyclic redundancy check (CRC) of the bits `a[start:stop]`,\n\
+which may be of any length (not just a multiple of 8).  The bits are fed\n\
+into the CRC register in order, and the parameters are those of the\n\
+Rocksoft model, as used in CRC catalogues: the generator polynomial\n\
+`poly` (without its leading term) of given `width` (1 to 64), the initial\n\
+register value `init`, and the final `xorout`.  When `refin` is true,\n\
+each group of 8 bits (counting from `start`) is fed in reverse order,\n\
+such that for a big-endian bitarray created from bytes, the result\n\
+matches the usual byte oriented CRC.  When `refout` is true,\n\
+the final register value is reflected.");
+
+
+/* r[offset:offset + n] ^= w[0:n], where r and w are word arrays (and r
+   has room for WORDS(offset + n) words) */
+static void
+xor_shifted(word_t *r, idx_t offset, const word_t *w, idx_t n)
+{
+    const int s = (int) (offset % WBITS);
+    const Py_ssize_t nwords = (Py_ssize_t) WORDS(n);
+    Py_ssize_t k;
+
+    r += offset / WBITS;
+    if (s == 0) {
+        for (k = 0; k < nwords; k++)
+            r[k] ^= w[k];
+        return;
+    }
+    for (k = 0; k < nwords; k++) {
+        r[k] ^= w[k] << s;
+        if (w[k] >> (WBITS - s))
+            r[k + 1] ^= w[k] >> (WBITS - s);
+    }
+}
+
+static PyObject *
+clmul(PyObject *module, PyObject *args)
+{
+    PyObject *a, *b, *res = NULL;
+    word_t *wa = NULL, *wb = NULL, *wr = NULL, *table = NULL;
+    idx_t na, nb, nr, q;
+    Py_ssize_t tw, k;
+    int v, nib;
+
+    if (!PyArg_ParseTuple(args, "OO:clmul", &a, &b))
+        return NULL;
+    if (!(bitarray_Check(a) && bitarray_Check(b))) {
+        PyErr_SetString(PyExc_TypeError, "bitarray expected");
+        return NULL;
+    }
+    na = ((bitarrayobject *) a)->nbits;
+    nb = ((bitarrayobject *) b)->nbits;
+    nr = (na && nb) ? na + nb - 1 : 0;
+    res = new_zeros((PyObject *) Py_TYPE(a), nr,
+                    ((bitarrayobject *) a)->endian);
+    if (res == NULL || nr == 0)
+        return res;
+
+    /* table[v] = a * v for all 4-bit polynomials v, each with tw words */
+    tw = (Py_ssize_t) WORDS(na + 3) + 1;
+    wa = new_words((bitarrayobject *) a, 0);
+    wb = new_words((bitarrayobject *) b, 1);
+    wr = (word_t *) PyMem_Malloc(WORDS(nr + 3) * sizeof(word_t) + 1);
+    table = (word_t *) PyMem_Malloc(16 * tw * sizeof(word_t));
+    if (wa == NULL || wb == NULL || wr == NULL || table == NULL) {
+        PyErr_NoMemory();
+        Py_CLEAR(res);
+        goto done;
+    }
+    memset(wr, 0x00, WORDS(nr + 3) * sizeof(word_t));
+    memset(table, 0x00, 16 * tw * sizeof(word_t));
+    for (v = 1; v < 16; v++)
+        for (k = 0; k < 4; k++)
+            if (v >> k & 1)
+                xor_shifted(table + v * tw, k, wa, na);
+
+    /* process b one nibble at a time */
+    for (q = 0; q < nb; q += 4) {
+        nib = (int) (wb[q / WBITS] >> (q % WBITS)) & 0x0f;
+        if (nib)
+            xor_shifted(wr, q, table + nib * tw, na + 3);
+    }
+    store_words((bitarrayobject *) res, 0, nr, wr);
+ done:
+    PyMem_Free(wa);
+    PyMem_Free(wb);
+    PyMem_Free(wr);
+    PyMem_Free(table);
+    return res;
+}
+
+PyDoc_STRVAR(clmul_doc,
+"clmul(a, b, /) -> bitarray\n\
+\n\
+Return the carry-less product of two polynomials over GF(2), represented\n\
+by bitarrays, whose first bit is the coefficient of the highest power.\n\
+That is, `bitarray('1011')` represents x^3 + x + 1.\n\
+The length of the result is `len(a) + len(b) - 1` (or 0 when either\n\
+bitarray is empty).");
+
+
+static PyObject *
+polymod(PyObject *module, PyObject *args)
+{
+    PyObject *a, *m, *res = NULL;
+    word_t *wr = NULL, *wm = NULL;
+    idx_t na, nm, first, dm, i;
+    Py_ssize_t k;
+
+    if (!PyArg_ParseTuple(args, "OO:polymod", &a, &m))
+        return NULL;
+    if (!(bitarray_Check(a) && bitarray_Check(m))) {
+        PyErr_SetString(PyExc_TypeError, "bitarray expected");
+        return NULL;
+    }
+    na = ((bitarrayobject *) a)->nbits;
+    nm = ((bitarrayobject *) m)->nbits;
+    /* skip leading zero coefficients of the modulus */
+    for (first = 0; first < nm; first++)
+        if (GETBIT((bitarrayobject *) m, first))
+            break;
+    if (first == nm) {
+        PyErr_SetString(PyExc_ZeroDivisionError, "polynomial modulo zero");
+        return NULL;
+    }
+    dm = nm - first - 1;        /* degree of the modulus */
+
+    res = new_zeros((PyObject *) Py_TYPE(a), dm,
+                    ((bitarrayobject *) a)->endian);
+    if (res == NULL || dm == 0)
+        return res;
+
+    wr = new_words((bitarrayobject *) a, 1);
+    wm = (word_t *) PyMem_Malloc(WORDS(dm + 1) * sizeof(word_t));
+    if (wr == NULL || wm == NULL) {
+        PyErr_NoMemory();
+        Py_CLEAR(res);
+        goto done;
+    }
+    load_words((bitarrayobject *) m, first, dm + 1, wm);
+
+    /* long division - subtract the shifted modulus for each leading 1 */
+    for (i = 0; i < na - dm; i++) {
+        k = (Py_ssize_t) (i / WBITS);
+        if ((wr[k] >> (i % WBITS)) == 0) {
+            /* skip to next word */
+            i = WBITS * (idx_t) (k + 1) - 1;
+            continue;
+        }
+        if (WGET(wr, i))
+            xor_shifted(wr, i, wm, dm + 1);
+    }
+    /* the remainder is in the last dm bits */
+    for (i = 0; i < dm; i++)
+        if (na - dm + i >= 0)
+            setbit((bitarrayobject *) res, i, WGET(wr, na - dm + i));
+ done:
+    PyMem_Free(wr);
+    PyMem_Free(wm);
+    return res;
+}
+
+PyDoc_STRVAR(polymod_doc,
+"polymod(a, m, /) -> bitarray\n\
+\n\
+Return the remainder of the division of polynomial `a` by polynomial `m`\n\
+over GF(2).  The polynomials are represented as for `clmul()`.\n\
+The length of the result is the degree of `m`.  Raises\n\
+`ZeroDivisionError`, if `m` contains no 1 bit.");
+
+
+/*********************** numeric buffers and bit planes *****************/
+
+/* non-zero on little-endian machines, set up in module init */
+static int host_little;
+
+/* index of the k-th least significant byte within an element (of given
+   size) of a numeric buffer */
+#define BYTE_INDEX(k, itemsize)  (host_little ? (k) : (itemsize) - 1 - (k))
+
+/* Return the struct module type character of the elements of the buffer
+   (e.g. 'B', 'h', 'q', 'd'), or 0 (and set an exception) when the elements
+   are not in native byte order, or of another type than in types. */
+static char
+buffer_type(Py_buffer *view, const char *types)
+{
+    const char *fmt = view->format ? view->format : "B";
+
+    switch (*fmt) {
+    case '@': case '=':
+        fmt++;
+        break;
+    case '<':
+        fmt += host_little ? 1 : 0;
+        break;
+    case '>': case '!':
+        fmt += host_little ? 0 : 1;
+        break;
+    }
+    if (fmt[0] == '\0' || fmt[1] != '\0' || strchr(types, fmt[0]) == NULL) {
+        PyErr_Format(PyExc_TypeError, "buffer with native element type "
+                     "in '%s' expected, got '%s'", types,
+                     view->format ? view->format : "B");
+        return 0;
+    }
+    return fmt[0];
+}
+
+#define INT_TYPES  "bBhHiIlLqQ"
+
+/* Transpose the 8 x 8 bit matrix x, whose element in row r and column c
+   is bit 8 * r + c of x.  See Hacker's Delight, section 7-3. */
+static word_t
+transpose8(word_t x)
+{
+    word_t t;
+
+    t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaULL;
+    x = x ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000cccc0000ccccULL;
+    x = x ^ t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ULL;
+    x = x ^ t ^ (t << 28);
+    return x;
+}
+
+static PyObject *
+bitplanes(PyObject *module, PyObject *args)
+{
+    PyObject *obj, *list = NULL, *a;
+    bitarrayobject *planes[64];
+    Py_buffer view;
+    char *endian_str = NULL;
+    unsigned char *data, c;
+    Py_ssize_t n, i, itemsize;
+    int endian, nplanes, k, r;
+    word_t x;
+
+    if (!PyArg_ParseTuple(args, "O|z:bitplanes", &obj, &endian_str))
+        return NULL;
+    if ((endian = endian_from_string(endian_str)) == -2)
+        return NULL;
+
+    if (PyObject_GetBuffer(obj, &view, PyBUF_CONTIG_RO | PyBUF_FORMAT) < 0)
+        return NULL;
+    if (buffer_type(&view, INT_TYPES) == 0)
+        goto error;
+    itemsize = view.itemsize;
+    n = view.len / itemsize;
+    nplanes = 8 * (int) itemsize;
+    data = (unsigned char *) view.buf;
+
+    list = PyList_New(nplanes);
+    if (list == NULL)
+        goto error;
+    for (k = 0; k < nplanes; k++) {
+        a = new_zeros(NULL, n, endian);
+        if (a == NULL)
+            goto error;
+        PyList_SET_ITEM(list, k, a);
+        planes[k] = (bitarrayobject *) a;
+    }
+
+    /* transpose blocks of 8 elements times 8 bits */
+    for (i = 0; i + 8 <= n; i += 8) {
+        for (k = 0; k < itemsize; k++) {
+            x = 0;
+            for (r = 0; r < 8; r++)
+                x |= ((word_t) data[(i + r) * itemsize +
+                                    BYTE_INDEX(k, itemsize)]) << (8 * r);
+            if (x == 0)
+                continue;
+            x = transpose8(x);
+            for (r = 0; r < 8; r++) {
+                c = (unsigned char) (x >> (8 * r));
+                planes[8 * k + r]->ob_item[i / 8] =
+                    planes[8 * k + r]->endian == ENDIAN_LITTLE ? c :
+                                                        reverse_trans[c];
+            }
+        }
+    }
+    /* remaining elements */
+    for (; i < n; i++)
+        for (k = 0; k < nplanes; k++)
+            setbit(planes[k], i, data[i * itemsize +
+                                      BYTE_INDEX(k / 8, itemsize)] >>
+                                 (k % 8) & 1);
+
+    PyBuffer_Release(&view);
+    return list;
+ error:
+    PyBuffer_Release(&view);
+    Py_XDECREF(list);
+    return NULL;
+}
+
+PyDoc_STRVAR(bitplanes_doc,
+"bitplanes(buffer, /, endian=None) -> list\n\
+\n\
+Split the integers in `buffer` (any object exposing integer elements of\n\
+1, 2, 4 or 8 bytes through the buffer protocol, e.g. `array.array` or\n\
+`numpy.ndarray`) into bit planes.  Return a list of `8 * itemsize`\n\
+bitarrays (with given endianness), where the k-th bitarray contains bit k\n\
+(counting from the least significant bit) of each integer.");
+
+
+static PyObject *
+frombitplanes(PyObject *module, PyObject *args)
+{
+    PyObject *seq, *obj, *a;
+    bitarrayobject *planes[64];
+    Py_buffer view;
+    unsigned char *data, c;
+    Py_ssize_t n, i, itemsize;
+    int nplanes, k, r;
+    word_t x;
+
+    if (!PyArg_ParseTuple(args, "OO:frombitplanes", &seq, &obj))
+        return NULL;
+
+    seq = PySequence_Fast(seq, "sequence of bitarrays expected");
+    if (seq == NULL)
+        return NULL;
+    if (PyObject_GetBuffer(obj, &view, PyBUF_CONTIG | PyBUF_FORMAT) < 0) {
+        Py_DECREF(seq);
+        return NULL;
+    }
+    if (buffer_type(&view, INT_TYPES) == 0)
+        goto error;
+    itemsize = view.itemsize;
+    n = view.len / itemsize;
+    data = (unsigned char *) view.buf;
+
+    if (PySequence_Fast_GET_SIZE(seq) > 8 * itemsize) {
+        PyErr_Format(PyExc_ValueError, "at most %d bit planes expected "
+                     "for buffer elements of %zd bytes",
+                     (int) (8 * itemsize), itemsize);
+        goto error;
+    }
+    nplanes = (int) PySequence_Fast_GET_SIZE(seq);
+    for (k = 0; k < nplanes; k++) {
+        a = PySequence_Fast_GET_ITEM(seq, k);
+        if (!bitarray_Check(a)) {
+            PyErr_SetString(PyExc_TypeError, "bitarray expected");
+            goto error;
+        }
+        if (((bitarrayobject *) a)->nbits != n) {
+            PyErr_Format(PyExc_ValueError, "bitarray of length %zd "
+                         "(number of buffer elements) expected", n);
+            goto error;
+        }
+        planes[k] = (bitarrayobject *) a;
+    }
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        for (k = 0; k < itemsize; k++) {
+            x = 0;
+            for (r = 0; r < 8 && 8 * k + r < nplanes; r++) {
+                c = (unsigned char) planes[8 * k + r]->ob_item[i / 8];
+                if (planes[8 * k + r]->endian == ENDIAN_BIG)
+                    c = reverse_trans[c];
+                x |= ((word_t) c) << (8 * r);
+            }
+            if (x)
+                x = transpose8(x);
+            for (r = 0; r < 8; r++)
+                data[(i + r) * itemsize + BYTE_INDEX(k, itemsize)] =
+                    (unsigned char) (x >> (8 * r));
+        }
+    }
+    for (; i < n; i++) {
+        memset(data + i * itemsize, 0x00, (size_t) itemsize);
+        for (k = 0; k < nplanes; k++)
+            if (GETBIT(planes[k], i))
+                data[i * itemsize + BYTE_INDEX(k / 8, itemsize)] |=
+                    1 << (k % 8);
+    }
+    PyBuffer_Release(&view);
+    Py_DECREF(seq);
+    Py_RETURN_NONE;
+ error:
+    PyBuffer_Release(&view);
+    Py_DECREF(seq);
+    return NULL;
+}
+
+PyDoc_STRVAR(frombitplanes_doc,
+"frombitplanes(planes, buffer, /)\n\
+\n\
+Reassemble the integers from a list of bit planes (as returned by\n\
+`bitplanes()`) into the (writable) `buffer`.  The number of bitarrays may\n\
+be smaller than `8 * itemsize`, in which case the missing (most\n\
+significant) bits are 0.");
+
+
+/*************** predicates and filtering over numeric buffers ************/
+
+enum cmp_op {OP_LT, OP_LE, OP_EQ, OP_NE, OP_GT, OP_GE, OP_BETWEEN};
+
+typedef union {
+    long long s;
+    unsigned long long u;
+    double d;
+} cmp_value;
+
+/* Evaluate cond for blocks of 8 elements, and store the results directly
+   as packed bits (little-endian bit order) into out.  Keeping the 8
+   comparisons of each block independent allows the compiler to vectorize
+   the loop. */
+#define CMP_LOOP(cond)                                              \
+    for (i = 0; i + 8 <= n; i += 8) {                               \
+        c = 0;                                                      \
+        for (k = 0; k < 8; k++) {                                   \
+            const idx_t j = i + k;                                  \
+            c |= ((cond) ? 1 : 0) << k;                             \
+        }                                                           \
+        *out++ = (unsigned char) c;                                 \
+    }                                                               \
+    if (i < n) {                                                    \
+        c = 0;                                                      \
+        for (k = 0; i + k < n; k++) {                               \
+            const idx_t j = i + k;                                  \
+            c |= ((cond) ? 1 : 0) << k;                             \
+        }                                                           \
+        *out = (unsigned char) c;                                   \
+    }                                                               \
+    break;
+
+#define CMP_KERNEL(name, T, F)                                      \
+static void                                                         \
+name(const void *buf, idx_t n, enum cmp_op op,                      \
+     cmp_value low, cmp_value high, unsigned char *out)             \
+{                                                                   \
+    const T *x = (const T *) buf;                                   \
+    const T v = (T) low.F, w = (T) high.F;                          \
+    idx_t i;                                                        \
+    int k, c;                                                       \
+                                                                    \
+    switch (op) {                                                   \
+    case OP_LT: CMP_LOOP(x[j] < v)                                  \
+    case OP_LE: CMP_LOOP(x[j] <= v)                                 \
+    case OP_EQ: CMP_LOOP(x[j] == v)                                 \
+    case OP_NE: CMP_LOOP(x[j] != v)                                 \
+    case OP_GT: CMP_LOOP(x[j] > v)                                  \
+    case OP_GE: CMP_LOOP(x[j] >= v)                                 \
+    case OP_BETWEEN: CMP_LOOP(v <= x[j] && x[j] <= w)               \
+    }                                                               \
+}
+
+CMP_KERNEL(cmp_b, signed char, s)
+CMP_KERNEL(cmp_B, unsigned char, u)
+CMP_KERNEL(cmp_h, short, s)
+CMP_KERNEL(cmp_H, unsigned short, u)
+CMP_KERNEL(cmp_i, int, s)
+CMP_KERNEL(cmp_I, unsigned int, u)
+CMP_KERNEL(cmp_l, long, s)
+CMP_KERNEL(cmp_L, unsigned long, u)
+CMP_KERNEL(cmp_q, long long, s)
+CMP_KERNEL(cmp_Q, unsigned long long, u)
+CMP_KERNEL(cmp_f, float, d)
+CMP_KERNEL(cmp_d, double, d)
+
+#undef CMP_KERNEL
+#undef CMP_LOOP
+
+#define CMP_TYPES  INT_TYPES "fd"
+
+/* Convert obj into a comparison value for buffer elements of type t (and
+   given itemsize).  Return 0 on success, -1 when the (integer) value is
+   below the range of the type, 1 when it is above, and -2 on error. */
+static int
+cmp_convert(PyObject *obj, char t, Py_ssize_t itemsize, cmp_value *res)
+{
+    PyObject *index;
+    int is_signed = Py_ISLOWER(t), nbits = 8 * (int) itemsize;
+    int overflow, ret;
+
+    if (t == 'f' || t == 'd') {
+        res->d = PyFloat_AsDouble(obj);
+        return (res->d == -1.0 && PyErr_Occurred()) ? -2 : 0;
+    }
+    if (!PyIndex_Check(obj)) {
+        PyErr_Format(PyExc_TypeError, "integer expected for buffer of "
+                     "type '%c', got '%s'", t, Py_TYPE(obj)->tp_name);
+        return -2;
+    }
+    if ((index = PyNumber_Index(obj)) == NULL)
+        return -2;
+
+    ret = 0;
+    res->s = PyLong_AsLongLongAndOverflow(index, &overflow);
+    if (res->s == -1 && PyErr_Occurred()) {
+        ret = -2;
+    }
+    else if (overflow) {
+        ret = overflow;
+        if (!is_signed && overflow == 1) {
+            /* may still fit into an unsigned long long */
+            res->u = PyLong_AsUnsignedLongLong(index);
+            if (res->u == (unsigned long long) -1 && PyErr_Occurred())
+                PyErr_Clear();
+            else if (nbits >= 64 ||
+                     res->u < ((unsigned long long) 1 << nbits))
+                ret = 0;
+        }
+    }
+    else if (is_signed) {
+        if (nbits < 64 && res->s < -(1LL << (nbits - 1)))
+            ret = -1;
+        else if (nbits < 64 && res->s >= (1LL << (nbits - 1)))
+            ret = 1;
+    }
+    else {
+        if (res->s < 0)
+            ret = -1;
+        else if (nbits < 64 && res->s >= (1LL << nbits))
+            ret = 1;
+    }
+    Py_DECREF(index);
+    return ret;
+}
+
+/* Set res to the minimal (when high is 0) or maximal (otherwise) value
+   of the integer type t with given itemsize. */
+static void
+cmp_limit(char t, Py_ssize_t itemsize, int high, cmp_value *res)
+{
+    int nbits = 8 * (int) itemsize;
+
+    if (Py_ISLOWER(t))
+        res->s = high ? (long long) (((unsigned long long) 1 <<
+                                      (nbits - 1)) - 1)
+                      : -1 - (long long) (((unsigned long long) 1 <<
+                                           (nbits - 1)) - 1);
+    else
+        res->u = high ? ((unsigned long long) -1 >> (64 - nbits)) : 0;
+}
+
+/* Evaluate the predicate (op, low, high) over all elements of buffer, and
+   return the result as a new bitarray. */
+static PyObject *
+compare_buffer(PyObject *obj, enum cmp_op op, PyObject *lowobj,
+               PyObject *highobj, const char *endian_str)
+{
+    void (*kernel)(const void *, idx_t, enum cmp_op,
+                   cmp_value, cmp_value, unsigned char *) = NULL;
+    PyObject *res = NULL;
+    bitarrayobject *a;
+    Py_buffer view;
+    cmp_value low, high;
+    int endian, rl = 0, rh = 0, constant = -1;
+    char t;
+    idx_t n, i;
+
+    if ((endian = endian_from_string(endian_str)) == -2)
+        return NULL;
+    if (PyObject_GetBuffer(obj, &view, PyBUF_CONTIG_RO | PyBUF_FORMAT) < 0)
+        return NULL;
+    if ((t = buffer_type(&view, CMP_TYPES)) == 0)
+        goto done;
+    n = view.len / view.itemsize;
+
+    if ((rl = cmp_convert(lowobj, t, view.itemsize, &low)) == -2)
+        goto done;
+    if (op == OP_BETWEEN) {
+        if ((rh = cmp_convert(highobj, t, view.itemsize, &high)) == -2)
+            goto done;
+        if (rl == 1 || rh == -1)
+            /* empty range */
+            constant = 0;
+        /* clamp the bounds to the range of the type */
+        if (rl == -1)
+            cmp_limit(t, view.itemsize, 0, &low);
+        if (rh == 1)
+            cmp_limit(t, view.itemsize, 1, &high);
+    }
+    else if (rl) {
+        /* value outside the range of the type */
+        switch (op) {
+        case OP_LT: case OP_LE: constant = rl == 1; break;
+        case OP_GT: case OP_GE: constant = rl == -1; break;
+        case OP_EQ: constant = 0; break;
+        default: constant = 1;
+        }
+    }
+    else {
+        high = low;
+    }
+
+    if ((res = new_zeros(NULL, n, endian)) == NULL)
+        goto done;
+    a = (bitarrayobject *) res;
+
+    if (constant >= 0) {
+        memset(a->ob_item, constant ? 0xff : 0x00, (size_t) Py_SIZE(a));
+        setunused(a);
+        goto done;
+    }
+
+    switch (t) {
+    case 'b': kernel = cmp_b; break;
+    case 'B': kernel = cmp_B; break;
+    case 'h': kernel = cmp_h; break;
+    case 'H': kernel = cmp_H; break;
+    case 'i': kernel = cmp_i; break;
+    case 'I': kernel = cmp_I; break;
+    case 'l': kernel = cmp_l; break;
+    case 'L': kernel = cmp_L; break;
+    case 'q': kernel = cmp_q; break;
+    case 'Q': kernel = cmp_Q; break;
+    case 'f': kernel = cmp_f; break;
+    case 'd': kernel = cmp_d; break;
+    }
+    kernel(view.buf, n, op, low, high, (unsigned char *) a->ob_item);
+    if (a->endian == ENDIAN_BIG)
+        for (i = 0; i < Py_SIZE(a); i++)
+            a->ob_item[i] = reverse_trans[(unsigned char) a->ob_item[i]];
+
+ done:
+    PyBuffer_Release(&view);
+    if (PyErr_Occurred())
+        Py_CLEAR(res);
+    return res;
+}
+
+static PyObject *
+compare(PyObject *module, PyObject *args)
+{
+    PyObject *obj, *value;
+    char *op_str, *endian_str = NULL;
+    static const char *ops[] = {"<", "<=", "==", "!=", ">", ">=", NULL};
+    int op;
+
+    if (!PyArg_ParseTuple(args, "OsO|z:compare",
+                          &obj, &op_str, &value, &endian_str))
+        return NULL;
+
+    for (op = 0; ops[op]; op++)
+        if (strcmp(op_str, ops[op]) == 0)
+            return compare_buffer(obj, (enum cmp_op) op, value, NULL,
+                                  endian_str);
+
+    PyErr_Format(PyExc_ValueError, "operator must be one of '<', '<=', "
+                 "'==', '!=', '>', '>=', got '%s'", op_str);
+    return NULL;
+}
+
+PyDoc_STRVAR(compare_doc,
+"compare(buffer, op, value, /, endian=None) -> bitarray\n\
+\n\
+Compare each element of `buffer` (any object exposing integer or float\n\
+elements through the buffer protocol, e.g. `array.array` or\n\
+`numpy.ndarray`) with `value`.  The operator `op` is one of the strings\n\
+`'<'`, `'<='`, `'=='`, `'!='`, `'>'` or `'>='`.  Return a bitarray (with\n\
+given endianness) which is 1 for each element satisfying the comparison.\n\
+The results are written directly as packed bits, no intermediate boolean\n\
+array is created.");
+
+
+static PyObject *
+between(PyObject *module, PyObject *args)
+{
+    PyObject *obj, *low, *high;
+    char *endian_str = NULL;
+
+    if (!PyArg_ParseTuple(args, "OOO|z:between",
+                          &obj, &low, &high, &endian_str))
+        return NULL;
+
+    return compare_buffer(obj, OP_BETWEEN, low, high, endian_str);
+}
+
+PyDoc_STRVAR(between_doc,
+"between(buffer, low, high, /, endian=None) -> bitarray\n\
+\n\
+Return a bitarray (with given endianness) which is 1 for each element `x`\n\
+of `buffer` with `low <= x <= high`.  See `compare()`.");
+
+
+static PyObject *
+filter(PyObject *module, PyObject *args)
+{
+    PyObject *obj, *mask, *res = NULL;
+    bitarrayobject *m;
+    Py_buffer view;
+    const char *src;
+    char *dst;
+    Py_ssize_t itemsize, nbytes, i;
+    idx_t n, count = 0;
+    unsigned char c;
+    int k;
+
+    if (!PyArg_ParseTuple(args, "OO:filter", &obj, &mask))
+        return NULL;
+    if (!bitarray_Check(mask)) {
+        PyErr_SetString(PyExc_TypeError, "bitarray expected for mask");
+        return NULL;
+    }
+    m = (bitarrayobject *) mask;
+    if (PyObject_GetBuffer(obj, &view, PyBUF_CONTIG_RO) < 0)
+        return NULL;
+    itemsize = view.itemsize;
+    n = view.len / itemsize;
+    if (m->nbits != n) {
+        PyErr_Format(PyExc_ValueError, "mask of length %zd (number of "
+                     "buffer elements) expected, got %zd",
+                     (Py_ssize_t) n, (Py_ssize_t) m->nbits);
+        goto done;
+    }
+
+    setunused(m);
+    nbytes = Py_SIZE(m);
+    count = bitarray_api->kernels->count(m->ob_item, nbytes);
+
+    /* one extra element, as the loop below always copies an element
+       (possibly just past the result) and then advances conditionally */
+    res = PyBytes_FromStringAndSize(NULL, (Py_ssize_t) (count + 1) *
+                                          itemsize);
+    if (res == NULL)
+        goto done;
+    src = (const char *) view.buf;
+    dst = PyBytes_AS_STRING(res);
+
+    for (i = 0; i < nbytes; i++, src += 8 * itemsize) {
+        c = (unsigned char) m->ob_item[i];
+        if (c == 0)
+            continue;
+        if (m->endian == ENDIAN_BIG)
+            c = reverse_trans[c];
+        if (c == 0xff) {
+            memcpy(dst, src, (size_t) (8 * itemsize));
+            dst += 8 * itemsize;
+            continue;
+        }
+        /* branch free, as mask bits tend to be unpredictable */
+        for (k = 0; k < 8 && 8 * i + k < n; k++) {
+            memcpy(dst, src + k * itemsize, (size_t) itemsize);
+            dst += itemsize * ((c >> k) & 1);
+        }
+    }
+    _PyBytes_Resize(&res, (Py_ssize_t) count * itemsize);
+ done:
+    PyBuffer_Release(&view);
+    return res;
+}
+
+PyDoc_STRVAR(filter_doc,
+"filter(buffer, mask, /) -> bytes\n\
+\n\
+Return the elements of `buffer` (any contiguous object supporting the\n\
+buffer protocol with fixed size elements) for which the bitarray `mask`\n\
+is 1, as a bytes object.  The length of `mask` has to equal the number\n\
+of elements in `buffer`.");
+
+
+/***************************** interleaving ******************************/
+
+#define MAX_STREAMS  8
+
+/* Spread the bits of each byte value with stride k, i.e. set bit i of
+   the byte value x to bit i * k of spread[x]. */
+static void
+setup_spread(int k, word_t *spread)
+{
+    int x, i;
+
+    for (x = 0; x < 256; x++) {
+        spread[x] = 0;
+        for (i = 0; i < 8; i++)
+            if (x & (1 << i))
+                spread[x] |= ((word_t) 1) << (i * k);
+    }
+}
+
+static PyObject *
+interleave(PyObject *module, PyObject *args)
+{
+    PyObject *seq, *res = NULL, *item;
+    /* initialized, as the compiler cannot tell that k >= 1 below */
+    bitarrayobject *streams[MAX_STREAMS] = {NULL}, *a;
+    word_t spread[256], w;
+    unsigned char c;
+    idx_t n, i;
+    int k, j, q;
+
+    if (!PyArg_ParseTuple(args, "O:interleave", &seq))
+        return NULL;
+    seq = PySequence_Fast(seq, "sequence of bitarrays expected");
+    if (seq == NULL)
+        return NULL;
+
+    k = (int) Py_MIN(PySequence_Fast_GET_SIZE(seq), MAX_STREAMS + 1);
+    if (k < 1 || k > MAX_STREAMS) {
+        PyErr_Format(PyExc_ValueError, "1 to %d bitarrays expected",
+                     MAX_STREAMS);
+        goto done;
+    }
+    for (j = 0; j < k; j++) {
+        item = PySequence_Fast_GET_ITEM(seq, j);
+        if (!bitarray_Check(item)) {
+            PyErr_SetString(PyExc_TypeError, "bitarray expected");
+            goto done;
+        }
+        streams[j] = (bitarrayobject *) item;
+        if (streams[j]->nbits != streams[0]->nbits) {
+            PyErr_SetString(PyExc_ValueError,
+                            "bitarrays of equal length expected");
+            goto done;
+        }
+    }
+    n = streams[0]->nbits;
+    res = new_zeros((PyObject *) Py_TYPE(streams[0]), k * n,
+                    streams[0]->endian);
+    if (res == NULL)
+        goto done;
+    a = (bitarrayobject *) res;
+
+    /* each group of 8 bits per stream makes k bytes of the result */
+    setup_spread(k, spread);
+    for (i = 0; i + 8 <= n; i += 8) {
+        w = 0;
+        for (j = 0; j < k; j++)
+            w |= spread[get_byte(streams[j], i)] << j;
+        for (q = 0; q < k; q++) {
+            c = (unsigned char) (w >> (8 * q));
+            a->ob_item[k * i / 8 + q] = a->endian == ENDIAN_LITTLE ? c :
+                                                         reverse_trans[c];
+        }
+    }
+    for (; i < n; i++)
+        for (j = 0; j < k; j++)
+            setbit(a, k * i + j, GETBIT(streams[j], i));
+ done:
+    Py_DECREF(seq);
+    return res;
+}
+
+PyDoc_STRVAR(interleave_doc,
+"interleave(sequence, /) -> bitarray\n\
+\n\
+Interleave the bits of k (1 to 8) bitarrays of equal length, i.e. return\n\
+a bitarray `a` with `a[k * i + j] == sequence[j][i]` (e.g. Morton order\n\
+keys from coordinate bitarrays).  The result has the endianness of the\n\
+first bitarray.");
+
+
+static PyObject *
+deinterleave(PyObject *module, PyObject *args)
+{
+    PyObject *list, *item;
+    bitarrayobject *a, *streams[MAX_STREAMS];
+    word_t table[MAX_STREAMS][256];
+    word_t w;
+    unsigned char c;
+    idx_t n, i, g;
+    int k, j, q, x;
+
+    if (!PyArg_ParseTuple(args, "Oi:deinterleave", &a, &k))
+        return NULL;
+    if (!bitarray_Check((PyObject *) a)) {
+        PyErr_SetString(PyExc_TypeError, "bitarray expected");
+        return NULL;
+    }
+    if (k < 1 || k > MAX_STREAMS) {
+        PyErr_Format(PyExc_ValueError, "k must be in range 1 to %d, got %d",
+                     MAX_STREAMS, k);
+        return NULL;
+    }
+    if (a->nbits % k) {
+        PyErr_Format(PyExc_ValueError, "length of bitarray must be multiple "
+                     "of %d, got %zd", k, (Py_ssize_t) a->nbits);
+        return NULL;
+    }
+    n = a->nbits / k;
+
+    if ((list = PyList_New(k)) == NULL)
+        return NULL;
+    for (j = 0; j < k; j++) {
+        item = new_zeros((PyObject *) Py_TYPE(a), n, a->endian);
+        if (item == NULL) {
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, j, item);
+        streams[j] = (bitarrayobject *) item;
+    }
+
+    /* table[q][x] has byte j set to the bits of stream j contained in the
+       byte value x at byte position q within a group of k bytes */
+    for (q = 0; q < k; q++)
+        for (x = 0; x < 256; x++) {
+            table[q][x] = 0;
+            for (j = 0; j < 8; j++)
+                if (x & (1 << j)) {
+                    g = 8 * q + j;
+                    table[q][x] |= ((word_t) 1) << (8 * (g % k) + g / k);
+                }
+        }
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        w = 0;
+        for (q = 0; q < k; q++)
+            w |= table[q][get_byte(a, k * i + 8 * q)];
+        for (j = 0; j < k; j++) {
+            c = (unsigned char) (w >> (8 * j));
+            streams[j]->ob_item[i / 8] = a->endian == ENDIAN_LITTLE ? c :
+                                                         reverse_trans[c];
+        }
+    }
+    for (; i < n; i++)
+        for (j = 0; j < k; j++)
+            setbit(streams[j], i, GETBIT(a, k * i + j));
+
+    return list;
+}
+
+PyDoc_STRVAR(deinterleave_doc,
+"deinterleave(bitarray, k, /) -> list\n\
+\n\
+Split a bitarray into k (1 to 8) bitarrays, such that bit `i` of the\n\
+j-th bitarray is bit `k * i + j` of the input.  This is the inverse of\n\
+`interleave()`.");
+
+
+/**************************** DNA sequences ******************************/
+
+/* Nucleotides are stored as 2 bits each: A = 00, C = 01, G = 10, T = 11,
+   such that the complement of a nucleotide is obtained by inverting its
+   bits.  Base i consists of the bits 2 * i (high) and 2 * i + 1 (low). */
+
+static const char dna_letters[] = "ACGT";
+
+/* map ASCII characters to nucleotide codes (0xff for invalid characters) */
+static unsigned char dna_code[256];
+
+/* map a byte with bits in big-endian order (the first base in the most
+   significant bits) to the byte with the order of its 4 bases reversed */
+static unsigned char dna_reverse[256];
+
+static void
+setup_dna_tables(void)
+{
+    int i, m;
+
+    memset(dna_code, 0xff, 256);
+    for (i = 0; i < 4; i++) {
+        dna_code[(unsigned char) dna_letters[i]] = (unsigned char) i;
+        dna_code[(unsigned char) dna_letters[i] + 32] = (unsigned char) i;
+    }
+    for (i = 0; i < 256; i++) {
+        dna_reverse[i] = 0;
+        for (m = 0; m < 4; m++)
+            dna_reverse[i] |= ((i >> (2 * m)) & 3) << (6 - 2 * m);
+    }
+}
+
+/* Return the 4 bases a[p:p+8] as a byte in big-endian bit order, i.e.
+   with the code of the first base in the 2 most significant bits. */
+#define DNA_BYTE(a, p)  reverse_trans[get_byte((a), (p))]
+
+static int
+dna_check(bitarrayobject *a)
+{
+    if (a->nbits % 2) {
+        PyErr_Format(PyExc_ValueError, "bitarray of even length expected "
+                     "(2 bits per nucleotide), got %zd",
+                     (Py_ssize_t) a->nbits);
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject *
+dna2ba(PyObject *module, PyObject *args)
+{
+    PyObject *res;
+    bitarrayobject *a;
+    const unsigned char *str;
+    char *endian_str = NULL;
+    Py_ssize_t n, i, j;
+    unsigned char c, invalid = 0;
+    int endian;
+
+    if (!PyArg_ParseTuple(args, "s#|z:dna2ba", &str, &n, &endian_str))
+        return NULL;
+    if ((endian = endian_from_string(endian_str)) == -2)
+        return NULL;
+    if ((res = new_zeros(NULL, 2 * (idx_t) n, endian)) == NULL)
+        return NULL;
+    a = (bitarrayobject *) res;
+
+    /* 4 nucleotides per byte - invalid characters (which have the high
+       bit set in dna_code) are only checked for once at the end */
+    for (i = 0; i + 4 <= n; i += 4) {
+        c = 0;
+        for (j = 0; j < 4; j++) {
+            invalid |= dna_code[str[i + j]];
+            c = (unsigned char) ((c << 2) | (dna_code[str[i + j]] & 3));
+        }
+        a->ob_item[i / 4] = a->endian == ENDIAN_BIG ? c : reverse_trans[c];
+    }
+    for (; i < n; i++) {
+        c = dna_code[str[i]];
+        invalid |= c;
+        setbit(a, 2 * i, c >> 1 & 1);
+        setbit(a, 2 * i + 1, c & 1);
+    }
+    if (invalid & 0x80) {
+        for (i = 0; dna_code[str[i]] != 0xff; i++) ;
+        PyErr_Format(PyExc_ValueError, "invalid nucleotide '%c' at "
+                     "position %zd", str[i], i);
+        Py_DECREF(res);
+        return NULL;
+    }
+    return res;
+}
+
+PyDoc_STRVAR(dna2ba_doc,
+"dna2ba(string, /, endian=None) -> bitarray\n\
+\n\
+Convert a nucleotide string (consisting of the letters A, C, G and T, in\n\
+upper or lower case) into a bitarray (with given endianness) using 2\n\
+bits per nucleotide: A = 00, C = 01, G = 10, T = 11.");
+
+
+static PyObject *
+ba2dna(PyObject *module, PyObject *args)
+{
+    PyObject *res;
+    bitarrayobject *a;
+    char *str;
+    Py_ssize_t n, i;
+    unsigned char c;
+    int m;
+
+    if (!PyArg_ParseTuple(args, "O:ba2dna", &a))
+        return NULL;
+    if (!bitarray_Check((PyObject *) a)) {
+        PyErr_SetString(PyExc_TypeError, "bitarray expected");
+        return NULL;
+    }
+    if (dna_check(a) < 0)
+        return NULL;
+    n = (Py_ssize_t) (a->nbits / 2);
+
+    str = (char *) PyMem_Malloc((size_t) n + 1);
+    if (str == NULL)
+        return PyErr_NoMemory();
+    for (i = 0; i + 4 <= n; i += 4) {
+        c = (unsigned char) a->ob_item[i / 4];
+        if (a->endian == ENDIAN_LITTLE)
+            c = reverse_trans[c];
+        for (m = 0; m < 4; m++)
+            str[i + m] = dna_letters[(c >> (6 - 2 * m)) & 3];
+    }
+    for (; i < n; i++)
+        str[i] = dna_letters[2 * GETBIT(a, 2 * i) + GETBIT(a, 2 * i + 1)];
+
+    res = Py_BuildValue("s#", str, n);
+    PyMem_Free((void *) str);
+    return res;
+}
+
+PyDoc_STRVAR(ba2dna_doc,
+"ba2dna(bitarray, /) -> str\n\
+\n\
+Return the nucleotide string (of upper case letters) of a bitarray with\n\
+2 bits per nucleotide.  This is the inverse of `dna2ba()`.");
+
+
+static PyObject *
+dna_revcomp(PyObject *module, PyObject *args)
+{
+    PyObject *res;
+    bitarrayobject *a, *b;
+    idx_t n, p;
+    unsigned char c;
+
+    if (!PyArg_ParseTuple(args, "O:dna_revcomp", &a))
+        return NULL;
+    if (!bitarray_Check((PyObject *) a)) {
+        PyErr_SetString(PyExc_TypeError, "bitarray expected");
+        return NULL;
+    }
+    if (dna_check(a) < 0)
+        return NULL;
+    n = a->nbits;
+    if ((res = new_zeros((PyObject *) Py_TYPE(a), n, a->endian)) == NULL)
+        return NULL;
+    b = (bitarrayobject *) res;
+
+    /* b[p:p+8] are the (reversed and complemented) 4 bases a[n-p-8:n-p] */
+    for (p = 0; p + 8 <= n; p += 8) {
+        c = (unsigned char) ~dna_reverse[DNA_BYTE(a, n - p - 8)];
+        b->ob_item[p / 8] = b->endian == ENDIAN_BIG ? c : reverse_trans[c];
+    }
+    for (; p < n; p += 2) {
+        setbit(b, p, !GETBIT(a, n - p - 2));
+        setbit(b, p + 1, !GETBIT(a, n - p - 1));
+    }
+    return res;
+}
+
+PyDoc_STRVAR(dna_revcomp_doc,
+"dna_revcomp(bitarray, /) -> bitarray\n\
+\n\
+Return the reverse complement of a nucleotide sequence stored with 2\n\
+bits per nucleotide (see `dna2ba()`).");
+
+
+static PyObject *
+dna_kmers(PyObject *module, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"", "", "canonical", NULL};
+    PyObject *res;
+    bitarrayobject *a;
+    word_t fwd = 0, rev = 0, mask, code, x;
+    char *out;
+    idx_t n, i;
+    int k, canonical = 0, m;
+    unsigned char c = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "Oi|i:dna_kmers", kwlist,
+                                     &a, &k, &canonical))
+        return NULL;
+    if (!bitarray_Check((PyObject *) a)) {
+        PyErr_SetString(PyExc_TypeError, "bitarray expected");
+        return NULL;
+    }
+    if (dna_check(a) < 0)
+        return NULL;
+    if (k < 1 || k > 32) {
+        PyErr_Format(PyExc_ValueError, "k must be in range 1 to 32, got %d",
+                     k);
+        return NULL;
+    }
+    n = a->nbits / 2;
+    res = PyBytes_FromStringAndSize(NULL, (Py_ssize_t) (n < k ? 0 :
+                                          (n - k + 1) * sizeof(word_t)));
+    if (res == NULL || n < k)
+        return res;
+    out = PyBytes_AS_STRING(res);
+
+    mask = k == 32 ? ~((word_t) 0) : (((word_t) 1) << (2 * k)) - 1;
+    for (i = 0; i < n; i++) {
+        if (i % 4 == 0) {
+            /* load the next (up to) 4 bases */
+            if (2 * i + 8 <= a->nbits) {
+                c = DNA_BYTE(a, 2 * i);
+            }
+            else {
+                c = 0;
+                for (m = 0; i + m < n; m++)
+                    c |= (2 * GETBIT(a, 2 * (i + m)) +
+                          GETBIT(a, 2 * (i + m) + 1)) << (6 - 2 * m);
+            }
+        }
+        code = (c >> (6 - 2 * (i % 4))) & 3;
+        fwd = ((fwd << 2) | code) & mask;
+        rev = (rev >> 2) | ((3 ^ code) << (2 * k - 2));
+        if (i + 1 >= k) {
+            /* the bytes data is not necessarily aligned to 8 bytes */
+            x = (canonical && rev < fwd) ? rev : fwd;
+            memcpy(out + (i + 1 - k) * sizeof(word_t), &x, sizeof(word_t));
+        }
+    }
+    return res;
+}
+
+PyDoc_STRVAR(dna_kmers_doc,
+"dna_kmers(bitarray, k, /, canonical=False) -> bytes\n\
+\n\
+Return all k-mers (1 <= k <= 32) of a nucleotide sequence stored with 2\n\
+bits per nucleotide (see `dna2ba()`), as a buffer of native unsigned\n\
+64-bit integers (e.g. for `array.array('Q', ...)` or\n\
+`numpy.frombuffer(..., dtype=numpy.uint64)`).  Each k-mer is encoded as\n\
+the integer with the 2-bit codes of its nucleotides (the first being the\n\
+most significant).  When `canonical` is true, the smaller of the k-mer\n\
+and its reverse complement is returned.");
+
+
+static PyObject *
+dna_gc(PyObject *module, PyObject *args)
+{
+    bitarrayobject *a;
+    Py_ssize_t i;
+    idx_t res = 0;
+    unsigned char c;
+
+    if (!PyArg_ParseTuple(args, "O:dna_gc", &a))
+        return NULL;
+    if (!bitarray_Check((PyObject *) a)) {
+        PyErr_SetString(PyExc_TypeError, "bitarray expected");
+        return NULL;
+    }
+    if (dna_check(a) < 0)
+        return NULL;
+
+    /* C = 01 and G = 10 are the nucleotides whose 2 bits differ - as the
+       bases are aligned to bit pairs within each byte, the count does not
+       depend on the bit endianness */
+    setunused(a);
+    for (i = 0; i < Py_SIZE(a); i++) {
+        c = (unsigned char) a->ob_item[i];
+        res += bitcount_lookup[(c ^ (c >> 1)) & 0x55];
+    }
+    return PyLong_FromLongLong(res);
+}
+
+PyDoc_STRVAR(dna_gc_doc,
+"dna_gc(bitarray, /) -> int\n\
+\n\
+Return the number of G and C nucleotides in a sequence stored with 2 bits\n\
+per nucleotide (see `dna2ba()`).");
+
+
+/************************* two dimensional images ************************/
+
+/* The functions below operate on bitarrays holding 2D images with rows of
+   given width, where row y starts at bit offset + y * stride. */
+
+enum blit_op {BLIT_COPY, BLIT_AND, BLIT_OR, BLIT_XOR};
+
+static int
+check_rect(bitarrayobject *a, idx_t offset, idx_t stride,
+           idx_t width, idx_t height)
+{
+    if (offset < 0 || stride < 0 || width < 0 || height < 0 ||
+        (height > 0 && offset + (height - 1) * stride + width > a->nbits)) {
+        PyErr_SetString(PyExc_ValueError, "rectangle out of range");
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject *
+blit(PyObject *module, PyObject *args)
+{
+    bitarrayobject *dst, *src;
+    idx_t doff, dstride, soff, sstride, width, height, y;
+    Py_ssize_t nwords, k;
+    word_t *w, *v = NULL;
+    int op;
+
+    if (!PyArg_ParseTuple(args, "OLLOLLLLi:_blit", &dst, &doff, &dstride,
+                          &src, &soff, &sstride, &width, &height, &op))
+        return NULL;
+    if (!bitarray_Check((PyObject *) dst) ||
+                                    !bitarray_Check((PyObject *) src)) {
+        PyErr_SetString(PyExc_TypeError, "bitarray expected");
+        return NULL;
+    }
+    if (check_rect(dst, doff, dstride, width, height) < 0 ||
+        check_rect(src, soff, sstride, width, height) < 0)
+        return NULL;
+    if (op < BLIT_COPY || op > BLIT_XOR) {
+        PyErr_SetString(PyExc_ValueError, "invalid blit operation");
+        return NULL;
+    }
+
+    nwords = (Py_ssize_t) WORDS(width);
+    w = (word_t *) PyMem_Malloc(2 * nwords * sizeof(word_t) + 1);
+    if (w == NULL)
+        return PyErr_NoMemory();
+    v = w + nwords;
+    if (width > 0 && height > 0)
+        MARK_DIRTY_BITS(dst, doff, doff + (height - 1) * dstride + width);
+
+    /* when the source and destination rows overlap within the same
+       bitarray, copy the rows in an order which does not overwrite rows
+       before they are read */
+    for (y = 0; y < height; y++) {
+        const idx_t row = (dst == src && doff > soff) ? height - 1 - y : y;
+
+        load_words(src, soff + row * sstride, width, w);
+        if (op != BLIT_COPY) {
+            load_words(dst, doff + row * dstride, width, v);
+            for (k = 0; k < nwords; k++)
+                switch (op) {
+                case BLIT_AND: w[k] &= v[k]; break;
+                case BLIT_OR:  w[k] |= v[k]; break;
+                case BLIT_XOR: w[k] ^= v[k]; break;
+                }
+        }
+        store_words(dst, doff + row * dstride, width, w);
+    }
+    PyMem_Free((void *) w);
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+transpose(PyObject *module, PyObject *args)
+{
+    PyObject *res;
+    bitarrayobject *a, *b;
+    idx_t offset, stride, width, height, bstride, bx, by;
+    unsigned char c;
+    word_t x;
+    int r;
+
+    if (!PyArg_ParseTuple(args, "OLLLL:_transpose", &a, &offset, &stride,
+                          &width, &height))
+        return NULL;
+    if (!bitarray_Check((PyObject *) a)) {
+        PyErr_SetString(PyExc_TypeError, "bitarray expected");
+        return NULL;
+    }
+    if (check_rect(a, offset, stride, width, height) < 0)
+        return NULL;
+
+    /* the result has width rows of height bits, padded to full bytes */
+    bstride = 8 * BYTES(height);
+    res = new_zeros((PyObject *) Py_TYPE(a), width * bstride, a->endian);
+    if (res == NULL)
+        return NULL;
+    b = (bitarrayobject *) res;
+
+    /* transpose blocks of 8 x 8 bits, which are loaded with pixel
+       (x, y) of the block as bit 8 * y + x of a word */
+    for (by = 0; by < height; by += 8) {
+        for (bx = 0; bx < width; bx += 8) {
+            x = 0;
+            for (r = 0; r < 8 && by + r < height; r++) {
+                const idx_t p = offset + (by + r) * stride + bx;
+
+                if (bx + 8 <= width) {
+                    c = get_byte(a, p);
+                }
+                else {
+                    int i;
+                    for (c = 0, i = 0; bx + i < width; i++)
+                        c |= GETBIT(a, p + i) << i;
+                }
+                x |= ((word_t) c) << (8 * r);
+            }
+            if (x == 0)
+                continue;
+            x = transpose8(x);
+            for (r = 0; r < 8 && bx + r < width; r++) {
+                c = (unsigned char) (x >> (8 * r));
+                b->ob_item[((bx + r) * bstride + by) / 8] =
+                    b->endian == ENDIAN_LITTLE ? c : reverse_trans[c];
+            }
+        }
+    }
+    return res;
+}
+
+
+/*************************** multiple patterns ****************************/
+
+/* The multisearch object is an Aho-Corasick automaton over the bits of a
+   set of patterns.  Its states are the nodes of the trie of all patterns,
+   and delta[2 * s + bit] is the state after reading bit in state s.
+   Additionally, bytenext[256 * s + c] is the state after reading the 8
+   bits of c (least significant bit first), with MATCH_FLAG set when a
+   pattern ends within these 8 bits.  Thus, the search only steps through
+   the bits one by one for bytes which contain the end of a match. */
+
+#define MATCH_FLAG  0x80000000U
+
+typedef struct {
+    PyObject_HEAD
+    Py_ssize_t npatterns;
+    idx_t *plen;                /* length of each pattern */
+    Py_ssize_t nstates;
+    int *delta;                 /* bit transitions */
+    unsigned int *bytenext;     /* byte transitions */
+    int *outstart;              /* start of output list in outlist */
+    int *outlist;               /* pattern ids ending in state, or -1 */
+} multisearchobject;
+
+static void
+multisearch_free(multisearchobject *self)
+{
+    PyMem_Free(self->plen);
+    PyMem_Free(self->delta);
+    PyMem_Free(self->bytenext);
+    PyMem_Free(self->outstart);
+    PyMem_Free(self->outlist);
+}
+
+static void
+multisearch_dealloc(multisearchobject *self)
+{
+    multisearch_free(self);
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+/* build the automaton from the sequence of bitarrays seq */
+static int
+multisearch_build(multisearchobject *self, PyObject *seq)
+{
+    bitarrayobject *a;
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq), maxstates = 1, i;
+    int *term = NULL, *termnext = NULL, *fail = NULL, *queue = NULL;
+    int s, t, b, nout, head, tail;
+    unsigned int st;
+    idx_t j;
+
+    for (i = 0; i < n; i++) {
+        a = (bitarrayobject *) PySequence_Fast_GET_ITEM(seq, i);
+        if (!bitarray_Check((PyObject *) a)) {
+            PyErr_SetString(PyExc_TypeError, "bitarray expected");
+            return -1;
+        }
+        if (a->nbits == 0) {
+            PyErr_SetString(PyExc_ValueError,
+                            "can't search for empty bitarray");
+            return -1;
+        }
+        maxstates += a->nbits;
+        if (maxstates > INT_MAX / 256) {
+            PyErr_SetString(PyExc_OverflowError, "patterns too long");
+            return -1;
+        }
+    }
+    self->npatterns = n;
+    self->plen = PyMem_New(idx_t, n + 1);
+    self->delta = PyMem_New(int, 2 * maxstates);
+    term = PyMem_New(int, maxstates);
+    termnext = PyMem_New(int, n + 1);
+    fail = PyMem_New(int, maxstates);
+    queue = PyMem_New(int, maxstates);
+    if (!self->plen || !self->delta || !term || !termnext || !fail ||
+                                                                  !queue) {
+        PyErr_NoMemory();
+        goto error;
+    }
+
+    /* trie, where term[s] is the first pattern ending in state s, and
+       termnext[i] the next pattern ending in the same state as pattern i
+       (the patterns are inserted in reverse order, such that these lists
+       are in increasing order) */
+    self->nstates = 1;
+    self->delta[0] = self->delta[1] = -1;
+    term[0] = -1;
+    for (i = n - 1; i >= 0; i--) {
+        a = (bitarrayobject *) PySequence_Fast_GET_ITEM(seq, i);
+        self->plen[i] = a->nbits;
+        s = 0;
+        for (j = 0; j < a->nbits; j++) {
+            b = GETBIT(a, j);
+            if (self->delta[2 * s + b] < 0) {
+                t = (int) self->nstates++;
+                self->delta[2 * t] = self->delta[2 * t + 1] = -1;
+                term[t] = -1;
+                self->delta[2 * s + b] = t;
+            }
+            s = self->delta[2 * s + b];
+        }
+        termnext[i] = term[s];
+        term[s] = (int) i;
+    }
+
+    /* breadth first traversal, which completes delta to the automaton's
+       transitions, and counts the total size of the output lists */
+    nout = 0;
+    head = tail = 0;
+    queue[tail++] = 0;
+    fail[0] = 0;
+    while (head < tail) {
+        s = queue[head++];
+        for (b = 0; b < 2; b++) {
+            t = self->delta[2 * s + b];
+            /* the transition of the fail state (which is less deep) */
+            st = s ? (unsigned int) self->delta[2 * fail[s] + b] : 0;
+            if (t < 0) {
+                self->delta[2 * s + b] = (int) st;
+            }
+            else {
+                fail[t] = (int) st;
+                queue[tail++] = t;
+            }
+        }
+    }
+    /* output lists, which are built in breadth first order such that the
+       list of the fail state is already complete */
+    for (head = 0; head < tail; head++) {
+        s = queue[head];
+        for (t = s; t; t = fail[t])
+            for (i = term[t]; i >= 0; i = termnext[i])
+                nout++;
+        nout++;
+    }
+    self->outstart = PyMem_New(int, self->nstates);
+    self->outlist = PyMem_New(int, nout);
+    self->bytenext = PyMem_New(unsigned int, 256 * self->nstates);
+    if (!self->outstart || !self->outlist || !self->bytenext) {
+        PyErr_NoMemory();
+        goto error;
+    }
+    nout = 0;
+    for (head = 0; head < tail; head++) {
+        s = queue[head];
+        self->outstart[s] = nout;
+        for (i = term[s]; i >= 0; i = termnext[i])
+            self->outlist[nout++] = (int) i;
+        if (s)
+            for (t = self->outstart[fail[s]]; self->outlist[t] >= 0; t++)
+                self->outlist[nout++] = self->outlist[t];
+        self->outlist[nout++] = -1;
+    }
+
+    for (s = 0; s < self->nstates; s++)
+        for (b = 0; b < 256; b++) {
+            unsigned int flag = 0;
+
+            t = s;
+            for (j = 0; j < 8; j++) {
+                t = self->delta[2 * t + ((b >> j) & 1)];
+                if (self->outlist[self->outstart[t]] >= 0)
+                    flag = MATCH_FLAG;
+            }
+            self->bytenext[256 * s + b] = (unsigned int) t | flag;
+        }
+
+    PyMem_Free(term);
+    PyMem_Free(termnext);
+    PyMem_Free(fail);
+    PyMem_Free(queue);
+    return 0;
+
+ error:
+    PyMem_Free(term);
+    PyMem_Free(termnext);
+    PyMem_Free(fail);
+    PyMem_Free(queue);
+    return -1;
+}
+
+static PyObject *
+multisearch_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    multisearchobject *self;
+    PyObject *seq;
+
+    if (kwds && PyDict_Size(kwds)) {
+        PyErr_SetString(PyExc_TypeError,
+                        "multisearch() takes no keyword arguments");
+        return NULL;
+    }
+    if (!PyArg_ParseTuple(args, "O:multisearch", &seq))
+        return NULL;
+    seq = PySequence_Fast(seq, "sequence of bitarrays expected");
+    if (seq == NULL)
+        return NULL;
+
+    self = (multisearchobject *) type->tp_alloc(type, 0);
+    if (self == NULL) {
+        Py_DECREF(seq);
+        return NULL;
+    }
+    /* tp_alloc initializes all pointers to NULL */
+    if (multisearch_build(self, seq) < 0) {
+        Py_DECREF(seq);
+        Py_DECREF(self);
+        return NULL;
+    }
+    Py_DECREF(seq);
+    return (PyObject *) self;
+}
+
+/* Append (pattern id, start position) of all patterns ending (at position
+   end) in state s to list.  Return the number of appended items, or -1
+   on error. */
+static int
+multisearch_emit(multisearchobject *self, int s, idx_t end, PyObject *list)
+{
+    PyObject *item;
+    int k, id, res = 0;
+
+    for (k = self->outstart[s]; (id = self->outlist[k]) >= 0; k++) {
+        item = Py_BuildValue("nL", (Py_ssize_t) id,
+                             end - self->plen[id] + 1);
+        if (item == NULL || PyList_Append(list, item) < 0) {
+            Py_XDECREF(item);
+            return -1;
+        }
+        Py_DECREF(item);
+        res++;
+    }
+    return res;
+}
+
+static PyObject *
+multisearch_search(multisearchobject *self, PyObject *args)
+{
+    PyObject *list;
+    bitarrayobject *a;
+    Py_ssize_t limit = -1, found = 0;
+    unsigned int st;
+    idx_t p, q;
+    int s = 0, k;
+
+    if (!PyArg_ParseTuple(args, "O|n:search", &a, &limit))
+        return NULL;
+    if (!bitarray_Check((PyObject *) a)) {
+        PyErr_SetString(PyExc_TypeError, "bitarray expected");
+        return NULL;
+    }
+    if ((list = PyList_New(0)) == NULL)
+        return NULL;
+    if (limit == 0)
+        return list;
+
+    for (p = 0; p < a->nbits; p += 8) {
+        if (p + 8 <= a->nbits) {
+            st = self->bytenext[256 * s + get_byte(a, p)];
+            if ((st & MATCH_FLAG) == 0) {
+                s = (int) st;
+                continue;
+            }
+        }
+        /* step bit by bit through a byte containing the end of a match,
+           or through the last bits */
+        for (q = p; q < a->nbits && q < p + 8; q++) {
+            s = self->delta[2 * s + GETBIT(a, q)];
+            if (self->outlist[self->outstart[s]] < 0)
+                continue;
+            if ((k = multisearch_emit(self, s, q, list)) < 0) {
+                Py_DECREF(list);
+                return NULL;
+            }
+            found += k;
+            if (limit > 0 && found >= limit) {
+                if (PyList_SetSlice(list, limit, found, NULL) < 0) {
+                    Py_DECREF(list);
+                    return NULL;
+                }
+                return list;
+            }
+        }
+    }
+    return list;
+}
+
+PyDoc_STRVAR(multisearch_search_doc,
+"search(bitarray, limit=<none>, /) -> list\n\
+\n\
+Return the list of tuples `(pattern_index, position)` for all matches of\n\
+all patterns, ordered by the end position of the matches (and longer\n\
+patterns first for matches ending at the same position).");
+
+static Py_ssize_t
+multisearch_len(multisearchobject *self)
+{
+    return self->npatterns;
+}
+
+static PySequenceMethods multisearch_as_sequence = {
+    (lenfunc) multisearch_len,                /* sq_length */
+};
+
+static PyMethodDef multisearch_methods[] = {
+    {"search",    (PyCFunction) multisearch_search, METH_VARARGS,
+     multisearch_search_doc},
+    {NULL,        NULL}  /* sentinel */
+};
+
+PyDoc_STRVAR(multisearch_doc,
+"multisearch(patterns, /) -> multisearch\n\
+\n\
+Compile a sequence of (non-empty) bitarrays into an object which finds\n\
+all occurrences of all patterns in a single pass over a bitarray, using\n\
+an Aho-Corasick automaton which steps through the bitarray one byte at a\n\
+time.  Use its method `search(bitarray, limit=<none>, /)` to obtain the\n\
+list of tuples `(pattern_index, position)` of all matches.");
+
+static PyTypeObject MultiSearch_Type = {
+#ifdef IS_PY3K
+    PyVarObject_HEAD_INIT(NULL, 0)
+#else
+    PyObject_HEAD_INIT(NULL)
+    0,                                        /* ob_size */
+#endif
+    "bitarray.util.multisearch",              /* tp_name */
+    sizeof(multisearchobject),                /* tp_basicsize */
+    0,                                        /* tp_itemsize */
+    /* methods */
+    (destructor) multisearch_dealloc,         /* tp_dealloc */
+    0,                                        /* tp_print */
+    0,                                        /* tp_getattr */
+    0,                                        /* tp_setattr */
+    0,                                        /* tp_compare */
+    0,                                        /* tp_repr */
+    0,                                        /* tp_as_number */
+    &multisearch_as_sequence,                 /* tp_as_sequence */
+    0,                                        /* tp_as_mapping */
+    0,                                        /* tp_hash */
+    0,                                        /* tp_call */
+    0,                                        /* tp_str */
+    PyObject_GenericGetAttr,                  /* tp_getattro */
+    0,                                        /* tp_setattro */
+    0,                                        /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,                       /* tp_flags */
+    multisearch_doc,                          /* tp_doc */
+    0,                                        /* tp_traverse */
+    0,                                        /* tp_clear */
+    0,                                        /* tp_richcompare */
+    0,                                        /* tp_weaklistoffset */
+    0,                                        /* tp_iter */
+    0,                                        /* tp_iternext */
+    multisearch_methods,                      /* tp_methods */
+    0,                                        /* tp_members */
+    0,                                        /* tp_getset */
+    0,                                        /* tp_base */
+    0,                                        /* tp_dict */
+    0,                                        /* tp_descr_get */
+    0,                                        /* tp_descr_set */
+    0,                                        /* tp_dictoffset */
+    0,                                        /* tp_init */
+    PyType_GenericAlloc,                      /* tp_alloc */
+    multisearch_new,                          /* tp_new */
+    PyObject_Del,                             /* tp_free */
+};
+
+
+/*********************** Arrow C data interface *************************/
+
+/* see https://arrow.apache.org/docs/format/CDataInterface.html and the
+   structures in bitarray.h */
+
+/* copy the n bits starting at bit offset of the little-endian bitmap buff
+   into the bitarray a */
+static void
+copy_bitmap(bitarrayobject *a, const unsigned char *buff, idx_t offset,
+            idx_t n)
+{
+    const int r = (int) (offset % 8);
+    Py_ssize_t i, nbytes = (Py_ssize_t) BYTES(n);
+    unsigned char c;
+
+    buff += offset / 8;
+    for (i = 0; i < nbytes; i++) {
+        c = buff[i] >> r;
+        /* the next byte only belongs to the bitmap when it contains
+           any of the n bits */
+        if (r && 8 * (idx_t) i + 8 - r < n)
+            c |= buff[i + 1] << (8 - r);
+        a->ob_item[i] = a->endian == ENDIAN_LITTLE ? c : reverse_trans[c];
+    }
+}
+
+static PyObject *
+from_arrow(PyObject *module, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"", "validity", NULL};
+    PyObject *obj, *capsules, *res = NULL;
+    struct ArrowSchema *schema;
+    struct ArrowArray *array;
+    const unsigned char *buff;
+    int validity = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|i:from_arrow", kwlist,
+                                     &obj, &validity))
+        return NULL;
+
+    capsules = PyObject_CallMethod(obj, "__arrow_c_array__", NULL);
+    if (capsules == NULL)
+        return NULL;
+    if (!PyTuple_Check(capsules) || PyTuple_GET_SIZE(capsules) != 2 ||
+            !PyCapsule_CheckExact(PyTuple_GET_ITEM(capsules, 0)) ||
+            !PyCapsule_CheckExact(PyTuple_GET_ITEM(capsules, 1))) {
+        PyErr_SetString(PyExc_TypeError, "__arrow_c_array__() must return "
+                        "a tuple of two capsules");
+        goto done;
+    }
+    schema = (struct ArrowSchema *) PyCapsule_GetPointer(
+                         PyTuple_GET_ITEM(capsules, 0), "arrow_schema");
+    if (schema == NULL)
+        goto done;
+    array = (struct ArrowArray *) PyCapsule_GetPointer(
+                         PyTuple_GET_ITEM(capsules, 1), "arrow_array");
+    if (array == NULL)
+        goto done;
+    if (schema->release == NULL || array->release == NULL) {
+        PyErr_SetString(PyExc_ValueError, "Arrow array already released");
+        goto done;
+    }
+
+    if (validity) {
+        /* null, union and run-end encoded arrays have no validity bitmap */
+        if (strcmp(schema->format, "n") == 0 ||
+                strncmp(schema->format, "+u", 2) == 0 ||
+                strcmp(schema->format, "+r") == 0 || array->n_buffers < 1) {
+            PyErr_Format(PyExc_ValueError, "Arrow array of format '%s' has "
+                         "no validity bitmap", schema->format);
+            goto done;
+        }
+        buff = (const unsigned char *) array->buffers[0];
+        if (buff == NULL && array->null_count != 0) {
+            PyErr_SetString(PyExc_ValueError, "validity bitmap missing");
+            goto done;
+        }
+    }
+    else {
+        if (strcmp(schema->format, "b") || array->n_buffers != 2) {
+            PyErr_Format(PyExc_TypeError, "boolean Arrow array expected, "
+                         "got format '%s'", schema->format);
+            goto done;
+        }
+        buff = (const unsigned char *) array->buffers[1];
+    }
+
+    /* the Arrow array stays owned by the capsule, which releases it */
+    res = new_zeros(NULL, array->length, ENDIAN_LITTLE);
+    if (res == NULL)
+        goto done;
+    if (buff)
+        copy_bitmap((bitarrayobject *) res, buff, array->offset,
+                    array->length);
+    else
+        /* no validity bitmap means all values are valid */
+        memset(((bitarrayobject *) res)->ob_item, 0xff,
+               (size_t) Py_SIZE(res));
+    setunused((bitarrayobject *) res);
+
+ done:
+    Py_DECREF(capsules);
+    return res;
+}
+
+PyDoc_STRVAR(from_arrow_doc,
+"from_arrow(array, /, validity=False) -> bitarray\n\
+\n\
+Return a (little-endian) bitarray with the values of a boolean Arrow\n\
+array, i.e. any object implementing `__arrow_c_array__()` of the Arrow\n\
+C data interface, taking the array's bit offset into account.  When\n\
+`validity` is true, return the validity bitmap (1 for valid values) of\n\
+an Arrow array of any type instead.  As the memory of a bitarray is\n\
+always owned by the bitarray, the bitmap is copied.");
+
+
+/************* Parquet RLE / bit-packing hybrid encoding ****************/
+
+/* see https://parquet.apache.org/docs/file-format/data-pages/encodings/
+   Values of bit_width k are stored as consecutive k bits of a bitarray,
+   least significant bit first, which for little-endian bitarrays is the
+   layout of Parquet's bit-packed runs. */
+
+#define RLE_MIN_RUN  8      /* minimal length of RLE runs when encoding */
+
+/* Return the k-bit value (k <= 64) stored in a[p:p+k] */
+static word_t
+rle_value(bitarrayobject *a, idx_t p, int k)
+{
+    word_t x = 0;
+    int i;
+
+    for (i = 0; i + 8 <= k; i += 8)
+        x |= ((word_t) get_byte(a, p + i)) << i;
+    for (; i < k; i++)
+        x |= ((word_t) GETBIT(a, p + i)) << i;
+    return x;
+}
+
+/* Return the number of consecutive values, starting with value i, which
+   equal value i, but at most max */
+static idx_t
+rle_run(bitarrayobject *a, idx_t i, int k, idx_t max)
+{
+    const idx_t stop = i + max;
+    idx_t j;
+    word_t x;
+    int vi;
+    char c;
+
+    if (k == 1) {
+        vi = GETBIT(a, i);
+        c = vi ? 0xff : 0x00;
+        for (j = i + 1; j < stop && j % 8; j++)
+            if (GETBIT(a, j) != vi)
+                return j - i;
+        /* skip whole bytes */
+        while (j + 8 <= stop && a->ob_item[j / 8] == c)
+            j += 8;
+        for (; j < stop; j++)
+            if (GETBIT(a, j) != vi)
+                break;
+        return j - i;
+    }
+    x = rle_value(a, i * k, k);
+    for (j = i + 1; j < stop; j++)
+        if (rle_value(a, j * k, k) != x)
+            break;
+    return j - i;
+}
+
+/* growing output buffer, used by rle_encode() and diff() */
+typedef struct {
+    PyObject *bytes;
+    Py_ssize_t size;    /* number of bytes written so far */
+} outbuf;
+
+/* Make room for n more bytes, and return a pointer to where they go or
+   NULL on failure.  The bytes object grows geometrically. */
+static unsigned char *
+outbuf_reserve(outbuf *buf, Py_ssize_t n)
+{
+    Py_ssize_t allocated = PyBytes_GET_SIZE(buf->bytes);
+
+    if (buf->size + n > allocated) {
+        allocated += (allocated >> 1) + n;
+        if (_PyBytes_Resize(&buf->bytes, allocated) < 0)
+            return NULL;
+    }
+    return (unsigned char *) PyBytes_AS_STRING(buf->bytes) + buf->size;
+}
+
+/* Write x as ULEB128 varint, and return 0 on success */
+static int
+write_varint(outbuf *buf, unsigned long long x)
+{
+    unsigned char *p;
+
+    if ((p = outbuf_reserve(buf, 10)) == NULL)
+        return -1;
+    do {
+        *p++ = (unsigned char) ((x & 0x7f) | (x > 0x7f ? 0x80 : 0));
+        x >>= 7;
+        buf->size++;
+    } while (x);
+    return 0;
+}
+
+static PyObject *
+rle_encode(PyObject *module, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"", "bit_width", NULL};
+    PyObject *obj;
+    bitarrayobject *a;
+    outbuf buf;
+    unsigned char *p;
+    idx_t n, i, j, r, q, nbits;
+    Py_ssize_t nbytes, m;
+    word_t x;
+    int k = 1, vbytes;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|i:rle_encode", kwlist,
+                                     &obj, &k))
+        return NULL;
+    if (!bitarray_Check(obj)) {
+        PyErr_SetString(PyExc_TypeError, "bitarray expected");
+        return NULL;
+    }
+    a = (bitarrayobject *) obj;
+    if (k < 1 || k > 64) {
+        PyErr_Format(PyExc_ValueError, "bit_width must be in range(1, 65), "
+                     "got %d", k);
+        return NULL;
+    }
+    if (a->nbits % k) {
+        PyErr_Format(PyExc_ValueError, "bitarray length %zd is not a "
+                     "multiple of bit_width %d", (Py_ssize_t) a->nbits, k);
+        return NULL;
+    }
+    n = a->nbits / k;
+    vbytes = (k + 7) / 8;
+    buf.size = 0;
+    buf.bytes = PyBytes_FromStringAndSize(NULL, (Py_ssize_t) (
+                                     BYTES(a->nbits) + n / 64 + 16));
+    if (buf.bytes == NULL)
+        return NULL;
+
+    for (i = 0; i < n; i = j) {
+        r = rle_run(a, i, k, n - i);
+        if (r >= RLE_MIN_RUN) {  /* RLE run */
+            x = rle_value(a, i * k, k);
+            if (write_varint(&buf, (unsigned long long) r << 1) < 0 ||
+                    (p = outbuf_reserve(&buf, vbytes)) == NULL)
+                goto error;
+            for (m = 0; m < vbytes; m++)
+                p[m] = (unsigned char) (x >> (8 * m));
+            buf.size += vbytes;
+            j = i + r;
+            continue;
+        }
+        /* bit-packed run of groups of 8 values, which ends where a group
+           starts with a run long enough to be worth an RLE run */
+        for (j = i + 8; j < n; j += 8)
+            if (j + RLE_MIN_RUN <= n &&
+                    rle_run(a, j, k, RLE_MIN_RUN) == RLE_MIN_RUN)
+                break;
+        if (write_varint(&buf, (unsigned long long) (j - i) / 8 << 1 | 1) < 0)
+            goto error;
+        /* (j - i) / 8 groups of 8 values take k bytes each */
+        nbytes = (Py_ssize_t) ((j - i) / 8 * k);
+        if ((p = outbuf_reserve(&buf, nbytes)) == NULL)
+            goto error;
+        /* the last group may be padded with zeros */
+        nbits = (j < n ? j : n) * k - i * k;
+        for (m = 0, q = i * k; m < nbytes; m++, q += 8) {
+            if (8 * (idx_t) m + 8 <= nbits) {
+                p[m] = get_byte(a, q);
+            }
+            else {
+                p[m] = 0;
+                for (r = 0; 8 * (idx_t) m + r < nbits; r++)
+                    p[m] |= GETBIT(a, q + r) << (int) r;
+            }
+        }
+        buf.size += nbytes;
+    }
+    _PyBytes_Resize(&buf.bytes, buf.size);
+    return buf.bytes;
+
+ error:
+    Py_XDECREF(buf.bytes);
+    return NULL;
+}
+
+PyDoc_STRVAR(rle_encode_doc,
+"rle_encode(bitarray, /, bit_width=1) -> bytes\n\
+\n\
+Encode the values of `bit_width` bits each stored in the bitarray (least\n\
+significant bit first) using the RLE / bit-packing hybrid encoding of\n\
+Parquet (without length prefix).  For `bit_width=1` (the default), each\n\
+bit is one value (e.g. a boolean column or definition levels of a flat\n\
+column).  Runs of at least 8 equal values are RLE encoded, everything\n\
+else is bit-packed in groups of 8 values, where the last group is padded\n\
+with zeros.");
+
+
+/* Set the n bits a[start:start+n] to 1 - whole bytes are set by memset */
+static void
+rle_setrange(bitarrayobject *a, idx_t start, idx_t n)
+{
+    const idx_t stop = start + n;
+    idx_t i;
+
+    for (i = start; i < stop && i % 8; i++)
+        setbit(a, i, 1);
+    if (i + 8 <= stop) {
+        memset(a->ob_item + i / 8, 0xff, (size_t) ((stop - i) / 8));
+        i += (stop - i) / 8 * 8;
+    }
+    for (; i < stop; i++)
+        setbit(a, i, 1);
+}
+
+/* Store the value x of k bits n times into a, starting at bit start.
+   As 64 values take exactly k words, these are set up once and then
+   copied into a repeatedly. */
+static void
+rle_fill(bitarrayobject *a, idx_t start, idx_t n, word_t x, int k)
+{
+    word_t w[64];
+    idx_t i;
+
+    if (k < 64 && x == ((word_t) 1 << k) - 1)
+        x = ~((word_t) 0);
+    if (x == 0)
+        return;
+    if (x == ~((word_t) 0)) {
+        rle_setrange(a, start, n * k);
+        return;
+    }
+    memset(w, 0x00, sizeof(w));
+    for (i = 0; i < 64 * k; i++)
+        if (x >> (i % k) & 1)
+            WSET(w, i);
+    for (i = 0; i + 64 <= n; i += 64)
+        store_words(a, start + i * k, 64 * k, w);
+    store_words(a, start + i * k, (n - i) * k, w);
+}
+
+/* Read the ULEB128 varint at data[*pos] into x and advance *pos.  Return 0
+   on success, or -1 (with exception set) for truncated or invalid data. */
+static int
+read_varint(const unsigned char *data, Py_ssize_t size, Py_ssize_t *pos,
+            unsigned long long *x)
+{
+    unsigned char c;
+    int shift = 0;
+
+    *x = 0;
+    do {
+        if (*pos >= size) {
+            PyErr_SetString(PyExc_ValueError, "truncated varint");
+            return -1;
+        }
+        if (shift > 63) {
+            PyErr_SetString(PyExc_ValueError, "varint too large");
+            return -1;
+        }
+        c = data[(*pos)++];
+        *x |= (unsigned long long) (c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    return 0;
+}
+
+/* Return the total number of values in data (including the padding of
+   bit-packed runs), or -1 on error.  As the result determines the size of
+   the bitarray to be allocated, each run is checked against the data
+   left, such that a corrupt header cannot cause a huge allocation. */
+static idx_t
+rle_count(const unsigned char *data, Py_ssize_t size, int k)
+{
+    unsigned long long header, n;
+    Py_ssize_t pos = 0;
+    idx_t count = 0;
+
+    while (pos < size) {
+        if (read_varint(data, size, &pos, &header) < 0)
+            return -1;
+        n = header >> 1;
+        if (n > PY_SSIZE_T_MAX / 8 / 64) {
+            PyErr_SetString(PyExc_ValueError, "RLE run too long");
+            return -1;
+        }
+        if (header & 1) {
+            /* each group of 8 values takes k bytes */
+            if (n > (unsigned long long) ((size - pos) / k)) {
+                PyErr_SetString(PyExc_ValueError,
+                                "truncated bit-packed run");
+                return -1;
+            }
+            pos += (Py_ssize_t) n * k;
+            n *= 8;
+        }
+        else {
+            if ((k + 7) / 8 > size - pos) {
+                PyErr_SetString(PyExc_ValueError, "truncated RLE run");
+                return -1;
+            }
+            pos += (k + 7) / 8;
+        }
+        /* n <= PY_SSIZE_T_MAX / 64 <= PY_SSIZE_T_MAX / k */
+        if (count > PY_SSIZE_T_MAX / k - (idx_t) n) {
+            PyErr_SetString(PyExc_OverflowError, "count too large");
+            return -1;
+        }
+        count += (idx_t) n;
+    }
+    return count;
+}
+
+static PyObject *
+rle_decode(PyObject *module, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"", "bit_width", "count", "endian", NULL};
+    PyObject *obj, *count_obj = Py_None, *res = NULL;
+    bitarrayobject *a;
+    Py_buffer view;
+    const unsigned char *data;
+    unsigned long long header;
+    char *endian_str = NULL;
+    Py_ssize_t size, pos = 0, nbytes, m, j, len, vbytes;
+    idx_t count, i = 0, n;
+    word_t w[512], x;
+    int k = 1, endian;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|iOz:rle_decode", kwlist,
+                                     &obj, &k, &count_obj, &endian_str))
+        return NULL;
+    if (k < 1 || k > 64) {
+        PyErr_Format(PyExc_ValueError, "bit_width must be in range(1, 65), "
+                     "got %d", k);
+        return NULL;
+    }
+    if ((endian = endian_from_string(endian_str)) == -2)
+        return NULL;
+    if (PyObject_GetBuffer(obj, &view, PyBUF_SIMPLE) < 0)
+        return NULL;
+    data = (const unsigned char *) view.buf;
+    size = view.len;
+    vbytes = (k + 7) / 8;
+
+    if (count_obj == Py_None) {
+        if ((count = rle_count(data, size, k)) < 0)
+            goto done;
+    }
+    else {
+        count = PyNumber_AsSsize_t(count_obj, PyExc_OverflowError);
+        if (count == -1 && PyErr_Occurred())
+            goto done;
+        if (count < 0) {
+            PyErr_SetString(PyExc_ValueError, "non-negative count expected");
+            goto done;
+        }
+    }
+    if (count > PY_SSIZE_T_MAX / k) {
+        PyErr_SetString(PyExc_OverflowError, "count too large");
+        goto done;
+    }
+    if ((res = new_zeros(NULL, count * k, endian)) == NULL)
+        goto done;
+    a = (bitarrayobject *) res;
+
+    while (i < count) {
+        if (pos >= size) {
+            PyErr_Format(PyExc_ValueError, "RLE data ends after %zd of %zd "
+                         "values", (Py_ssize_t) i, (Py_ssize_t) count);
+            goto error;
+        }
+        if (read_varint(data, size, &pos, &header) < 0)
+            goto error;
+        if (header & 1) {  /* bit-packed run */
+            n = count - i;
+            if (header >> 1 < (unsigned long long) (n + 7) / 8)
+                n = (idx_t) (header >> 1) * 8;
+            /* only the bytes holding the values we need have to exist */
+            nbytes = (Py_ssize_t) BYTES(n * k);
+            if (nbytes > size - pos) {
+                PyErr_SetString(PyExc_ValueError, "truncated bit-packed run");
+                goto error;
+            }
+            /* copy in chunks of 512 words */
+            for (m = 0; m < nbytes; m += sizeof(w)) {
+                len = Py_MIN(nbytes - m, (Py_ssize_t) sizeof(w));
+                memset(w, 0x00, sizeof(w));
+                for (j = 0; j < len; j++)
+                    w[j / 8] |= ((word_t) data[pos + m + j]) << (8 * (j % 8));
+                store_words(a, i * k + BITS(m),
+                            Py_MIN(BITS(len), n * k - BITS(m)), w);
+            }
+            pos += (Py_ssize_t) (header >> 1) * k;
+        }
+        else {  /* RLE run */
+            n = (idx_t) (header >> 1);
+            if (n > count - i)
+                n = count - i;
+            if (vbytes > size - pos) {
+                PyErr_SetString(PyExc_ValueError, "truncated RLE run");
+                goto error;
+            }
+            x = 0;
+            for (m = 0; m < vbytes; m++)
+                x |= ((word_t) data[pos + m]) << (8 * m);
+            if (k < 64 && x >> k) {
+                PyErr_Format(PyExc_ValueError, "RLE value %llu exceeds "
+                             "bit_width %d", x, k);
+                goto error;
+            }
+            rle_fill(a, i * k, n, x, k);
+            pos += vbytes;
+        }
+        i += n;
+    }
+    goto done;
+
+ error:
+    Py_CLEAR(res);
+ done:
+    PyBuffer_Release(&view);
+    return res;
+}
+
+PyDoc_STRVAR(rle_decode_doc,
+"rle_decode(bytes, /, bit_width=1, count=None, endian=None) -> bitarray\n\
+\n\
+Decode `count` values of `bit_width` bits each from a bytes-like object\n\
+using the RLE / bit-packing hybrid encoding of Parquet (without length\n\
+prefix), and return them as a bitarray (with given endianness) of length\n\
+`count * bit_width`, each value stored least significant bit first.\n\
+Any data after `count` values is ignored.  When `count` is None, all\n\
+values are decoded, including the zero padding of the last bit-packed\n\
+group.  This is the inverse of `rle_encode()`.");
+
+
+/************************** binary delta encoding ************************/
+
+/* A delta consists of the varints len(old) and len(new), followed by runs
+   of 64-bit words in which old and new differ.  Each run is given by the
+   varints gap (number of equal words since the previous run) and length
+   (number of words), followed by the XOR of these words (in little-endian
+   bit order), where a run at the end is truncated to the bytes of new. */
+
+/* byte j of a in little-endian bit order, or 0 when j is out of range */
+#define LE_BYTE(a, j)  ((j) >= Py_SIZE(a) ? 0 :                         \
+    ((a)->endian == ENDIAN_LITTLE ? (unsigned char) (a)->ob_item[j] :    \
+                        reverse_trans[(unsigned char) (a)->ob_item[j]]))
+
+/* Store the XOR of the bytes of word i of old and new into x (which has
+   room for 8 bytes), and return the number of bytes which are non-zero.
+   Only the bytes (and bits) of new are considered. */
+static int
+delta_word(bitarrayobject *old, bitarrayobject *new, Py_ssize_t i,
+           unsigned char *x)
+{
+    const Py_ssize_t nbytes = Py_SIZE(new);
+    const int r = (int) (new->nbits % 8);
+    Py_ssize_t j;
+    int k, nz = 0;
+
+    for (k = 0; k < 8; k++) {
+        j = 8 * i + k;
+        if (j >= nbytes) {
+            x[k] = 0;
+            continue;
+        }
+        x[k] = LE_BYTE(old, j) ^ LE_BYTE(new, j);
+        if (r && j == nbytes - 1)  /* mask bits beyond the end of new */
+            x[k] &= (1 << r) - 1;
+        nz += x[k] != 0;
+    }
+    return nz;
+}
+
+static PyObject *
+diff(PyObject *module, PyObject *args)
+{
+    PyObject *o, *n;
+    bitarrayobject *old, *new;
+    outbuf buf;
+    unsigned char x[8], *p;
+    Py_ssize_t nbytes, nwords, limit, i, j, prev = 0, m;
+
+    if (!PyArg_ParseTuple(args, "OO:diff", &o, &n))
+        return NULL;
+    if (!bitarray_Check(o) || !bitarray_Check(n)) {
+        PyErr_SetString(PyExc_TypeError, "bitarray expected");
+        return NULL;
+    }
+    old = (bitarrayobject *) o;
+    new = (bitarrayobject *) n;
+    setunused(old);
+    setunused(new);
+    nbytes = Py_SIZE(new);
+    nwords = (Py_ssize_t) WORDS(new->nbits);
+    /* words which can be compared directly, as they are stored within both
+       buffers in the same bit endianness */
+    limit = old->endian == new->endian ?
+                                  Py_MIN(Py_SIZE(old), nbytes) / 8 : 0;
+
+    buf.size = 0;
+    if ((buf.bytes = PyBytes_FromStringAndSize(NULL, 64)) == NULL)
+        return NULL;
+    if (write_varint(&buf, (unsigned long long) old->nbits) < 0 ||
+            write_varint(&buf, (unsigned long long) new->nbits) < 0)
+        goto error;
+
+    for (i = 0; i < nwords; i = j) {
+        /* skip equal words, in blocks of 64 words first */
+        while (i + 64 <= limit && memcmp(old->ob_item + 8 * i,
+                                         new->ob_item + 8 * i, 512) == 0)
+            i += 64;
+        while (i < limit && memcmp(old->ob_item + 8 * i,
+                                   new->ob_item + 8 * i, 8) == 0)
+            i++;
+        if (i == nwords)
+            break;
+        if (delta_word(old, new, i, x) == 0) {
+            j = i + 1;
+            continue;
+        }
+        /* find the end j of the run of differing words */
+        for (j = i + 1; j < nwords; j++)
+            if (j < limit ? memcmp(old->ob_item + 8 * j,
+                                   new->ob_item + 8 * j, 8) == 0 :
+                            delta_word(old, new, j, x) == 0)
+                break;
+
+        if (write_varint(&buf, (unsigned long long) (i - prev)) < 0 ||
+                write_varint(&buf, (unsigned long long) (j - i)) < 0)
+            goto error;
+        m = Py_MIN(8 * j, nbytes) - 8 * i;
+        if ((p = outbuf_reserve(&buf, m)) == NULL)
+            goto error;
+        for (; i < j; i++, p += 8) {
+            delta_word(old, new, i, x);
+            memcpy(p, x, (size_t) Py_MIN(8, nbytes - 8 * i));
+        }
+        buf.size += m;
+        prev = j;
+    }
+    _PyBytes_Resize(&buf.bytes, buf.size);
+    return buf.bytes;
+
+ error:
+    Py_XDECREF(buf.bytes);
+    return NULL;
+}
+
+PyDoc_STRVAR(diff_doc,
+"diff(old, new, /) -> bytes\n\
+\n\
+Return a delta, which turns bitarray `old` into bitarray `new` when\n\
+applied using `patch()`.  The delta contains the XOR of the 64-bit words\n\
+in which `old` and `new` differ, such that its size grows with the amount\n\
+of change and not with the length of the bitarrays.  The bitarrays may\n\
+differ in length and bit endianness.");
+
+
+static PyObject *
+patch(PyObject *module, PyObject *args)
+{
+    PyObject *obj, *z;
+    bitarrayobject *a;
+    Py_buffer view;
+    const unsigned char *data;
+    unsigned long long old_len, new_len, gap, len;
+    Py_ssize_t size, pos, runs, start, i, j, m, nbytes;
+    idx_t nwords;
+    int pass;
+
+    if (!PyArg_ParseTuple(args, "OO:patch", &obj, &z))
+        return NULL;
+    /* excludes frozenbitarray objects */
+    if (PyObject_IsInstance(obj, bitarray_type_obj) != 1) {
+        PyErr_SetString(PyExc_TypeError, "mutable bitarray expected");
+        return NULL;
+    }
+    a = (bitarrayobject *) obj;
+    if (PyObject_GetBuffer(z, &view, PyBUF_SIMPLE) < 0)
+        return NULL;
+    data = (const unsigned char *) view.buf;
+    size = view.len;
+
+    pos = 0;
+    if (read_varint(data, size, &pos, &old_len) < 0 ||
+            read_varint(data, size, &pos, &new_len) < 0)
+        goto error;
+    if (old_len != (unsigned long long) a->nbits) {
+        PyErr_Format(PyExc_ValueError, "delta expects bitarray of length "
+                     "%llu, got %zd", old_len, (Py_ssize_t) a->nbits);
+        goto error;
+    }
+    if (new_len > (unsigned long long) PY_SSIZE_T_MAX) {
+        PyErr_SetString(PyExc_OverflowError, "delta length too large");
+        goto error;
+    }
+    nbytes = (Py_ssize_t) BYTES((idx_t) new_len);
+    nwords = WORDS((idx_t) new_len);
+    runs = pos;
+
+    /* The first pass only validates the delta, such that a is left
+       unchanged for invalid deltas.  The second pass resizes a and
+       applies the runs. */
+    for (pass = 0; pass < 2; pass++) {
+        if (pass == 1 && (idx_t) new_len != a->nbits) {
+            if ((idx_t) new_len > a->nbits) {
+                PyObject *t = new_zeros(NULL, (idx_t) new_len - a->nbits,
+                                        a->endian);
+                PyObject *r;
+
+                if (t == NULL)
+                    goto error;
+                r = PyObject_CallMethod(obj, "extend", "O", t);
+                Py_DECREF(t);
+                if (r == NULL)
+                    goto error;
+                Py_DECREF(r);
+            }
+            else if (PySequence_DelSlice(obj, (Py_ssize_t) new_len,
+                                         (Py_ssize_t) a->nbits) < 0) {
+                goto error;
+            }
+        }
+        start = 0;
+        for (pos = runs; pos < size; pos += m) {
+            if (read_varint(data, size, &pos, &gap) < 0 ||
+                    read_varint(data, size, &pos, &len) < 0)
+                goto error;
+            if (len == 0 || gap > (unsigned long long) nwords - start ||
+                    len > (unsigned long long) nwords - start - gap) {
+                PyErr_SetString(PyExc_ValueError, "delta run out of range");
+                goto error;
+            }
+            start += (Py_ssize_t) gap;
+            m = Py_MIN(8 * (start + (Py_ssize_t) len), nbytes) - 8 * start;
+            if (m > size - pos) {
+                PyErr_SetString(PyExc_ValueError, "truncated delta");
+                goto error;
+            }
+            if (pass == 1) {
+                MARK_DIRTY(a, 8 * start, 8 * start + m);
+                for (i = 8 * start, j = pos; j < pos + m; i++, j++)
+                    a->ob_item[i] ^= a->endian == ENDIAN_LITTLE ? data[j] :
+                                                     reverse_trans[data[j]];
+            }
+            start += (Py_ssize_t) len;
+        }
+    }
+    setunused(a);
+    PyBuffer_Release(&view);
+    Py_RETURN_NONE;
+
+ error:
+    PyBuffer_Release(&view);
+    return NULL;
+}
+
+PyDoc_STRVAR(patch_doc,
+"patch(bitarray, delta, /)\n\
+\n\
+Apply a delta created by `diff(old, new)` to the bitarray in-place, which\n\
+has to equal `old` (its length is checked) and then equals `new`.  The\n\
+bit endianness of the bitarray is unchanged.  An invalid delta raises\n\
+`ValueError` and leaves the bitarray unchanged.");
+
+
+/* set bitarray_type_obj (bato) */
+static PyObject *
+set_bato(PyObject *module, PyObject *obj)
+{
+    bitarray_type_obj = obj;
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef module_functions[] = {
+    {"count_n",   (PyCFunction) count_n,   METH_VARARGS, count_n_doc},
+    {"rindex",    (PyCFunction) r_index,   METH_VARARGS, rindex_doc},
+    {"count_and", (PyCFunction) count_and, METH_VARARGS, count_and_doc},
+    {"count_or",  (PyCFunction) count_or,  METH_VARARGS, count_or_doc},
+    {"count_xor", (PyCFunction) count_xor, METH_VARARGS, count_xor_doc},
+    {"subset",    (PyCFunction) subset,    METH_VARARGS, subset_doc},
+    {"gf2_rank",  (PyCFunction) gf2_rank,  METH_VARARGS | METH_KEYWORDS,
+                                                         gf2_rank_doc},
+    {"gf2_solve", (PyCFunction) gf2_solve, METH_VARARGS | METH_KEYWORDS,
+                                                         gf2_solve_doc},
+    {"gf2_nullspace", (PyCFunction) gf2_nullspace, METH_VARARGS |
+                                     METH_KEYWORDS,      gf2_nullspace_doc},
+    {"crc",       (PyCFunction) crc,       METH_VARARGS | METH_KEYWORDS,
+                                                         crc_doc},
+    {"clmul",     (PyCFunction) clmul,     METH_VARARGS, clmul_doc},
+    {"polymod",   (PyCFunction) polymod,   METH_VARARGS, polymod_doc},
+    {"bitplanes", (PyCFunction) bitplanes, METH_VARARGS, bitplanes_doc},
+    {"frombitplanes", (PyCFunction) frombitplanes, METH_VARARGS,
+                                                         frombitplanes_doc},
+    {"compare",   (PyCFunction) compare,   METH_VARARGS, compare_doc},
+    {"between",   (PyCFunction) between,   METH_VARARGS, between_doc},
+    {"filter",    (PyCFunction) filter,    METH_VARARGS, filter_doc},
+    {"interleave", (PyCFunction) interleave, METH_VARARGS, interleave_doc},
+    {"deinterleave", (PyCFunction) deinterleave, METH_VARARGS,
+                                                          deinterleave_doc},
+    {"dna2ba",    (PyCFunction) dna2ba,    METH_VARARGS, dna2ba_doc},
+    {"ba2dna",    (PyCFunction) ba2dna,    METH_VARARGS, ba2dna_doc},
+    {"dna_revcomp", (PyCFunction) dna_revcomp, METH_VARARGS,
+                                                           dna_revcomp_doc},
+    {"dna_kmers", (PyCFunction) dna_kmers, METH_VARARGS | METH_KEYWORDS,
+                                                             dna_kmers_doc},
+    {"dna_gc",    (PyCFunction) dna_gc,    METH_VARARGS, dna_gc_doc},
+    {"from_arrow", (PyCFunction) from_arrow, METH_VARARGS | METH_KEYWORDS,
+                                                            from_arrow_doc},
+    {"rle_encode", (PyCFunction) rle_encode, METH_VARARGS | METH_KEYWORDS,
+                                             rle_encode_doc},
+    {"rle_decode", (PyCFunction) rle_decode, METH_VARARGS | METH_KEYWORDS,
+                                             rle_decode_doc},
+    {"diff",      (PyCFunction) diff,      METH_VARARGS, diff_doc},
+    {"patch",     (PyCFunction) patch,     METH_VARARGS, patch_doc},
+    {"_blit",     (PyCFunction) blit,      METH_VARARGS, ""},
+    {"_transpose", (PyCFunction) transpose, METH_VARARGS, ""},
+    {"_set_bato", (PyCFunction) set_bato,  METH_O,       ""},
+    {NULL,        NULL}  /* sentinel */
+};
+
+/*********************** Install Module **************************/
+
+#ifdef IS_PY3K
+static PyModuleDef moduledef = {
+    PyModuleDef_HEAD_INIT, "_util", 0, -1, module_functions,
+};
+#endif
+
+PyMODINIT_FUNC
+#ifdef IS_PY3K
+PyInit__util(void)
+#else
+init_util(void)
+#endif
+{
+    PyObject *m;
+    const short one = 1;
+
+#ifdef IS_PY3K
+    m = PyModule_Create(&moduledef);
+    if (m == NULL)
+        return NULL;
+#else
+    m = Py_InitModule3("_util", module_functions, 0);
+    if (m == NULL)
+        return;
+#endif
+
+    if (PyType_Ready(&MultiSearch_Type) < 0)
+#ifdef IS_PY3K
+        return NULL;
+#else
+        return;
+#endif
+    Py_INCREF((PyObject *) &MultiSearch_Type);
+    PyModule_AddObject(m, "multisearch", (PyObject *) &MultiSearch_Type);
+
+    if ((bitarray_api = import_bitarray()) == NULL)
+#ifdef IS_PY3K
+        return NULL;
+#else
         return;
 #endif
 
+    setup_dna_tables();
+    host_little = (*(unsigned char *) &one) == 1;
     PyModule_AddObject(m, "_swap_hilo_bytes", make_swap_hilo_bytes());
 #ifdef IS_PY3K
     return m;
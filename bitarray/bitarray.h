@@ -0,0 +1,317 @@
+/*
+   Copyright (c) 2008 - 2020, Ilan Schnell
+   bitarray is published under the PSF license.
+
+   This header contains the definitions shared by _bitarray.c and _util.c
+   (only visible when BITARRAY_INTERNAL is defined), as well as the C API,
+   which the _bitarray module exports through a capsule for use by other
+   extension modules (see import_bitarray()).
+   The bit kernels themselves, which do not depend on Python, are in
+   bitkernels.h.  The directory of these headers is returned by
+   bitarray.get_include().
+
+   Author: Ilan Schnell
+*/
+#ifndef BITARRAY_H
+#define BITARRAY_H
+
+#include <stdint.h>
+
+#include "bitkernels.h"
+
+/* Unlike the normal convention, ob_size is the byte count, not the number
+   of elements.  The reason for doing this is that we can use our own
+   special bk_idx_t for the number of bits, which may exceed 2^32 on a 32 bit
+   machine.  */
+typedef struct {
+    PyObject_VAR_HEAD
+    char *ob_item;
+    Py_ssize_t allocated;       /* how many bytes allocated */
+    bk_idx_t nbits;             /* length of bitarray, i.e. elements */
+    int endian;                 /* bit endianness of bitarray */
+    int ob_exports;             /* how many buffer exports */
+    PyObject *weakreflist;      /* list of weak references */
+    char *dirty;                /* bitmap of modified blocks, or NULL when
+                                   dirty block tracking is off */
+    Py_ssize_t dirty_alloc;     /* how many bytes allocated for dirty */
+    Py_ssize_t clean_size;      /* buffer size when dirty was cleared */
+} bitarrayobject;
+
+#ifdef BITARRAY_INTERNAL
+
+/* The following is only used by _bitarray.c and _util.c, which define
+   BITARRAY_INTERNAL before including this header.  Other extension
+   modules only see the object structure and the C API (below), as well
+   as the prefixed names of bitkernels.h.
+
+   The names defined by bitkernels.h are prefixed by bk_ or BK_, such that
+   the header can be included by any program.  Within the extension, we
+   use these shorter names. */
+typedef bk_idx_t idx_t;
+typedef bk_word_t word_t;
+typedef bk_span bitspan;
+typedef bk_node bitnode;
+typedef bk_kernels bitarray_kernels;
+
+#define BITARRAY_UNUSED  BK_UNUSED
+
+#define ENDIAN_LITTLE  BK_ENDIAN_LITTLE
+#define ENDIAN_BIG     BK_ENDIAN_BIG
+
+#define BITS(bytes)          BK_BITS(bytes)
+#define BYTES(bits)          BK_BYTES(bits)
+#define BITMASK(endian, i)   BK_BITMASK(endian, i)
+#define BITMASK_E(E, i)      BK_BITMASK_E(E, i)
+#define GETBIT_E(buf, E, i)  BK_GETBIT_E(buf, E, i)
+#define setbit_e             bk_setbit_e
+
+#define ENDIAN_SPECIALIZE   BK_ENDIAN_SPECIALIZE
+#define ENDIAN_SPECIALIZE2  BK_ENDIAN_SPECIALIZE2
+
+#define WBITS         BK_WBITS
+#define WORDS(bits)   BK_WORDS(bits)
+#define WGET(w, k)    BK_WGET(w, k)
+#define WSET(w, k)    BK_WSET(w, k)
+#define popcount64    bk_popcount64
+
+#define bitcount_lookup  bk_bitcount_lookup
+#define reverse_trans    bk_reverse_trans
+
+#define op_type   bk_op
+#define OP_and    BK_AND
+#define OP_or     BK_OR
+#define OP_xor    BK_XOR
+#define count_op  bk_count_op
+
+/* --- bit endianness --- */
+#define ENDIAN_INT(i)  ((i) == ENDIAN_LITTLE ? "little" : "big")
+
+/* ------------ low level access to bits in bitarrayobject ------------- */
+
+#ifndef NDEBUG
+Py_LOCAL_INLINE(int) GETBIT(bitarrayobject *self, idx_t i) {
+    assert(0 <= i && i < self->nbits);
+    return ((self)->ob_item[(i) / 8] & BITMASK((self)->endian, i) ? 1 : 0);
+}
+#else
+#define GETBIT(self, i)  \
+    ((self)->ob_item[(i) / 8] & BITMASK((self)->endian, i) ? 1 : 0)
+#endif
+
+Py_LOCAL_INLINE(void)
+setbit(bitarrayobject *self, idx_t i, int bit)
+{
+    char *cp, mask;
+
+    assert(0 <= i && i < BITS(Py_SIZE(self)));
+    mask = BITMASK(self->endian, i);
+    cp = self->ob_item + i / 8;
+    if (bit)
+        *cp |= mask;
+    else
+        *cp &= ~mask;
+}
+
+/* sets unused padding bits (within last byte of buffer) to 0,
+   and return the number of padding bits -- self->nbits is unchanged */
+Py_LOCAL_INLINE(int)
+setunused(bitarrayobject *self)
+{
+    idx_t n, i;
+
+    if (self->nbits % 8 == 0)
+        return 0;
+
+    n = BITS(Py_SIZE(self));    /* number of bits in buffer */
+    for (i = self->nbits; i < n; i++)
+        setbit(self, i, 0);
+    assert(0 < n - self->nbits && n - self->nbits < 8);
+    return (int) (n - self->nbits);
+}
+
+/* the buffer of self as bitspan, for use with the bit kernels */
+Py_LOCAL_INLINE(bitspan)
+bitarray_span(bitarrayobject *self)
+{
+    bitspan s;
+
+    s.buf = self->ob_item;
+    s.nbits = self->nbits;
+    s.endian = self->endian;
+    return s;
+}
+
+/* Normalize index (which may be negative), such that 0 <= i <= n */
+Py_LOCAL_INLINE(void)
+normalize_index(idx_t n, idx_t *i)
+{
+    if (*i < 0) {
+        *i += n;
+        if (*i < 0)
+            *i = 0;
+    }
+    if (*i > n)
+        *i = n;
+}
+
+/* ------------------------ dirty block tracking ----------------------- */
+
+/* Size (in bytes) of the blocks in which modifications are tracked, when
+   dirty block tracking is on.  The buffer is divided into blocks
+   starting at offset 0, the last block may be smaller. */
+#define DIRTY_BLOCK  4096
+
+/* number of dirty blocks necessary to cover given bytes */
+#define DIRTY_BLOCKS(bytes)  (((bytes) + DIRTY_BLOCK - 1) / DIRTY_BLOCK)
+
+#define DIRTY_GET(self, i)  ((self)->dirty[(i) / 8] & (1 << (i) % 8))
+
+/* mark the blocks covering the bytes [start:stop] of the buffer dirty */
+Py_LOCAL_INLINE(void)
+mark_dirty(bitarrayobject *self, Py_ssize_t start, Py_ssize_t stop)
+{
+    Py_ssize_t i;
+
+    assert(self->dirty);
+    if (start < 0)
+        start = 0;
+    if (start >= stop)
+        return;
+    assert(8 * self->dirty_alloc >= DIRTY_BLOCKS(stop));
+    for (i = start / DIRTY_BLOCK; i <= (stop - 1) / DIRTY_BLOCK; i++)
+        self->dirty[i / 8] |= 1 << i % 8;
+}
+
+/* Every function which modifies the buffer (other than its padding bits)
+   marks the modified bytes [start:stop] using this macro, which costs
+   only a single (predictable) branch when dirty block tracking is off. */
+#define MARK_DIRTY(self, start, stop)  \
+    ((self)->dirty ? mark_dirty((self), (start), (stop)) : (void) 0)
+
+/* mark bytes containing the bits [start:stop] */
+#define MARK_DIRTY_BITS(self, start, stop)  \
+    MARK_DIRTY((self), (Py_ssize_t) ((start) / 8), (Py_ssize_t) BYTES(stop))
+
+/* ----------------------- Arrow C data interface ---------------------- */
+
+/* see https://arrow.apache.org/docs/format/CDataInterface.html */
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+    /* Array type description */
+    const char* format;
+    const char* name;
+    const char* metadata;
+    int64_t flags;
+    int64_t n_children;
+    struct ArrowSchema** children;
+    struct ArrowSchema* dictionary;
+
+    /* Release callback */
+    void (*release)(struct ArrowSchema*);
+    /* Opaque producer-specific data */
+    void* private_data;
+};
+
+struct ArrowArray {
+    /* Array data description */
+    int64_t length;
+    int64_t null_count;
+    int64_t offset;
+    int64_t n_buffers;
+    int64_t n_children;
+    const void** buffers;
+    struct ArrowArray** children;
+    struct ArrowArray* dictionary;
+
+    /* Release callback */
+    void (*release)(struct ArrowArray*);
+    /* Opaque producer-specific data */
+    void* private_data;
+};
+
+#endif  /* ARROW_C_DATA_INTERFACE */
+
+#endif  /* BITARRAY_INTERNAL */
+
+/******************************* C API **********************************/
+
+/* The version is incremented whenever members are added to the end of
+   bitarray_capi.  Existing members are never changed or removed. */
+#define BITARRAY_CAPI_VERSION  2
+
+#define BITARRAY_CAPSULE_NAME  "bitarray._bitarray._C_API"
+
+typedef struct {
+    int version;                /* BITARRAY_CAPI_VERSION of _bitarray */
+    PyTypeObject *type;         /* the bitarray base type */
+
+    /* return new bitarray object of given type, length and endianness
+       (with uninitialized buffer), or NULL on failure */
+    PyObject *(*new_bitarray)(PyTypeObject *type, bk_idx_t nbits,
+                              int endian);
+    /* resize to nbits, new bits are uninitialized (-1 on failure) */
+    int (*resize)(bitarrayobject *self, bk_idx_t nbits);
+    /* copy n bits from other (starting at b) onto self (starting at a) */
+    void (*copy_n)(bitarrayobject *self, bk_idx_t a,
+                   bitarrayobject *other, bk_idx_t b, bk_idx_t n);
+    /* delete / insert (uninitialized) n bits at start (-1 on failure) */
+    int (*delete_n)(bitarrayobject *self, bk_idx_t start, bk_idx_t n);
+    int (*insert_n)(bitarrayobject *self, bk_idx_t start, bk_idx_t n);
+    /* set the bits from start to stop (excluding) to val */
+    void (*setrange)(bitarrayobject *self, bk_idx_t start, bk_idx_t stop,
+                     int val);
+    void (*invert)(bitarrayobject *self);
+    /* number of bits equal to vi within start to stop (excluding) */
+    bk_idx_t (*count)(bitarrayobject *self, int vi, bk_idx_t start,
+                      bk_idx_t stop);
+    /* index of first bit equal to vi within start to stop, or -1 */
+    bk_idx_t (*findfirst)(bitarrayobject *self, int vi, bk_idx_t start,
+                          bk_idx_t stop);
+    /* index of first occurrence of xa at or after p, or -1 */
+    bk_idx_t (*search)(bitarrayobject *self, bitarrayobject *xa,
+                       bk_idx_t p);
+
+    /* added in version 2 */
+    const bk_kernels *kernels;          /* see bitkernels.h */
+} bitarray_capi;
+
+#define BitarrayCAPI_Check(api, obj)  PyObject_TypeCheck((obj), (api)->type)
+
+/* Import the C API of the _bitarray module (typically in the init function
+   of an extension module).  Return NULL (with ImportError set) when the
+   module cannot be imported or is older than this header. */
+Py_LOCAL_INLINE(bitarray_capi *)
+import_bitarray(void)
+{
+    PyObject *module, *capsule;
+    bitarray_capi *api;
+
+    /* PyCapsule_Import() cannot be used here, as the attribute _bitarray
+       of the bitarray package is the base type, not the module */
+    module = PyImport_ImportModule("bitarray._bitarray");
+    if (module == NULL)
+        return NULL;
+    capsule = PyObject_GetAttrString(module, "_C_API");
+    Py_DECREF(module);
+    if (capsule == NULL)
+        return NULL;
+    api = (bitarray_capi *) PyCapsule_GetPointer(capsule,
+                                                 BITARRAY_CAPSULE_NAME);
+    /* the capsule is kept alive by the module */
+    Py_DECREF(capsule);
+    if (api != NULL && api->version < BITARRAY_CAPI_VERSION) {
+        PyErr_Format(PyExc_ImportError, "bitarray C API version %d or "
+                     "higher required, got %d", BITARRAY_CAPI_VERSION,
+                     api->version);
+        return NULL;
+    }
+    return api;
+}
+
+#endif  /* BITARRAY_H */
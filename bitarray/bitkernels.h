@@ -0,0 +1,1056 @@
+/*
+   Copyright (c) 2008 - 2020, Ilan Schnell
+   bitarray is published under the PSF license.
+
+   This header contains the bit kernels, on which _bitarray.c and _util.c
+   are built.  It does not depend on Python, and can be included by C
+   (C89 with long long, or later) and C++ programs, in order to process
+   the same bit buffers as bitarray objects, e.g. the data written by
+   .tofile() or exported by the buffer protocol, given their length and
+   bit endianness.  All functions are static (inline), so no library
+   needs to be linked, and all names are prefixed by bk_ or BK_.  The
+   directory of this header is returned by bitarray.get_include(), see
+   also examples/kernels.
+
+   Author: Ilan Schnell
+*/
+#ifndef BITKERNELS_H
+#define BITKERNELS_H
+
+#include <assert.h>
+#include <string.h>
+
+#if defined(__cplusplus) || \
+    (defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L)
+#define BK_INLINE  static inline
+#elif defined(_MSC_VER)
+#define BK_INLINE  static __inline
+#elif defined(__GNUC__)
+#define BK_INLINE  static __inline__
+#else
+#define BK_INLINE  static
+#endif
+
+#if defined(__GNUC__)
+#define BK_UNUSED  __attribute__((unused))
+#else
+#define BK_UNUSED
+#endif
+
+/* The x86 byte kernels are compiled for several instruction set levels,
+   using function attributes (or, for MSVC, intrinsics which need no
+   compiler flags), such that a single build runs on any CPU, and the best
+   implementations are selected at runtime by probing the CPU (see
+   bk_select_kernels()).  On other architectures, or with other
+   compilers, only the generic (portable) kernels are available. */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    (__GNUC__ >= 8 || (defined(__clang__) && __clang_major__ >= 6))
+#define BK_X86_KERNELS
+#include <cpuid.h>
+#include <immintrin.h>
+#define BK_TARGET(isa)  __attribute__((target(isa)))
+#define BK_POPCNT64(x)  __builtin_popcountll(x)
+#elif defined(_MSC_VER) && _MSC_VER >= 1920 && defined(_M_X64)
+#define BK_X86_KERNELS
+#include <intrin.h>
+#include <immintrin.h>
+#define BK_TARGET(isa)
+#define BK_POPCNT64(x)  __popcnt64(x)
+#endif
+
+/* instead of Py_ssize_t, we use this type indices, as Py_ssize_t is
+   only 4 bytes on 32bit machines, but bitarray indices can exceed this */
+typedef long long int bk_idx_t;
+
+/* --- bit endianness --- */
+#define BK_ENDIAN_LITTLE  0
+#define BK_ENDIAN_BIG     1
+
+#define BK_BITS(bytes)  ((bk_idx_t) (bytes) << 3)
+
+/* number of bytes necessary to store given bits */
+#define BK_BYTES(bits)  (((bits) == 0) ? 0 : (((bits) - 1) / 8 + 1))
+
+#define BK_BITMASK(endian, i)  \
+    (((char) 1) << ((endian) == BK_ENDIAN_LITTLE ? ((i) % 8) : (7 - (i) % 8)))
+
+/* number of 1 bits in each byte */
+static BK_UNUSED const unsigned char bk_bitcount_lookup[256] = {
+    0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,
+    1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,
+    1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,
+    2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,
+    1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,
+    2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,
+    2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,
+    3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,4,5,5,6,5,6,6,7,5,6,6,7,6,7,7,8,
+};
+
+/* each byte with its bits reversed */
+static BK_UNUSED const unsigned char bk_reverse_trans[256] = {
+    0x00,0x80,0x40,0xc0,0x20,0xa0,0x60,0xe0,0x10,0x90,0x50,0xd0,0x30,0xb0,
+    0x70,0xf0,0x08,0x88,0x48,0xc8,0x28,0xa8,0x68,0xe8,0x18,0x98,0x58,0xd8,
+    0x38,0xb8,0x78,0xf8,0x04,0x84,0x44,0xc4,0x24,0xa4,0x64,0xe4,0x14,0x94,
+    0x54,0xd4,0x34,0xb4,0x74,0xf4,0x0c,0x8c,0x4c,0xcc,0x2c,0xac,0x6c,0xec,
+    0x1c,0x9c,0x5c,0xdc,0x3c,0xbc,0x7c,0xfc,0x02,0x82,0x42,0xc2,0x22,0xa2,
+    0x62,0xe2,0x12,0x92,0x52,0xd2,0x32,0xb2,0x72,0xf2,0x0a,0x8a,0x4a,0xca,
+    0x2a,0xaa,0x6a,0xea,0x1a,0x9a,0x5a,0xda,0x3a,0xba,0x7a,0xfa,0x06,0x86,
+    0x46,0xc6,0x26,0xa6,0x66,0xe6,0x16,0x96,0x56,0xd6,0x36,0xb6,0x76,0xf6,
+    0x0e,0x8e,0x4e,0xce,0x2e,0xae,0x6e,0xee,0x1e,0x9e,0x5e,0xde,0x3e,0xbe,
+    0x7e,0xfe,0x01,0x81,0x41,0xc1,0x21,0xa1,0x61,0xe1,0x11,0x91,0x51,0xd1,
+    0x31,0xb1,0x71,0xf1,0x09,0x89,0x49,0xc9,0x29,0xa9,0x69,0xe9,0x19,0x99,
+    0x59,0xd9,0x39,0xb9,0x79,0xf9,0x05,0x85,0x45,0xc5,0x25,0xa5,0x65,0xe5,
+    0x15,0x95,0x55,0xd5,0x35,0xb5,0x75,0xf5,0x0d,0x8d,0x4d,0xcd,0x2d,0xad,
+    0x6d,0xed,0x1d,0x9d,0x5d,0xdd,0x3d,0xbd,0x7d,0xfd,0x03,0x83,0x43,0xc3,
+    0x23,0xa3,0x63,0xe3,0x13,0x93,0x53,0xd3,0x33,0xb3,0x73,0xf3,0x0b,0x8b,
+    0x4b,0xcb,0x2b,0xab,0x6b,0xeb,0x1b,0x9b,0x5b,0xdb,0x3b,0xbb,0x7b,0xfb,
+    0x07,0x87,0x47,0xc7,0x27,0xa7,0x67,0xe7,0x17,0x97,0x57,0xd7,0x37,0xb7,
+    0x77,0xf7,0x0f,0x8f,0x4f,0xcf,0x2f,0xaf,0x6f,0xef,0x1f,0x9f,0x5f,0xdf,
+    0x3f,0xbf,0x7f,0xff,
+};
+
+/* --- bit loops specialized for the bit endianness ---
+
+   BK_BITMASK() tests the bit endianness for every bit.  In bit loops,
+   BK_ENDIAN_SPECIALIZE() is used to expand the loop once for each bit
+   endianness, with E (the given name) declared as a constant, such that
+   the test is done once before the loop, and the mask reduces to a shift
+   within the loop.  Inside the loop, bits are accessed using BK_GETBIT_E()
+   and bk_setbit_e() on the buffers, which are kept in local variables, as
+   the compiler would otherwise have to reload them after each store (a
+   char may alias anything).  The loop must not contain commas outside
+   of parentheses, or labels. */
+#define BK_ENDIAN_SPECIALIZE(E, endian, stmt)  \
+    if ((endian) == BK_ENDIAN_LITTLE) {        \
+        const int E = BK_ENDIAN_LITTLE;        \
+        stmt                                   \
+    }                                          \
+    else {                                     \
+        const int E = BK_ENDIAN_BIG;           \
+        stmt                                   \
+    }
+
+/* expand stmt for each combination of two bit endiannesses */
+#define BK_ENDIAN_SPECIALIZE2(E1, endian1, E2, endian2, stmt)  \
+    BK_ENDIAN_SPECIALIZE(E1, endian1, BK_ENDIAN_SPECIALIZE(E2, endian2, stmt))
+
+/* like BK_BITMASK(), for bit indices i >= 0 */
+#define BK_BITMASK_E(E, i)  \
+    ((char) (1 << ((E) == BK_ENDIAN_LITTLE ? ((i) & 7) : 7 - ((i) & 7))))
+
+#define BK_GETBIT_E(buf, E, i)  ((buf)[(i) >> 3] & BK_BITMASK_E(E, i) ? 1 : 0)
+
+BK_INLINE void
+bk_setbit_e(char *buf, int E, bk_idx_t i, int bit)
+{
+    const char mask = BK_BITMASK_E(E, i);
+
+    assert(i >= 0);
+    if (bit)
+        buf[i >> 3] |= mask;
+    else
+        buf[i >> 3] &= ~mask;
+}
+
+/* ----------------------------- bit spans ----------------------------- */
+
+/* The nbits bits stored in the buffer buf, with given bit endianness.
+   The buffer has (at least) BK_BYTES(nbits) bytes. */
+typedef struct {
+    char *buf;
+    bk_idx_t nbits;
+    int endian;
+} bk_span;
+
+BK_INLINE int
+bk_getbit(const bk_span *s, bk_idx_t i)
+{
+    assert(0 <= i && i < s->nbits);
+    return s->buf[i / 8] & BK_BITMASK(s->endian, i) ? 1 : 0;
+}
+
+BK_INLINE void
+bk_setbit(bk_span *s, bk_idx_t i, int bit)
+{
+    assert(0 <= i && i < s->nbits);
+    bk_setbit_e(s->buf, s->endian, i, bit);
+}
+
+/* ------------------------ word level access ------------------------- */
+
+/* Word level functions work on arrays of 64-bit words, into which the
+   bits of a bitarray are loaded such that bit k ends up as bit k % 64
+   (counting from the least significant bit) of word k / 64, regardless
+   of the bit endianness of the bitarray. */
+typedef unsigned long long bk_word_t;
+
+#define BK_WBITS  64
+
+/* number of words necessary to store given bits */
+#define BK_WORDS(bits)  (((bits) + BK_WBITS - 1) / BK_WBITS)
+
+/* bit k of word array w */
+#define BK_WGET(w, k)  ((int) ((w)[(k) / BK_WBITS] >> ((k) % BK_WBITS)) & 1)
+
+#define BK_WSET(w, k)  \
+    ((w)[(k) / BK_WBITS] |= ((bk_word_t) 1) << ((k) % BK_WBITS))
+
+/* number of 1 bits in x - see Hacker's Delight, section 5-1 */
+BK_INLINE int
+bk_popcount64(bk_word_t x)
+{
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (int) ((x * 0x0101010101010101ULL) >> 56);
+}
+
+/* Return the 8 bits s[p:p+8] as a byte, such that s[p] is the least
+   significant bit.  Note that p + 8 may not exceed the length of s. */
+BK_INLINE unsigned char
+bk_get_byte(const bk_span *s, bk_idx_t p)
+{
+    const unsigned char *buff = (const unsigned char *) s->buf + p / 8;
+    const int r = (int) (p % 8);
+    unsigned int x = buff[0];
+
+    assert(0 <= p && p + 8 <= s->nbits);
+    if (s->endian == BK_ENDIAN_LITTLE) {
+        if (r)
+            x = (x >> r) | (buff[1] << (8 - r));
+        return (unsigned char) x;
+    }
+    if (r)
+        x = (x << r) | (buff[1] >> (8 - r));
+    return bk_reverse_trans[x & 0xff];
+}
+
+/* load the n bits s[start:start+n] into the words w (which need to have
+   room for BK_WORDS(n) words) - the unused bits of the last word are 0 */
+BK_INLINE void
+bk_load_words(const bk_span *s, bk_idx_t start, bk_idx_t n, bk_word_t *w)
+{
+    bk_idx_t i;
+
+    assert(0 <= start && 0 <= n && start + n <= s->nbits);
+    memset(w, 0x00, (size_t) BK_WORDS(n) * sizeof(bk_word_t));
+    for (i = 0; i + 8 <= n; i += 8)
+        w[i / BK_WBITS] |=
+            ((bk_word_t) bk_get_byte(s, start + i)) << (i % BK_WBITS);
+    for (; i < n; i++)
+        if (bk_getbit(s, start + i))
+            BK_WSET(w, i);
+}
+
+/* store the n bits of the words w into s[start:start+n] */
+BK_INLINE void
+bk_store_words(bk_span *s, bk_idx_t start, bk_idx_t n, const bk_word_t *w)
+{
+    unsigned char *buff, c;
+    bk_idx_t i = 0;
+    int r;
+
+    assert(0 <= start && 0 <= n && start + n <= s->nbits);
+    /* set bits individually until a byte boundary of s is reached */
+    for (; i < n && (start + i) % 8; i++)
+        bk_setbit(s, start + i, BK_WGET(w, i));
+
+    buff = (unsigned char *) s->buf + (start + i) / 8;
+    for (; i + 8 <= n; i += 8) {
+        r = (int) (i % BK_WBITS);
+        c = (unsigned char) (w[i / BK_WBITS] >> r);
+        if (r > BK_WBITS - 8)
+            c |= (unsigned char) (w[i / BK_WBITS + 1] << (BK_WBITS - r));
+        *buff++ = s->endian == BK_ENDIAN_LITTLE ? c : bk_reverse_trans[c];
+    }
+    for (; i < n; i++)
+        bk_setbit(s, start + i, BK_WGET(w, i));
+}
+
+/* --------------------------- byte kernels ---------------------------- */
+
+enum bk_op {
+    BK_AND,
+    BK_OR,
+    BK_XOR
+};
+
+/* The kernels which process whole bytes of buffers.  Their
+   implementations are selected according to the features of the CPU
+   using bk_select_kernels() below.  The _bitarray module does so on
+   import (see _sysinfo()), and updates its table in place when the
+   selection changes, such that pointers to it remain valid.  The generic
+   implementations are portable. */
+typedef struct {
+    /* number of 1 bits in the n bytes at buf */
+    bk_idx_t (*count)(const char *buf, bk_idx_t n);
+    /* a[i] = a[i] OP b[i] for the n bytes of a and b, OP given by oper */
+    void (*bitwise)(char *a, const char *b, bk_idx_t n, enum bk_op oper);
+    /* invert the n bytes at buf */
+    void (*invert)(char *buf, bk_idx_t n);
+    /* index of the first of the n bytes at buf which is not c, or n */
+    bk_idx_t (*skip)(const char *buf, bk_idx_t n, char c);
+    /* dst[i] = the 8 bits of src starting at bit 8 * i + r (0 < r < 8) of
+       given bit endianness, for the n bytes of dst (n + 1 bytes of src are
+       read), where the buffers may overlap (as for memmove()) */
+    void (*shift)(char *dst, const char *src, bk_idx_t n, int r,
+                  int endian);
+} bk_kernels;
+
+/* number of members of bk_kernels */
+#define BK_NKERNELS  5
+
+static bk_idx_t
+bk_count_bytes(const char *buf, bk_idx_t n)
+{
+    bk_idx_t i, res = 0;
+    bk_word_t w;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        memcpy(&w, buf + i, 8);
+        res += bk_popcount64(w);
+    }
+    for (; i < n; i++)
+        res += bk_bitcount_lookup[(unsigned char) buf[i]];
+    return res;
+}
+
+static void
+bk_bitwise_bytes(char *a, const char *b, bk_idx_t n, enum bk_op oper)
+{
+    bk_idx_t i;
+    bk_word_t x, y;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        switch (oper) {
+        case BK_AND: x &= y; break;
+        case BK_OR:  x |= y; break;
+        case BK_XOR: x ^= y; break;
+        }
+        memcpy(a + i, &x, 8);
+    }
+    for (; i < n; i++) {
+        switch (oper) {
+        case BK_AND: a[i] &= b[i]; break;
+        case BK_OR:  a[i] |= b[i]; break;
+        case BK_XOR: a[i] ^= b[i]; break;
+        }
+    }
+}
+
+static void
+bk_invert_bytes(char *buf, bk_idx_t n)
+{
+    bk_idx_t i;
+    bk_word_t w;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        memcpy(&w, buf + i, 8);
+        w = ~w;
+        memcpy(buf + i, &w, 8);
+    }
+    for (; i < n; i++)
+        buf[i] = ~buf[i];
+}
+
+static bk_idx_t
+bk_skip_bytes(const char *buf, bk_idx_t n, char c)
+{
+    bk_idx_t i;
+    bk_word_t w, cw;
+
+    memset(&cw, c, 8);
+    for (i = 0; i + 8 <= n; i += 8) {
+        memcpy(&w, buf + i, 8);
+        if (w != cw)
+            break;
+    }
+    for (; i < n; i++)
+        if (buf[i] != c)
+            break;
+    return i;
+}
+
+/* the byte of src at i shifted by r bits, filled with the following byte */
+#define BK_SHIFT_BYTE(E, src, i, r)  ((char) ((E) == BK_ENDIAN_LITTLE ?  \
+    (src)[i] >> (r) | (src)[(i) + 1] << (8 - (r)) :                      \
+    (src)[i] << (r) | (src)[(i) + 1] >> (8 - (r))))
+
+static void
+bk_shift_bytes(char *dst, const char *src, bk_idx_t n, int r, int endian)
+{
+    const unsigned char *usrc = (const unsigned char *) src;
+    bk_idx_t i;
+
+    assert(0 < r && r < 8);
+    if (dst <= src) {
+        BK_ENDIAN_SPECIALIZE(E, endian,
+            for (i = 0; i < n; i++)
+                dst[i] = BK_SHIFT_BYTE(E, usrc, i, r);
+        )
+    }
+    else {
+        BK_ENDIAN_SPECIALIZE(E, endian,
+            for (i = n - 1; i >= 0; i--)
+                dst[i] = BK_SHIFT_BYTE(E, usrc, i, r);
+        )
+    }
+}
+
+static BK_UNUSED const bk_kernels bk_generic_kernels = {
+    bk_count_bytes,
+    bk_bitwise_bytes,
+    bk_invert_bytes,
+    bk_skip_bytes,
+    bk_shift_bytes,
+};
+
+/* ------------------- CPU features and kernel dispatch ------------------- */
+
+enum bk_cpu_feature {
+    BK_CPU_POPCNT           = 1 << 0,
+    BK_CPU_SSE4_2           = 1 << 1,
+    BK_CPU_AVX2             = 1 << 2,
+    BK_CPU_BMI2             = 1 << 3,
+    BK_CPU_AVX512F          = 1 << 4,
+    BK_CPU_AVX512BW         = 1 << 5,
+    BK_CPU_AVX512_VPOPCNTDQ = 1 << 6,
+    BK_CPU_AVX512_VBMI2     = 1 << 7
+};
+
+/* names as in the flags of /proc/cpuinfo, in the order of the bits */
+static BK_UNUSED const char *const bk_cpu_feature_names[] = {
+    "popcnt", "sse4_2", "avx2", "bmi2", "avx512f", "avx512bw",
+    "avx512_vpopcntdq", "avx512_vbmi2", NULL,
+};
+
+/* The ISA levels, which may be selected as an upper limit (e.g. using the
+   environment variable BITARRAY_ISA), each with the features it allows.
+   Features not present on the CPU are never used. */
+typedef struct {
+    const char *name;
+    int features;
+} bk_isa_level;
+
+static BK_UNUSED const bk_isa_level bk_isa_levels[] = {
+    {"generic", 0},
+    {"popcnt",  BK_CPU_POPCNT | BK_CPU_SSE4_2},
+    {"avx2",    BK_CPU_POPCNT | BK_CPU_SSE4_2 | BK_CPU_AVX2},
+    {"avx512",  ~0},
+    {NULL,      0},
+};
+
+/* index of the ISA level with given name in bk_isa_levels, or -1 */
+BK_INLINE int
+bk_find_isa_level(const char *name)
+{
+    int k;
+
+    for (k = 0; bk_isa_levels[k].name; k++)
+        if (strcmp(bk_isa_levels[k].name, name) == 0)
+            return k;
+    return -1;
+}
+
+#ifdef BK_X86_KERNELS
+BK_INLINE void
+bk_cpuid(unsigned int leaf, unsigned int subleaf, unsigned int r[4])
+{
+#ifdef _MSC_VER
+    __cpuidex((int *) r, (int) leaf, (int) subleaf);
+#else
+    __cpuid_count(leaf, subleaf, r[0], r[1], r[2], r[3]);
+#endif
+}
+
+/* the register state enabled by the OS (XCR0) */
+BK_INLINE unsigned long long
+bk_xgetbv0(void)
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned int lo, hi;
+
+    __asm__ __volatile__ ("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+    return ((unsigned long long) hi << 32) | lo;
+#endif
+}
+#endif  /* BK_X86_KERNELS */
+
+/* the features (enum bk_cpu_feature) of the CPU which may be used */
+BK_INLINE int
+bk_detect_cpu_features(void)
+{
+    int res = 0;
+#ifdef BK_X86_KERNELS
+    unsigned int r[4], max_leaf;
+    unsigned long long xcr0 = 0;
+
+    bk_cpuid(0, 0, r);
+    max_leaf = r[0];
+    if (max_leaf < 1)
+        return 0;
+
+    bk_cpuid(1, 0, r);
+    if (r[2] & (1u << 23))
+        res |= BK_CPU_POPCNT;
+    if (r[2] & (1u << 20))
+        res |= BK_CPU_SSE4_2;
+    /* AVX registers may only be used when the OS saves them (OSXSAVE) */
+    if ((r[2] & (1u << 27)) && (r[2] & (1u << 28)))
+        xcr0 = bk_xgetbv0();
+    if (max_leaf < 7)
+        return res;
+
+    bk_cpuid(7, 0, r);
+    if (r[1] & (1u << 8))
+        res |= BK_CPU_BMI2;
+    if ((xcr0 & 0x06) == 0x06 && (r[1] & (1u << 5)))
+        res |= BK_CPU_AVX2;
+    /* AVX-512 additionally requires the opmask and ZMM state */
+    if ((xcr0 & 0xe6) == 0xe6 && (r[1] & (1u << 16))) {
+        res |= BK_CPU_AVX512F;
+        if (r[1] & (1u << 30))
+            res |= BK_CPU_AVX512BW;
+        if (r[2] & (1u << 14))
+            res |= BK_CPU_AVX512_VPOPCNTDQ;
+        if (r[2] & (1u << 6))
+            res |= BK_CPU_AVX512_VBMI2;
+    }
+#endif  /* BK_X86_KERNELS */
+    return res;
+}
+
+#ifdef BK_X86_KERNELS
+/* --- x86 kernels, the remaining bytes are left to a lower level --- */
+
+BK_TARGET("popcnt") static bk_idx_t
+bk_count_popcnt(const char *buf, bk_idx_t n)
+{
+    bk_idx_t i, res = 0;
+    bk_word_t w;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        memcpy(&w, buf + i, 8);
+        res += (bk_idx_t) BK_POPCNT64(w);
+    }
+    for (; i < n; i++)
+        res += bk_bitcount_lookup[(unsigned char) buf[i]];
+    return res;
+}
+
+/* count the 1 bits of each nibble using a lookup table in a register,
+   and add the bytes using SAD - see Mula, Kurz and Lemire:
+   "Faster Population Counts Using AVX2 Instructions" */
+BK_TARGET("avx2,popcnt") static bk_idx_t
+bk_count_avx2(const char *buf, bk_idx_t n)
+{
+    const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                           1, 2, 2, 3, 2, 3, 3, 4,
+                                           0, 1, 1, 2, 1, 2, 2, 3,
+                                           1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    __m256i v, cnt, acc = _mm256_setzero_si256();
+    unsigned long long sums[4];
+    bk_idx_t i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        v = _mm256_loadu_si256((const __m256i *) (buf + i));
+        cnt = _mm256_add_epi8(
+            _mm256_shuffle_epi8(table, _mm256_and_si256(v, low)),
+            _mm256_shuffle_epi8(table, _mm256_and_si256(
+                                    _mm256_srli_epi16(v, 4), low)));
+        acc = _mm256_add_epi64(acc,
+                               _mm256_sad_epu8(cnt, _mm256_setzero_si256()));
+    }
+    _mm256_storeu_si256((__m256i *) sums, acc);
+    return (bk_idx_t) (sums[0] + sums[1] + sums[2] + sums[3]) +
+        bk_count_popcnt(buf + i, n - i);
+}
+
+BK_TARGET("avx2") static void
+bk_bitwise_avx2(char *a, const char *b, bk_idx_t n, enum bk_op oper)
+{
+    __m256i x, y;
+    bk_idx_t i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        x = _mm256_loadu_si256((const __m256i *) (a + i));
+        y = _mm256_loadu_si256((const __m256i *) (b + i));
+        switch (oper) {
+        case BK_AND: x = _mm256_and_si256(x, y); break;
+        case BK_OR:  x = _mm256_or_si256(x, y); break;
+        case BK_XOR: x = _mm256_xor_si256(x, y); break;
+        }
+        _mm256_storeu_si256((__m256i *) (a + i), x);
+    }
+    bk_bitwise_bytes(a + i, b + i, n - i, oper);
+}
+
+BK_TARGET("avx2") static void
+bk_invert_avx2(char *buf, bk_idx_t n)
+{
+    const __m256i ones = _mm256_set1_epi8(-1);
+    __m256i v;
+    bk_idx_t i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        v = _mm256_loadu_si256((const __m256i *) (buf + i));
+        _mm256_storeu_si256((__m256i *) (buf + i),
+                            _mm256_xor_si256(v, ones));
+    }
+    bk_invert_bytes(buf + i, n - i);
+}
+
+BK_TARGET("avx2") static bk_idx_t
+bk_skip_avx2(const char *buf, bk_idx_t n, char c)
+{
+    const __m256i v = _mm256_set1_epi8(c);
+    __m256i x;
+    bk_idx_t i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        x = _mm256_loadu_si256((const __m256i *) (buf + i));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, v)) != -1)
+            break;
+    }
+    return i + bk_skip_bytes(buf + i, n - i, c);
+}
+
+/* The 32 bytes of bk_shift_bytes() at src.  As there are no byte shifts,
+   the 16-bit lanes of the bytes at src (x) and src + 1 (y) are shifted,
+   and the masks mx and my remove the bits shifted across bytes. */
+BK_TARGET("avx2") static __m256i
+bk_shift32_avx2(const char *src, int little, __m128i r, __m128i rc,
+                __m256i mx, __m256i my)
+{
+    const __m256i x = _mm256_loadu_si256((const __m256i *) src);
+    const __m256i y = _mm256_loadu_si256((const __m256i *) (src + 1));
+
+    if (little)
+        return _mm256_or_si256(_mm256_and_si256(_mm256_srl_epi16(x, r), mx),
+                               _mm256_and_si256(_mm256_sll_epi16(y, rc), my));
+    return _mm256_or_si256(_mm256_and_si256(_mm256_sll_epi16(x, r), mx),
+                           _mm256_and_si256(_mm256_srl_epi16(y, rc), my));
+}
+
+BK_TARGET("avx2") static void
+bk_shift_avx2(char *dst, const char *src, bk_idx_t n, int r, int endian)
+{
+    const int little = endian == BK_ENDIAN_LITTLE;
+    const __m128i cr = _mm_cvtsi32_si128(r), crc = _mm_cvtsi32_si128(8 - r);
+    const __m256i mx = _mm256_set1_epi8(
+        (char) (little ? 0xff >> r : 0xff << r));
+    const __m256i my = _mm256_set1_epi8(
+        (char) (little ? 0xff << (8 - r) : 0xff >> (8 - r)));
+    bk_idx_t i;
+
+    assert(0 < r && r < 8);
+    /* both loads are done before the store, see bk_shift_bytes() */
+    if (dst <= src) {
+        for (i = 0; i + 32 <= n; i += 32)
+            _mm256_storeu_si256((__m256i *) (dst + i), bk_shift32_avx2(
+                                    src + i, little, cr, crc, mx, my));
+        bk_shift_bytes(dst + i, src + i, n - i, r, endian);
+    }
+    else {
+        for (i = n; i >= 32; i -= 32)
+            _mm256_storeu_si256((__m256i *) (dst + i - 32), bk_shift32_avx2(
+                                    src + i - 32, little, cr, crc, mx, my));
+        bk_shift_bytes(dst, src, i, r, endian);
+    }
+}
+
+BK_TARGET("avx512f,avx512vpopcntdq,popcnt") static bk_idx_t
+bk_count_avx512(const char *buf, bk_idx_t n)
+{
+    __m512i acc = _mm512_setzero_si512();
+    unsigned long long sums[8];
+    bk_idx_t i, res;
+    int k;
+
+    for (i = 0; i + 64 <= n; i += 64)
+        acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(
+                                   _mm512_loadu_si512(buf + i)));
+    /* _mm512_reduce_add_epi64() triggers -Wuninitialized in GCC 12 */
+    _mm512_storeu_si512(sums, acc);
+    for (res = 0, k = 0; k < 8; k++)
+        res += (bk_idx_t) sums[k];
+    return res + bk_count_popcnt(buf + i, n - i);
+}
+
+BK_TARGET("avx512f") static void
+bk_bitwise_avx512(char *a, const char *b, bk_idx_t n, enum bk_op oper)
+{
+    __m512i x, y;
+    bk_idx_t i;
+
+    for (i = 0; i + 64 <= n; i += 64) {
+        x = _mm512_loadu_si512(a + i);
+        y = _mm512_loadu_si512(b + i);
+        switch (oper) {
+        case BK_AND: x = _mm512_and_si512(x, y); break;
+        case BK_OR:  x = _mm512_or_si512(x, y); break;
+        case BK_XOR: x = _mm512_xor_si512(x, y); break;
+        }
+        _mm512_storeu_si512(a + i, x);
+    }
+    bk_bitwise_bytes(a + i, b + i, n - i, oper);
+}
+
+BK_TARGET("avx512f") static void
+bk_invert_avx512(char *buf, bk_idx_t n)
+{
+    const __m512i ones = _mm512_set1_epi32(-1);
+    bk_idx_t i;
+
+    for (i = 0; i + 64 <= n; i += 64)
+        _mm512_storeu_si512(buf + i, _mm512_xor_si512(
+                                _mm512_loadu_si512(buf + i), ones));
+    bk_invert_bytes(buf + i, n - i);
+}
+
+BK_TARGET("avx512f,avx512bw") static bk_idx_t
+bk_skip_avx512(const char *buf, bk_idx_t n, char c)
+{
+    const __m512i v = _mm512_set1_epi8(c);
+    bk_idx_t i;
+
+    for (i = 0; i + 64 <= n; i += 64)
+        if (_mm512_cmpneq_epi8_mask(_mm512_loadu_si512(buf + i), v))
+            break;
+    return i + bk_skip_bytes(buf + i, n - i, c);
+}
+#endif  /* BK_X86_KERNELS */
+
+/* Fill the table k with the best kernels which only use the given
+   features (typically those of bk_detect_cpu_features(), limited by the
+   features of an ISA level).  When names is not NULL, the names of the
+   ISA levels of the selected kernels are stored in names[0], names[1],
+   ..., in the order of the members of bk_kernels. */
+BK_INLINE void
+bk_select_kernels(bk_kernels *k, int features, const char **names)
+{
+    const char *dummy[BK_NKERNELS];
+
+#define BK_HAS(f)  ((features & (f)) == (f))
+    if (names == NULL)
+        names = dummy;
+    *k = bk_generic_kernels;
+    names[0] = names[1] = names[2] = names[3] = names[4] = "generic";
+#ifdef BK_X86_KERNELS
+    if (BK_HAS(BK_CPU_AVX512F | BK_CPU_AVX512_VPOPCNTDQ | BK_CPU_POPCNT)) {
+        k->count = bk_count_avx512;
+        names[0] = "avx512";
+    }
+    else if (BK_HAS(BK_CPU_AVX2 | BK_CPU_POPCNT)) {
+        k->count = bk_count_avx2;
+        names[0] = "avx2";
+    }
+    else if (BK_HAS(BK_CPU_POPCNT)) {
+        k->count = bk_count_popcnt;
+        names[0] = "popcnt";
+    }
+    if (BK_HAS(BK_CPU_AVX512F)) {
+        k->bitwise = bk_bitwise_avx512;
+        k->invert = bk_invert_avx512;
+        names[1] = names[2] = "avx512";
+    }
+    else if (BK_HAS(BK_CPU_AVX2)) {
+        k->bitwise = bk_bitwise_avx2;
+        k->invert = bk_invert_avx2;
+        names[1] = names[2] = "avx2";
+    }
+    if (BK_HAS(BK_CPU_AVX512F | BK_CPU_AVX512BW)) {
+        k->skip = bk_skip_avx512;
+        names[3] = "avx512";
+    }
+    else if (BK_HAS(BK_CPU_AVX2)) {
+        k->skip = bk_skip_avx2;
+        names[3] = "avx2";
+    }
+    if (BK_HAS(BK_CPU_AVX2)) {
+        k->shift = bk_shift_avx2;
+        names[4] = "avx2";
+    }
+#endif  /* BK_X86_KERNELS */
+#undef BK_HAS
+}
+
+/* number of 1 bits in (a OP b) of n bytes, without modifying a or b */
+BK_INLINE bk_idx_t
+bk_count_op(const bk_kernels *k, const char *a, const char *b,
+            bk_idx_t n, enum bk_op oper)
+{
+    char buf[1024];
+    const bk_idx_t size = (bk_idx_t) sizeof(buf);
+    bk_idx_t i, m, res = 0;
+
+    for (i = 0; i < n; i += m) {
+        m = n - i < size ? n - i : size;
+        memcpy(buf, a + i, (size_t) m);
+        k->bitwise(buf, b + i, m, oper);
+        res += k->count(buf, m);
+    }
+    return res;
+}
+
+/* ---------------------------- bit kernels ---------------------------- */
+
+/* number of 1 bits in s[start:stop], where the whole bytes are counted
+   by the count kernel of k */
+BK_INLINE bk_idx_t
+bk_count(const bk_kernels *k, const bk_span *s,
+         bk_idx_t start, bk_idx_t stop)
+{
+    bk_idx_t i, res = 0;
+
+    assert(0 <= start && start <= s->nbits);
+    assert(0 <= stop && stop <= s->nbits);
+    if (start >= stop)
+        return 0;
+
+    if (stop >= start + 8) {
+        const bk_idx_t byte_start = BK_BYTES(start);
+        const bk_idx_t byte_stop = stop / 8;
+
+        for (i = start; i < BK_BITS(byte_start); i++)
+            res += bk_getbit(s, i);
+        res += k->count(s->buf + byte_start, byte_stop - byte_start);
+        for (i = BK_BITS(byte_stop); i < stop; i++)
+            res += bk_getbit(s, i);
+    }
+    else {
+        for (i = start; i < stop; i++)
+            res += bk_getbit(s, i);
+    }
+    return res;
+}
+
+/* index of the first bit equal to vi in s[start:stop], or -1, where
+   whole bytes are skipped by the skip kernel of k */
+BK_INLINE bk_idx_t
+bk_findfirst(const bk_kernels *k, const bk_span *s, int vi,
+             bk_idx_t start, bk_idx_t stop)
+{
+    bk_idx_t i, j;
+
+    assert(0 <= start && start <= s->nbits);
+    assert(0 <= stop && stop <= s->nbits);
+    assert(0 <= vi && vi <= 1);
+    if (start >= stop)
+        return -1;
+
+    if (stop >= start + 8) {
+        /* seraching for 1 means: break when byte is not 0x00
+           searching for 0 means: break when byte is not 0xff */
+        const char c = (char) (vi ? 0x00 : 0xff);
+
+        /* skip ahead by checking whole bytes */
+        j = start / 8;
+        j += k->skip(s->buf + j, BK_BYTES(stop) - j, c);
+
+        if (start < BK_BITS(j))
+            start = BK_BITS(j);
+    }
+
+    /* fine grained search */
+    for (i = start; i < stop; i++)
+        if (bk_getbit(s, i) == vi)
+            return i;
+    return -1;
+}
+
+/* set the bits s[start:stop] to vi */
+BK_INLINE void
+bk_setrange(bk_span *s, bk_idx_t start, bk_idx_t stop, int vi)
+{
+    bk_idx_t i;
+
+    assert(0 <= start && start <= s->nbits);
+    assert(0 <= stop && stop <= s->nbits);
+    if (start >= stop)
+        return;
+
+    if (stop >= start + 8) {
+        const bk_idx_t byte_start = BK_BYTES(start);
+        const bk_idx_t byte_stop = stop / 8;
+
+        for (i = start; i < BK_BITS(byte_start); i++)
+            bk_setbit(s, i, vi);
+        memset(s->buf + byte_start, vi ? 0xff : 0x00,
+               (size_t) (byte_stop - byte_start));
+        for (i = BK_BITS(byte_stop); i < stop; i++)
+            bk_setbit(s, i, vi);
+    }
+    else {
+        for (i = start; i < stop; i++)
+            bk_setbit(s, i, vi);
+    }
+}
+
+/* copy the n bits individually, see bk_copy() */
+BK_INLINE void
+bk_copy_bits(bk_span *dst, bk_idx_t a, const bk_span *src, bk_idx_t b,
+             bk_idx_t n)
+{
+    char *dbuf = dst->buf;
+    const char *sbuf = src->buf;
+    bk_idx_t i;
+
+    /* The two different types of looping are only relevant when copying
+       a buffer onto itself. */
+    if (a <= b) {                           /* loop forward (delete) */
+        BK_ENDIAN_SPECIALIZE2(Ed, dst->endian, Es, src->endian,
+            for (i = 0; i < n; i++)
+                bk_setbit_e(dbuf, Ed, i + a, BK_GETBIT_E(sbuf, Es, i + b));
+        )
+    }
+    else {                                /* loop backwards (insert) */
+        BK_ENDIAN_SPECIALIZE2(Ed, dst->endian, Es, src->endian,
+            for (i = n - 1; i >= 0; i--)
+                bk_setbit_e(dbuf, Ed, i + a, BK_GETBIT_E(sbuf, Es, i + b));
+        )
+    }
+}
+
+/* Copy n bits from src (starting at b) onto dst (starting at a).  The
+   spans may share the same buffer, and the ranges may overlap.  Return 1
+   when whole bytes were copied (using memmove() or the shift kernel of
+   k), and 0 when the bits were copied individually. */
+BK_INLINE int
+bk_copy(const bk_kernels *k, bk_span *dst, bk_idx_t a,
+        const bk_span *src, bk_idx_t b, bk_idx_t n)
+{
+    /* number of bits before the first byte boundary of dst */
+    const bk_idx_t h = (8 - a % 8) % 8;
+
+    assert(0 <= n && n <= dst->nbits && n <= src->nbits);
+    assert(0 <= a && a <= dst->nbits - n);
+    assert(0 <= b && b <= src->nbits - n);
+
+    /* When the bit endiannesses are equal, we copy the bits before the
+       first byte boundary of dst individually, the following whole bytes
+       of dst using memmove() (when src is at a byte boundary as well) or
+       the shift kernel, and the remaining few bits individually.  Note
+       that the order of these operations matters when copying a buffer
+       onto itself. */
+    if (dst->endian == src->endian && n - h >= 8) {
+        const bk_idx_t bytes = (n - h) / 8, bits = h + BK_BITS(bytes);
+        char *dbuf = dst->buf + (a + h) / 8;
+        const char *sbuf = src->buf + (b + h) / 8;
+        const int r = (int) ((b + h) % 8);
+
+        assert(bits <= n && n < bits + 8);
+        if (a <= b)
+            bk_copy_bits(dst, a, src, b, h);
+        else
+            bk_copy_bits(dst, a + bits, src, b + bits, n - bits);
+
+        if (r == 0)
+            memmove(dbuf, sbuf, (size_t) bytes);
+        else
+            k->shift(dbuf, sbuf, bytes, r, dst->endian);
+
+        if (a <= b)
+            bk_copy_bits(dst, a + bits, src, b + bits, n - bits);
+        else
+            bk_copy_bits(dst, a, src, b, h);
+        return 1;
+    }
+    bk_copy_bits(dst, a, src, b, n);
+    return 0;
+}
+
+/* search for the first occurrence of the bits of x (in s), starting at p,
+   and return its position (or -1 when not found) */
+BK_INLINE bk_idx_t
+bk_search(const bk_span *s, const bk_span *x, bk_idx_t p)
+{
+    const char *buf = s->buf, *xbuf = x->buf;
+    const bk_idx_t m = x->nbits, stop = s->nbits - m + 1;
+    bk_idx_t i;
+
+    assert(p >= 0);
+    BK_ENDIAN_SPECIALIZE2(Es, s->endian, Ex, x->endian,
+        for (; p < stop; p++) {
+            for (i = 0; i < m; i++)
+                if (BK_GETBIT_E(buf, Es, p + i) != BK_GETBIT_E(xbuf, Ex, i))
+                    break;
+            if (i == m)
+                break;
+        }
+    )
+    return p < stop ? p : -1;
+}
+
+/* like bk_search(), but only compare the bits of x where the bits of mask
+   (which has the same length as x) are 1 */
+BK_INLINE bk_idx_t
+bk_search_masked(const bk_span *s, const bk_span *x, const bk_span *mask,
+                 bk_idx_t p)
+{
+    const char *buf = s->buf, *xbuf = x->buf, *mbuf = mask->buf;
+    const bk_idx_t m = x->nbits, stop = s->nbits - m + 1;
+    bk_idx_t i;
+
+    assert(p >= 0 && mask->nbits == m);
+    BK_ENDIAN_SPECIALIZE2(Es, s->endian, Ex, x->endian,
+    BK_ENDIAN_SPECIALIZE(Em, mask->endian,
+        for (; p < stop; p++) {
+            for (i = 0; i < m; i++)
+                if (BK_GETBIT_E(mbuf, Em, i) && BK_GETBIT_E(buf, Es, p + i)
+                                             != BK_GETBIT_E(xbuf, Ex, i))
+                    break;
+            if (i == m)
+                break;
+        }
+    ))
+    return p < stop ? p : -1;
+}
+
+/* --------------------------- prefix codes ---------------------------- */
+
+/* node of the binary tree of a prefix code, where leaf nodes have a
+   symbol (which is opaque to the kernels) */
+typedef struct bk_node {
+    struct bk_node *child[2];
+    void *symbol;
+} bk_node;
+
+/* Starting at the root of the tree, follow the branches given by the
+   bits of s, starting at *p (which is advanced past the bits used), until
+   a leaf is reached.  Return 1 when a leaf was reached (which is stored
+   in *leaf), 0 when s ended before any bit was used, -1 when the bits do
+   not match any code, and -2 when s ended within a code. */
+BK_INLINE int
+bk_decode_next(const bk_node *tree, const bk_span *s, bk_idx_t *p,
+               const bk_node **leaf)
+{
+    const char *buf = s->buf;
+    const bk_node *nd = tree;
+    bk_idx_t i = *p;
+
+    assert(tree->symbol == NULL);
+    BK_ENDIAN_SPECIALIZE(E, s->endian,
+        while (i < s->nbits) {
+            nd = nd->child[BK_GETBIT_E(buf, E, i)];
+            i++;
+            if (nd == NULL || nd->symbol)
+                break;
+        }
+    )
+    *p = i;
+    if (nd == NULL)
+        return -1;
+    if (nd->symbol) {
+        *leaf = nd;
+        return 1;
+    }
+    return nd == tree ? 0 : -2;
+}
+
+#endif  /* BITKERNELS_H */
@@ -31,8 +31,8 @@ else:
 
 
 from bitarray import (bitarray, frozenbitarray, bitdiff, bits2bytes,
-                      get_default_endian, _set_default_endian,
-                      _sysinfo, __version__)
+                      get_default_endian, _set_default_endian, _set_isa,
+                      enable_stats, stats, _sysinfo, __version__)
 
 tests = []
 
@@ -470,6 +470,27 @@ class SliceTests(unittest.TestCase, Util):
                 s = slice(self.rndsliceidx(la), self.rndsliceidx(la), step)
                 self.assertEQUAL(a[s], bitarray(aa[s], endian=a.endian()))
 
+    def test_getitem_large_index(self):
+        # indices which do not fit into 64 bits, like for lists, item
+        # access raises IndexError and slice indices are clipped
+        class Index(object):
+            def __init__(self, i):
+                self.i = i
+            def __index__(self):
+                return self.i
+
+        a = bitarray('01101')
+        aa = a.tolist()
+        for big in 1 << 64, 1 << 100, Index(1 << 70):
+            self.assertRaises(IndexError, a.__getitem__, big)
+        for i in 1 << 64, -(1 << 64), 1 << 100, -(1 << 100):
+            self.assertRaises(IndexError, a.__getitem__, i)
+            for s in (slice(i, None), slice(None, i), slice(i, 2),
+                      slice(2, i), slice(None, None, i), slice(i, -i, -1)):
+                self.assertEqual(a[s], bitarray(aa[s]))
+        self.assertEqual(a[Index(-(1 << 80)):Index(1 << 80)], a)
+        self.assertEqual(a.pop(Index(1)), 1)
+
     def test_setitem1(self):
         a = bitarray([False])
         a[0] = 1
@@ -1587,6 +1608,88 @@ class MethodTests(unittest.TestCase, Util):
                     p = -1
                 self.assertEqual(p, aa.find(sub))
 
+    def test_search_mask(self):
+        a = bitarray('10010101110011111001011')
+        b, m = bitarray('0011'), bitarray('1011')
+        res = [p for p in range(len(a) - 3)
+               if a[p] == 0 and a[p + 2:p + 4] == bitarray('11')]
+        self.assertEqual(a.search(b, mask=m), res)
+        self.assertEqual(a.search(bitarray('0111'), mask=m), res)
+        self.assertEqual(a.search(b, 2, mask=m), res[:2])
+        self.assertEqual(list(a.itersearch(b, mask=m)), res)
+        self.assertEqual(list(a.itersearch(b, m)), res)
+        self.assertEqual(a.search(b, mask=bitarray('0000')),
+                         list(range(len(a) - 3)))
+        self.assertEqual(a.search(b, mask=None), a.search(b))
+        self.assertEqual(list(a.itersearch(b, mask=None)), a.search(b))
+        self.assertRaises(TypeError, a.search, b, mask='1011')
+        self.assertRaises(ValueError, a.search, b, mask=bitarray('101'))
+        self.assertRaises(TypeError, a.itersearch, b, mask='1011')
+        self.assertRaises(ValueError, a.itersearch, b, bitarray('101'))
+
+        it = a.itersearch(b, mask=m)
+        self.assertEqual(next(it), res[0])
+        m.append(1)
+        self.assertRaises(ValueError, next, it)
+
+    def test_search_mask_random(self):
+        for a in self.randombitarrays():
+            aa = a.to01()
+            n = randint(1, 10)
+            b = bitarray([randint(0, 1) for _ in range(n)])
+            m = bitarray([randint(0, 1) for _ in range(n)])
+            res = [p for p in range(len(a) - n + 1)
+                   if all(aa[p + i] == b.to01()[i]
+                          for i in range(n) if m[i])]
+            self.assertEqual(a.search(b, mask=m), res)
+            self.assertEqual(list(a.itersearch(b, mask=m)), res)
+
+    def test_search_approx(self):
+        a = bitarray('10010101110011111001011')
+        self.assertEqual(a.search_approx(bitarray('011'), 0),
+                         [(6, 0), (11, 0), (20, 0)])
+        self.assertEqual(a.search_approx(bitarray('0110'), 1, 3),
+                         [(1, 1), (6, 1), (7, 1)])
+        self.assertEqual(a.search_approx(a, 0), [(0, 0)])
+        self.assertEqual(a.search_approx(~a, len(a)), [(0, len(a))])
+        self.assertEqual(a.search_approx(a + bitarray('0'), 5), [])
+        self.assertEqual(a.search_approx(bitarray('1'), 1, 0), [])
+        self.assertRaises(ValueError, a.search_approx, bitarray(), 1)
+        self.assertRaises(ValueError, a.search_approx, bitarray('1'), -1)
+        self.assertRaises(TypeError, a.search_approx, '010', 1)
+
+    def test_search_approx_random(self):
+        for a in self.randombitarrays():
+            aa = a.to01()
+            for _ in range(3):
+                n = randint(1, 150)
+                b = bitarray([randint(0, 1) for _ in range(n)],
+                             endian=['little', 'big'][randint(0, 1)])
+                bb = b.to01()
+                k = randint(0, n // 4)
+                res = []
+                for p in range(len(a) - n + 1):
+                    d = sum(x != y for x, y in zip(aa[p:p + n], bb))
+                    if d <= k:
+                        res.append((p, d))
+                self.assertEqual(a.search_approx(b, k), res)
+
+    def test_search_approx_end(self):
+        # the windows near the end of the buffer are read in place
+        for endian in 'little', 'big':
+            for n in 1, 7, 63, 64, 65, 130:
+                a = bitarray(200 + n % 8, endian)
+                a.setall(0)
+                b = bitarray(n, endian)
+                b.setall(1)
+                a[-n:] = b
+                b2 = bitarray(b, {'little': 'big', 'big': 'little'}[endian])
+                for x in b, b2:
+                    res = a.search_approx(x, 0)
+                    self.assertEqual(res, [(len(a) - n, 0)])
+                    res = a.search_approx(x, 1)
+                    self.assertEqual(res[-1], (len(a) - n, 0))
+
     def test_search_type(self):
         a = bitarray('10011')
         it = a.itersearch(bitarray('1'))
@@ -2203,6 +2306,160 @@ tests.append(FileTests)
 
 # ---------------------------------------------------------------------------
 
+class DirtyBlockTests(unittest.TestCase, Util):
+
+    B = 8 * 4096  # bits per block
+
+    def tracked(self, nblocks, endian='big'):
+        a = bitarray(nblocks * self.B, endian)
+        a.setall(0)
+        a.track_dirty()
+        self.assertEqual(a.dirty_blocks(), [])
+        return a
+
+    def check_sound(self, a, before):
+        # every block which actually changed has to be marked dirty
+        after = a.tobytes()
+        dirty = set(a.dirty_blocks())
+        for i in range(0, max(len(before), len(after)), 4096):
+            if before[i:i + 4096] != after[i:i + 4096]:
+                if i < len(after):
+                    self.assertTrue(i // 4096 in dirty, i // 4096)
+
+    def test_off(self):
+        a = bitarray(100)
+        self.assertRaises(ValueError, a.dirty_blocks)
+        self.assertRaises(ValueError, a.clear_dirty)
+        self.assertRaises(ValueError, a.tofile_incremental, BytesIO())
+        a.track_dirty()
+        a[0] = 1
+        self.assertEqual(a.dirty_blocks(), [0])
+        a.track_dirty(False)
+        self.assertRaises(ValueError, a.dirty_blocks)
+        # copies are not tracked
+        a.track_dirty(True)
+        self.assertRaises(ValueError, a.copy().dirty_blocks)
+
+    def test_setitem(self):
+        a = self.tracked(4)
+        a[self.B + 5] = 1
+        a[-1] = 1
+        self.assertEqual(a.dirty_blocks(), [1, 3])
+        a.clear_dirty()
+        self.assertEqual(a.dirty_blocks(), [])
+        a[2 * self.B: 2 * self.B + 3] = bitarray('101')
+        self.assertEqual(a.dirty_blocks(), [2])
+        a.clear_dirty()
+        # extended slices mark the range they cover
+        a[::3 * self.B] = 1
+        self.assertEqual(a.dirty_blocks(), [0, 1, 2, 3])
+        a.clear_dirty()
+        a[3 * self.B:self.B - 1:-self.B] = 0
+        self.assertEqual(a.dirty_blocks(), [1, 2, 3])
+        a.clear_dirty()
+        a[self.B + 3:2 * self.B:7] = 1
+        self.assertEqual(a.dirty_blocks(), [1])
+        a.clear_dirty()
+        # nothing is marked when the assignment fails
+        self.assertRaises(IndexError, a.__setitem__, slice(None), 'x')
+        self.assertRaises(ValueError, a.__setitem__, slice(None, None, 2),
+                          bitarray('1'))
+        self.assertEqual(a.dirty_blocks(), [])
+
+    def test_whole(self):
+        for f in [lambda a: a.setall(1), lambda a: a.invert(),
+                  lambda a: a.reverse(), lambda a: a.bytereverse(),
+                  lambda a: a.sort(), lambda a: a.__iand__(a.copy()),
+                  lambda a: a.__ior__(a.copy()),
+                  lambda a: a.__ixor__(a.copy())]:
+            a = self.tracked(3)
+            f(a)
+            self.assertEqual(a.dirty_blocks(), [0, 1, 2])
+
+    def test_resize(self):
+        a = self.tracked(2)
+        a.append(1)
+        self.assertEqual(a.dirty_blocks(), [1, 2])
+        a.clear_dirty()
+        a.extend(self.B * [0])
+        self.assertEqual(a.dirty_blocks(), [2, 3])
+        a.clear_dirty()
+        # the last byte is gone (block 3)
+        del a[self.B + 7]
+        self.assertEqual(a.dirty_blocks(), [1, 2])
+        a.clear_dirty()
+        a.pop()
+        self.assertEqual(a.dirty_blocks(), [2])
+        a.clear_dirty()
+        a.insert(self.B, 1)
+        self.assertEqual(a.dirty_blocks(), [1, 2])
+
+    def test_buffer(self):
+        a = self.tracked(3)
+        m = memoryview(a)
+        self.assertEqual(a.dirty_blocks(), [])
+        m[5000] = 1
+        del m
+        self.assertEqual(a.dirty_blocks(), [0, 1, 2])
+
+    def test_random(self):
+        for endian in 'little', 'big':
+            a = bitarray(randint(0, 3 * self.B), endian)
+            a.setall(0)
+            f = BytesIO()
+            a.tofile(f)
+            a.track_dirty()
+            for _ in range(50):
+                before = a.tobytes()
+                n = len(a)
+                i = randint(0, n)
+                j = randint(i, n)
+                op = randint(0, 6)
+                if op == 0 and n:
+                    a[randint(0, n - 1)] = 1
+                elif op == 1:
+                    a[i:j] = 1
+                elif op == 2:
+                    a[i:j:randint(1, 5)] = 0
+                elif op == 3:
+                    del a[i:j:randint(1, 3)]
+                elif op == 4:
+                    a[i:j] = bitarray(randint(0, 1000) * '1')
+                elif op == 5:
+                    a.extend(randint(0, 5000) * '1')
+                else:
+                    a.frombytes(os.urandom(randint(0, 10)))
+                self.check_sound(a, before)
+                if randint(0, 4) == 0:
+                    a.tofile_incremental(f)
+                    self.assertEqual(f.getvalue(), a.tobytes())
+                    self.assertEqual(a.dirty_blocks(), [])
+            a.tofile_incremental(f)
+            self.assertEqual(f.getvalue(), a.tobytes())
+
+    def test_tofile_incremental(self):
+        a = self.tracked(5, 'little')
+        f = BytesIO()
+        a.tofile(f)
+        a[3 * self.B + 1] = 1
+        a.tofile_incremental(f)
+        self.assertEqual(f.getvalue(), a.tobytes())
+        self.assertEqual(a.dirty_blocks(), [])
+        # shrinking truncates the file
+        del a[self.B + 3:]
+        a.tofile_incremental(f)
+        self.assertEqual(f.getvalue(), a.tobytes())
+        self.assertEqual(len(f.getvalue()), 4097)
+
+    def test_frozen(self):
+        a = frozenbitarray(1000)
+        a.track_dirty()
+        self.assertEqual(a.dirty_blocks(), [])
+
+tests.append(DirtyBlockTests)
+
+# ---------------------------------------------------------------------------
+
 class PrefixCodeTests(unittest.TestCase, Util):
 
     def test_encode_string(self):
@@ -2583,6 +2840,459 @@ tests.append(TestsFrozenbitarray)
 
 # ---------------------------------------------------------------------------
 
+def huge_bits():
+    """
+    Return the maximal number of bits given by the environment variable
+    BITARRAY_HUGE (which may use the suffixes k, M, G), or 0 when not set.
+    """
+    s = os.environ.get('BITARRAY_HUGE', '')
+    if not s:
+        return 0
+    shift = {'k': 10, 'M': 20, 'G': 30}.get(s[-1], 0)
+    return int(s[:-1] if shift else s) << shift
+
+@unittest.skipIf(huge_bits() == 0, "BITARRAY_HUGE not set")
+class HugeTests(unittest.TestCase):
+    """
+    Tests for bitarrays longer than 2^31 bits, near the boundaries where
+    32-bit indices overflow (for bits at 2^31 and 2^32, and for bytes at
+    2^34), and at 2^35 bits.  These tests are opt-in, as they need up to
+    1/8 of the number of bits given by BITARRAY_HUGE (e.g. 8G) in memory,
+    see also bench/huge.py.
+    """
+    PAD = 256
+
+    def boundaries(self):
+        res = [1 << k for k in (31, 32, 34, 35)
+               if (1 << k) + self.PAD <= huge_bits()]
+        if not res:
+            self.skipTest("BITARRAY_HUGE too small")
+        return res
+
+    def huge(self, B, endian):
+        a = bitarray(B + self.PAD, endian)
+        a.setall(0)
+        self.assertEqual(len(a), B + self.PAD)
+        self.assertEqual(a.length(), B + self.PAD)
+        self.assertEqual(a.buffer_info()[1], (B + self.PAD) // 8)
+        return a
+
+    def test_items(self):
+        for k, B in enumerate(self.boundaries()):
+            a = self.huge(B, ['little', 'big'][k % 2])
+            n = len(a)
+            ones = [B - 65, B - 1, B, B + 1, B + 63]
+            for i in ones:
+                a[i] = 1
+                self.assertEqual(a[i], 1)
+                self.assertEqual(a[i - n], 1)
+            self.assertEqual(a[B - 2], 0)
+            self.assertEqual(a[B + 2], 0)
+            self.assertEqual(a.count(1), len(ones))
+            self.assertEqual(a.count(0), n - len(ones))
+            self.assertEqual(a.count(1, B), 3)
+            self.assertEqual(a.count(1, B - 1, B + 1), 2)
+            self.assertEqual(a.index(1), B - 65)
+            self.assertEqual(a.index(1, B - 64), B - 1)
+            self.assertEqual(a.index(1, B + 2), B + 63)
+            self.assertEqual(a.index(0, B - 1), B + 2)
+            self.assertRaises(ValueError, a.index, 1, B + 64)
+            self.assertRaises(IndexError, a.__getitem__, n)
+            a[-1] = 1
+            self.assertEqual(a.pop(), 1)
+            self.assertEqual(len(a), n - 1)
+            a.append(0)
+            for i in ones:
+                a[i] = 0
+            self.assertFalse(a.any())
+
+    def test_slices(self):
+        for k, B in enumerate(self.boundaries()):
+            a = self.huge(B, ['big', 'little'][k % 2])
+            n = len(a)
+            a[B - 2:B + 3] = bitarray('01110')
+            self.assertEqual(a[B - 3:B + 4], bitarray('0011100'))
+            self.assertEqual(a[B - 1:B + 2:2], bitarray('11'))
+            self.assertEqual(a[B + 2:B - 3:-1], bitarray('01110'))
+            self.assertEqual(a[-n + B - 1:-n + B + 2], bitarray('111'))
+            # search() is slow (compared to count() and index()) as it
+            # compares bit by bit, so only one search over the array here
+            self.assertEqual(a.search(bitarray('0111')), [B - 2])
+            a[B + 100:B + 140] = bitarray(40 * '1')
+            self.assertEqual(a.count(1, B + 3), 40)
+            self.assertEqual(a[B + 99:B + 141].to01(), '0' + 40 * '1' + '0')
+            # copy bits across the boundary at unaligned offsets
+            a[B - 37:B + 3] = a[B + 100:B + 140]
+            self.assertEqual(a.count(1, B - 40, B + 5), 40)
+            self.assertEqual(a.count(), 80)
+            a.setall(0)
+            m = len(range(B - 37, B + 140, 7))
+            a[B - 37:B + 140:7] = bitarray(m * '1')
+            self.assertEqual(a.count(), m)
+            self.assertEqual(a.index(1), B - 37)
+            self.assertEqual(a[B - 37 + 7 * (m - 1)], 1)
+            self.assertEqual(len(a), n)
+
+    def test_insert_delete(self):
+        for k, B in enumerate(self.boundaries()):
+            a = self.huge(B, ['little', 'big'][k % 2])
+            n = len(a)
+            a[B] = 1
+            a.insert(B - 1, 1)
+            self.assertEqual(len(a), n + 1)
+            self.assertEqual(a[B - 2:B + 3], bitarray('01010'))
+            del a[B - 1]
+            self.assertEqual(len(a), n)
+            self.assertEqual(a[B - 2:B + 2], bitarray('0010'))
+            self.assertEqual(a.pop(B), 1)
+            self.assertFalse(a.any())
+            a.append(1)
+            del a[B - 3:B + 5]
+            self.assertEqual(len(a), n - 8)
+            self.assertEqual(a.index(1), n - 9)
+            del a[B - 8::2]
+            self.assertEqual(len(a), B - 8 + (n - 8 - (B - 8)) // 2)
+
+    def test_whole(self):
+        from bitarray.util import count_n, rindex
+
+        for k, B in enumerate(self.boundaries()):
+            a = self.huge(B, ['big', 'little'][k % 2])
+            n = len(a)
+            for i in B - 1, B, B + 1:
+                a[i] = 1
+            self.assertEqual(count_n(a, 2), B + 1)
+            self.assertEqual(count_n(a, 3), B + 2)
+            self.assertEqual(rindex(a), B + 1)
+            a.invert()
+            self.assertEqual(a.count(0), 3)
+            self.assertEqual(a.index(0), B - 1)
+            self.assertEqual(rindex(a, 0), B + 1)
+            a &= a
+            self.assertEqual(a.count(1), n - 3)
+            a.invert()
+            self.assertEqual(a.count(), 3)
+
+tests.append(HugeTests)
+
+# ---------------------------------------------------------------------------
+
+class StatsTests(unittest.TestCase):
+
+    def setUp(self):
+        self.enabled = stats()['enabled']
+        enable_stats()
+        stats(reset=True)
+
+    def tearDown(self):
+        enable_stats(self.enabled)
+
+    def op(self, name):
+        return stats()['ops'][name]
+
+    def test_keys(self):
+        st = stats()
+        self.assertTrue(st['enabled'])
+        for key in 'resize', 'realloc', 'realloc_bytes', 'export_refused':
+            self.assertEqual(st[key], 0)
+        for name in ['count', 'index', 'search', 'bitwise', 'invert',
+                     'setrange', 'copy_fast', 'copy_slow', 'encode',
+                     'decode', 'pack', 'unpack', 'frombytes', 'tobytes',
+                     'fromfile', 'tofile']:
+            self.assertEqual(st['ops'][name],
+                             {'calls': 0, 'bytes': 0, 'time': 0.0})
+
+    def test_disabled(self):
+        enable_stats(False)
+        self.assertFalse(stats()['enabled'])
+        a = bitarray(1000)
+        a.setall(1)
+        a.count()
+        a.invert()
+        a.insert(3, 1)
+        st = stats()
+        self.assertEqual(st['resize'], 0)
+        self.assertEqual(st['ops']['count']['calls'], 0)
+        self.assertEqual(st['ops']['copy_slow']['calls'], 0)
+
+    def test_reset(self):
+        bitarray('1100').count()
+        self.assertEqual(stats(reset=True)['ops']['count']['calls'], 1)
+        self.assertEqual(stats()['ops']['count']['calls'], 0)
+
+    def test_count(self):
+        a = bitarray(8000)
+        a.setall(0)
+        for _ in range(3):
+            self.assertEqual(a.count(), 0)
+        self.assertEqual(a.count(1, 80, 160), 0)
+        op = self.op('count')
+        self.assertEqual(op['calls'], 4)
+        self.assertEqual(op['bytes'], 3 * 1000 + 10)
+        self.assertTrue(op['time'] > 0.0)
+
+    def test_index_search(self):
+        a = bitarray(800)
+        a.setall(0)
+        a[400] = 1
+        self.assertEqual(a.index(1), 400)
+        self.assertEqual(self.op('index'), dict(self.op('index'),
+                                                calls=1, bytes=50))
+        self.assertEqual(a.search(bitarray('01')), [399])
+        op = self.op('search')
+        self.assertEqual(op['calls'], 2)  # second call finds no match
+        self.assertEqual(op['bytes'], 2 * (399 // 8))
+
+    def test_copy(self):
+        a = bitarray(8000)
+        del a[:800]  # aligned
+        op = self.op('copy_fast')
+        self.assertEqual((op['calls'], op['bytes']), (1, 900))
+        self.assertEqual(self.op('copy_slow')['calls'], 0)
+        del a[:1]  # not aligned, shifted bytes
+        op = self.op('copy_fast')
+        self.assertEqual((op['calls'], op['bytes']), (2, 900 + 7199 // 8))
+        self.assertEqual(self.op('copy_slow')['calls'], 0)
+        a = bitarray(8000, 'little')
+        a.extend(bitarray(800, 'big'))  # different endianness
+        op = self.op('copy_slow')
+        self.assertEqual((op['calls'], op['bytes']), (1, 100))
+        self.assertEqual(self.op('copy_fast')['calls'], 2)
+
+    def test_resize(self):
+        a = bitarray()
+        for _ in range(100):
+            a.append(1)
+        st = stats()
+        self.assertEqual(st['resize'], 100)
+        self.assertTrue(0 < st['realloc'] < 100)
+        self.assertTrue(st['realloc_bytes'] >= 13)
+
+    @unittest.skipIf(sys.version_info[0] == 2, "new buffer protocol")
+    def test_export_refused(self):
+        a = bitarray(64)
+        m = memoryview(a)
+        self.assertRaises(BufferError, a.extend, bitarray(64))
+        self.assertRaises(BufferError, a.extend, bitarray(64))
+        self.assertEqual(stats()['export_refused'], 2)
+        del m
+
+    def test_bytes_files(self):
+        a = bitarray(8000)
+        a.setall(1)
+        b = bitarray()
+        b.frombytes(a.tobytes())
+        self.assertEqual(self.op('tobytes')['bytes'], 1000)
+        self.assertEqual(self.op('frombytes')['bytes'], 1000)
+        f = BytesIO()
+        a.tofile(f)
+        f.seek(0)
+        b.fromfile(f)
+        self.assertEqual(self.op('tofile')['bytes'], 1000)
+        self.assertEqual(self.op('fromfile')['bytes'], 1000)
+        self.assertEqual(self.op('frombytes')['calls'], 1)
+        b.pack(a.unpack())
+        self.assertEqual(self.op('unpack')['bytes'], 1000)
+        self.assertEqual(self.op('pack')['bytes'], 1000)
+
+    def test_codec(self):
+        code = {'a': bitarray('0'), 'b': bitarray('1')}
+        a = bitarray()
+        a.encode(code, 16 * 'ab')
+        self.assertEqual(a.decode(code), 16 * ['a', 'b'])
+        self.assertEqual(self.op('encode'), dict(self.op('encode'),
+                                                 calls=1, bytes=4))
+        self.assertEqual(self.op('decode'), dict(self.op('decode'),
+                                                 calls=1, bytes=4))
+
+    def test_errors(self):
+        # the bytes processed before an error are still recorded
+        a = bitarray()
+        self.assertRaises(EOFError, a.fromfile, BytesIO(100 * b'A'), 200)
+        self.assertEqual(len(a), 800)
+        self.assertEqual(self.op('fromfile'), dict(self.op('fromfile'),
+                                                   calls=1, bytes=100))
+
+        class Writer(object):
+            def __init__(self):
+                self.n = 0
+            def write(self, data):
+                self.n += 1
+                if self.n == 2:
+                    raise IOError
+        a = bitarray(8 * 100000)
+        self.assertRaises(IOError, a.tofile, Writer())
+        self.assertEqual(self.op('tofile'), dict(self.op('tofile'),
+                                                 calls=1, bytes=65536))
+
+        code = {'a': bitarray('0'), 'b': bitarray('1')}
+        a = bitarray()
+        self.assertRaises(ValueError, a.encode, code, 16 * 'ab' + 'c')
+        self.assertEqual(self.op('encode'), dict(self.op('encode'),
+                                                 calls=1, bytes=4))
+        a.append(1)
+        self.assertRaises(ValueError, a.decode, {'a': bitarray('00')})
+        self.assertEqual(self.op('decode')['calls'], 1)
+
+tests.append(StatsTests)
+
+# ---------------------------------------------------------------------------
+
+class KernelTests(unittest.TestCase):
+
+    levels = ['generic', 'popcnt', 'avx2', 'avx512']
+
+    def setUp(self):
+        self.isa = _sysinfo()[5]['isa']
+
+    def tearDown(self):
+        _set_isa(self.isa)
+
+    def test_sysinfo(self):
+        info = _sysinfo()[5]
+        self.assertEqual(sorted(info), ['features', 'isa', 'kernels'])
+        for name in info['features']:
+            self.assertTrue(name in ['popcnt', 'sse4_2', 'avx2', 'bmi2',
+                                     'avx512f', 'avx512bw',
+                                     'avx512_vpopcntdq', 'avx512_vbmi2'])
+        self.assertTrue(info['isa'] in self.levels)
+        self.assertEqual(sorted(info['kernels']),
+                         ['bitwise', 'count', 'invert', 'shift', 'skip'])
+        for level in info['kernels'].values():
+            self.assertTrue(level in self.levels)
+
+    def test_set_isa(self):
+        for i, level in enumerate(self.levels):
+            _set_isa(level)
+            info = _sysinfo()[5]
+            self.assertEqual(info['isa'], level)
+            # kernels never exceed the selected level
+            for kernel in info['kernels'].values():
+                self.assertTrue(self.levels.index(kernel) <= i)
+        _set_isa('generic')
+        self.assertEqual(set(_sysinfo()[5]['kernels'].values()),
+                         set(['generic']))
+        self.assertRaises(ValueError, _set_isa, 'sse2')
+        self.assertRaises(TypeError, _set_isa, 3)
+        self.assertEqual(_sysinfo()[5]['isa'], 'generic')
+
+    def randombits(self, n):
+        a = bitarray(endian='little')
+        a.frombytes(os.urandom(bits2bytes(n)))
+        del a[n:]
+        return a
+
+    def check_kernels(self, n):
+        from bitarray.util import count_and, count_or, count_xor
+
+        a, b = self.randombits(n), self.randombits(n)
+        la, lb = a.tolist(), b.tolist()
+        self.assertEqual(a.count(), sum(la))
+        for start in 0, 5, 64, 300:
+            self.assertEqual(a.count(1, start, n), sum(la[start:]))
+        for res, f in [(a & b, lambda x, y: x & y),
+                       (a | b, lambda x, y: x | y),
+                       (a ^ b, lambda x, y: x ^ y)]:
+            self.assertEqual(res.tolist(), list(map(f, la, lb)))
+        self.assertEqual((~a).tolist(), [1 - x for x in la])
+        self.assertEqual(count_and(a, b), (a & b).count())
+        self.assertEqual(count_or(a, b), (a | b).count())
+        self.assertEqual(count_xor(a, b), (a ^ b).count())
+        # skip kernel
+        for vi in 0, 1:
+            c = bitarray(n, 'big')
+            c.setall(1 - vi)
+            c.append(vi)
+            self.assertEqual(c.index(vi), n)
+            self.assertEqual(c.index(vi, n % 11), n)
+        # shift kernel, forward and backwards
+        for i in 1, 5, 11:
+            self.assertEqual(a[i:].tolist(), la[i:])
+            c = a.copy()
+            del c[:i]
+            self.assertEqual(c.tolist(), la[i:])
+            c = a.copy()
+            c[3:3] = bitarray(i)
+            self.assertEqual(c[3 + i:].tolist(), la[3:])
+
+    def test_levels(self):
+        for level in self.levels:
+            _set_isa(level)
+            # cover the vector loops as well as the remaining bytes
+            for n in list(range(0, 80)) + [511, 512, 513, 1023, 8193,
+                                           randint(0, 20000)]:
+                self.check_kernels(n)
+
+tests.append(KernelTests)
+
+# ---------------------------------------------------------------------------
+
+class CAPITests(unittest.TestCase):
+
+    def setUp(self):
+        try:
+            import ctypes
+        except ImportError:
+            self.skipTest("ctypes not available")
+        self.ctypes = ctypes
+        self.capsule = sys.modules['bitarray._bitarray']._C_API
+
+    def api(self):
+        ct = self.ctypes
+        get_pointer = ct.pythonapi.PyCapsule_GetPointer
+        get_pointer.restype = ct.c_void_p
+        get_pointer.argtypes = [ct.py_object, ct.c_char_p]
+        p = get_pointer(self.capsule, b"bitarray._bitarray._C_API")
+        self.assertTrue(p)
+
+        class API(ct.Structure):
+            _fields_ = [('version', ct.c_int),
+                        ('type', ct.c_void_p)] + [
+                (name, ct.c_void_p) for name in [
+                    'new_bitarray', 'resize', 'copy_n', 'delete_n',
+                    'insert_n', 'setrange', 'invert', 'count',
+                    'findfirst', 'search', 'kernels']]
+
+        return ct.cast(p, ct.POINTER(API)).contents
+
+    def test_capsule(self):
+        self.assertEqual(type(self.capsule).__name__, 'PyCapsule')
+        self.assertTrue('bitarray._bitarray._C_API' in repr(self.capsule))
+
+    def test_table(self):
+        api = self.api()
+        self.assertTrue(api.version >= 2)
+        self.assertEqual(api.type, id(bitarray.__base__))
+        for name, _ in api._fields_[2:]:
+            self.assertTrue(getattr(api, name), name)
+
+    def test_count(self):
+        ct = self.ctypes
+        count = ct.CFUNCTYPE(ct.c_longlong, ct.py_object, ct.c_int,
+                             ct.c_longlong, ct.c_longlong)(self.api().count)
+        for a in [bitarray(), bitarray('0110111'), frozenbitarray('1101')]:
+            for vi in 0, 1:
+                self.assertEqual(count(a, vi, 0, len(a)), a.count(vi))
+        a = bitarray('1110000111')
+        self.assertEqual(count(a, 1, 2, 8), 2)
+
+    def test_kernels(self):
+        ct = self.ctypes
+        count = ct.CFUNCTYPE(ct.c_longlong, ct.c_char_p, ct.c_ssize_t)(
+            ct.c_void_p.from_address(self.api().kernels).value)
+        self.assertEqual(count(b'\x01\xff\x00\x0f', 4), 13)
+        self.assertEqual(count(b'\xff\xff', 1), 8)
+
+    def test_get_include(self):
+        from bitarray import get_include
+        for name in 'bitarray.h', 'bitkernels.h':
+            self.assertTrue(os.path.isfile(os.path.join(get_include(),
+                                                        name)))
+
+tests.append(CAPITests)
+
+# ---------------------------------------------------------------------------
+
 def run(verbosity=1, repeat=1):
     import bitarray.test_util as btu
     tests.extend(btu.tests)
@@ -4,8 +4,9 @@ Tests for bitarray.util module
 import os
 import sys
 import unittest
+from array import array
 from string import hexdigits
-from random import choice, randint
+from random import choice, getrandbits, randint
 try:
     from collections import Counter
 except ImportError:
@@ -16,7 +17,14 @@ from bitarray.test_bitarray import Util
 
 from bitarray.util import (zeros, make_endian, rindex, strip, count_n,
                            count_and, count_or, count_xor, subset,
-                           ba2hex, hex2ba, ba2int, int2ba, huffman_code)
+                           ba2hex, hex2ba, ba2int, int2ba, huffman_code,
+                           gf2_rank, gf2_solve, gf2_nullspace,
+                           crc, clmul, polymod, bitplanes, frombitplanes,
+                           bsi, compare, between, filter,
+                           interleave, deinterleave,
+                           dna2ba, ba2dna, dna_revcomp, dna_kmers, dna_gc,
+                           bitimage, multisearch, from_arrow,
+                           rle_encode, rle_decode, diff, patch)
 
 if sys.version_info[0] == 3:
     unicode = str
@@ -681,6 +689,1314 @@ tests.append(TestsHuffman)
 
 # ---------------------------------------------------------------------------
 
+class TestsGF2(unittest.TestCase, Util):
+
+    @staticmethod
+    def random_matrix(nrows, ncols, endian='big'):
+        res = []
+        for _ in range(nrows):
+            a = bitarray(endian=endian)
+            a.frombytes(os.urandom(bits2bytes(ncols)))
+            del a[ncols:]
+            res.append(a)
+        return res
+
+    @staticmethod
+    def rank_simple(matrix):
+        # Gaussian elimination on Python integers
+        rows = [int(a.to01(), 2) if a else 0 for a in matrix]
+        rank = 0
+        while rows:
+            pivot = max(rows)
+            rows.remove(pivot)
+            if pivot == 0:
+                break
+            rank += 1
+            top = 1 << (pivot.bit_length() - 1)
+            rows = [r ^ pivot if r & top else r for r in rows]
+        return rank
+
+    @staticmethod
+    def mul(matrix, x):
+        return bitarray([count_and(row, x) % 2 for row in matrix])
+
+    def test_explicit(self):
+        m = [bitarray('110'), bitarray('011'), bitarray('101')]
+        self.assertEqual(gf2_rank(m), 2)
+        self.assertEqual(gf2_nullspace(m), [bitarray('111')])
+        self.assertEqual(gf2_solve(m, bitarray('110')), bitarray('010'))
+        self.assertTrue(gf2_solve(m, bitarray('001')) is None)
+        self.assertEqual(gf2_rank([bitarray('0000')]), 0)
+        self.assertEqual(gf2_rank([bitarray()]), 0)
+        self.assertEqual(gf2_nullspace([bitarray()]), [])
+
+    def test_matrix_buffer(self):
+        a = bitarray('110011101')
+        self.assertEqual(gf2_rank(a, ncols=3), 2)
+        self.assertEqual(gf2_rank(a, ncols=9), 1)
+        self.assertEqual(gf2_nullspace(a, ncols=3), [bitarray('111')])
+        self.assertEqual(gf2_solve(a, bitarray('011'), ncols=3),
+                         bitarray('110'))
+        for n in 2, 7, 8, 63, 64, 65, 130:
+            m = self.random_matrix(n, n + 3)
+            b = bitarray()
+            for row in m:
+                b.extend(row)
+            self.assertEqual(gf2_rank(b, ncols=n + 3), gf2_rank(m))
+
+    def test_generator(self):
+        # the rows are only referenced by the sequence built from the
+        # generator, the result must not depend on them afterwards
+        for endian in 'big', 'little':
+            rows = lambda: (bitarray(s, endian) for s in ['110', '011'])
+            for _ in range(100):
+                self.assertEqual(gf2_rank(rows()), 2)
+                null = gf2_nullspace(rows())
+                self.assertEqual(null, [bitarray('111')])
+                self.assertEqual(null[0].endian(), endian)
+                x = gf2_solve(rows(), bitarray('10'))
+                self.assertEqual(x, bitarray('100'))
+                self.assertEqual(x.endian(), endian)
+
+    def test_wrong_args(self):
+        self.assertRaises(TypeError, gf2_rank)
+        self.assertRaises(TypeError, gf2_rank, 1)
+        self.assertRaises(TypeError, gf2_rank, [bitarray('01'), '01'])
+        self.assertRaises(ValueError, gf2_rank, [])
+        self.assertRaises(ValueError, gf2_rank, [bitarray('0'),
+                                                 bitarray('01')])
+        self.assertRaises(ValueError, gf2_rank, bitarray('0110'))
+        self.assertRaises(ValueError, gf2_rank, bitarray('0110'), ncols=3)
+        self.assertRaises(TypeError, gf2_solve, [bitarray('01')], '1')
+        self.assertRaises(ValueError, gf2_solve, [bitarray('01')],
+                          bitarray('10'))
+
+    def test_rank_random(self):
+        for nrows, ncols in [(1, 1), (3, 5), (5, 3), (20, 20), (64, 64),
+                             (70, 130), (200, 90), (300, 300)]:
+            m = self.random_matrix(nrows, ncols)
+            self.assertEqual(gf2_rank(m), self.rank_simple(m))
+            # dependent rows do not increase the rank
+            m2 = m + [m[0] ^ m[-1], m[-1]]
+            self.assertEqual(gf2_rank(m2), gf2_rank(m))
+
+    def test_solve_random(self):
+        for nrows, ncols in [(1, 1), (4, 7), (7, 4), (33, 33), (100, 120),
+                             (300, 280)]:
+            for endian in 'big', 'little':
+                m = self.random_matrix(nrows, ncols, endian)
+                x = self.random_matrix(1, ncols, endian)[0]
+                b = self.mul(m, x)
+                y = gf2_solve(m, b)
+                self.assertEqual(y.endian(), endian)
+                self.assertEqual(len(y), ncols)
+                self.assertEqual(self.mul(m, y), b)
+                self.check_obj(y)
+
+    def test_nullspace_random(self):
+        for nrows, ncols in [(1, 5), (5, 5), (10, 40), (40, 10),
+                             (100, 150), (260, 300)]:
+            m = self.random_matrix(nrows, ncols)
+            m.append(m[0] ^ m[-1])
+            null = gf2_nullspace(m)
+            self.assertEqual(len(null), ncols - gf2_rank(m))
+            for v in null:
+                self.assertFalse(self.mul(m, v).any())
+            if null:
+                self.assertEqual(gf2_rank(null), len(null))
+
+tests.append(TestsGF2)
+
+# ---------------------------------------------------------------------------
+
+class TestsCRC(unittest.TestCase, Util):
+
+    # (poly, width, init, refin, refout, xorout, check) taken from the
+    # catalogue of parametrised CRC algorithms, where check is the CRC
+    # of the ASCII string "123456789"
+    catalogue = [
+        (0x3, 3, 0x0, False, False, 0x7, 0x4),                  # CRC-3/GSM
+        (0x05, 5, 0x1f, True, True, 0x1f, 0x19),                # CRC-5/USB
+        (0x07, 8, 0x00, False, False, 0x00, 0xf4),              # CRC-8
+        (0x4599, 15, 0x0, False, False, 0x0, 0x059e),           # CRC-15/CAN
+        (0x1021, 16, 0xffff, False, False, 0x0, 0x29b1),  # CRC-16/IBM-3740
+        (0x1021, 16, 0xb2aa, True, True, 0x0, 0x63d0),    # CRC-16/RIELLO
+        (0x04c11db7, 32, 0xffffffff, True, True, 0xffffffff,
+         0xcbf43926),                                           # CRC-32
+        (0x42f0e1eba9ea3693, 64, 0xffffffffffffffff, True, True,
+         0xffffffffffffffff, 0x995dc9bbdf1939fa),               # CRC-64/XZ
+    ]
+
+    @staticmethod
+    def crc_simple(a, poly, width, init=0, refin=False, refout=False,
+                   xorout=0):
+        bits = a.tolist()
+        if refin:
+            n = 8 * (len(bits) // 8)
+            bits = [bits[i + 7 - j] for i in range(0, n, 8)
+                    for j in range(8)] + bits[n:]
+        top = 1 << (width - 1)
+        mask = (1 << width) - 1
+        reg = init
+        for bit in bits:
+            x = bool(reg & top) ^ bit
+            reg = (reg << 1) & mask
+            if x:
+                reg ^= poly
+        if refout:
+            reg = int(bin(reg)[2:].zfill(width)[::-1], 2)
+        return reg ^ xorout
+
+    def test_catalogue(self):
+        for endian in 'big', 'little':
+            a = bitarray(endian=endian)
+            a.frombytes(b'123456789')
+            if endian == 'little':
+                a.bytereverse()
+            for poly, width, init, refin, refout, xorout, check in \
+                    self.catalogue:
+                self.assertEqual(crc(a, poly, width, init, refin, refout,
+                                     xorout), check)
+                self.assertEqual(self.crc_simple(a, poly, width, init,
+                                                 refin, refout, xorout),
+                                 check)
+
+    def test_crc32(self):
+        import binascii
+        for n in list(range(20)) + [randint(100, 5000)]:
+            data = os.urandom(n)
+            a = bitarray()
+            a.frombytes(data)
+            self.assertEqual(crc(a, 0x04c11db7, 32, 0xffffffff, True,
+                                 True, 0xffffffff),
+                             binascii.crc32(data) & 0xffffffff)
+
+    def test_random(self):
+        for a in self.randombitarrays():
+            n = len(a)
+            for _ in range(5):
+                width = randint(1, 64)
+                poly = randint(0, (1 << width) - 1)
+                init = randint(0, (1 << width) - 1)
+                xorout = randint(0, (1 << width) - 1)
+                refin = bool(randint(0, 1))
+                refout = bool(randint(0, 1))
+                start = randint(0, n)
+                stop = randint(start, n)
+                self.assertEqual(
+                    crc(a, poly, width, init, refin, refout, xorout,
+                        start, stop),
+                    self.crc_simple(a[start:stop], poly, width, init,
+                                    refin, refout, xorout))
+
+    def test_range(self):
+        a = bitarray()
+        a.frombytes(os.urandom(100))
+        for start, stop in [(0, 800), (3, 800), (8, 797), (-100, -3),
+                            (5, 2), (700, 1000)]:
+            self.assertEqual(crc(a, 0x1021, 16, start=start, stop=stop),
+                             crc(a[start:stop], 0x1021, 16))
+
+    def test_polymod(self):
+        # CRC (with zero init, xorout and no reflection) is the remainder
+        # of the message (followed by width zeros) divided by the generator
+        for a in self.randombitarrays():
+            g = bitarray('1') + int2ba(0x4599, 15)
+            self.assertEqual(ba2int(bitarray('0') +
+                                    polymod(a + zeros(15), g)),
+                             crc(a, 0x4599, 15))
+
+    def test_wrong_args(self):
+        a = bitarray('1101')
+        self.assertRaises(TypeError, crc, '1101', 7, 3)
+        self.assertRaises(TypeError, crc, a, 7)
+        self.assertRaises(ValueError, crc, a, 7, 0)
+        self.assertRaises(ValueError, crc, a, 7, 65)
+        self.assertRaises(ValueError, crc, a, 8, 3)
+        self.assertRaises(ValueError, crc, a, 7, 3, init=8)
+        self.assertRaises(ValueError, crc, a, 7, 3, xorout=9)
+
+tests.append(TestsCRC)
+
+# ---------------------------------------------------------------------------
+
+class TestsPolynomial(unittest.TestCase, Util):
+
+    @staticmethod
+    def clmul_int(x, y):
+        res = 0
+        while y:
+            if y & 1:
+                res ^= x
+            x <<= 1
+            y >>= 1
+        return res
+
+    def test_explicit(self):
+        self.assertEqual(clmul(bitarray('11'), bitarray('11')),
+                         bitarray('101'))
+        self.assertEqual(clmul(bitarray('1011'), bitarray('1')),
+                         bitarray('1011'))
+        self.assertEqual(clmul(bitarray(), bitarray('1')), bitarray())
+        self.assertEqual(polymod(bitarray('101'), bitarray('11')),
+                         bitarray('0'))
+        self.assertEqual(polymod(bitarray('1'), bitarray('1011')),
+                         bitarray('001'))
+        self.assertEqual(polymod(bitarray('10011'), bitarray('0111')),
+                         bitarray('01'))
+        self.assertEqual(polymod(bitarray('1011'), bitarray('1')),
+                         bitarray())
+        self.assertRaises(ZeroDivisionError, polymod, bitarray('1'),
+                          bitarray('000'))
+        self.assertRaises(TypeError, clmul, bitarray('1'), '1')
+        self.assertRaises(TypeError, polymod, '1', bitarray('1'))
+
+    def test_clmul_random(self):
+        for a in self.randombitarrays(start=1):
+            for b in self.randombitarrays(start=1):
+                c = clmul(a, b)
+                self.assertEqual(len(c), len(a) + len(b) - 1)
+                self.assertEqual(c.endian(), a.endian())
+                self.check_obj(c)
+                self.assertEqual(ba2int(bitarray('0') + c),
+                                 self.clmul_int(ba2int(bitarray('0') + a),
+                                                ba2int(bitarray('0') + b)))
+
+    def test_division(self):
+        # a == q * m + r, where deg(r) < deg(m)
+        for m in self.randombitarrays(start=1):
+            m[0] = 1
+            for q in self.randombitarrays(start=1):
+                r = polymod(q, m)
+                self.assertEqual(len(r), len(m) - 1)
+                a = clmul(q, m)
+                a[len(a) - len(r):] ^= r
+                self.assertEqual(polymod(a, m), r)
+                self.check_obj(r)
+
+tests.append(TestsPolynomial)
+
+# ---------------------------------------------------------------------------
+
+INT_CODES = [c for c in 'bBhHiIlLqQ' if array(c).itemsize in (1, 2, 4, 8)]
+
+def random_array(code, n):
+    size = 8 * array(code).itemsize
+    if code.islower():
+        return array(code, [randint(-(1 << (size - 1)), (1 << (size - 1)) - 1)
+                            for _ in range(n)])
+    return array(code, [randint(0, (1 << size) - 1) for _ in range(n)])
+
+
+@unittest.skipIf(sys.version_info[0] == 2, "new buffer protocol required")
+class TestsBitplanes(unittest.TestCase, Util):
+
+    def test_explicit(self):
+        planes = bitplanes(array('B', [1, 2, 3, 128]), 'big')
+        self.assertEqual(len(planes), 8)
+        self.assertEqual(planes[0], bitarray('1010'))
+        self.assertEqual(planes[1], bitarray('0110'))
+        self.assertEqual(planes[7], bitarray('0001'))
+        for k in range(2, 7):
+            self.assertEqual(planes[k], bitarray('0000'))
+        for a in planes:
+            self.assertEqual(a.endian(), 'big')
+            self.check_obj(a)
+
+        self.assertEqual(bitplanes(array('h'))[0], bitarray())
+        self.assertEqual(len(bitplanes(array('h'))), 16)
+
+    def test_errors(self):
+        self.assertRaises(TypeError, bitplanes, array('d', [1.0]))
+        self.assertRaises(TypeError, bitplanes, [1, 2])
+        self.assertRaises(ValueError, bitplanes, b'a', 'foo')
+        a = array('H', [1, 2])
+        self.assertRaises(TypeError, frombitplanes, [bitarray('00'), 0], a)
+        self.assertRaises(ValueError, frombitplanes, [bitarray('000')], a)
+        self.assertRaises(ValueError, frombitplanes, 17 * [bitarray('00')], a)
+        self.assertRaises(BufferError, frombitplanes, [], b'ab')
+
+    def test_random(self):
+        for code in INT_CODES:
+            size = 8 * array(code).itemsize
+            for n in list(range(20)) + [randint(20, 1000)]:
+                x = random_array(code, n)
+                endian = choice(['little', 'big'])
+                planes = bitplanes(x, endian)
+                self.assertEqual(len(planes), size)
+                for k, a in enumerate(planes):
+                    self.assertEqual(len(a), n)
+                    self.assertEqual(a.endian(), endian)
+                    self.assertEqual(a.tolist(),
+                                     [(v >> k) & 1 for v in x])
+                y = array(code, n * [0])
+                frombitplanes(planes, y)
+                self.assertEqual(x, y)
+
+    def test_missing_planes(self):
+        x = array('I', [randint(0, 255) for _ in range(100)])
+        planes = bitplanes(x)[:8]
+        y = array('I', 100 * [0xffffffff])
+        frombitplanes(planes, y)
+        self.assertEqual(x, y)
+
+tests.append(TestsBitplanes)
+
+# ---------------------------------------------------------------------------
+
+@unittest.skipIf(sys.version_info[0] == 2, "new buffer protocol required")
+class TestsBSI(unittest.TestCase, Util):
+
+    def check(self, x, a, pred, filter=None):
+        self.assertIsInstance(a, bitarray)
+        self.assertEqual(len(a), len(x))
+        self.check_obj(a)
+        self.assertEqual(a.tolist(),
+                         [int(pred(v) and (filter is None or bool(filter[i])))
+                          for i, v in enumerate(x)])
+
+    def test_explicit(self):
+        b = bsi(array('i', [3, -1, 7, 0, 3]), 'little')
+        self.assertEqual(len(b), 5)
+        self.assertEqual(b.lt(3), bitarray('01010'))
+        self.assertEqual(b.le(3), bitarray('11011'))
+        self.assertEqual(b.eq(3), bitarray('10001'))
+        self.assertEqual(b.ne(3), bitarray('01110'))
+        self.assertEqual(b.gt(3), bitarray('00100'))
+        self.assertEqual(b.ge(3), bitarray('10101'))
+        self.assertEqual(b.between(-1, 0), bitarray('01010'))
+        self.assertEqual(b.sum(), 12)
+        self.assertEqual(b.count(), 5)
+        f = bitarray('11100', 'big')
+        self.assertEqual(b.sum(f), 9)
+        self.assertEqual(b.count(f), 3)
+        self.assertEqual(b.eq(3, f), bitarray('10000'))
+        self.assertEqual(b.eq(3, f).endian(), 'little')
+
+    def test_errors(self):
+        b = bsi(array('B', [1, 2]))
+        self.assertRaises(TypeError, b.lt, 1.0)
+        self.assertRaises(TypeError, b.lt, 1, '11')
+        self.assertRaises(ValueError, b.lt, 1, bitarray('1'))
+        self.assertRaises(TypeError, bsi, array('f', [1.0]))
+
+    def test_empty(self):
+        b = bsi(array('q'))
+        self.assertEqual(len(b), 0)
+        self.assertEqual(b.eq(0), bitarray())
+        self.assertEqual(b.sum(), 0)
+        b = bsi(array('B', [0, 0, 0]))
+        self.assertEqual(b.eq(0), bitarray('111'))
+        self.assertEqual(b.gt(0), bitarray('000'))
+        self.assertEqual(b.lt(1), bitarray('111'))
+
+    def test_random(self):
+        for code in INT_CODES:
+            size = 8 * array(code).itemsize
+            for n in range(0, 100, 7):
+                x = random_array(code, n)
+                if randint(0, 1):
+                    x = array(code, [v >> randint(0, size) for v in x])
+                b = bsi(x, choice(['little', 'big']))
+                filter = bitarray([randint(0, 1) for _ in range(n)])
+                self.assertEqual(b.sum(), sum(x))
+                self.assertEqual(b.sum(filter),
+                                 sum(v for i, v in enumerate(x) if filter[i]))
+                values = [v + d for v in x[:3] for d in (-1, 0, 1)]
+                values += [0, -1, 1 << size, -(1 << size)]
+                for v in values:
+                    f = choice([None, filter])
+                    self.check(x, b.lt(v, f), lambda y: y < v, f)
+                    self.check(x, b.le(v, f), lambda y: y <= v, f)
+                    self.check(x, b.eq(v, f), lambda y: y == v, f)
+                    self.check(x, b.ne(v, f), lambda y: y != v, f)
+                    self.check(x, b.gt(v, f), lambda y: y > v, f)
+                    self.check(x, b.ge(v, f), lambda y: y >= v, f)
+                    w = v + randint(-5, 5)
+                    self.check(x, b.between(v, w, f),
+                               lambda y: v <= y <= w, f)
+
+tests.append(TestsBSI)
+
+# ---------------------------------------------------------------------------
+
+@unittest.skipIf(sys.version_info[0] == 2, "new buffer protocol required")
+class TestsCompare(unittest.TestCase, Util):
+
+    ops = {'<':  lambda x, v: x < v,
+           '<=': lambda x, v: x <= v,
+           '==': lambda x, v: x == v,
+           '!=': lambda x, v: x != v,
+           '>':  lambda x, v: x > v,
+           '>=': lambda x, v: x >= v}
+
+    def check(self, a, x, pred):
+        self.assertIsInstance(a, bitarray)
+        self.check_obj(a)
+        self.assertEqual(a.tolist(), [int(pred(y)) for y in x])
+
+    def test_explicit(self):
+        x = array('i', [3, -1, 7, 0, 3, 8, 9, 10, 2])
+        self.assertEqual(compare(x, '<', 3), bitarray('010100001'))
+        self.assertEqual(compare(x, '==', 3, 'big'), bitarray('100010000'))
+        self.assertEqual(compare(x, '==', 3, 'big').endian(), 'big')
+        self.assertEqual(compare(x, '>=', 8, 'little').endian(), 'little')
+        self.assertEqual(between(x, 0, 3), bitarray('100110001'))
+        self.assertEqual(between(x, 3, 0), bitarray('000000000'))
+        self.assertEqual(compare(array('B'), '<', 3), bitarray())
+        self.assertEqual(compare(b'\x01\x02', '>', 1), bitarray('01'))
+
+    def test_out_of_range(self):
+        x = array('B', [0, 1, 255])
+        for op, f in self.ops.items():
+            for v in 256, -1, 1 << 70, -(1 << 70):
+                self.check(compare(x, op, v), x, lambda y: f(y, v))
+        x = array('b', [-128, 0, 127])
+        for op, f in self.ops.items():
+            for v in 128, -129, 1 << 64, -(1 << 64):
+                self.check(compare(x, op, v), x, lambda y: f(y, v))
+        self.check(between(x, -1000, 0), x, lambda y: y <= 0)
+        self.check(between(x, 0, 1000), x, lambda y: y >= 0)
+        self.check(between(x, 200, 1000), x, lambda y: False)
+        x = array('Q', [0, 1, (1 << 64) - 1])
+        self.check(compare(x, '==', (1 << 64) - 1), x,
+                   lambda y: y == (1 << 64) - 1)
+        self.check(compare(x, '<', 1 << 64), x, lambda y: True)
+
+    def test_unsigned_boundaries(self):
+        # values which do not fit into a long long, but into an unsigned
+        # long long, must still be checked against the item size
+        for code in INT_CODES:
+            if code.islower():
+                continue
+            x = array(code, [0, 1, 200])
+            m = (1 << 8 * x.itemsize) - 1
+            x.append(m)
+            for v in (1 << 63) - 1, 1 << 63, (1 << 64) - 1, 1 << 64:
+                for op, f in self.ops.items():
+                    self.check(compare(x, op, v), x, lambda y: f(y, v))
+                self.check(between(x, 1, v), x, lambda y: 1 <= y <= v)
+                self.check(between(x, v, m), x, lambda y: v <= y <= m)
+        self.assertEqual(compare(array('B', [1, 200]), '<', 1 << 63),
+                         bitarray('11'))
+
+    def test_float(self):
+        x = array('d', [0.5, -1.5, float('nan'), float('inf'), 2.0])
+        self.assertEqual(compare(x, '<', 1), bitarray('11000'))
+        self.assertEqual(compare(x, '!=', 2.0), bitarray('11110'))
+        self.assertEqual(compare(x, '>', float('nan')), bitarray('00000'))
+        self.assertEqual(between(x, -1.5, 0.5), bitarray('11000'))
+        x = array('f', [0.25, 1.5])
+        self.assertEqual(compare(x, '==', 0.25), bitarray('10'))
+
+    def test_errors(self):
+        x = array('i', [1, 2])
+        self.assertRaises(ValueError, compare, x, '=', 1)
+        self.assertRaises(TypeError, compare, x, '<', 1.5)
+        self.assertRaises(TypeError, compare, x, '<', '1')
+        self.assertRaises(TypeError, compare, array('d', [1.0]), '<', '1')
+        self.assertRaises(ValueError, compare, x, '<', 1, 'foo')
+        self.assertRaises(TypeError, compare, [1, 2], '<', 1)
+        self.assertRaises(TypeError, between, x, 1, None)
+
+    def test_random(self):
+        for code in INT_CODES + ['f', 'd']:
+            for n in list(range(20)) + [randint(20, 300)]:
+                if code in 'fd':
+                    x = array(code, [randint(-8, 8) / 4.0 for _ in range(n)])
+                else:
+                    x = random_array(code, n)
+                    if randint(0, 1):
+                        x = array(code, [y % 7 for y in x])
+                endian = choice(['little', 'big'])
+                v = choice(x) if n else 0
+                for op, f in self.ops.items():
+                    a = compare(x, op, v, endian)
+                    self.assertEqual(a.endian(), endian)
+                    self.check(a, x, lambda y: f(y, v))
+                w = choice(x) if n else 0
+                self.check(between(x, v, w, endian), x,
+                           lambda y: v <= y <= w)
+
+tests.append(TestsCompare)
+
+# ---------------------------------------------------------------------------
+
+@unittest.skipIf(sys.version_info[0] == 2, "new buffer protocol required")
+class TestsFilter(unittest.TestCase, Util):
+
+    def test_explicit(self):
+        x = array('h', [1, -2, 3, -4])
+        self.assertEqual(array('h', filter(x, bitarray('0110'))),
+                         array('h', [-2, 3]))
+        self.assertEqual(filter(b'abcdefghij', bitarray('1000000001')),
+                         b'aj')
+        self.assertEqual(filter(b'', bitarray()), b'')
+        self.assertEqual(filter(b'abcdefghij', bitarray(10 * '1', 'big')),
+                         b'abcdefghij')
+
+    def test_not_exported(self):
+        # must not shadow the builtin on "from bitarray.util import *"
+        import bitarray.util
+        self.assertTrue('filter' not in bitarray.util.__all__)
+        self.assertTrue(hasattr(bitarray.util, 'filter'))
+
+    def test_errors(self):
+        self.assertRaises(TypeError, filter, b'ab', '11')
+        self.assertRaises(ValueError, filter, b'ab', bitarray('1'))
+        self.assertRaises(ValueError, filter, array('i', [1]),
+                          bitarray('1111'))
+        self.assertRaises(TypeError, filter, [1], bitarray('1'))
+
+    def test_random(self):
+        for code in INT_CODES + ['d']:
+            for n in list(range(20)) + [randint(20, 1000)]:
+                x = random_array(code, n) if code != 'd' else \
+                    array('d', [randint(0, 100) / 3.0 for _ in range(n)])
+                mask = bitarray([randint(0, 1) for _ in range(n)],
+                                choice(['little', 'big']))
+                if randint(0, 1):
+                    mask[:n // 2] = 1
+                y = array(code, filter(x, mask))
+                self.assertEqual(y, array(code, [v for i, v in enumerate(x)
+                                                 if mask[i]]))
+                # round trip with compare()
+                if code != 'd':
+                    m = compare(x, '>', 0)
+                    self.assertEqual(list(array(code, filter(x, m))),
+                                     [v for v in x if v > 0])
+
+tests.append(TestsFilter)
+
+# ---------------------------------------------------------------------------
+
+class TestsInterleave(unittest.TestCase, Util):
+
+    def test_explicit(self):
+        a = interleave([bitarray('0011'), bitarray('0101')])
+        self.assertEqual(a, bitarray('00011011'))
+        self.assertEqual(deinterleave(a, 2),
+                         [bitarray('0011'), bitarray('0101')])
+        self.assertEqual(interleave([bitarray('10', 'big'),
+                                     bitarray('01')]).endian(), 'big')
+        self.assertEqual(interleave([bitarray('110')]), bitarray('110'))
+        self.assertEqual(interleave(3 * [bitarray()]), bitarray())
+        self.assertEqual(deinterleave(bitarray('101100'), 3),
+                         [bitarray('11'), bitarray('00'), bitarray('10')])
+        self.assertEqual(deinterleave(bitarray(), 5), 5 * [bitarray()])
+
+    def test_errors(self):
+        self.assertRaises(TypeError, interleave, None)
+        self.assertRaises(TypeError, interleave, [bitarray(), '1'])
+        self.assertRaises(ValueError, interleave, [])
+        self.assertRaises(ValueError, interleave, 9 * [bitarray()])
+        self.assertRaises(ValueError, interleave,
+                          [bitarray('1'), bitarray('11')])
+        self.assertRaises(TypeError, deinterleave, '1', 1)
+        self.assertRaises(ValueError, deinterleave, bitarray('11'), 0)
+        self.assertRaises(ValueError, deinterleave, bitarray(18), 9)
+        self.assertRaises(ValueError, deinterleave, bitarray('111'), 2)
+
+    def test_random(self):
+        for k in range(1, 9):
+            for n in list(range(20)) + [randint(20, 500)]:
+                seq = [bitarray([randint(0, 1) for _ in range(n)],
+                                choice(['little', 'big']))
+                       for _ in range(k)]
+                a = interleave(seq)
+                self.assertEqual(len(a), k * n)
+                self.assertEqual(a.endian(), seq[0].endian())
+                self.check_obj(a)
+                for i in range(n):
+                    for j in range(k):
+                        self.assertEqual(a[k * i + j], seq[j][i])
+                res = deinterleave(a, k)
+                self.assertEqual(res, seq)
+                for b in res:
+                    self.assertEqual(b.endian(), a.endian())
+                    self.check_obj(b)
+
+tests.append(TestsInterleave)
+
+# ---------------------------------------------------------------------------
+
+class TestsDNA(unittest.TestCase, Util):
+
+    codes = {'A': 0, 'C': 1, 'G': 2, 'T': 3}
+
+    @staticmethod
+    def random_dna(n):
+        return ''.join(choice('ACGT') for _ in range(n))
+
+    @staticmethod
+    def revcomp(s):
+        return ''.join({'A': 'T', 'C': 'G', 'G': 'C', 'T': 'A'}[c]
+                       for c in reversed(s))
+
+    def kmer(self, s):
+        res = 0
+        for c in s:
+            res = 4 * res + self.codes[c]
+        return res
+
+    def test_explicit(self):
+        a = dna2ba('ACGTa', 'big')
+        self.assertEqual(a, bitarray('0001101100'))
+        self.assertEqual(a.endian(), 'big')
+        self.assertEqual(ba2dna(a), 'ACGTA')
+        self.assertEqual(dna2ba(b'gt'), bitarray('1011'))
+        self.assertEqual(dna2ba(''), bitarray())
+        self.assertEqual(ba2dna(bitarray()), '')
+        self.assertEqual(ba2dna(dna_revcomp(dna2ba('AACG'))), 'CGTT')
+        self.assertEqual(dna_gc(dna2ba('GATTACCA')), 3)
+        self.assertEqual(list(array('Q', dna_kmers(dna2ba('ACGT'), 2))),
+                         [1, 6, 11])
+        self.assertEqual(list(array('Q', dna_kmers(dna2ba('TTG'), 2,
+                                                   canonical=True))),
+                         [0, 4])
+        self.assertEqual(dna_kmers(dna2ba('ACG'), 4), b'')
+
+    def test_errors(self):
+        self.assertRaises(ValueError, dna2ba, 'ACGN')
+        self.assertRaises(ValueError, dna2ba, 'ACGTACGTACGTU')
+        self.assertRaises(ValueError, dna2ba, 'AC', 'foo')
+        self.assertRaises(TypeError, dna2ba, 12)
+        for f in ba2dna, dna_revcomp, dna_gc:
+            self.assertRaises(TypeError, f, 'AC')
+            self.assertRaises(ValueError, f, bitarray('101'))
+        self.assertRaises(ValueError, dna_kmers, bitarray('101'), 1)
+        self.assertRaises(ValueError, dna_kmers, bitarray('10'), 0)
+        self.assertRaises(ValueError, dna_kmers, bitarray('10'), 33)
+
+    def test_random(self):
+        for n in list(range(20)) + [randint(20, 500)]:
+            s = self.random_dna(n)
+            endian = choice(['little', 'big'])
+            a = dna2ba(s if randint(0, 1) else s.lower(), endian)
+            self.assertEqual(len(a), 2 * n)
+            self.assertEqual(a.endian(), endian)
+            self.check_obj(a)
+            self.assertEqual(ba2dna(a), s)
+            b = dna_revcomp(a)
+            self.assertEqual(b.endian(), endian)
+            self.check_obj(b)
+            self.assertEqual(ba2dna(b), self.revcomp(s))
+            self.assertEqual(dna_revcomp(b), a)
+            self.assertEqual(dna_gc(a), s.count('G') + s.count('C'))
+            for k in 1, 2, 3, 5, 31, 32:
+                self.assertEqual(list(array('Q', dna_kmers(a, k))),
+                                 [self.kmer(s[i:i + k])
+                                  for i in range(n - k + 1)])
+                self.assertEqual(
+                    list(array('Q', dna_kmers(a, k, canonical=True))),
+                    [min(self.kmer(s[i:i + k]),
+                         self.kmer(self.revcomp(s[i:i + k])))
+                     for i in range(n - k + 1)])
+
+tests.append(TestsDNA)
+
+# ---------------------------------------------------------------------------
+
+class TestsBitImage(unittest.TestCase, Util):
+
+    @staticmethod
+    def random_image(w, h):
+        img = bitimage(w, h)
+        for y in range(h):
+            for x in range(w):
+                img[x, y] = randint(0, 1)
+        return img
+
+    @staticmethod
+    def pixels(img):
+        return [[img[x, y] for x in range(img.width)]
+                for y in range(img.height)]
+
+    def check(self, img):
+        self.assertEqual(img.bits_per_row, 8 * bits2bytes(img.width))
+        self.assertEqual(len(img.data), img.bits_per_row * img.height)
+        self.assertEqual(img.data.endian(), 'big')
+        # padding bits are always 0
+        n = img.bits_per_row
+        for y in range(img.height):
+            self.assertFalse(img.data[y * n + img.width:(y + 1) * n].any())
+
+    def test_basic(self):
+        img = bitimage(10, 3)
+        self.assertEqual(img.bits_per_row, 16)
+        self.assertEqual(len(img.data), 48)
+        self.assertFalse(img.data.any())
+        img[9, 2] = 1
+        self.assertEqual(img[9, 2], 1)
+        self.assertEqual(img.data[41], 1)
+        self.assertEqual(img.row(2), bitarray('0000000001'))
+        self.assertEqual(img.row_counts(), [0, 0, 1])
+        self.assertRaises(IndexError, img.__getitem__, (10, 0))
+        self.assertRaises(IndexError, img.__setitem__, (0, -1), 1)
+        self.assertRaises(ValueError, bitimage, -1, 2)
+        self.assertEqual(repr(img), 'bitimage(10, 3)')
+        c = img.copy()
+        self.assertEqual(c, img)
+        c[0, 0] = 1
+        self.assertNotEqual(c, img)
+
+    def test_fill(self):
+        for _ in range(20):
+            w, h = randint(0, 30), randint(0, 10)
+            img = self.random_image(w, h)
+            p = self.pixels(img)
+            x, y = randint(-5, w + 5), randint(-5, h + 5)
+            rw, rh = randint(0, 20), randint(0, 8)
+            v = randint(0, 1)
+            img.fill(x, y, rw, rh, v)
+            for j in range(max(0, y), min(h, y + rh)):
+                for i in range(max(0, x), min(w, x + rw)):
+                    p[j][i] = v
+            self.assertEqual(self.pixels(img), p)
+            self.check(img)
+
+    def test_blit(self):
+        ops = {'copy': lambda d, s: s,
+               'and': lambda d, s: d & s,
+               'or': lambda d, s: d | s,
+               'xor': lambda d, s: d ^ s}
+        for _ in range(50):
+            w, h = randint(0, 90), randint(0, 10)
+            img = self.random_image(w, h)
+            src = self.random_image(randint(0, 80), randint(0, 12))
+            p = self.pixels(img)
+            x, y = randint(-20, w + 2), randint(-5, h + 2)
+            op = choice(list(ops))
+            img.blit(src, x, y, op)
+            for j in range(src.height):
+                for i in range(src.width):
+                    if 0 <= x + i < w and 0 <= y + j < h:
+                        p[y + j][x + i] = ops[op](p[y + j][x + i],
+                                                  src[i, j])
+            self.assertEqual(self.pixels(img), p)
+            self.check(img)
+
+    def test_blit_self(self):
+        for _ in range(20):
+            img = self.random_image(randint(1, 40), randint(1, 10))
+            c = img.copy()
+            x, y = randint(-5, 5), randint(-5, 5)
+            img.blit(img, x, y)
+            c.blit(c.copy(), x, y)
+            self.assertEqual(img, c)
+
+    def test_blit_errors(self):
+        img = bitimage(8, 8)
+        self.assertRaises(TypeError, img.blit, bitarray(), 0, 0)
+        self.assertRaises(ValueError, img.blit, img, 0, 0, 'nand')
+
+    def test_crop(self):
+        img = self.random_image(37, 11)
+        c = img.crop(3, 2, 30, 5)
+        self.check(c)
+        for y in range(5):
+            for x in range(30):
+                self.assertEqual(c[x, y], img[x + 3, y + 2])
+        self.assertEqual(img.crop(0, 0, 37, 11), img)
+        self.assertEqual(img.crop(5, 5, 0, 0), bitimage(0, 0))
+        self.assertRaises(ValueError, img.crop, 8, 0, 30, 1)
+        self.assertRaises(ValueError, img.crop, -1, 0, 3, 1)
+
+    def test_flip(self):
+        for _ in range(20):
+            w, h = choice([0, 8, 16, randint(0, 40)]), randint(0, 10)
+            img = self.random_image(w, h)
+            p = self.pixels(img)
+            c = img.copy()
+            c.flip_horizontal()
+            self.check(c)
+            self.assertEqual(self.pixels(c), [r[::-1] for r in p])
+            c = img.copy()
+            c.flip_vertical()
+            self.assertEqual(self.pixels(c), p[::-1])
+
+    def test_rotate(self):
+        for _ in range(20):
+            w, h = randint(0, 40), randint(0, 40)
+            img = self.random_image(w, h)
+            t = img.transpose()
+            self.check(t)
+            self.assertEqual((t.width, t.height), (h, w))
+            for y in range(h):
+                for x in range(w):
+                    self.assertEqual(t[y, x], img[x, y])
+            r = img.rotate90()
+            self.check(r)
+            for y in range(h):
+                for x in range(w):
+                    self.assertEqual(r[h - 1 - y, x], img[x, y])
+            self.assertEqual(r.rotate90(False), img)
+            self.assertEqual(r.rotate90().rotate90().rotate90(), img)
+
+    def test_row_counts(self):
+        img = self.random_image(45, 7)
+        self.assertEqual(img.row_counts(),
+                         [img.row(y).count() for y in range(7)])
+
+    def test_file(self):
+        from io import BytesIO
+
+        img = self.random_image(13, 5)
+        f = BytesIO()
+        img.tofile(f)
+        self.assertTrue(f.getvalue().startswith(b'P4\n13 5\n'))
+        self.assertEqual(len(f.getvalue()), 8 + 10)
+        f.seek(0)
+        self.assertEqual(bitimage.fromfile(f), img)
+
+        f = BytesIO(b'P4 # comment\n 9\n\n# another\n2 \x80\x00\x00\x80')
+        img = bitimage.fromfile(f)
+        self.assertEqual((img.width, img.height), (9, 2))
+        self.assertEqual(img.row_counts(), [1, 1])
+        self.assertEqual(img[0, 0], 1)
+        self.assertEqual(img[8, 1], 1)
+
+        self.assertRaises(ValueError, bitimage.fromfile, BytesIO(b'P1 1 1 '))
+        self.assertRaises(EOFError, bitimage.fromfile,
+                          BytesIO(b'P4 8 2 \x00'))
+
+    def test_fromfile_padding(self):
+        from io import BytesIO
+
+        # the padding bits of each row are "don't care"
+        img = bitimage.fromfile(BytesIO(b'P4\n3 2\n\x9f\x01'))
+        self.assertEqual(img.row_counts(), [1, 0])
+        other = bitimage(3, 2)
+        other[0, 0] = 1
+        self.assertEqual(img, other)
+        f = BytesIO()
+        img.tofile(f)
+        self.assertEqual(f.getvalue(), b'P4\n3 2\n\x80\x00')
+
+tests.append(TestsBitImage)
+
+# ---------------------------------------------------------------------------
+
+class TestsMultiSearch(unittest.TestCase, Util):
+
+    @staticmethod
+    def search_simple(patterns, a):
+        # reference implementation using .search(), ordered by end position
+        # and decreasing pattern length
+        res = []
+        for i, p in enumerate(patterns):
+            res.extend((i, pos) for pos in a.search(p))
+        res.sort(key=lambda r: (r[1] + len(patterns[r[0]]),
+                                -len(patterns[r[0]]), r[0]))
+        return res
+
+    def test_explicit(self):
+        m = multisearch([bitarray('11'), bitarray('011'), bitarray('1')])
+        self.assertEqual(len(m), 3)
+        self.assertEqual(m.search(bitarray('0110')),
+                         [(2, 1), (1, 0), (0, 1), (2, 2)])
+        self.assertEqual(m.search(bitarray('0110'), 2), [(2, 1), (1, 0)])
+        self.assertEqual(m.search(bitarray('0110'), 0), [])
+        self.assertEqual(m.search(bitarray()), [])
+        m = multisearch([])
+        self.assertEqual(len(m), 0)
+        self.assertEqual(m.search(bitarray('0110')), [])
+        m = multisearch((bitarray('01'), bitarray('01')))
+        self.assertEqual(m.search(bitarray('0101')),
+                         [(0, 0), (1, 0), (0, 2), (1, 2)])
+
+    def test_errors(self):
+        self.assertRaises(TypeError, multisearch)
+        self.assertRaises(TypeError, multisearch, None)
+        self.assertRaises(TypeError, multisearch, ['01'])
+        self.assertRaises(ValueError, multisearch, [bitarray('1'),
+                                                    bitarray()])
+        m = multisearch([bitarray('1')])
+        self.assertRaises(TypeError, m.search, '1')
+
+    def test_random(self):
+        for a in self.randombitarrays():
+            patterns = [bitarray([randint(0, 1)
+                                  for _ in range(randint(1, 12))],
+                                 choice(['little', 'big']))
+                        for _ in range(randint(1, 10))]
+            m = multisearch(patterns)
+            res = m.search(a)
+            self.assertEqual(len(res), sum(len(a.search(p))
+                                           for p in patterns))
+            self.assertEqual(res, self.search_simple(patterns, a))
+            limit = randint(0, len(res) + 1)
+            self.assertEqual(m.search(a, limit), res[:limit])
+
+    def test_large(self):
+        a = bitarray(endian='little')
+        a.frombytes(os.urandom(10000))
+        patterns = [a[i:i + randint(1, 70)] for i in range(0, 80000, 3000)]
+        patterns.append(bitarray(20 * '1'))
+        m = multisearch(patterns)
+        self.assertEqual(m.search(a), self.search_simple(patterns, a))
+
+tests.append(TestsMultiSearch)
+
+# ---------------------------------------------------------------------------
+
+class TestsArrow(unittest.TestCase, Util):
+
+    def test_roundtrip(self):
+        for a in self.randombitarrays():
+            b = from_arrow(a)
+            self.assertEqual(b, a)
+            self.assertEqual(b.endian(), 'little')
+            self.check_obj(b)
+            v = from_arrow(a, validity=True)
+            self.assertEqual(len(v), len(a))
+            self.assertTrue(v.all())
+            self.check_obj(v)
+
+    def test_export(self):
+        a = bitarray('1101', 'little')
+        schema, array = a.__arrow_c_array__()
+        self.assertEqual(type(schema).__name__, 'PyCapsule')
+        self.assertEqual(type(array).__name__, 'PyCapsule')
+        # the exported (zero copy) array prevents resizing
+        self.assertRaises(BufferError, a.extend, 8 * [1])
+        del schema, array
+        a.append(1)
+        self.assertEqual(from_arrow(a), bitarray('11011'))
+
+        # big-endian bitarrays are exported as a copy
+        a = bitarray('1101', 'big')
+        schema, array = a.__arrow_c_array__(None)
+        a.append(1)
+        self.assertEqual(from_arrow(a), bitarray('11011'))
+
+    def test_errors(self):
+        self.assertRaises(AttributeError, from_arrow, [1, 0])
+
+        class Foo(object):
+            def __arrow_c_array__(self, requested_schema=None):
+                return 1, 2
+
+        self.assertRaises(TypeError, from_arrow, Foo())
+
+    @unittest.skipIf(sys.version_info[0] == 2, "ctypes capsule API")
+    def test_offset(self):
+        # produce Arrow arrays with ctypes, to test bit offsets and other
+        # formats than boolean
+        import ctypes
+
+        class ArrowSchema(ctypes.Structure):
+            _fields_ = [('format', ctypes.c_char_p),
+                        ('name', ctypes.c_char_p),
+                        ('metadata', ctypes.c_char_p),
+                        ('flags', ctypes.c_int64),
+                        ('n_children', ctypes.c_int64),
+                        ('children', ctypes.c_void_p),
+                        ('dictionary', ctypes.c_void_p),
+                        ('release', ctypes.c_void_p),
+                        ('private_data', ctypes.c_void_p)]
+
+        class ArrowArray(ctypes.Structure):
+            _fields_ = [('length', ctypes.c_int64),
+                        ('null_count', ctypes.c_int64),
+                        ('offset', ctypes.c_int64),
+                        ('n_buffers', ctypes.c_int64),
+                        ('n_children', ctypes.c_int64),
+                        ('buffers', ctypes.POINTER(ctypes.c_void_p)),
+                        ('children', ctypes.c_void_p),
+                        ('dictionary', ctypes.c_void_p),
+                        ('release', ctypes.c_void_p),
+                        ('private_data', ctypes.c_void_p)]
+
+        capsule_new = ctypes.pythonapi.PyCapsule_New
+        capsule_new.restype = ctypes.py_object
+        capsule_new.argtypes = [ctypes.c_void_p, ctypes.c_char_p,
+                                ctypes.c_void_p]
+
+        class Producer(object):
+            def __init__(self, fmt, data, validity, offset, length):
+                # keep everything alive as long as the producer exists
+                self.data = ctypes.create_string_buffer(data)
+                self.validity = (ctypes.create_string_buffer(validity)
+                                 if validity else None)
+                self.buffers = (ctypes.c_void_p * 2)(
+                    ctypes.addressof(self.validity) if validity else None,
+                    ctypes.addressof(self.data))
+                self.schema = ArrowSchema(format=fmt, release=1)
+                self.array = ArrowArray(length=length, offset=offset,
+                                        null_count=-1 if validity else 0,
+                                        n_buffers=2,
+                                        buffers=self.buffers, release=1)
+
+            def __arrow_c_array__(self, requested_schema=None):
+                # capsules without destructor, as the structures are
+                # owned by this object
+                return (capsule_new(ctypes.addressof(self.schema),
+                                    b'arrow_schema', None),
+                        capsule_new(ctypes.addressof(self.array),
+                                    b'arrow_array', None))
+
+        for _ in range(100):
+            a = bitarray(randint(0, 100), 'little')
+            a.setall(0)
+            for i in range(len(a)):
+                a[i] = randint(0, 1)
+            offset = randint(0, len(a))
+            length = randint(0, len(a) - offset)
+            # set bits after the slice to make sure they are not copied
+            data = (a + bitarray(16 * '1', 'little')).tobytes()
+            p = Producer(b'b', data, None, offset, length)
+            self.assertEqual(from_arrow(p), a[offset:offset + length])
+            self.check_obj(from_arrow(p))
+            v = from_arrow(p, validity=True)
+            self.assertEqual(len(v), length)
+            self.assertTrue(v.all())
+            p = Producer(b'i', b'xxxx', data, offset, length)
+            self.assertEqual(from_arrow(p, validity=True),
+                             a[offset:offset + length])
+            self.assertRaises(TypeError, from_arrow, p)
+
+        p = Producer(b'n', b'', None, 0, 0)
+        self.assertRaises(ValueError, from_arrow, p, validity=True)
+
+tests.append(TestsArrow)
+
+# ---------------------------------------------------------------------------
+
+class TestsRLE(unittest.TestCase, Util):
+
+    @staticmethod
+    def values(lst, k, endian='little'):
+        a = bitarray(endian=endian)
+        for x in lst:
+            a.extend(int2ba(x, k, 'little'))
+        return a
+
+    @staticmethod
+    def decode(data, k, count):
+        # straightforward reference decoder
+        res = []
+        data = bytearray(data)
+        pos = 0
+        while len(res) < count:
+            header = shift = 0
+            while True:
+                c = data[pos]
+                pos += 1
+                header |= (c & 0x7f) << shift
+                shift += 7
+                if not c & 0x80:
+                    break
+            if header & 1:
+                n = 8 * (header >> 1)
+                b = bitarray(endian='little')
+                b.frombytes(bytes(data[pos:pos + n * k // 8]))
+                res.extend(ba2int(b[i * k:(i + 1) * k]) for i in range(n))
+                pos += n * k // 8
+            else:
+                vbytes = (k + 7) // 8
+                x = 0
+                for i in range(vbytes):
+                    x |= data[pos + i] << (8 * i)
+                res.extend((header >> 1) * [x])
+                pos += vbytes
+        return res[:count]
+
+    def test_spec_example(self):
+        # bit-packing example from the Parquet documentation
+        a = self.values(range(8), 3)
+        self.assertEqual(rle_encode(a, 3), b'\x03\x88\xc6\xfa')
+        self.assertEqual(rle_decode(b'\x03\x88\xc6\xfa', 3), a)
+
+    def test_rle_run(self):
+        a = bitarray(100 * '1')
+        self.assertEqual(rle_encode(a), b'\xc8\x01\x01')
+        self.assertEqual(rle_decode(b'\xc8\x01\x01'), a)
+        a = self.values(20 * [0x1234], 13)
+        self.assertEqual(rle_encode(a, bit_width=13), b'\x28\x34\x12')
+        self.assertEqual(rle_decode(b'\x28\x34\x12', 13), a)
+        self.assertEqual(rle_encode(bitarray()), b'')
+        self.assertEqual(rle_decode(b''), bitarray())
+
+    def test_mixed(self):
+        a = bitarray('1101' + 16 * '0' + '01')
+        data = rle_encode(a)
+        # bit-packed group, RLE run of 13 zeros, bit-packed padded group
+        self.assertEqual(data, b'\x03\x0b\x1a\x00\x03\x01')
+        self.assertEqual(rle_decode(data, count=len(a)), a)
+        # without count, the padding of the last group is included
+        self.assertEqual(rle_decode(data), a + bitarray('0000000'))
+
+    def test_count_endian(self):
+        data = rle_encode(bitarray('1110000000000'))
+        for endian in 'big', 'little':
+            a = rle_decode(data, count=5, endian=endian)
+            self.assertEqual(a, bitarray('11100'))
+            self.assertEqual(a.endian(), endian)
+            self.check_obj(a)
+        self.assertEqual(rle_decode(data, count=0), bitarray())
+        # trailing data after count values is ignored
+        self.assertEqual(rle_decode(data + b'\xff', count=13),
+                         bitarray('1110000000000'))
+
+    def test_roundtrip(self):
+        for k in list(range(1, 17)) + [31, 32, 33, 63, 64]:
+            n = randint(0, 100)
+            # values with many runs
+            lst = []
+            while len(lst) < n:
+                lst.extend(randint(1, 20) * [randint(0, min(3, k))
+                                             if randint(0, 1) else
+                                             getrandbits(k)])
+            for endian in 'little', 'big':
+                a = self.values(lst, k, endian)
+                data = rle_encode(a, k)
+                self.assertEqual(self.decode(data, k, len(lst)), lst)
+                b = rle_decode(data, k, len(lst), endian)
+                self.assertEqual(b, a)
+                self.assertEqual(b.endian(), endian)
+                self.check_obj(b)
+
+    def test_roundtrip_bits(self):
+        for a in self.randombitarrays():
+            data = rle_encode(a)
+            self.assertEqual(rle_decode(data, count=len(a)), a)
+            c = rle_decode(data)
+            # possibly padded last bit-packed group
+            self.assertTrue(len(a) <= len(c) < len(a) + 8)
+            self.assertEqual(c[:len(a)], a)
+            self.assertFalse(c[len(a):].any())
+
+    def test_large_runs(self):
+        a = bitarray(1000 * '1' + 5000 * '0' + '1010' + 777 * '1',
+                     'big')
+        data = rle_encode(a)
+        self.assertTrue(len(data) < 20)
+        self.assertEqual(rle_decode(data, count=len(a), endian='big'), a)
+
+    def test_errors(self):
+        self.assertRaises(TypeError, rle_encode, b'1')
+        self.assertRaises(ValueError, rle_encode, bitarray(3), 0)
+        self.assertRaises(ValueError, rle_encode, bitarray(3), 65)
+        self.assertRaises(ValueError, rle_encode, bitarray(5), 2)
+        self.assertRaises(TypeError, rle_decode, u'abc')
+        self.assertRaises(ValueError, rle_decode, b'', 0)
+        self.assertRaises(ValueError, rle_decode, b'', 1, -1)
+        self.assertRaises(ValueError, rle_decode, b'', 1, None, 'foo')
+        # data ends too early
+        self.assertRaises(ValueError, rle_decode, b'', 1, 1)
+        self.assertRaises(ValueError, rle_decode, b'\x03', 1, 8)
+        self.assertRaises(ValueError, rle_decode, b'\x03\x01', 2, 8)
+        self.assertRaises(ValueError, rle_decode, b'\x10', 1, 8)
+        self.assertRaises(ValueError, rle_decode, b'\x80', 1)
+        # the length of bit-packed runs is checked before allocating
+        for k in 1, 7, 64:
+            for data in b'\xff\xff\xff\x7f', b'\x05\x00', 3 * b'\xff\x01':
+                self.assertRaises(ValueError, rle_decode, data, k)
+        self.assertRaises(ValueError, rle_decode, b'\x05' + 15 * b'\x00', 8)
+        self.assertEqual(len(rle_decode(b'\x05' + 16 * b'\x00', 8)), 128)
+        # RLE runs of 2**54 - 1 values, whose total count does not fit
+        run = b'\xfe' + 6 * b'\xff' + b'\x3f' + 8 * b'\x00'
+        self.assertRaises(OverflowError, rle_decode, 10 * run, 64)
+        # RLE value exceeding bit width
+        self.assertRaises(ValueError, rle_decode, b'\x10\x02', 1)
+        self.assertRaises(ValueError, rle_decode, b'\x10\x08', 3)
+
+tests.append(TestsRLE)
+
+# ---------------------------------------------------------------------------
+
+class TestsDiffPatch(unittest.TestCase, Util):
+
+    @staticmethod
+    def urandom(n, endian):
+        a = bitarray(endian=endian)
+        a.frombytes(os.urandom(bits2bytes(n)))
+        del a[n:]
+        return a
+
+    def check_patch(self, old, new):
+        delta = diff(old, new)
+        self.assertIsInstance(delta, bytes)
+        a = old.copy()
+        patch(a, delta)
+        self.assertEqual(a, new)
+        self.assertEqual(a.endian(), old.endian())
+        self.check_obj(a)
+        return delta
+
+    def test_basic(self):
+        a = bitarray('1101')
+        self.assertEqual(diff(a, a), b'\x04\x04')
+        self.assertEqual(self.check_patch(a, bitarray('1100')),
+                         b'\x04\x04\x00\x01\x08')
+        self.assertEqual(diff(bitarray(), bitarray()), b'\x00\x00')
+        self.check_patch(bitarray(), bitarray())
+
+    def test_size(self):
+        a = bitarray(1000000)
+        a.setall(0)
+        b = a.copy()
+        b[1000] = b[500000] = b[500001] = 1
+        b[999999] = 1
+        delta = self.check_patch(a, b)
+        # header, 3 runs of one word each
+        self.assertTrue(len(delta) < 50)
+        self.check_patch(b, a)
+
+    def test_lengths(self):
+        for a in self.randombitarrays():
+            for b in self.randombitarrays():
+                self.check_patch(a, b)
+
+    def test_random(self):
+        for n in 0, 1, 63, 64, 65, 1000, 5000:
+            for endian in 'little', 'big':
+                a = self.urandom(n, endian)
+                b = a.copy()
+                for _ in range(randint(0, 10)):
+                    i = randint(0, n)
+                    j = min(n, i + randint(0, 200))
+                    b[i:j] = self.urandom(j - i, choice(['little', 'big']))
+                delta = self.check_patch(a, b)
+                # endianness of old and new does not matter
+                c = bitarray(endian='big' if endian == 'little' else
+                             'little')
+                c.extend(b)
+                self.assertEqual(diff(a, c), delta)
+
+    def test_errors(self):
+        a = bitarray('1101')
+        delta = diff(a, bitarray('0011'))
+        self.assertRaises(TypeError, diff, a, b'1')
+        self.assertRaises(TypeError, patch, frozenbitarray(a), delta)
+        self.assertRaises(TypeError, patch, a, u'abc')
+        # wrong length
+        self.assertRaises(ValueError, patch, bitarray('110'), delta)
+        for d in b'', b'\x04', delta[:-1], delta + b'\x00', \
+                 b'\x04\x04\x01\x01\x00', b'\x04\x04\x00\x00':
+            self.assertRaises(ValueError, patch, a, d)
+            self.assertEqual(a, bitarray('1101'))
+        # exported buffer prevents resizing
+        m = memoryview(a)
+        self.assertRaises(BufferError, patch, a, diff(a, bitarray(100)))
+        self.assertEqual(a, bitarray('1101'))
+        patch(a, delta)
+        self.assertEqual(a, bitarray('0011'))
+        del m
+
+    def test_dirty(self):
+        a = zeros(8 * 4096 * 4)
+        b = a.copy()
+        b[8 * 4096 * 2 + 17] = 1
+        a.track_dirty()
+        patch(a, diff(a, b))
+        self.assertEqual(a.dirty_blocks(), [2])
+
+tests.append(TestsDiffPatch)
+
+# ---------------------------------------------------------------------------
+
 def run(verbosity=1):
     import os
     import bitarray
@@ -13,17 +13,31 @@ from bitarray import bitarray, bits2bytes, _bitarray, get_default_endian
 
 from bitarray._util import (count_n, rindex,
                             count_and, count_or, count_xor, subset,
-                            _swap_hilo_bytes, _set_babt)
+                            gf2_rank, gf2_solve, gf2_nullspace,
+                            crc, clmul, polymod, bitplanes, frombitplanes,
+                            compare, between, filter,
+                            interleave, deinterleave,
+                            dna2ba, ba2dna, dna_revcomp, dna_kmers, dna_gc,
+                            multisearch, from_arrow,
+                            rle_encode, rle_decode, diff, patch,
+                            _blit, _transpose,
+                            _swap_hilo_bytes, _set_bato)
 
 
 __all__ = ['zeros', 'make_endian', 'rindex', 'strip', 'count_n',
            'count_and', 'count_or', 'count_xor', 'subset',
-           'ba2hex', 'hex2ba', 'ba2int', 'int2ba', 'huffman_code']
+           'ba2hex', 'hex2ba', 'ba2int', 'int2ba', 'huffman_code',
+           'gf2_rank', 'gf2_solve', 'gf2_nullspace',
+           'crc', 'clmul', 'polymod', 'bitplanes', 'frombitplanes', 'bsi',
+           'compare', 'between', 'interleave', 'deinterleave',
+           'dna2ba', 'ba2dna', 'dna_revcomp', 'dna_kmers', 'dna_gc',
+           'bitimage', 'multisearch', 'from_arrow',
+           'rle_encode', 'rle_decode', 'diff', 'patch']
 
 
-# tell the _util extension what the bitarray base type is, such that it can
-# check for instances thereof when checking for bitarray type
-_set_babt(_bitarray)
+# tell the _util extension which type to use when creating new bitarrays
+# (the base type for type checks is taken from the _bitarray C API)
+_set_bato(bitarray)
 
 _is_py2 = bool(sys.version_info[0] == 2)
 
@@ -309,3 +323,349 @@ hashable object (including `None`).
 
     traverse(huff_tree(freq_map))
     return result
+
+
+class bsi(object):
+    """bsi(buffer, /, endian=None) -> bsi
+
+Bit-sliced index over the integers in `buffer` (any object exposing
+integer elements through the buffer protocol, see `bitplanes()`).
+The comparison methods `lt()`, `le()`, `eq()`, `ne()`, `gt()`, `ge()`
+and `between()` return a bitarray (with given endianness) which is 1 for
+each element satisfying the condition.  All methods take an optional
+`filter` bitarray, which restricts the result to the elements for which
+`filter` is 1.
+"""
+    def __init__(self, buffer, endian=None):
+        fmt = memoryview(buffer).format
+        planes = bitplanes(buffer, endian)
+        self._n = len(planes[0])
+        self._endian = planes[0].endian()
+        self._bias = 0
+        if fmt[-1] in 'bhilq':
+            # signed integers - store x + 2**(k-1), i.e. invert sign bit
+            planes[-1].invert()
+            self._bias = 1 << (len(planes) - 1)
+        # drop most significant planes which are all zero
+        while planes and not planes[-1].any():
+            planes.pop()
+        self._planes = planes
+
+    def __len__(self):
+        return self._n
+
+    def _ones(self):
+        a = bitarray(self._n, self._endian)
+        a.setall(1)
+        return a
+
+    def _filter(self, filter):
+        if filter is None:
+            return None
+        if not isinstance(filter, _bitarray):
+            raise TypeError("bitarray expected for filter")
+        if len(filter) != self._n:
+            raise ValueError("filter of length %d expected" % self._n)
+        return make_endian(filter, self._endian)
+
+    def _compare(self, value):
+        # return bitarrays (lt, eq) of elements less than / equal to value
+        if not isinstance(value, (int, long) if _is_py2 else int):
+            raise TypeError("integer expected")
+        c = value + self._bias
+        if c < 0:
+            return zeros(self._n, self._endian), zeros(self._n, self._endian)
+        if c >> len(self._planes):
+            return self._ones(), zeros(self._n, self._endian)
+        lt = zeros(self._n, self._endian)
+        eq = self._ones()
+        for j in range(len(self._planes) - 1, -1, -1):
+            t = eq & self._planes[j]
+            eq ^= t
+            if c >> j & 1:
+                # equal so far and bit 0 here -> less than value
+                lt |= eq
+                eq = t
+        return lt, eq
+
+    def _apply(self, a, filter):
+        filter = self._filter(filter)
+        if filter is not None:
+            a &= filter
+        return a
+
+    def lt(self, value, filter=None):
+        return self._apply(self._compare(value)[0], filter)
+
+    def le(self, value, filter=None):
+        lt, eq = self._compare(value)
+        lt |= eq
+        return self._apply(lt, filter)
+
+    def eq(self, value, filter=None):
+        return self._apply(self._compare(value)[1], filter)
+
+    def ne(self, value, filter=None):
+        return self._apply(~self._compare(value)[1], filter)
+
+    def gt(self, value, filter=None):
+        lt, eq = self._compare(value)
+        lt |= eq
+        return self._apply(~lt, filter)
+
+    def ge(self, value, filter=None):
+        return self._apply(~self._compare(value)[0], filter)
+
+    def between(self, low, high, filter=None):
+        """between(low, high, /, filter=None) -> bitarray
+
+Return bitarray of elements with `low <= x <= high`.
+"""
+        a = self.ge(low, filter)
+        a &= self.le(high)
+        return a
+
+    def count(self, filter=None):
+        """count(filter=None) -> int
+
+Return number of elements (for which `filter` is 1).
+"""
+        filter = self._filter(filter)
+        return self._n if filter is None else filter.count()
+
+    def sum(self, filter=None):
+        """sum(filter=None) -> int
+
+Return the sum of the elements (for which `filter` is 1).
+"""
+        filter = self._filter(filter)
+        res = 0
+        for j, p in enumerate(self._planes):
+            res += (p.count() if filter is None else
+                    count_and(p, filter)) << j
+        return res - self._bias * self.count(filter)
+
+
+class bitimage(object):
+    """bitimage(width, height, /) -> bitimage
+
+Two dimensional image with one bit per pixel, all pixels are 0 initially.
+The pixels are stored in the (big-endian) bitarray `data`, row by row,
+with each row padded to full bytes (`bits_per_row` bits per row), which is
+the layout of the raster of PBM (P4) files.  Pixels are accessed by
+`img[x, y]`.
+"""
+    _ops = {'copy': 0, 'and': 1, 'or': 2, 'xor': 3}
+
+    def __init__(self, width, height):
+        if width < 0 or height < 0:
+            raise ValueError("non-negative width and height expected")
+        self.width = width
+        self.height = height
+        self.bits_per_row = 8 * bits2bytes(width)
+        self.data = zeros(self.bits_per_row * height, 'big')
+
+    def __repr__(self):
+        return 'bitimage(%d, %d)' % (self.width, self.height)
+
+    def __eq__(self, other):
+        return (isinstance(other, bitimage) and
+                (self.width, self.height) == (other.width, other.height) and
+                self.data == other.data)
+
+    def __ne__(self, other):
+        return not self == other
+
+    def _index(self, xy):
+        x, y = xy
+        if not (0 <= x < self.width and 0 <= y < self.height):
+            raise IndexError("pixel (%d, %d) out of range" % (x, y))
+        return y * self.bits_per_row + x
+
+    def __getitem__(self, xy):
+        return self.data[self._index(xy)]
+
+    def __setitem__(self, xy, value):
+        self.data[self._index(xy)] = value
+
+    def _clip(self, x, y, w, h):
+        # clip rectangle to image, and return (x, y, w, h, dx, dy), where
+        # (dx, dy) is the offset of the clipped rectangle within the
+        # original one
+        dx, dy = max(0, -x), max(0, -y)
+        w = max(0, min(x + w, self.width) - x - dx)
+        h = max(0, min(y + h, self.height) - y - dy)
+        return x + dx, y + dy, w, h, dx, dy
+
+    def row(self, y):
+        """row(y, /) -> bitarray
+
+Return the pixels of row `y` as a bitarray.
+"""
+        i = self._index((0, y))
+        return self.data[i:i + self.width]
+
+    def fill(self, x, y, width, height, value=1):
+        """fill(x, y, width, height, /, value=1)
+
+Set all pixels within the given rectangle (clipped to the image) to
+`value`.
+"""
+        x, y, width, height = self._clip(x, y, width, height)[:4]
+        if width == 0:
+            return
+        value = bool(value)
+        for j in range(y, y + height):
+            i = j * self.bits_per_row + x
+            self.data[i:i + width] = value
+
+    def blit(self, src, x, y, op='copy'):
+        """blit(src, x, y, /, op='copy')
+
+Combine the image `src` into this image, such that its top left corner
+is at pixel `(x, y)`, which may be any position (parts of `src` outside
+of this image are ignored).  The operation `op` is one of 'copy', 'and',
+'or' and 'xor'.
+"""
+        if not isinstance(src, bitimage):
+            raise TypeError("bitimage expected")
+        if op not in self._ops:
+            raise ValueError("op must be 'copy', 'and', 'or' or 'xor', "
+                             "got %r" % (op,))
+        x, y, w, h, dx, dy = self._clip(x, y, src.width, src.height)
+        if w and h:
+            _blit(self.data, y * self.bits_per_row + x, self.bits_per_row,
+                  src.data, dy * src.bits_per_row + dx, src.bits_per_row,
+                  w, h, self._ops[op])
+
+    def crop(self, x, y, width, height):
+        """crop(x, y, width, height, /) -> bitimage
+
+Return a new image of the given rectangle, which has to lie within
+the image.
+"""
+        if (x < 0 or y < 0 or width < 0 or height < 0 or
+                x + width > self.width or y + height > self.height):
+            raise ValueError("rectangle out of range")
+        res = bitimage(width, height)
+        if width and height:
+            _blit(res.data, 0, res.bits_per_row,
+                  self.data, y * self.bits_per_row + x, self.bits_per_row,
+                  width, height, 0)
+        return res
+
+    def copy(self):
+        """copy() -> bitimage
+
+Return a copy of the image.
+"""
+        res = bitimage(self.width, self.height)
+        res.data = self.data.copy()
+        return res
+
+    def flip_horizontal(self):
+        """flip_horizontal()
+
+Mirror the image in place, left to right.
+"""
+        if self.width == self.bits_per_row:
+            # reversing all bits reverses each row and the order of rows
+            self.data.reverse()
+            self.flip_vertical()
+            return
+        for y in range(self.height):
+            i = y * self.bits_per_row
+            r = self.data[i:i + self.width]
+            r.reverse()
+            self.data[i:i + self.width] = r
+
+    def flip_vertical(self):
+        """flip_vertical()
+
+Mirror the image in place, top to bottom.
+"""
+        n = self.bits_per_row // 8
+        if n == 0:
+            return
+        b = self.data.tobytes()
+        m = memoryview(self.data)
+        m[:] = b''.join(b[i:i + n] for i in range(len(b) - n, -1, -n))
+        del m
+
+    def transpose(self):
+        """transpose() -> bitimage
+
+Return the transposed image, i.e. pixel `(x, y)` becomes `(y, x)`.
+"""
+        res = bitimage(self.height, self.width)
+        res.data = _transpose(self.data, 0, self.bits_per_row,
+                              self.width, self.height)
+        return res
+
+    def rotate90(self, clockwise=True):
+        """rotate90(clockwise=True) -> bitimage
+
+Return the image rotated by 90 degrees.
+"""
+        # only use flip_vertical(), which moves whole (byte aligned) rows
+        if clockwise:
+            res = self.copy()
+            res.flip_vertical()
+            return res.transpose()
+        res = self.transpose()
+        res.flip_vertical()
+        return res
+
+    def row_counts(self):
+        """row_counts() -> list
+
+Return the list of the number of 1 pixels in each row.
+"""
+        n = self.bits_per_row
+        return [self.data.count(1, y * n, (y + 1) * n)
+                for y in range(self.height)]
+
+    def tofile(self, f):
+        """tofile(f, /)
+
+Write the image to the file object `f` in PBM (P4) format.
+"""
+        f.write(('P4\n%d %d\n' % (self.width, self.height)).encode())
+        self.data.tofile(f)
+
+    @classmethod
+    def fromfile(cls, f):
+        """fromfile(f, /) -> bitimage
+
+Read an image in PBM (P4) format from the file object `f`.
+"""
+        if _pbm_token(f) != b'P4':
+            raise ValueError("PBM (P4) file expected")
+        width, height = int(_pbm_token(f)), int(_pbm_token(f))
+        res = cls(width, height)
+        nbytes = res.data.buffer_info()[1]
+        if f.readinto(memoryview(res.data)) != nbytes:
+            raise EOFError("unexpected end of file in PBM raster")
+        # the padding bits of each row are "don't care" in PBM files, but
+        # all other methods rely on them being 0
+        n = res.bits_per_row
+        if width < n:
+            for y in range(height):
+                res.data[y * n + width:(y + 1) * n] = 0
+        return res
+
+
+def _pbm_token(f):
+    # return the next whitespace separated token of a PBM header (where
+    # '#' starts a comment), and consume the single whitespace character
+    # which follows it
+    c = f.read(1)
+    while c.isspace() or c == b'#':
+        if c == b'#':
+            f.readline()
+        c = f.read(1)
+    token = b''
+    while c and not c.isspace():
+        token += c
+        c = f.read(1)
+    return token
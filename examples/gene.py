@@ -25,3 +25,17 @@ assert arr.decode(trans) == seq
 # decodage
 t = timeit(lambda: arr.decode(trans), number=1000)
 print(t)
+
+# bitarray.util also provides functions for nucleotide sequences, which use
+# the encoding A = 00, C = 01, G = 10, T = 11 (such that the complement of
+# a nucleotide is obtained by inverting its bits)
+from bitarray.util import dna2ba, ba2dna, dna_revcomp, dna_gc
+
+s = ''.join(seq)
+a = dna2ba(s)
+assert ba2dna(a) == s
+assert dna_gc(a) == s.count('G') + s.count('C')
+assert dna_revcomp(dna_revcomp(a)) == a
+
+t = timeit(lambda: ba2dna(a), number=1000)
+print(t)
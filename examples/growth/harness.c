@@ -0,0 +1,276 @@
+/*
+   Harness for comparing growth policies of the bitarray buffer.
+
+   Like resize.c, this contains distilled versions of resize(), but here
+   for several growth policies, which are run side by side on workloads
+   which append, extend, read chunks (like .frombytes()) and shrink.  The
+   buffer is really (re)allocated using realloc(), and for each policy and
+   workload we report:
+
+     resize     number of calls to resize()
+     realloc    number of calls to realloc()
+     moved      number of times realloc() returned a new address
+     copied     bytes copied by realloc() when moving the buffer
+     peak       peak allocated size of the buffer (bytes)
+     rss        peak resident memory of the process (KB)
+     time       time spent (seconds)
+
+   Each workload runs in a child process, such that the peak resident
+   memory is measured separately.  The policy "bitarray" is the one
+   implemented in _bitarray.c.  For measuring the real extension, see
+   measure.py.
+
+   Usage: ./harness [NBITS]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+
+#define BYTES(bits)  (((bits) == 0) ? 0 : (((bits) - 1) / 8 + 1))
+
+typedef struct {
+    char *ob_item;
+    size_t size;
+    size_t allocated;
+    long long nbits;
+} buffer;
+
+typedef struct {
+    long long resize, realloc, moved, copied, peak, rss;
+    double time;
+} stats;
+
+/* ----------------------------- policies ------------------------------ */
+
+typedef struct {
+    const char *name;
+    /* return the new allocation, or 0 when realloc() can be bypassed */
+    size_t (*grow)(size_t size, size_t allocated, size_t newsize);
+} policy;
+
+/* the policy of resize() in _bitarray.c */
+static size_t
+grow_bitarray(size_t size, size_t allocated, size_t newsize)
+{
+    if (allocated >= newsize && newsize >= (allocated >> 1))
+        return 0;
+    if (size == 0 && newsize <= 4)
+        return 4;
+    if (size != 0 && newsize > size)
+        return newsize + (newsize >> 4) + (newsize < 8 ? 3 : 7);
+    return newsize;
+}
+
+/* the policy of list_resize() in CPython 3 */
+static size_t
+grow_list(size_t size, size_t allocated, size_t newsize)
+{
+    if (allocated >= newsize && newsize >= (allocated >> 1))
+        return 0;
+    return newsize + (newsize >> 3) + (newsize < 9 ? 3 : 6);
+}
+
+/* double the allocation, shrink when below a quarter */
+static size_t
+grow_double(size_t size, size_t allocated, size_t newsize)
+{
+    if (allocated >= newsize && newsize >= (allocated >> 2))
+        return 0;
+    if (newsize > size)
+        return newsize > 2 * allocated ? newsize : 2 * allocated;
+    return newsize;
+}
+
+/* no overallocation at all */
+static size_t
+grow_exact(size_t size, size_t allocated, size_t newsize)
+{
+    return newsize;
+}
+
+static policy policies[] = {
+    {"bitarray", grow_bitarray},
+    {"list",     grow_list},
+    {"double",   grow_double},
+    {"exact",    grow_exact},
+    {NULL,       NULL}
+};
+
+/* ------------------------------ resize ------------------------------- */
+
+static void
+resize(buffer *self, long long nbits, const policy *pol, stats *st)
+{
+    size_t newsize = BYTES(nbits), new_allocated;
+    char *p;
+
+    st->resize++;
+    if (newsize == self->size) {
+        self->nbits = nbits;
+        return;
+    }
+    if (newsize == 0) {
+        free(self->ob_item);
+        self->ob_item = NULL;
+        self->size = self->allocated = 0;
+        self->nbits = 0;
+        return;
+    }
+    new_allocated = pol->grow(self->size, self->allocated, newsize);
+    if (new_allocated) {
+        p = realloc(self->ob_item, new_allocated);
+        if (p == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+        st->realloc++;
+        if (self->ob_item && p != self->ob_item) {
+            st->moved++;
+            st->copied += self->size < newsize ? self->size : newsize;
+        }
+        self->ob_item = p;
+        self->allocated = new_allocated;
+        if ((long long) new_allocated > st->peak)
+            st->peak = new_allocated;
+    }
+    /* touch the new bytes, as the bitarray methods would */
+    if (newsize > self->size)
+        memset(self->ob_item + self->size, 0xff, newsize - self->size);
+    self->size = newsize;
+    self->nbits = nbits;
+}
+
+/* ----------------------------- workloads ----------------------------- */
+
+/* append n bits one by one */
+static void
+work_append(buffer *a, long long n, const policy *pol, stats *st)
+{
+    long long i;
+
+    for (i = 0; i < n; i++)
+        resize(a, a->nbits + 1, pol, st);
+}
+
+/* extend by chunks of 1 to 1024 bits (pseudo random), up to n bits */
+static void
+work_extend(buffer *a, long long n, const policy *pol, stats *st)
+{
+    unsigned int x = 12345;
+
+    while (a->nbits < n) {
+        x = 1103515245 * x + 12345;
+        resize(a, a->nbits + 1 + (x >> 16) % 1024, pol, st);
+    }
+}
+
+/* extend by chunks of 4096 bytes, like reading a file using .frombytes() */
+static void
+work_frombytes(buffer *a, long long n, const policy *pol, stats *st)
+{
+    while (a->nbits < n)
+        resize(a, a->nbits + 8 * 4096, pol, st);
+}
+
+/* start with n bits (not overallocated, like bitarray(n)), and delete
+   chunks of 64 bits from the end, until the buffer is empty */
+static void
+work_shrink(buffer *a, long long n, const policy *pol, stats *st)
+{
+    a->ob_item = malloc(BYTES(n));
+    a->size = a->allocated = BYTES(n);
+    st->peak = a->allocated;
+    a->nbits = n;
+    memset(a->ob_item, 0xff, a->size);
+    while (a->nbits > 0)
+        resize(a, a->nbits > 64 ? a->nbits - 64 : 0, pol, st);
+}
+
+typedef struct {
+    const char *name;
+    void (*run)(buffer *a, long long n, const policy *pol, stats *st);
+} workload;
+
+static workload workloads[] = {
+    {"append",    work_append},
+    {"extend",    work_extend},
+    {"frombytes", work_frombytes},
+    {"shrink",    work_shrink},
+    {NULL,        NULL}
+};
+
+/* ------------------------------- main -------------------------------- */
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/* run workload with policy in a child process, and return its stats */
+static stats
+run(const workload *w, const policy *pol, long long n)
+{
+    stats st;
+    int fd[2];
+    pid_t pid;
+
+    memset(&st, 0, sizeof(stats));
+    if (pipe(fd) < 0 || (pid = fork()) < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        buffer a = {NULL, 0, 0, 0};
+        struct rusage ru;
+        double t0 = now();
+
+        close(fd[0]);
+        w->run(&a, n, pol, &st);
+        st.time = now() - t0;
+        free(a.ob_item);
+        getrusage(RUSAGE_SELF, &ru);
+        st.rss = ru.ru_maxrss;
+        if (write(fd[1], &st, sizeof(stats)) != sizeof(stats))
+            _exit(1);
+        _exit(0);
+    }
+    close(fd[1]);
+    if (read(fd[0], &st, sizeof(stats)) != sizeof(stats)) {
+        fprintf(stderr, "child failed\n");
+        exit(1);
+    }
+    close(fd[0]);
+    waitpid(pid, NULL, 0);
+    return st;
+}
+
+int main(int argc, char *argv[])
+{
+    long long n = argc > 1 ? atoll(argv[1]) : 1LL << 26;
+    const workload *w;
+    const policy *pol;
+    stats st;
+
+    printf("%lld bits (%lld bytes)\n", n, BYTES(n));
+    for (w = workloads; w->name; w++) {
+        printf("\n%-10s %10s %10s %8s %12s %12s %10s %8s\n", w->name,
+               "resize", "realloc", "moved", "copied", "peak", "rss",
+               "time");
+        for (pol = policies; pol->name; pol++) {
+            st = run(w, pol, n);
+            printf("  %-8s %10lld %10lld %8lld %12lld %12lld %10lld %8.4f\n",
+                   pol->name, st.resize, st.realloc, st.moved, st.copied,
+                   st.peak, st.rss, st.time);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,89 @@
+"""
+Measure the allocation cost of the real bitarray extension, for the same
+workloads as harness.c: append, extend, frombytes (in chunks) and shrink.
+
+The PyMem allocator is hooked by the memhook extension (make memhook),
+which counts the calls to realloc, how often the buffer moved and how many
+bytes were copied.  Each workload runs in a separate process, such that
+the peak resident memory can be attributed to it.
+
+Usage: python measure.py [NBITS]
+"""
+from __future__ import division, print_function
+
+import sys
+import json
+import subprocess
+from random import randint, seed
+from time import time
+
+from bitarray import bitarray
+
+
+def work_append(n):
+    a = bitarray()
+    append = a.append
+    for _ in range(n):
+        append(1)
+    return a
+
+def work_extend(n):
+    seed(12345)
+    chunks = [bitarray(k) for k in range(1, 1025)]
+    a = bitarray()
+    while len(a) < n:
+        a.extend(chunks[randint(0, 1023)])
+    return a
+
+def work_frombytes(n):
+    chunk = 4096 * b'\xff'
+    a = bitarray()
+    while len(a) < n:
+        a.frombytes(chunk)
+    return a
+
+def work_shrink(n):
+    a = bitarray(n)
+    while a:
+        del a[-64:]
+    return a
+
+WORKLOADS = ['append', 'extend', 'frombytes', 'shrink']
+
+
+def child(name, n):
+    import resource
+    import memhook
+
+    func = globals()['work_' + name]
+    memhook.start()
+    t0 = time()
+    func(n)
+    dt = time() - t0
+    memhook.stop()
+    st = memhook.stats()
+    st['time'] = dt
+    st['rss'] = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    print(json.dumps(st))
+
+
+def main():
+    if len(sys.argv) == 4 and sys.argv[1] == '--child':
+        child(sys.argv[2], int(sys.argv[3]))
+        return
+    n = int(sys.argv[1]) if len(sys.argv) > 1 else 1 << 26
+
+    print('%d bits (%d bytes)\n' % (n, n // 8))
+    fmt = '%-10s %10s %8s %12s %12s %10s %8s'
+    print(fmt % ('workload', 'realloc', 'moved', 'copied', 'peak', 'rss',
+                 'time'))
+    for name in WORKLOADS:
+        out = subprocess.check_output([sys.executable, __file__, '--child',
+                                       name, str(n)])
+        st = json.loads(out.decode())
+        print(fmt % (name, st['realloc'], st['moved'], st['copied'],
+                     st['peak'], st['rss'], '%.4f' % st['time']))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,206 @@
+/*
+   Extension module which hooks the PyMem allocator (PYMEM_DOMAIN_MEM,
+   i.e. PyMem_Malloc(), PyMem_Realloc() and PyMem_Free()), in order to
+   count the calls and bytes copied by realloc.  The bitarray buffers are
+   allocated using these functions, whereas Python objects themselves are
+   allocated in another domain (PYMEM_DOMAIN_OBJ), so while the hook is
+   installed, the counts are dominated by the bitarray buffers.
+
+   Used by measure.py, requires Python 3.5 or higher.
+*/
+#define PY_SSIZE_T_CLEAN
+#include "Python.h"
+
+#if PY_VERSION_HEX < 0x03050000
+#error "Python 3.5 or higher required"
+#endif
+
+static PyMemAllocatorEx orig;
+static int installed = 0;
+
+static struct {
+    long long malloc, calloc, realloc, free, moved, copied;
+    long long live, peak;    /* bytes of known blocks */
+} st;
+
+/* The sizes of the blocks allocated while the hook is installed are kept
+   in a hash table (open addressing with linear probing), such that
+   realloc knows how many bytes are copied when the block is moved.
+   Blocks which were allocated before are unknown, and counted as 0 bytes.
+*/
+#define TABLE_SIZE  (1 << 20)
+
+typedef struct {
+    void *ptr;
+    size_t size;
+} entry;
+
+static entry *table = NULL;
+
+static size_t
+slot(void *ptr)
+{
+    return (((size_t) ptr) >> 4) * 2654435761u % TABLE_SIZE;
+}
+
+static void
+table_add(void *ptr, size_t size)
+{
+    size_t i = slot(ptr), n;
+
+    for (n = 0; n < TABLE_SIZE; n++, i = (i + 1) % TABLE_SIZE) {
+        if (table[i].ptr == NULL) {
+            table[i].ptr = ptr;
+            table[i].size = size;
+            st.live += size;
+            if (st.live > st.peak)
+                st.peak = st.live;
+            return;
+        }
+    }
+    /* table full - the block stays unknown */
+}
+
+/* remove ptr from table and return its size (0 when unknown) */
+static size_t
+table_pop(void *ptr)
+{
+    size_t i = slot(ptr), j, k, n, size;
+
+    for (n = 0; n < TABLE_SIZE; n++, i = (i + 1) % TABLE_SIZE) {
+        if (table[i].ptr == NULL)
+            return 0;
+        if (table[i].ptr == ptr)
+            break;
+    }
+    if (n == TABLE_SIZE)
+        return 0;
+    size = table[i].size;
+    st.live -= size;
+    /* backward shift deletion, such that no probe sequence is broken */
+    for (j = (i + 1) % TABLE_SIZE; table[j].ptr; j = (j + 1) % TABLE_SIZE) {
+        k = slot(table[j].ptr);
+        if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+            table[i] = table[j];
+            i = j;
+        }
+    }
+    table[i].ptr = NULL;
+    return size;
+}
+
+static void *
+hook_malloc(void *ctx, size_t size)
+{
+    void *ptr = orig.malloc(orig.ctx, size);
+
+    st.malloc++;
+    if (ptr)
+        table_add(ptr, size);
+    return ptr;
+}
+
+static void *
+hook_calloc(void *ctx, size_t nelem, size_t elsize)
+{
+    void *ptr = orig.calloc(orig.ctx, nelem, elsize);
+
+    st.calloc++;
+    if (ptr)
+        table_add(ptr, nelem * elsize);
+    return ptr;
+}
+
+static void *
+hook_realloc(void *ctx, void *ptr, size_t size)
+{
+    size_t oldsize = ptr ? table_pop(ptr) : 0;
+    void *new = orig.realloc(orig.ctx, ptr, size);
+
+    st.realloc++;
+    if (new == NULL) {
+        if (ptr && oldsize)
+            table_add(ptr, oldsize);
+        return NULL;
+    }
+    if (ptr && new != ptr) {
+        st.moved++;
+        st.copied += oldsize < size ? oldsize : size;
+    }
+    table_add(new, size);
+    return new;
+}
+
+static void
+hook_free(void *ctx, void *ptr)
+{
+    st.free++;
+    if (ptr)
+        table_pop(ptr);
+    orig.free(orig.ctx, ptr);
+}
+
+static PyObject *
+start(PyObject *self)
+{
+    PyMemAllocatorEx hook = {NULL, hook_malloc, hook_calloc, hook_realloc,
+                             hook_free};
+
+    if (installed) {
+        PyErr_SetString(PyExc_RuntimeError, "hook already installed");
+        return NULL;
+    }
+    if (table == NULL && (table = calloc(TABLE_SIZE, sizeof(entry))) == NULL)
+        return PyErr_NoMemory();
+    memset(&st, 0, sizeof(st));
+    PyMem_GetAllocator(PYMEM_DOMAIN_MEM, &orig);
+    PyMem_SetAllocator(PYMEM_DOMAIN_MEM, &hook);
+    installed = 1;
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+stop(PyObject *self)
+{
+    if (installed) {
+        /* blocks still in the table are freed by the original allocator,
+           so we can simply forget about them */
+        PyMem_SetAllocator(PYMEM_DOMAIN_MEM, &orig);
+        memset(table, 0, TABLE_SIZE * sizeof(entry));
+        installed = 0;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+stats(PyObject *self)
+{
+    return Py_BuildValue("{sLsLsLsLsLsLsL}",
+                         "malloc", st.malloc,
+                         "calloc", st.calloc,
+                         "realloc", st.realloc,
+                         "free", st.free,
+                         "moved", st.moved,
+                         "copied", st.copied,
+                         "peak", st.peak);
+}
+
+static PyMethodDef methods[] = {
+    {"start", (PyCFunction) start, METH_NOARGS,
+     "install hook and reset counters"},
+    {"stop",  (PyCFunction) stop,  METH_NOARGS,
+     "restore original allocator"},
+    {"stats", (PyCFunction) stats, METH_NOARGS,
+     "return dict of counters"},
+    {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef moduledef = {
+    PyModuleDef_HEAD_INIT, "memhook", 0, -1, methods,
+};
+
+PyMODINIT_FUNC
+PyInit_memhook(void)
+{
+    return PyModule_Create(&moduledef);
+}
@@ -0,0 +1,149 @@
+/*
+   Benchmarks the bit kernels of bitkernels.h directly, i.e. without the
+   overhead of the Python interpreter and bitarray objects, for both bit
+   endiannesses.  The byte kernels are selected according to the CPU,
+   like the _bitarray module does on import.  For each kernel, the best
+   time of several repetitions is reported, along with the throughput in
+   Mbit/s.
+
+   Usage: ./bench [NBITS]
+*/
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include "bitkernels.h"
+
+static double
+best_time(const std::function<void()> &f, int repeat = 5)
+{
+    double best = 1e9;
+
+    for (int k = 0; k < repeat; k++) {
+        const auto t0 = std::chrono::steady_clock::now();
+        f();
+        const std::chrono::duration<double> dt =
+            std::chrono::steady_clock::now() - t0;
+        if (dt.count() < best)
+            best = dt.count();
+    }
+    return best;
+}
+
+static void
+report(const char *endian, const char *name, bk_idx_t nbits, double t)
+{
+    std::printf("%-8s %-16s %12.6f %12.1f\n", endian, name, t,
+                1e-6 * (double) nbits / t);
+}
+
+/* volatile sink, such that the results are not optimized away */
+static volatile bk_idx_t sink;
+
+static bk_kernels kernels;
+
+static void
+run(bk_idx_t nbits, int endian)
+{
+    const char *ename = endian == BK_ENDIAN_LITTLE ? "little" : "big";
+    std::vector<char> data(BK_BYTES(nbits) + 1), data2(BK_BYTES(nbits) + 1);
+    std::mt19937_64 rng(12345);
+    bk_span a = {data.data(), nbits, endian};
+    bk_span b = {data2.data(), nbits, endian};
+    bk_span c = {data2.data(), nbits, 1 - endian};
+
+    for (auto &x : data)
+        x = (char) rng();
+
+    report(ename, "count", nbits, best_time([&] {
+        sink = bk_count(&kernels, &a, 1, nbits);
+    }));
+    /* the only 1 bit is at the end, such that all bytes are skipped */
+    bk_setrange(&b, 0, nbits, 0);
+    bk_setbit(&b, nbits - 1, 1);
+    report(ename, "findfirst", nbits, best_time([&] {
+        sink = bk_findfirst(&kernels, &b, 1, 0, nbits);
+    }));
+    report(ename, "setrange", nbits, best_time([&] {
+        bk_setrange(&b, 1, nbits, 1);
+    }));
+    report(ename, "copy aligned", nbits, best_time([&] {
+        sink = bk_copy(&kernels, &b, 0, &a, 0, nbits);
+    }));
+    report(ename, "copy unaligned", nbits, best_time([&] {
+        sink = bk_copy(&kernels, &b, 1, &a, 0, nbits - 1);
+    }));
+    report(ename, "copy other", nbits, best_time([&] {
+        sink = bk_copy(&kernels, &c, 0, &a, 0, nbits);
+    }));
+
+    /* search a pattern which does not occur in a span of 0 bits (with a
+       single 1 bit at the end) */
+    {
+        char xbuf[1] = {0};
+        bk_span x = {xbuf, 8, endian};
+
+        bk_setbit(&x, 7, 1);
+        bk_setbit(&x, 6, 1);
+        bk_setrange(&b, 0, nbits, 0);
+        bk_setbit(&b, nbits - 1, 1);
+        report(ename, "search", nbits / 8, best_time([&] {
+            bk_span s = {b.buf, nbits / 8, endian};
+            sink = bk_search(&s, &x, 0);
+        }));
+    }
+
+    /* decode using the prefix code {a: 0, b: 10, c: 11} */
+    {
+        static char symbols[] = "abc";
+        bk_node leaves[3] = {{{nullptr, nullptr}, symbols},
+                             {{nullptr, nullptr}, symbols + 1},
+                             {{nullptr, nullptr}, symbols + 2}};
+        bk_node inner = {{&leaves[1], &leaves[2]}, nullptr};
+        bk_node tree = {{&leaves[0], &inner}, nullptr};
+
+        report(ename, "decode", nbits, best_time([&] {
+            const bk_node *leaf;
+            bk_idx_t p = 0, n = 0;
+
+            while (bk_decode_next(&tree, &a, &p, &leaf) == 1)
+                n++;
+            sink = n;
+        }));
+    }
+
+    {
+        std::vector<bk_word_t> w(BK_WORDS(nbits) + 1);
+
+        report(ename, "load_words", nbits, best_time([&] {
+            bk_load_words(&a, 3, nbits - 3, w.data());
+        }));
+        report(ename, "store_words", nbits, best_time([&] {
+            bk_store_words(&b, 3, nbits - 3, w.data());
+        }));
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const bk_idx_t nbits = argc > 1 ? std::atoll(argv[1]) : 1LL << 26;
+
+    if (nbits < 64) {
+        std::fprintf(stderr, "at least 64 bits required\n");
+        return 1;
+    }
+    const char *names[BK_NKERNELS];
+
+    bk_select_kernels(&kernels, bk_detect_cpu_features(), names);
+    std::printf("%lld bits, byte kernels: count=%s bitwise=%s "
+                "invert=%s skip=%s shift=%s\n", nbits, names[0], names[1],
+                names[2], names[3], names[4]);
+    std::printf("%-8s %-16s %12s %12s\n", "endian", "kernel", "time [s]",
+                "Mbit/s");
+    run(nbits, BK_ENDIAN_LITTLE);
+    run(nbits, BK_ENDIAN_BIG);
+    return 0;
+}
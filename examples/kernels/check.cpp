@@ -0,0 +1,361 @@
+/*
+   Checks the bit kernels of bitkernels.h against naive implementations,
+   on random spans of both bit endiannesses and at all bit offsets.  The
+   byte kernels are checked for each ISA level, as far as the features of
+   the CPU allow (the selected kernels are printed first).  This also
+   ensures that the header compiles as C++.
+
+   Usage: ./check [ROUNDS]
+*/
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "bitkernels.h"
+
+static std::mt19937_64 rng(12345);
+static int failures = 0;
+
+/* the byte kernels selected for each ISA level */
+static std::vector<bk_kernels> tables;
+
+#define CHECK(cond)  do {                                              \
+    if (!(cond)) {                                                    \
+        std::printf("%s:%d: check failed: %s\n", __FILE__, __LINE__,  \
+                    #cond);                                           \
+        failures++;                                                   \
+    }                                                                 \
+} while (0)
+
+/* random integer in [a, b] */
+static bk_idx_t
+randint(bk_idx_t a, bk_idx_t b)
+{
+    return std::uniform_int_distribution<bk_idx_t>(a, b)(rng);
+}
+
+/* a bk_span together with its buffer */
+struct span {
+    std::vector<char> data;
+    bk_span s;
+
+    span(bk_idx_t nbits, int endian, double p = 0.5)
+        : data(BK_BYTES(nbits) + 1)
+    {
+        std::bernoulli_distribution bit(p);
+
+        s.buf = data.data();
+        s.nbits = nbits;
+        s.endian = endian;
+        for (bk_idx_t i = 0; i < nbits; i++)
+            bk_setbit(&s, i, bit(rng));
+    }
+    span(const span &other) : data(other.data), s(other.s)
+    {
+        s.buf = data.data();
+    }
+    span &operator=(const span &) = delete;
+
+    int operator[](bk_idx_t i) const { return bk_getbit(&s, i); }
+};
+
+static span
+random_span(bk_idx_t maxbits)
+{
+    return span(randint(0, maxbits), (int) randint(0, 1),
+                randint(0, 3) ? 0.5 : 0.02);
+}
+
+static void
+check_tables()
+{
+    for (int k = 0; k < 256; k++) {
+        int r = 0, c = 0;
+
+        for (int j = 0; j < 8; j++) {
+            if (k & (1 << j)) {
+                r |= 1 << (7 - j);
+                c++;
+            }
+        }
+        CHECK(bk_reverse_trans[k] == r);
+        CHECK(bk_bitcount_lookup[k] == c);
+    }
+}
+
+static void
+check_count_find()
+{
+    span a = random_span(500);
+    const bk_idx_t n = a.s.nbits;
+    const bk_idx_t start = randint(0, n), stop = randint(0, n);
+    const int vi = (int) randint(0, 1);
+    bk_idx_t res = 0, first = -1;
+
+    for (bk_idx_t i = start; i < stop; i++) {
+        res += a[i];
+        if (first < 0 && a[i] == vi)
+            first = i;
+    }
+    for (const bk_kernels &k : tables) {
+        CHECK(bk_count(&k, &a.s, start, stop) == res);
+        CHECK(bk_findfirst(&k, &a.s, vi, start, stop) == first);
+    }
+}
+
+static void
+check_setrange()
+{
+    span a = random_span(500);
+    const span b = a;
+    const bk_idx_t n = a.s.nbits;
+    const bk_idx_t start = randint(0, n), stop = randint(0, n);
+    const int vi = (int) randint(0, 1);
+
+    bk_setrange(&a.s, start, stop, vi);
+    for (bk_idx_t i = 0; i < n; i++)
+        CHECK(a[i] == (start <= i && i < stop ? vi : b[i]));
+}
+
+static void
+check_copy(const bk_kernels *k)
+{
+    span a = random_span(500);
+    const span b = random_span(500);
+    bk_idx_t n = randint(0, std::min(a.s.nbits, b.s.nbits));
+    bk_idx_t p = randint(0, a.s.nbits - n), q = randint(0, b.s.nbits - n);
+    span c = a;
+
+    bk_copy(k, &c.s, p, &b.s, q, n);
+    for (bk_idx_t i = 0; i < a.s.nbits; i++)
+        CHECK(c[i] == (p <= i && i < p + n ? b[i - p + q] : a[i]));
+
+    /* onto itself, where the ranges may overlap */
+    n = randint(0, a.s.nbits);
+    p = randint(0, a.s.nbits - n);
+    q = randint(0, a.s.nbits - n);
+    span d = a;
+    bk_copy(k, &d.s, p, &d.s, q, n);
+    for (bk_idx_t i = 0; i < a.s.nbits; i++)
+        CHECK(d[i] == (p <= i && i < p + n ? a[i - p + q] : a[i]));
+}
+
+static void
+check_search()
+{
+    const span a = random_span(300);
+    const span x(randint(1, 6), (int) randint(0, 1));
+    const span mask(x.s.nbits, (int) randint(0, 1));
+    const bk_idx_t m = x.s.nbits, p = randint(0, a.s.nbits);
+    bk_idx_t res = -1, res_masked = -1;
+
+    for (bk_idx_t i = p; i + m <= a.s.nbits; i++) {
+        bool match = true, match_masked = true;
+
+        for (bk_idx_t j = 0; j < m; j++) {
+            if (a[i + j] != x[j]) {
+                match = false;
+                if (mask[j])
+                    match_masked = false;
+            }
+        }
+        if (res < 0 && match)
+            res = i;
+        if (res_masked < 0 && match_masked)
+            res_masked = i;
+    }
+    CHECK(bk_search(&a.s, &x.s, p) == res);
+    CHECK(bk_search_masked(&a.s, &x.s, &mask.s, p) == res_masked);
+}
+
+static void
+check_words()
+{
+    const span a = random_span(500);
+    const bk_idx_t n = randint(0, a.s.nbits);
+    const bk_idx_t start = randint(0, a.s.nbits - n);
+    std::vector<bk_word_t> w(BK_WORDS(n) + 1);
+    span b(a.s.nbits, 1 - a.s.endian);
+
+    bk_load_words(&a.s, start, n, w.data());
+    for (bk_idx_t i = 0; i < n; i++)
+        CHECK(BK_WGET(w.data(), i) == a[start + i]);
+    if (n % BK_WBITS)
+        CHECK(w[n / BK_WBITS] >> (n % BK_WBITS) == 0);
+
+    bk_store_words(&b.s, start, n, w.data());
+    for (bk_idx_t i = 0; i < n; i++)
+        CHECK(b[start + i] == a[start + i]);
+}
+
+static void
+check_count_op()
+{
+    const bk_idx_t nbytes = randint(0, 3000);
+    const span a(BK_BITS(nbytes), BK_ENDIAN_LITTLE);
+    const span b(BK_BITS(nbytes), BK_ENDIAN_BIG);
+    const enum bk_op ops[3] = {BK_AND, BK_OR, BK_XOR};
+
+    for (enum bk_op oper : ops) {
+        bk_idx_t res = 0;
+
+        for (bk_idx_t i = 0; i < nbytes; i++) {
+            unsigned char x = a.data[i], y = b.data[i];
+
+            res += bk_bitcount_lookup[oper == BK_AND ? x & y :
+                                      oper == BK_OR ? x | y : x ^ y];
+        }
+        for (const bk_kernels &k : tables)
+            CHECK(bk_count_op(&k, a.s.buf, b.s.buf, nbytes, oper) == res);
+    }
+}
+
+static void
+select_tables()
+{
+    const int features = bk_detect_cpu_features();
+
+    for (int k = 0; bk_isa_levels[k].name; k++) {
+        const char *names[BK_NKERNELS];
+        bk_kernels t;
+
+        bk_select_kernels(&t, features & bk_isa_levels[k].features, names);
+        tables.push_back(t);
+        std::printf("%-8s", bk_isa_levels[k].name);
+        for (const char *name : names)
+            std::printf(" %-8s", name);
+        std::printf("\n");
+    }
+}
+
+/* the byte kernels of k on n bytes (at unaligned positions) */
+static void
+check_byte_kernels(const bk_kernels *k)
+{
+    const bk_idx_t n = randint(0, 300);
+    const bk_idx_t p = randint(0, 7), q = randint(0, 7);
+    std::vector<char> a(n + 8), b(n + 8);
+    const enum bk_op ops[3] = {BK_AND, BK_OR, BK_XOR};
+    bk_idx_t res = 0;
+
+    for (auto &x : a)
+        x = (char) rng();
+    for (auto &x : b)
+        x = (char) rng();
+
+    for (bk_idx_t i = 0; i < n; i++)
+        res += bk_bitcount_lookup[(unsigned char) a[p + i]];
+    CHECK(k->count(a.data() + p, n) == res);
+
+    for (enum bk_op oper : ops) {
+        std::vector<char> c(a);
+
+        k->bitwise(c.data() + p, b.data() + q, n, oper);
+        for (bk_idx_t i = 0; i < n + 8; i++) {
+            const char x = a[i];
+
+            if (i < p || i >= p + n) {
+                CHECK(c[i] == x);
+                continue;
+            }
+            const char y = b[i - p + q];
+            CHECK(c[i] == (oper == BK_AND ? (char) (x & y) :
+                           oper == BK_OR ? (char) (x | y) : (char) (x ^ y)));
+        }
+    }
+
+    std::vector<char> c(a);
+    k->invert(c.data() + p, n);
+    for (bk_idx_t i = 0; i < n + 8; i++)
+        CHECK(c[i] == (i < p || i >= p + n ? a[i] : (char) ~a[i]));
+
+    /* skip the first m of n bytes, which are equal to x */
+    {
+        const char x = (char) (randint(0, 1) ? 0xff : 0x00);
+        const bk_idx_t m = randint(0, n);
+        std::vector<char> d(n + 1, x);
+
+        d[m] = (char) (x ^ (1 << randint(0, 7)));
+        CHECK(k->skip(d.data(), n, x) == m);
+    }
+
+    /* shift the bytes at a + 2 onto a separate buffer, and onto the same
+       buffer at a + p, where the ranges overlap */
+    const int r = (int) randint(1, 7), endian = (int) randint(0, 1);
+    const bk_span sa = {a.data() + 2, BK_BITS(n + 1), endian};
+    for (int same = 0; same < 2; same++) {
+        std::vector<char> d(same ? a : b);
+        const bk_idx_t off = same ? p % 5 : q;
+        const bk_span sd = {d.data() + off, BK_BITS(n), endian};
+
+        k->shift(d.data() + off, same ? d.data() + 2 : a.data() + 2, n, r,
+                 endian);
+        for (bk_idx_t i = 0; i < BK_BITS(n); i++)
+            CHECK(bk_getbit(&sd, i) == bk_getbit(&sa, i + r));
+        for (bk_idx_t i = 0; i < n + 8; i++)
+            if (i < off || i >= off + n)
+                CHECK(d[i] == (same ? a : b)[i]);
+    }
+}
+
+/* decode using the prefix code {a: 0, b: 10, c: 11} */
+static void
+check_decode()
+{
+    static char symbols[] = "abc";
+    bk_node leaves[3] = {{{nullptr, nullptr}, symbols},
+                         {{nullptr, nullptr}, symbols + 1},
+                         {{nullptr, nullptr}, symbols + 2}};
+    bk_node inner = {{&leaves[1], &leaves[2]}, nullptr};
+    bk_node tree = {{&leaves[0], &inner}, nullptr};
+    const span a = random_span(300);
+    const bk_node *leaf = nullptr;
+    bk_idx_t p = 0, i = 0;
+    int res;
+
+    while ((res = bk_decode_next(&tree, &a.s, &p, &leaf)) == 1) {
+        const char sym = *(const char *) leaf->symbol;
+
+        if (a[i] == 0) {
+            CHECK(sym == 'a');
+            i++;
+        }
+        else {
+            CHECK(i + 1 < a.s.nbits);
+            CHECK(sym == (a[i + 1] ? 'c' : 'b'));
+            i += 2;
+        }
+        CHECK(p == i);
+    }
+    /* the code is complete, so decoding fails only within a code */
+    CHECK(res == (i == a.s.nbits ? 0 : -2));
+    CHECK(p == a.s.nbits);
+}
+
+int main(int argc, char *argv[])
+{
+    const int rounds = argc > 1 ? std::atoi(argv[1]) : 2000;
+
+    select_tables();
+    check_tables();
+    for (int k = 0; k < rounds; k++) {
+        for (const bk_kernels &t : tables)
+            check_byte_kernels(&t);
+        check_count_find();
+        check_setrange();
+        for (const bk_kernels &t : tables)
+            check_copy(&t);
+        check_search();
+        check_words();
+        check_count_op();
+        check_decode();
+    }
+    if (failures) {
+        std::printf("%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("all checks passed (%d rounds)\n", rounds);
+    return 0;
+}
@@ -39,9 +39,14 @@ setup(
     ],
     description = "efficient arrays of booleans -- C extension",
     packages = ["bitarray"],
+    package_data = {"bitarray": ["bitarray.h", "bitkernels.h"]},
     ext_modules = [Extension(name = "bitarray._bitarray",
-                             sources = ["bitarray/_bitarray.c"]),
+                             sources = ["bitarray/_bitarray.c"],
+                             depends = ["bitarray/bitarray.h",
+                                        "bitarray/bitkernels.h"]),
                    Extension(name = "bitarray._util",
-                             sources = ["bitarray/_util.c"])],
+                             sources = ["bitarray/_util.c"],
+                             depends = ["bitarray/bitarray.h",
+                                        "bitarray/bitkernels.h"])],
     **kwds
 )
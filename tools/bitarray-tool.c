@@ -0,0 +1,662 @@
+/*
+   Copyright (c) 2008 - 2020, Ilan Schnell
+   bitarray is published under the PSF license.
+
+   bitarray-tool: query and convert bitmap files without Python.
+
+   A bitmap file contains the buffer of a bitarray, as written by
+   .tofile(), where the bit endianness is given by the -e option (big by
+   default, like bitarray).  Input files are mapped into memory, such that
+   only the parts needed are read (the operating system streams them in),
+   and files larger than the memory can be processed.  Binary output is
+   produced and written in chunks.  The scanning commands (count, find,
+   search) and the conversions may use several threads (-j), each of which
+   processes a contiguous part of the range.  The work is done by the bit
+   kernels of bitarray/bitkernels.h, on which the extension is built as
+   well.  Like the extension, the byte kernels are selected on startup
+   according to the CPU, limited by the environment variable BITARRAY_ISA.
+
+   Requires a POSIX system (mmap and pthreads).  See usage() below.
+
+   Author: Ilan Schnell
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bitkernels.h"
+
+/* bytes converted by each thread per chunk of binary output */
+#define CHUNK  (1 << 22)
+
+/* minimal number of bits scanned by each thread */
+#define MIN_TASK_BITS  (1LL << 23)
+
+static struct {
+    int endian;                 /* bit endianness of the files */
+    bk_idx_t nbits;             /* number of bits, or -1 for whole file */
+    int vi;                     /* bit value to count or find */
+    const char *output;         /* output file, or NULL for stdout */
+    int threads;                /* number of threads */
+    bk_idx_t max;               /* maximal number of matches, or -1 */
+    int hex;                    /* dump as hex */
+} opts = {BK_ENDIAN_BIG, -1, 1, NULL, 1, -1, 0};
+
+static const char *usage_text = "\
+usage: bitarray-tool [OPTIONS] COMMAND FILE [ARGS]\n\
+\n\
+commands:\n\
+  count FILE [START [STOP]]     number of 1 bits (0 bits with -v 0)\n\
+  find FILE [START [STOP]]      index of first 1 bit (0 bit with -v 0),\n\
+                                or -1 when not found (exit status 1)\n\
+  search FILE PATTERN [START [STOP]]\n\
+                                positions of PATTERN (string of 0s and\n\
+                                1s), one per line (exit status 1 when\n\
+                                not found)\n\
+  and|or|xor FILE1 FILE2        bitwise operation of two bitmaps of equal\n\
+                                length\n\
+  endian FILE                   convert bitmap to the other bit endianness\n\
+  dump FILE [START [STOP]]      print bits as 0s and 1s (or hex with -x),\n\
+                                preceded by the index of the first bit of\n\
+                                each line\n\
+\n\
+START and STOP are bit indices, negative values count from the end.\n\
+Errors result in exit status 2.\n\
+\n\
+options:\n\
+  -e ENDIAN     bit endianness of the files: big (default) or little\n\
+  -n NBITS      number of bits (default: 8 times the file size)\n\
+  -v BIT        bit value to count or find (default: 1)\n\
+  -o FILE       output file (default: standard output)\n\
+  -j N          number of threads (default: 1)\n\
+  -m MAX        stop after MAX matches (search)\n\
+  -x            dump as hex, 4 bits per digit like util.ba2hex()\n\
+  -h            show this help\n\
+\n\
+The environment variable BITARRAY_ISA limits the kernels used to an ISA\n\
+level: generic, popcnt, avx2 or avx512 (default: best for the CPU).\n";
+
+static void
+usage(void)
+{
+    fputs(usage_text, stderr);
+    exit(2);
+}
+
+static void
+fail(const char *fmt, ...)
+{
+    va_list ap;
+
+    fputs("bitarray-tool: ", stderr);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    exit(2);
+}
+
+static void *
+xmalloc(size_t size)
+{
+    void *p = malloc(size ? size : 1);
+
+    if (p == NULL)
+        fail("out of memory");
+    return p;
+}
+
+static bk_idx_t
+parse_int(const char *arg, const char *what)
+{
+    char *end;
+    bk_idx_t i;
+
+    errno = 0;
+    i = strtoll(arg, &end, 10);
+    if (errno || end == arg || *end)
+        fail("invalid %s: %s", what, arg);
+    return i;
+}
+
+/* parse index, which is normalized (like a slice index in Python), such
+   that 0 <= i <= n */
+static bk_idx_t
+parse_index(const char *arg, bk_idx_t n)
+{
+    bk_idx_t i = parse_int(arg, "index");
+
+    if (i < 0) {
+        i += n;
+        if (i < 0)
+            i = 0;
+    }
+    if (i > n)
+        i = n;
+    return i;
+}
+
+/* parse the optional arguments START and STOP (an empty range when STOP
+   is before START) */
+static void
+parse_range(int argc, char *argv[], bk_idx_t n,
+            bk_idx_t *start, bk_idx_t *stop)
+{
+    if (argc > 2)
+        usage();
+    *start = argc > 0 ? parse_index(argv[0], n) : 0;
+    *stop = argc > 1 ? parse_index(argv[1], n) : n;
+    if (*stop < *start)
+        *stop = *start;
+}
+
+/* ------------------------------- files ------------------------------- */
+
+/* map the file at path (read only), and return the bk_span of its bits */
+static bk_span
+map_file(const char *path)
+{
+    struct stat st;
+    bk_span s;
+    void *p;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0)
+        fail("%s: %s", path, strerror(errno));
+    if (!S_ISREG(st.st_mode))
+        fail("%s: not a regular file", path);
+
+    s.buf = NULL;
+    if (st.st_size > 0) {
+        p = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED)
+            fail("%s: %s", path, strerror(errno));
+        madvise(p, (size_t) st.st_size, MADV_SEQUENTIAL);
+        s.buf = (char *) p;
+    }
+    close(fd);
+
+    s.nbits = BK_BITS(st.st_size);
+    s.endian = opts.endian;
+    if (opts.nbits >= 0) {
+        if (opts.nbits > s.nbits)
+            fail("%s: only %lld bits", path, s.nbits);
+        s.nbits = opts.nbits;
+    }
+    return s;
+}
+
+/* open the output file, binary output is never written to a terminal */
+static FILE *
+open_output(int binary)
+{
+    FILE *fo;
+
+    if (opts.output == NULL) {
+        if (binary && isatty(fileno(stdout)))
+            fail("not writing binary data to a terminal, use -o FILE");
+        return stdout;
+    }
+    fo = fopen(opts.output, binary ? "wb" : "w");
+    if (fo == NULL)
+        fail("%s: %s", opts.output, strerror(errno));
+    return fo;
+}
+
+static void
+close_output(FILE *fo)
+{
+    if (fflush(fo) != 0 || ferror(fo))
+        fail("%s: write error", opts.output ? opts.output : "stdout");
+    if (fo != stdout)
+        fclose(fo);
+}
+
+/* ------------------------------- tasks ------------------------------- */
+
+/* the part of the work done by one thread */
+typedef struct {
+    const bk_span *s;
+    bk_idx_t start, stop;       /* range of bits (or bytes) of the task */
+
+    const bk_span *x;           /* search: pattern */
+    bk_idx_t *matches;          /* search: positions found */
+    bk_idx_t nmatches, alloc;
+
+    char *dst;                  /* chunks: output buffer */
+    const char *src, *src2;     /* chunks: input of the task */
+    enum bk_op oper;
+
+    bk_idx_t res;               /* count and find: result */
+} task;
+
+/* number of threads for a range of n bits */
+static int
+nthreads(bk_idx_t n)
+{
+    bk_idx_t k = n / MIN_TASK_BITS;
+
+    if (k < 1)
+        k = 1;
+    return k < opts.threads ? (int) k : opts.threads;
+}
+
+/* split [start:stop] into n tasks (contiguous, in order), where the
+   boundaries are multiples of align */
+static task *
+split(const bk_span *s, bk_idx_t start, bk_idx_t stop, int n, bk_idx_t align)
+{
+    task *tasks = (task *) xmalloc(n * sizeof(task));
+    bk_idx_t p = start, q;
+    int k;
+
+    memset(tasks, 0, n * sizeof(task));
+    for (k = 0; k < n; k++) {
+        q = stop;
+        if (k < n - 1) {
+            q = start + (stop - start) / n * (k + 1);
+            q -= q % align;
+            if (q < p)
+                q = p;
+        }
+        tasks[k].s = s;
+        tasks[k].start = p;
+        tasks[k].stop = q;
+        p = q;
+    }
+    return tasks;
+}
+
+/* run func on each of the n tasks in its own thread, where the first task
+   runs in the calling thread */
+static void
+run_tasks(void *(*func)(void *), task *tasks, int n)
+{
+    pthread_t *tids = (pthread_t *) xmalloc(n * sizeof(pthread_t));
+    int k;
+
+    for (k = 1; k < n; k++)
+        if (pthread_create(tids + k, NULL, func, tasks + k) != 0)
+            fail("cannot create thread");
+    func(tasks);
+    for (k = 1; k < n; k++)
+        pthread_join(tids[k], NULL);
+    free(tids);
+}
+
+/* the byte kernels, see select_kernels() */
+static bk_kernels kernels;
+
+/* select the best kernels for the CPU, limited to the ISA level given by
+   the environment variable BITARRAY_ISA (like the extension does) */
+static void
+select_kernels(void)
+{
+    const char *env = getenv("BITARRAY_ISA");
+    int features = bk_detect_cpu_features(), k;
+
+    if (env != NULL && *env != '\0') {
+        if ((k = bk_find_isa_level(env)) < 0)
+            fputs("bitarray-tool: BITARRAY_ISA: unknown ISA level ignored "
+                  "(use generic, popcnt, avx2 or avx512)\n", stderr);
+        else
+            features &= bk_isa_levels[k].features;
+    }
+    bk_select_kernels(&kernels, features, NULL);
+}
+
+/* ----------------------------- commands ------------------------------ */
+
+static void *
+count_task(void *arg)
+{
+    task *t = (task *) arg;
+
+    t->res = bk_count(&kernels, t->s, t->start, t->stop);
+    return NULL;
+}
+
+static int
+cmd_count(const bk_span *s, bk_idx_t start, bk_idx_t stop)
+{
+    const int n = nthreads(stop - start);
+    task *tasks = split(s, start, stop, n, 8);
+    bk_idx_t res = 0;
+    int k;
+    FILE *fo;
+
+    run_tasks(count_task, tasks, n);
+    for (k = 0; k < n; k++)
+        res += tasks[k].res;
+    if (opts.vi == 0)
+        res = stop - start - res;
+    free(tasks);
+
+    fo = open_output(0);
+    fprintf(fo, "%lld\n", res);
+    close_output(fo);
+    return 0;
+}
+
+static void *
+find_task(void *arg)
+{
+    task *t = (task *) arg;
+
+    t->res = bk_findfirst(&kernels, t->s, opts.vi, t->start, t->stop);
+    return NULL;
+}
+
+static int
+cmd_find(const bk_span *s, bk_idx_t start, bk_idx_t stop)
+{
+    const int n = nthreads(stop - start);
+    task *tasks = split(s, start, stop, n, 8);
+    bk_idx_t res = -1;
+    int k;
+    FILE *fo;
+
+    run_tasks(find_task, tasks, n);
+    for (k = 0; k < n && res < 0; k++)
+        res = tasks[k].res;
+    free(tasks);
+
+    fo = open_output(0);
+    fprintf(fo, "%lld\n", res);
+    close_output(fo);
+    return res < 0;
+}
+
+/* Each task tests the positions [start:stop] of the pattern, such that
+   matches may extend m - 1 bits beyond stop. */
+static void *
+search_task(void *arg)
+{
+    task *t = (task *) arg;
+    bk_span s = *t->s;
+    bk_idx_t p = t->start;
+
+    s.nbits = t->stop + t->x->nbits - 1;
+    while (opts.max < 0 || t->nmatches < opts.max) {
+        if ((p = bk_search(&s, t->x, p)) < 0)
+            break;
+        if (t->nmatches == t->alloc) {
+            t->alloc = t->alloc ? 2 * t->alloc : 1024;
+            t->matches = (bk_idx_t *) realloc(t->matches,
+                                              t->alloc * sizeof(bk_idx_t));
+            if (t->matches == NULL)
+                fail("out of memory");
+        }
+        t->matches[t->nmatches++] = p++;
+    }
+    return NULL;
+}
+
+static int
+cmd_search(const bk_span *s, const char *pattern,
+           bk_idx_t start, bk_idx_t stop)
+{
+    const bk_idx_t m = (bk_idx_t) strlen(pattern);
+    char *xbuf = (char *) xmalloc(BK_BYTES(m));
+    bk_span x = {NULL, 0, BK_ENDIAN_LITTLE};
+    bk_idx_t i, found = 0;
+    task *tasks;
+    int n, k;
+    FILE *fo;
+
+    if (m == 0)
+        fail("empty pattern");
+    x.buf = xbuf;
+    x.nbits = m;
+    for (i = 0; i < m; i++) {
+        if (pattern[i] != '0' && pattern[i] != '1')
+            fail("invalid pattern: %s", pattern);
+        bk_setbit(&x, i, pattern[i] == '1');
+    }
+
+    /* the positions at which the pattern is tested */
+    if (stop - start < m)
+        stop = start;
+    else
+        stop -= m - 1;
+
+    n = nthreads(stop - start);
+    tasks = split(s, start, stop, n, 1);
+    for (k = 0; k < n; k++)
+        tasks[k].x = &x;
+    run_tasks(search_task, tasks, n);
+
+    fo = open_output(0);
+    for (k = 0; k < n; k++) {
+        for (i = 0; i < tasks[k].nmatches; i++) {
+            if (opts.max >= 0 && found >= opts.max)
+                break;
+            fprintf(fo, "%lld\n", tasks[k].matches[i]);
+            found++;
+        }
+        free(tasks[k].matches);
+    }
+    close_output(fo);
+    free(tasks);
+    free(xbuf);
+    return found == 0;
+}
+
+/* chunk task: dst = src OP src2 for the bytes [start:stop] of the chunk */
+static void *
+bitwise_task(void *arg)
+{
+    task *t = (task *) arg;
+    const bk_idx_t n = t->stop - t->start;
+
+    memcpy(t->dst + t->start, t->src + t->start, (size_t) n);
+    kernels.bitwise(t->dst + t->start, t->src2 + t->start, n, t->oper);
+    return NULL;
+}
+
+/* chunk task: dst = src with the bits of each byte reversed */
+static void *
+endian_task(void *arg)
+{
+    task *t = (task *) arg;
+    bk_idx_t i;
+
+    for (i = t->start; i < t->stop; i++)
+        t->dst[i] = bk_reverse_trans[(unsigned char) t->src[i]];
+    return NULL;
+}
+
+/* Write the bits of a (with the bit endianness of out_endian) which are
+   produced by func from a (and b, when not NULL) in chunks, using tasks
+   which each get a part of the chunk. */
+static int
+write_chunks(void *(*func)(void *), enum bk_op oper,
+             const bk_span *a, const bk_span *b, int out_endian)
+{
+    const bk_idx_t nbytes = BK_BYTES(a->nbits);
+    bk_span chunk;
+    bk_idx_t i, size;
+    task *tasks;
+    FILE *fo;
+    char *buf;
+    int n, k;
+
+    /* number of chunks processed at once, no more than the input has */
+    n = opts.threads;
+    if ((nbytes + CHUNK - 1) / CHUNK < n)
+        n = (int) ((nbytes + CHUNK - 1) / CHUNK);
+    if (n < 1)
+        n = 1;
+    buf = (char *) xmalloc((size_t) n * CHUNK);
+
+    fo = open_output(1);
+    for (i = 0; i < nbytes; i += size) {
+        size = nbytes - i;
+        if (size > (bk_idx_t) n * CHUNK)
+            size = (bk_idx_t) n * CHUNK;
+
+        tasks = split(NULL, 0, size, n, 1);
+        for (k = 0; k < n; k++) {
+            tasks[k].dst = buf;
+            tasks[k].src = a->buf + i;
+            tasks[k].src2 = b ? b->buf + i : NULL;
+            tasks[k].oper = oper;
+        }
+        run_tasks(func, tasks, n);
+        free(tasks);
+
+        if (i + size == nbytes) {
+            /* set the padding bits of the last byte to 0 */
+            chunk.buf = buf;
+            chunk.nbits = BK_BITS(size);
+            chunk.endian = out_endian;
+            bk_setrange(&chunk, a->nbits - BK_BITS(i), BK_BITS(size), 0);
+        }
+        if (fwrite(buf, 1, (size_t) size, fo) != (size_t) size)
+            break;
+    }
+    close_output(fo);
+    free(buf);
+    return 0;
+}
+
+static int
+cmd_bitwise(enum bk_op oper, const bk_span *a, const bk_span *b)
+{
+    if (a->nbits != b->nbits)
+        fail("bitmaps of equal length expected, got %lld and %lld bits",
+             a->nbits, b->nbits);
+    return write_chunks(bitwise_task, oper, a, b, a->endian);
+}
+
+static int
+cmd_dump(const bk_span *s, bk_idx_t start, bk_idx_t stop)
+{
+    /* bits per line */
+    const bk_idx_t width = opts.hex ? 256 : 64;
+    FILE *fo;
+    bk_idx_t i;
+    int k, x;
+
+    if (opts.hex && (stop - start) % 4)
+        fail("hex dump requires a multiple of 4 bits, got %lld",
+             stop - start);
+
+    fo = open_output(0);
+    for (i = start; i < stop; i += opts.hex ? 4 : 1) {
+        if ((i - start) % width == 0)
+            fprintf(fo, "%s%12lld  ", i == start ? "" : "\n", i);
+        if (!opts.hex) {
+            putc(bk_getbit(s, i) ? '1' : '0', fo);
+            continue;
+        }
+        /* the first bit is the most significant bit of the digit for
+           big-endian, and the least significant bit for little-endian */
+        for (x = k = 0; k < 4; k++)
+            x |= bk_getbit(s, i + k) << (s->endian == BK_ENDIAN_LITTLE ?
+                                            k : 3 - k);
+        putc("0123456789abcdef"[x], fo);
+    }
+    if (stop > start)
+        putc('\n', fo);
+    close_output(fo);
+    return 0;
+}
+
+/* -------------------------------- main ------------------------------- */
+
+int main(int argc, char *argv[])
+{
+    const char *cmd;
+    bk_span a, b;
+    bk_idx_t start, stop;
+    int c;
+
+    while ((c = getopt(argc, argv, "+e:n:v:o:j:m:xh")) != -1) {
+        switch (c) {
+        case 'e':
+            if (strcmp(optarg, "big") == 0)
+                opts.endian = BK_ENDIAN_BIG;
+            else if (strcmp(optarg, "little") == 0)
+                opts.endian = BK_ENDIAN_LITTLE;
+            else
+                fail("bit endianness must be 'big' or 'little', got: %s",
+                     optarg);
+            break;
+        case 'n':
+            opts.nbits = parse_int(optarg, "number of bits");
+            if (opts.nbits < 0)
+                fail("number of bits cannot be negative");
+            break;
+        case 'v':
+            if (strcmp(optarg, "0") && strcmp(optarg, "1"))
+                fail("bit value must be 0 or 1, got: %s", optarg);
+            opts.vi = optarg[0] == '1';
+            break;
+        case 'o':
+            opts.output = optarg;
+            break;
+        case 'j':
+            opts.threads = (int) parse_int(optarg, "number of threads");
+            if (opts.threads < 1 || opts.threads > 1024)
+                fail("number of threads must be in range(1, 1025)");
+            break;
+        case 'm':
+            opts.max = parse_int(optarg, "maximal number of matches");
+            if (opts.max < 0)
+                fail("maximal number of matches cannot be negative");
+            break;
+        case 'x':
+            opts.hex = 1;
+            break;
+        default:
+            usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc < 2)
+        usage();
+    cmd = argv[0];
+    select_kernels();
+    a = map_file(argv[1]);
+
+    if (strcmp(cmd, "count") == 0 || strcmp(cmd, "find") == 0 ||
+            strcmp(cmd, "dump") == 0) {
+        parse_range(argc - 2, argv + 2, a.nbits, &start, &stop);
+        if (cmd[0] == 'c')
+            return cmd_count(&a, start, stop);
+        if (cmd[0] == 'f')
+            return cmd_find(&a, start, stop);
+        return cmd_dump(&a, start, stop);
+    }
+    if (strcmp(cmd, "search") == 0) {
+        if (argc < 3)
+            usage();
+        parse_range(argc - 3, argv + 3, a.nbits, &start, &stop);
+        return cmd_search(&a, argv[2], start, stop);
+    }
+    if (strcmp(cmd, "and") == 0 || strcmp(cmd, "or") == 0 ||
+            strcmp(cmd, "xor") == 0) {
+        if (argc != 3)
+            usage();
+        b = map_file(argv[2]);
+        return cmd_bitwise(cmd[0] == 'a' ? BK_AND :
+                           (cmd[0] == 'o' ? BK_OR : BK_XOR), &a, &b);
+    }
+    if (strcmp(cmd, "endian") == 0) {
+        if (argc != 2)
+            usage();
+        return write_chunks(endian_task, BK_AND, &a, NULL, 1 - a.endian);
+    }
+    usage();
+    return 2;
+}
@@ -0,0 +1,201 @@
+"""
+Tests for bitarray-tool, which compare its output with the results of
+the bitarray methods on the same data.  Run using: make test-tool
+"""
+from __future__ import print_function
+
+import os
+import sys
+import shutil
+import tempfile
+import unittest
+import subprocess
+from random import randint
+
+from bitarray import bitarray
+from bitarray.util import ba2hex
+
+
+TOOL = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                    'bitarray-tool')
+
+
+def urandom(n, endian='big'):
+    a = bitarray(0, endian)
+    a.frombytes(os.urandom((n + 7) // 8))
+    del a[n:]
+    return a
+
+
+class ToolTests(unittest.TestCase):
+
+    def setUp(self):
+        self.tmpdir = tempfile.mkdtemp()
+
+    def tearDown(self):
+        shutil.rmtree(self.tmpdir)
+
+    def write(self, a, name='a.bin'):
+        path = os.path.join(self.tmpdir, name)
+        with open(path, 'wb') as fo:
+            a.tofile(fo)
+        return path
+
+    def run_tool(self, a, *args, **kwds):
+        opts = ['-e', a.endian(), '-n', str(len(a))]
+        opts.extend(kwds.get('opts', []))
+        env = dict(os.environ)
+        env.update(kwds.get('env', {}))
+        p = subprocess.Popen([TOOL] + [str(x) for x in opts + list(args)],
+                             stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                             env=env)
+        out, err = p.communicate()
+        status = kwds.get('status', 0)
+        if status is not None:
+            self.assertEqual(p.returncode, status, err)
+        if 'stderr' in kwds:
+            kwds['stderr'].append(err.decode())
+        return out.decode()
+
+    def randombitarrays(self):
+        for n in list(range(20)) + [randint(20, 2000) for _ in range(20)]:
+            yield urandom(n, endian=['little', 'big'][randint(0, 1)])
+
+    def random_range(self, n):
+        start, stop = randint(-n - 3, n + 3), randint(-n - 3, n + 3)
+        return start, stop, slice(start, stop)
+
+    def test_count(self):
+        for a in self.randombitarrays():
+            path = self.write(a)
+            self.assertEqual(int(self.run_tool(a, 'count', path)), a.count())
+            start, stop, s = self.random_range(len(a))
+            for vi in 0, 1:
+                self.assertEqual(
+                    int(self.run_tool(a, 'count', path, start, stop,
+                                      opts=['-v', vi])),
+                    a[s].count(vi))
+
+    def test_find(self):
+        for a in self.randombitarrays():
+            path = self.write(a)
+            start, stop, s = self.random_range(len(a))
+            for vi in 0, 1:
+                b = a[s]
+                res = b.index(vi) + s.indices(len(a))[0] if vi in b else -1
+                out = self.run_tool(a, 'find', path, start, stop,
+                                    opts=['-v', vi], status=int(res < 0))
+                self.assertEqual(int(out), res)
+
+    def test_search(self):
+        for a in self.randombitarrays():
+            path = self.write(a)
+            x = urandom(randint(1, 4))
+            res = a.search(x)
+            out = self.run_tool(a, 'search', path, x.to01(),
+                                status=int(not res))
+            self.assertEqual([int(i) for i in out.split()], res)
+            out = self.run_tool(a, 'search', path, x.to01(), opts=['-m', 2],
+                                status=int(not res))
+            self.assertEqual([int(i) for i in out.split()], res[:2])
+            # matches have to be within the range
+            start, stop, s = self.random_range(len(a))
+            p, q = s.indices(len(a))[:2]
+            out = self.run_tool(a, 'search', path, x.to01(), start, stop,
+                                status=None)
+            self.assertEqual([int(i) for i in out.split()],
+                             [i for i in res if p <= i and i + len(x) <= q])
+
+    def test_bitwise(self):
+        for a in self.randombitarrays():
+            b = urandom(len(a), a.endian())
+            pa, pb = self.write(a), self.write(b, 'b.bin')
+            out = os.path.join(self.tmpdir, 'out.bin')
+            for op, res in [('and', a & b), ('or', a | b), ('xor', a ^ b)]:
+                self.run_tool(a, op, pa, pb, opts=['-o', out])
+                with open(out, 'rb') as fi:
+                    self.assertEqual(fi.read(), res.tobytes())
+
+    def test_bitwise_length(self):
+        a = urandom(20)
+        pa, pb = self.write(a), self.write(a[:10], 'b.bin')
+        p = subprocess.Popen([TOOL, 'and', pa, pb], stdout=subprocess.PIPE,
+                             stderr=subprocess.PIPE)
+        p.communicate()
+        self.assertEqual(p.returncode, 2)
+
+    def test_endian(self):
+        for a in self.randombitarrays():
+            path = self.write(a)
+            out = os.path.join(self.tmpdir, 'out.bin')
+            self.run_tool(a, 'endian', path, opts=['-o', out])
+            other = 'little' if a.endian() == 'big' else 'big'
+            b = bitarray(endian=other)
+            with open(out, 'rb') as fi:
+                b.fromfile(fi)
+            self.assertEqual(b[:len(a)], a)
+            self.assertEqual(b.tobytes(),
+                             bitarray(a.to01(), endian=other).tobytes())
+
+    def test_dump(self):
+        for a in self.randombitarrays():
+            path = self.write(a)
+            start, stop, s = self.random_range(len(a))
+            out = self.run_tool(a, 'dump', path, start, stop)
+            self.assertEqual(''.join(line.split()[1]
+                                     for line in out.splitlines()),
+                             a[s].to01())
+            b = a[s]
+            if len(b) % 4 == 0:
+                out = self.run_tool(a, 'dump', path, start, stop,
+                                    opts=['-x'])
+                self.assertEqual(''.join(line.split()[1]
+                                         for line in out.splitlines()),
+                                 ba2hex(b))
+
+    def test_isa(self):
+        a = urandom(100000, 'little')
+        a[-30:] = 0
+        a[-10] = 1
+        b = urandom(len(a), 'little')
+        pa, pb = self.write(a), self.write(b, 'b.bin')
+        po = os.path.join(self.tmpdir, 'out.bin')
+        for isa in 'generic', 'popcnt', 'avx2', 'avx512', 'foo':
+            env = {'BITARRAY_ISA': isa}
+            err = []
+            self.assertEqual(int(self.run_tool(a, 'count', pa, 5, env=env,
+                                               stderr=err)),
+                             a.count(1, 5))
+            self.assertEqual(('unknown ISA level' in err[0]), isa == 'foo')
+            self.assertEqual(int(self.run_tool(a, 'find', pa, -25, env=env,
+                                               opts=['-v', 1])),
+                             len(a) - 10)
+            self.run_tool(a, 'and', pa, pb, opts=['-o', po], env=env)
+            with open(po, 'rb') as fi:
+                self.assertEqual(fi.read(), (a & b).tobytes())
+
+    def test_threads(self):
+        # large enough for the scans to be split across threads
+        a = urandom(1 << 26, 'big')
+        a[-20:] = bitarray('1101' * 5)
+        b = urandom(1 << 26, 'big')
+        pa, pb = self.write(a), self.write(b, 'b.bin')
+        x = bitarray('11011101110111011101')
+        po = os.path.join(self.tmpdir, 'out.bin')
+        matches = [i for i in a.search(x) if i >= 1 << 25]
+        for j in 1, 3:
+            opts = ['-j', j]
+            self.assertEqual(int(self.run_tool(a, 'count', pa, opts=opts)),
+                             a.count())
+            out = self.run_tool(a, 'search', pa, x.to01(), 1 << 25,
+                                opts=opts)
+            self.assertEqual([int(i) for i in out.split()], matches)
+            self.run_tool(a, 'xor', pa, pb, opts=opts + ['-o', po])
+            with open(po, 'rb') as fi:
+                self.assertEqual(fi.read(), (a ^ b).tobytes())
+
+
+if __name__ == '__main__':
+    if not os.path.isfile(TOOL):
+        sys.exit("%s not found, run: make tool" % TOOL)
+    unittest.main()
@@ -78,11 +78,17 @@ def write_reference():
     write_doc('test')
     write_doc('bits2bytes')
     write_doc('get_default_endian')
+    write_doc('get_include')
+    write_doc('enable_stats')
+    write_doc('stats')
 
     fo.write("Functions defined in bitarray.util:\n"
              "-----------------------------------\n\n")
     for func in bitarray.util.__all__:
         write_doc('util.%s' % func)
+        if func == 'between':
+            # not in __all__, as it would shadow the builtin
+            write_doc('util.filter')
 
 
 def write_all(data):